@@ -5,7 +5,11 @@
 #include <android/log.h>
 #include <stdbool.h>
 #include <pthread.h>
+#include <unistd.h>
 #include "plug.h"
+#include "ipc.h"
+#include "sync.h"
+#include "pool.h"
 
 // Cache method ids
 static jmethodID resolveInvokeMethodId;
@@ -16,78 +20,139 @@ __thread JNIEnv *current_env;
 __thread jobject current_obj;
 __thread jstring current_jid;
 
-// Global for emit
-JNIEnv *global_env = NULL;
+// Global for emit. JNIEnv pointers are only valid on the thread they belong
+// to, so emitters look up (or attach) their own env through the cached VM.
+JavaVM *global_jvm = NULL;
 jobject global_obj = NULL;
 
-// Helper: emit an event into the JS layer (centralized JNI emit)
+static JNIEnv *android_thread_env(bool *attached) {
+    *attached = false;
+    if (global_jvm == NULL) return NULL;
+    JNIEnv *env = NULL;
+    jint rc = (*global_jvm)->GetEnv(global_jvm, (void **)&env, JNI_VERSION_1_6);
+    if (rc == JNI_EDETACHED) {
+        if ((*global_jvm)->AttachCurrentThread(global_jvm, &env, NULL) != JNI_OK) return NULL;
+        *attached = true;
+    } else if (rc != JNI_OK) {
+        return NULL;
+    }
+    return env;
+}
+
+static void android_call_ipc(jmethodID method, const char *a, const char *b) {
+    if (global_obj == NULL || method == NULL) return;
+    bool attached;
+    JNIEnv *env = android_thread_env(&attached);
+    if (env == NULL) return;
+    jstring ja = (*env)->NewStringUTF(env, a);
+    jstring jb = (*env)->NewStringUTF(env, b);
+    (*env)->CallVoidMethod(env, global_obj, method, ja, jb);
+    (*env)->DeleteLocalRef(env, ja);
+    (*env)->DeleteLocalRef(env, jb);
+    if (attached) (*global_jvm)->DetachCurrentThread(global_jvm);
+}
+
+// Replies and event data go to Kotlin as JavaScript expressions, which it
+// splices into evaluateJavascript() as they are (see ipc_json_to_js()).
+static void android_call_ipc_json(jmethodID method, const char *a, const char *json) {
+    size_t len;
+    char *js = ipc_json_to_js(json, &len);
+    android_call_ipc(method, a, js ? js : "null");
+    free(js);
+}
+
+// Helper: emit an event into the JS layer (centralized JNI emit).
+// Safe to call from any thread.
 void android_emit(const char *event, const char *data) {
-    if (global_env == NULL || global_obj == NULL || emitMethodId == NULL) return;
-    const char *ev = event ? event : "";
-    const char *dt = data ? data : "null";
-    jstring jevent = (*global_env)->NewStringUTF(global_env, ev);
-    jstring jdata = (*global_env)->NewStringUTF(global_env, dt);
-    (*global_env)->CallVoidMethod(global_env, global_obj, emitMethodId, jevent, jdata);
-    (*global_env)->DeleteLocalRef(global_env, jevent);
-    (*global_env)->DeleteLocalRef(global_env, jdata);
+    android_call_ipc_json(emitMethodId, event ? event : "", data ? data : "null");
 }
 
-// Helper: send response back to JS via JNI
+// Helper: send response back to JS via JNI. Safe to call from any thread.
 void android_response(const char *id, const char *response_json) {
-    if (global_env == NULL || global_obj == NULL || resolveInvokeMethodId == NULL) return;
-    jstring jid = (*global_env)->NewStringUTF(global_env, id);
-    jstring jresult = (*global_env)->NewStringUTF(global_env, response_json);
-    (*global_env)->CallVoidMethod(global_env, global_obj, resolveInvokeMethodId, jid, jresult);
-    (*global_env)->DeleteLocalRef(global_env, jid);
-    (*global_env)->DeleteLocalRef(global_env, jresult);
+    android_call_ipc_json(resolveInvokeMethodId, id, response_json);
 }
 
 struct InvokeData {
     char *id;
     char *cmd;
     char *payload;
-    JNIEnv *env;
+    size_t payload_len;
+    unsigned long long deadline_ms;
     jobject obj;
     jstring jid;
 };
 
+// Requests are dispatched one at a time from this strand, which plays the
+// part of a UI thread: PLUG_THREAD_MAIN plugins run right there, everything
+// else is handed on to the worker pool by plug_invoke().
+static PoolStrand *dispatch_strand = NULL;
+
 void respond_callback(const char *response) {
-    jstring jresult = (*current_env)->NewStringUTF(current_env, response);
+    size_t len;
+    char *js = ipc_json_to_js(response, &len);
+    jstring jresult = (*current_env)->NewStringUTF(current_env, js ? js : "null");
     (*current_env)->CallVoidMethod(current_env, current_obj, resolveInvokeMethodId, current_jid, jresult);
     (*current_env)->DeleteLocalRef(current_env, jresult);
+    free(js);
+}
+
+static void free_invoke_data(struct InvokeData *data) {
+    free(data->id);
+    free(data->cmd);
+    free(data->payload);
+    free(data);
+}
+
+// Completion hook for plug.c: `host_ctx` is the request's InvokeData, which
+// lives until here so deferred plugins can still read the payload.
+static void android_complete(void *host_ctx, const char *content_type, const void *data, size_t len) {
+    struct InvokeData *invoke = (struct InvokeData *)host_ctx;
+    if (data != NULL && content_type == NULL) {
+        android_response(invoke->id, (const char *)data);
+    } else if (data != NULL) {
+        ipc_respond_bytes(invoke->id, NULL, content_type, data, len);
+    }
+    free_invoke_data(invoke);
 }
 
-void *async_invoke(void *arg) {
+static void dispatch_invoke(void *arg) {
     struct InvokeData *data = (struct InvokeData *)arg;
 
-    // Attach to JVM
-    JavaVM *jvm;
-    (*data->env)->GetJavaVM(data->env, &jvm);
-    JNIEnv *thread_env;
-    (*jvm)->AttachCurrentThread(jvm, &thread_env, NULL);
+    // Pool threads are not attached to the JVM between jobs
+    bool attached;
+    JNIEnv *thread_env = android_thread_env(&attached);
+    if (thread_env == NULL) {
+        android_response(data->id, "{\"ok\":false,\"error\":\"no JNI environment\"}");
+        free_invoke_data(data);
+        return;
+    }
 
     // Set current for callback
     current_env = thread_env;
     current_obj = data->obj;
     current_jid = data->jid;
+    jobject obj = data->obj;
+    jstring jid = data->jid;
 
     // Call plugin
-    plug_invoke(data->cmd, data->payload, respond_callback);
+    PlugRequest req = {
+        .id = data->id,
+        .cmd = data->cmd,
+        .payload = data->payload,
+        .payload_len = data->payload_len,
+        .deadline_ms = data->deadline_ms,
+        .host_ctx = data,
+    };
+    // `data` belongs to android_complete() from here on.
+    plug_invoke(&req, respond_callback);
 
     // Delete global refs
-    (*thread_env)->DeleteGlobalRef(thread_env, data->obj);
-    (*thread_env)->DeleteGlobalRef(thread_env, data->jid);
-
-    // Detach
-    (*jvm)->DetachCurrentThread(jvm);
+    current_obj = NULL;
+    current_jid = NULL;
+    (*thread_env)->DeleteGlobalRef(thread_env, obj);
+    (*thread_env)->DeleteGlobalRef(thread_env, jid);
 
-    // Free
-    free(data->id);
-    free(data->cmd);
-    free(data->payload);
-    free(data);
-
-    return NULL;
+    if (attached) (*global_jvm)->DetachCurrentThread(global_jvm);
 }
 
 JNIEXPORT void JNICALL Java___PACKAGE_MANGLED___Ipc_ipc(JNIEnv *env, jobject obj, jstring jurl, jstring jmessage) {
@@ -105,7 +170,7 @@ JNIEXPORT void JNICALL Java___PACKAGE_MANGLED___Ipc_ipc(JNIEnv *env, jobject obj
     (*env)->ReleaseStringUTFChars(env, jmessage, message);
 }
 
-JNIEXPORT void JNICALL Java___PACKAGE_MANGLED___Ipc_nativeInvoke(JNIEnv *env, jobject obj, jstring jid, jstring jcmd, jstring jpayload) {
+JNIEXPORT void JNICALL Java___PACKAGE_MANGLED___Ipc_nativeInvoke(JNIEnv *env, jobject obj, jstring jid, jstring jcmd, jstring jpayload, jint timeout_ms) {
     // Cache method ids if not done
     if (resolveInvokeMethodId == NULL) {
         jclass cls = (*env)->FindClass(env, "__PACKAGE_PATH__/Ipc");
@@ -126,8 +191,7 @@ JNIEXPORT void JNICALL Java___PACKAGE_MANGLED___Ipc_nativeInvoke(JNIEnv *env, jo
     }
 
     // Set global for emit
-    if (global_env == NULL) {
-        global_env = env;
+    if (global_obj == NULL) {
         global_obj = (*env)->NewGlobalRef(env, obj);
     }
 
@@ -139,18 +203,22 @@ JNIEXPORT void JNICALL Java___PACKAGE_MANGLED___Ipc_nativeInvoke(JNIEnv *env, jo
     jobject global_obj_ref = (*env)->NewGlobalRef(env, obj);
     jstring global_jid_ref = (*env)->NewGlobalRef(env, jid);
 
-    // Create async invoke
+    // Queue the call; the JavaScript thread must not wait for the plugin
     struct InvokeData *data = malloc(sizeof(struct InvokeData));
     data->id = strdup(id);
     data->cmd = strdup(cmd);
     data->payload = strdup(payload);
-    data->env = env;
+    data->payload_len = strlen(payload);
+    data->deadline_ms = timeout_ms > 0 ? sync_now_ms() + (unsigned long long)timeout_ms : 0;
     data->obj = global_obj_ref;
     data->jid = global_jid_ref;
 
-    pthread_t thread;
-    pthread_create(&thread, NULL, async_invoke, data);
-    pthread_detach(thread);
+    if (!pool_strand_submit(dispatch_strand, dispatch_invoke, data)) {
+        android_response(data->id, "{\"ok\":false,\"error\":\"busy\",\"busy\":true,\"retryAfterMs\":50}");
+        (*env)->DeleteGlobalRef(env, global_obj_ref);
+        (*env)->DeleteGlobalRef(env, global_jid_ref);
+        free_invoke_data(data);
+    }
 
     // Release strings
     (*env)->ReleaseStringUTFChars(env, jid, id);
@@ -158,6 +226,17 @@ JNIEXPORT void JNICALL Java___PACKAGE_MANGLED___Ipc_nativeInvoke(JNIEnv *env, jo
     (*env)->ReleaseStringUTFChars(env, jpayload, payload);
 }
 
+// There is no native UI loop on Android, so a background thread stands in for
+// it and drives plug_update() (held events, timers, plugin fds), sleeping in
+// the core event loop whenever there is nothing to do.
+static void *update_loop(void *arg) {
+    (void)arg;
+    for (;;) {
+        plug_poll(NULL, -1);
+    }
+    return NULL;
+}
+
 JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM *vm, void *reserved) {
     JNIEnv *env;
     if ((*vm)->GetEnv(vm, (void **)&env, JNI_VERSION_1_6) != JNI_OK) {
@@ -166,9 +245,20 @@ JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM *vm, void *reserved) {
 
     // Cache method id later
     resolveInvokeMethodId = NULL;
+    global_jvm = vm;
 
     // Initialize plugins (webview is NULL for Android)
+    plug_set_host_complete(android_complete);
     plug_init(NULL);
+    // plug_init() only starts the pool when some plugin asks for workers
+    if (pool_start(NULL)) {
+        dispatch_strand = pool_strand_create();
+    }
+
+    pthread_t updater;
+    if (pthread_create(&updater, NULL, update_loop, NULL) == 0) {
+        pthread_detach(updater);
+    }
 
     return JNI_VERSION_1_6;
 }
\ No newline at end of file
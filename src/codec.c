@@ -0,0 +1,1161 @@
+// ============================================================================
+// codec.c - base64 / hex / UTF-8 / JSON kernels with runtime CPU dispatch
+// ============================================================================
+// The scalar code is the reference implementation and handles every tail and
+// error path. SIMD kernels only ever consume whole, fully valid blocks and
+// return how far they got; the scalar loop picks up from there. The base64
+// kernels follow Wojciech Mula's pshufb lookup scheme.
+// ============================================================================
+
+#include "codec.h"
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define CODEC_X86 1
+#include <immintrin.h>
+#define CODEC_TARGET(t) __attribute__((target(t)))
+#endif
+
+enum {
+    CODEC_LEVEL_SCALAR = 0,
+    CODEC_LEVEL_SSE41 = 1,
+    CODEC_LEVEL_AVX2 = 2,
+};
+
+static atomic_int codec_level = -1;
+
+static int codec_cpu_level(void) {
+    int level = atomic_load_explicit(&codec_level, memory_order_relaxed);
+    if (level >= 0) {
+        return level;
+    }
+    level = CODEC_LEVEL_SCALAR;
+#ifdef CODEC_X86
+    const char *force = getenv("CROSSWEB_CODEC");
+    __builtin_cpu_init();
+    if (force != NULL && strcmp(force, "scalar") == 0) {
+        level = CODEC_LEVEL_SCALAR;
+    } else if (__builtin_cpu_supports("avx2") && (force == NULL || strcmp(force, "sse4.1") != 0)) {
+        level = CODEC_LEVEL_AVX2;
+    } else if (__builtin_cpu_supports("sse4.1")) {
+        level = CODEC_LEVEL_SSE41;
+    }
+#endif
+    atomic_store_explicit(&codec_level, level, memory_order_relaxed);
+    return level;
+}
+
+const char *codec_backend(void) {
+    switch (codec_cpu_level()) {
+        case CODEC_LEVEL_AVX2: return "avx2";
+        case CODEC_LEVEL_SSE41: return "sse4.1";
+        default: return "scalar";
+    }
+}
+
+// ============================================================================
+// base64
+// ============================================================================
+
+static const char base64_std_alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+static const char base64_url_alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+#define B64_PAD 64
+#define B64_BAD 255
+
+// Character -> sextet. 64 marks '=', 255 marks anything invalid.
+static const uint8_t base64_std_values[256] = {
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,  62, 255, 255, 255,  63,
+     52,  53,  54,  55,  56,  57,  58,  59,  60,  61, 255, 255, 255,  64, 255, 255,
+    255,   0,   1,   2,   3,   4,   5,   6,   7,   8,   9,  10,  11,  12,  13,  14,
+     15,  16,  17,  18,  19,  20,  21,  22,  23,  24,  25, 255, 255, 255, 255, 255,
+    255,  26,  27,  28,  29,  30,  31,  32,  33,  34,  35,  36,  37,  38,  39,  40,
+     41,  42,  43,  44,  45,  46,  47,  48,  49,  50,  51, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+};
+
+static const uint8_t base64_url_values[256] = {
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,  62, 255, 255,
+     52,  53,  54,  55,  56,  57,  58,  59,  60,  61, 255, 255, 255,  64, 255, 255,
+    255,   0,   1,   2,   3,   4,   5,   6,   7,   8,   9,  10,  11,  12,  13,  14,
+     15,  16,  17,  18,  19,  20,  21,  22,  23,  24,  25, 255, 255, 255, 255,  63,
+    255,  26,  27,  28,  29,  30,  31,  32,  33,  34,  35,  36,  37,  38,  39,  40,
+     41,  42,  43,  44,  45,  46,  47,  48,  49,  50,  51, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+};
+
+size_t codec_base64_encoded_len(size_t len, CodecBase64Variant variant) {
+    if (variant == CODEC_BASE64URL) {
+        return (len / 3) * 4 + ((len % 3) ? (len % 3) + 1 : 0);
+    }
+    return ((len + 2) / 3) * 4;
+}
+
+size_t codec_base64_decoded_cap(size_t len) {
+    return (len / 4) * 3 + 3;
+}
+
+#ifdef CODEC_X86
+// Returns the number of input bytes consumed (a multiple of 12).
+CODEC_TARGET("sse4.1")
+static size_t base64_encode_sse41(const uint8_t *in, size_t len, char *out, bool url) {
+    const __m128i shuffle = _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+    const __m128i shift_lut = _mm_setr_epi8(
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, (char)((url ? '-' : '+') - 62), (char)((url ? '_' : '/') - 63), 'A', 0, 0);
+    size_t i = 0;
+    while (len - i >= 16) {
+        __m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(in + i)), shuffle);
+        __m128i t0 = _mm_mulhi_epu16(_mm_and_si128(v, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040));
+        __m128i t1 = _mm_mullo_epi16(_mm_and_si128(v, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010));
+        __m128i idx = _mm_or_si128(t0, t1);
+        __m128i reduced = _mm_subs_epu8(idx, _mm_set1_epi8(51));
+        reduced = _mm_or_si128(reduced, _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), idx), _mm_set1_epi8(13)));
+        __m128i chars = _mm_add_epi8(idx, _mm_shuffle_epi8(shift_lut, reduced));
+        _mm_storeu_si128((__m128i *)out, chars);
+        out += 16;
+        i += 12;
+    }
+    return i;
+}
+
+// Returns the number of input bytes consumed (a multiple of 24).
+CODEC_TARGET("avx2")
+static size_t base64_encode_avx2(const uint8_t *in, size_t len, char *out, bool url) {
+    const __m256i shuffle = _mm256_setr_epi8(
+        1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+        1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+    const char c62 = (char)((url ? '-' : '+') - 62);
+    const char c63 = (char)((url ? '_' : '/') - 63);
+    const __m256i shift_lut = _mm256_setr_epi8(
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, c62, c63, 'A', 0, 0,
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, c62, c63, 'A', 0, 0);
+    size_t i = 0;
+    // Each lane takes 12 bytes; the second 16-byte load reads 4 bytes past the
+    // 24 consumed, hence the 28 byte requirement.
+    while (len - i >= 28) {
+        __m128i lo = _mm_loadu_si128((const __m128i *)(in + i));
+        __m128i hi = _mm_loadu_si128((const __m128i *)(in + i + 12));
+        __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+        v = _mm256_shuffle_epi8(v, shuffle);
+        __m256i t0 = _mm256_mulhi_epu16(_mm256_and_si256(v, _mm256_set1_epi32(0x0fc0fc00)), _mm256_set1_epi32(0x04000040));
+        __m256i t1 = _mm256_mullo_epi16(_mm256_and_si256(v, _mm256_set1_epi32(0x003f03f0)), _mm256_set1_epi32(0x01000010));
+        __m256i idx = _mm256_or_si256(t0, t1);
+        __m256i reduced = _mm256_subs_epu8(idx, _mm256_set1_epi8(51));
+        reduced = _mm256_or_si256(reduced, _mm256_and_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(26), idx), _mm256_set1_epi8(13)));
+        __m256i chars = _mm256_add_epi8(idx, _mm256_shuffle_epi8(shift_lut, reduced));
+        _mm256_storeu_si256((__m256i *)out, chars);
+        out += 32;
+        i += 24;
+    }
+    return i;
+}
+
+// Standard alphabet only. Stops at the first block containing anything that
+// is not a base64 digit (padding included) or when `out` lacks 16 bytes of
+// slack, leaving it to the scalar decoder.
+CODEC_TARGET("sse4.1")
+static void base64_decode_sse41(const char *in, size_t len, uint8_t *out, size_t out_cap, size_t *ip, size_t *op) {
+    const __m128i lut_lo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                         0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m128i lut_hi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                         0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m128i lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    const __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    size_t i = *ip, o = *op;
+    while (len - i >= 16 && out_cap - o >= 16) {
+        __m128i str = _mm_loadu_si128((const __m128i *)(in + i));
+        __m128i hi_nibbles = _mm_and_si128(_mm_srli_epi32(str, 4), nibble);
+        __m128i lo = _mm_shuffle_epi8(lut_lo, _mm_and_si128(str, nibble));
+        __m128i hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+        if (!_mm_testz_si128(lo, hi)) {
+            break;
+        }
+        __m128i eq_2f = _mm_cmpeq_epi8(str, _mm_set1_epi8(0x2f));
+        __m128i roll = _mm_shuffle_epi8(lut_roll, _mm_add_epi8(eq_2f, hi_nibbles));
+        __m128i values = _mm_add_epi8(str, roll);
+        __m128i merged = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+        __m128i packed = _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+        _mm_storeu_si128((__m128i *)(out + o), _mm_shuffle_epi8(packed, pack));
+        i += 16;
+        o += 12;
+    }
+    *ip = i;
+    *op = o;
+}
+
+CODEC_TARGET("avx2")
+static void base64_decode_avx2(const char *in, size_t len, uint8_t *out, size_t out_cap, size_t *ip, size_t *op) {
+    const __m256i lut_lo = _mm256_setr_epi8(
+        0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A,
+        0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m256i lut_hi = _mm256_setr_epi8(
+        0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+        0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m256i lut_roll = _mm256_setr_epi8(
+        0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    const __m256i pack = _mm256_setr_epi8(
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    const __m256i compact = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, -1, -1);
+    size_t i = *ip, o = *op;
+    while (len - i >= 32 && out_cap - o >= 32) {
+        __m256i str = _mm256_loadu_si256((const __m256i *)(in + i));
+        __m256i hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(str, 4), nibble);
+        __m256i lo = _mm256_shuffle_epi8(lut_lo, _mm256_and_si256(str, nibble));
+        __m256i hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+        if (!_mm256_testz_si256(lo, hi)) {
+            break;
+        }
+        __m256i eq_2f = _mm256_cmpeq_epi8(str, _mm256_set1_epi8(0x2f));
+        __m256i roll = _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(eq_2f, hi_nibbles));
+        __m256i values = _mm256_add_epi8(str, roll);
+        __m256i merged = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+        __m256i packed = _mm256_madd_epi16(merged, _mm256_set1_epi32(0x00011000));
+        packed = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(packed, pack), compact);
+        _mm256_storeu_si256((__m256i *)(out + o), packed);
+        i += 32;
+        o += 24;
+    }
+    *ip = i;
+    *op = o;
+}
+#endif // CODEC_X86
+
+size_t codec_base64_encode(const void *in, size_t len, char *out, CodecBase64Variant variant) {
+    const uint8_t *src = (const uint8_t *)in;
+    const bool url = variant == CODEC_BASE64URL;
+    const char *table = url ? base64_url_alphabet : base64_std_alphabet;
+    size_t i = 0;
+    char *dst = out;
+#ifdef CODEC_X86
+    int level = codec_cpu_level();
+    if (level == CODEC_LEVEL_AVX2) {
+        i = base64_encode_avx2(src, len, dst, url);
+    } else if (level == CODEC_LEVEL_SSE41) {
+        i = base64_encode_sse41(src, len, dst, url);
+    }
+    dst += (i / 3) * 4;
+#endif
+    for (; len - i >= 3; i += 3) {
+        uint32_t triple = ((uint32_t)src[i] << 16) | ((uint32_t)src[i + 1] << 8) | src[i + 2];
+        dst[0] = table[(triple >> 18) & 0x3F];
+        dst[1] = table[(triple >> 12) & 0x3F];
+        dst[2] = table[(triple >> 6) & 0x3F];
+        dst[3] = table[triple & 0x3F];
+        dst += 4;
+    }
+    size_t rest = len - i;
+    if (rest > 0) {
+        uint32_t triple = (uint32_t)src[i] << 16;
+        if (rest == 2) {
+            triple |= (uint32_t)src[i + 1] << 8;
+        }
+        *dst++ = table[(triple >> 18) & 0x3F];
+        *dst++ = table[(triple >> 12) & 0x3F];
+        if (rest == 2) {
+            *dst++ = table[(triple >> 6) & 0x3F];
+        } else if (!url) {
+            *dst++ = '=';
+        }
+        if (!url) {
+            *dst++ = '=';
+        }
+    }
+    *dst = '\0';
+    return (size_t)(dst - out);
+}
+
+// Decodes until the end of input or the first '=' (reported via *padded).
+// Only more '=' may follow the first one.
+static bool base64_decode_core(const char *in, size_t len, uint8_t *out, size_t out_cap,
+                               size_t *written, CodecBase64Variant variant, bool *padded) {
+    const uint8_t *values = variant == CODEC_BASE64URL ? base64_url_values : base64_std_values;
+    size_t i = 0, o = 0;
+    *padded = false;
+#ifdef CODEC_X86
+    if (variant == CODEC_BASE64) {
+        int level = codec_cpu_level();
+        if (level == CODEC_LEVEL_AVX2) {
+            base64_decode_avx2(in, len, out, out_cap, &i, &o);
+        } else if (level == CODEC_LEVEL_SSE41) {
+            base64_decode_sse41(in, len, out, out_cap, &i, &o);
+        }
+    }
+#endif
+    for (; len - i >= 4; i += 4) {
+        uint32_t a = values[(uint8_t)in[i]];
+        uint32_t b = values[(uint8_t)in[i + 1]];
+        uint32_t c = values[(uint8_t)in[i + 2]];
+        uint32_t d = values[(uint8_t)in[i + 3]];
+        if ((a | b | c | d) >= B64_PAD) {
+            break;
+        }
+        if (out_cap - o < 3) {
+            return false;
+        }
+        uint32_t triple = (a << 18) | (b << 12) | (c << 6) | d;
+        out[o++] = (uint8_t)(triple >> 16);
+        out[o++] = (uint8_t)(triple >> 8);
+        out[o++] = (uint8_t)triple;
+    }
+    // Tail, padding and error handling, one character at a time.
+    uint32_t val = 0;
+    int valb = -8;
+    for (; i < len; ++i) {
+        uint8_t v = values[(uint8_t)in[i]];
+        if (v == B64_PAD) {
+            *padded = true;
+            for (; i < len; ++i) {
+                if (values[(uint8_t)in[i]] != B64_PAD) {
+                    return false;
+                }
+            }
+            break;
+        }
+        if (v == B64_BAD) {
+            return false;
+        }
+        val = ((val << 6) | v) & 0xFFFFFF;
+        valb += 6;
+        if (valb >= 0) {
+            if (o >= out_cap) {
+                return false;
+            }
+            out[o++] = (uint8_t)((val >> valb) & 0xFF);
+            valb -= 8;
+        }
+    }
+    *written = o;
+    return true;
+}
+
+bool codec_base64_decode(const char *in, size_t len, void *out, size_t out_cap,
+                         size_t *written, CodecBase64Variant variant) {
+    size_t n = 0;
+    bool padded;
+    if (!base64_decode_core(in, len, (uint8_t *)out, out_cap, &n, variant, &padded)) {
+        return false;
+    }
+    if (n < out_cap) {
+        ((uint8_t *)out)[n] = '\0';
+    }
+    if (written) {
+        *written = n;
+    }
+    return true;
+}
+
+// ============================================================================
+// UTF-8
+// ============================================================================
+
+// Backs `end` up to the start of a sequence that runs past it, so the SIMD
+// kernels below only ever claim whole characters.
+static size_t utf8_boundary(const uint8_t *s, size_t end) {
+    for (size_t k = 1; k <= 3 && k <= end; ++k) {
+        uint8_t c = s[end - k];
+        if (c < 0x80) {
+            return end;
+        }
+        if (c >= 0xC0) {
+            size_t n = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : 2;
+            return k < n ? end - k : end;
+        }
+    }
+    return end;
+}
+
+#ifdef CODEC_X86
+// Keiser and Lemire's lookup validator ("Validating UTF-8 in less than one
+// instruction per byte"): three nibble lookups classify every byte together
+// with the one before it, and the bytes two and three back settle which
+// continuations are required. Blocks are checked whole; the kernels stop at
+// the first block with an error and leave it to the scalar code to decide.
+#define UTF8_TOO_SHORT (1 << 0)
+#define UTF8_TOO_LONG (1 << 1)
+#define UTF8_OVERLONG_3 (1 << 2)
+#define UTF8_TOO_LARGE (1 << 3)
+#define UTF8_SURROGATE (1 << 4)
+#define UTF8_OVERLONG_2 (1 << 5)
+#define UTF8_TOO_LARGE_1000 (1 << 6)
+#define UTF8_OVERLONG_4 (1 << 6)
+#define UTF8_TWO_CONTS (1 << 7)
+#define UTF8_CARRY (UTF8_TOO_SHORT | UTF8_TOO_LONG | UTF8_TWO_CONTS)
+#define UTF8_B(x) ((char)(x))
+
+// By the high nibble of the previous byte.
+#define UTF8_BYTE_1_HIGH \
+    UTF8_B(UTF8_TOO_LONG), UTF8_B(UTF8_TOO_LONG), UTF8_B(UTF8_TOO_LONG), UTF8_B(UTF8_TOO_LONG), \
+    UTF8_B(UTF8_TOO_LONG), UTF8_B(UTF8_TOO_LONG), UTF8_B(UTF8_TOO_LONG), UTF8_B(UTF8_TOO_LONG), \
+    UTF8_B(UTF8_TWO_CONTS), UTF8_B(UTF8_TWO_CONTS), UTF8_B(UTF8_TWO_CONTS), UTF8_B(UTF8_TWO_CONTS), \
+    UTF8_B(UTF8_TOO_SHORT | UTF8_OVERLONG_2), \
+    UTF8_B(UTF8_TOO_SHORT), \
+    UTF8_B(UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE), \
+    UTF8_B(UTF8_TOO_SHORT | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4)
+
+// By the low nibble of the previous byte.
+#define UTF8_BYTE_1_LOW \
+    UTF8_B(UTF8_CARRY | UTF8_OVERLONG_3 | UTF8_OVERLONG_2 | UTF8_OVERLONG_4), \
+    UTF8_B(UTF8_CARRY | UTF8_OVERLONG_2), \
+    UTF8_B(UTF8_CARRY), UTF8_B(UTF8_CARRY), \
+    UTF8_B(UTF8_CARRY | UTF8_TOO_LARGE), \
+    UTF8_B(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000), \
+    UTF8_B(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000), \
+    UTF8_B(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000), \
+    UTF8_B(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000), \
+    UTF8_B(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000), \
+    UTF8_B(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000), \
+    UTF8_B(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000), \
+    UTF8_B(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000), \
+    UTF8_B(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_SURROGATE), \
+    UTF8_B(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000), \
+    UTF8_B(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000)
+
+// By the high nibble of the current byte.
+#define UTF8_BYTE_2_HIGH \
+    UTF8_B(UTF8_TOO_SHORT), UTF8_B(UTF8_TOO_SHORT), UTF8_B(UTF8_TOO_SHORT), UTF8_B(UTF8_TOO_SHORT), \
+    UTF8_B(UTF8_TOO_SHORT), UTF8_B(UTF8_TOO_SHORT), UTF8_B(UTF8_TOO_SHORT), UTF8_B(UTF8_TOO_SHORT), \
+    UTF8_B(UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4), \
+    UTF8_B(UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE), \
+    UTF8_B(UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE), \
+    UTF8_B(UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE), \
+    UTF8_B(UTF8_TOO_SHORT), UTF8_B(UTF8_TOO_SHORT), UTF8_B(UTF8_TOO_SHORT), UTF8_B(UTF8_TOO_SHORT)
+
+// Largest byte that may end a block at each of its last three positions
+// without leaving a sequence open.
+#define UTF8_MAX_TAIL(n) \
+    [0 ... (n) - 4] = UTF8_B(0xFF), [(n) - 3] = UTF8_B(0xEF), [(n) - 2] = UTF8_B(0xDF), [(n) - 1] = UTF8_B(0xBF)
+
+CODEC_TARGET("sse4.1")
+static size_t utf8_run_sse41(const uint8_t *s, size_t len) {
+    const __m128i byte_1_high = _mm_setr_epi8(UTF8_BYTE_1_HIGH);
+    const __m128i byte_1_low = _mm_setr_epi8(UTF8_BYTE_1_LOW);
+    const __m128i byte_2_high = _mm_setr_epi8(UTF8_BYTE_2_HIGH);
+    static const char max_tail[16] = { UTF8_MAX_TAIL(16) };
+    const __m128i max = _mm_loadu_si128((const __m128i *)max_tail);
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    __m128i prev = _mm_setzero_si128();
+    size_t i = 0;
+    while (len - i >= 16) {
+        __m128i in = _mm_loadu_si128((const __m128i *)(s + i));
+        __m128i error;
+        if (_mm_movemask_epi8(in) == 0) {
+            // All ASCII: only a sequence left open by the last block can fail.
+            error = _mm_subs_epu8(prev, max);
+        } else {
+            __m128i prev1 = _mm_alignr_epi8(in, prev, 15);
+            __m128i special = _mm_and_si128(
+                _mm_and_si128(_mm_shuffle_epi8(byte_1_high, _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble)),
+                              _mm_shuffle_epi8(byte_1_low, _mm_and_si128(prev1, nibble))),
+                _mm_shuffle_epi8(byte_2_high, _mm_and_si128(_mm_srli_epi16(in, 4), nibble)));
+            __m128i third = _mm_subs_epu8(_mm_alignr_epi8(in, prev, 14), _mm_set1_epi8(0xE0 - 0x80));
+            __m128i fourth = _mm_subs_epu8(_mm_alignr_epi8(in, prev, 13), _mm_set1_epi8((char)(0xF0 - 0x80)));
+            __m128i must23 = _mm_and_si128(_mm_or_si128(third, fourth), _mm_set1_epi8((char)0x80));
+            error = _mm_xor_si128(must23, special);
+        }
+        if (!_mm_testz_si128(error, error)) {
+            break;
+        }
+        prev = in;
+        i += 16;
+    }
+    return utf8_boundary(s, i);
+}
+
+CODEC_TARGET("avx2")
+static size_t utf8_run_avx2(const uint8_t *s, size_t len) {
+    const __m256i byte_1_high = _mm256_setr_epi8(UTF8_BYTE_1_HIGH, UTF8_BYTE_1_HIGH);
+    const __m256i byte_1_low = _mm256_setr_epi8(UTF8_BYTE_1_LOW, UTF8_BYTE_1_LOW);
+    const __m256i byte_2_high = _mm256_setr_epi8(UTF8_BYTE_2_HIGH, UTF8_BYTE_2_HIGH);
+    static const char max_tail[32] = { UTF8_MAX_TAIL(32) };
+    const __m256i max = _mm256_loadu_si256((const __m256i *)max_tail);
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    __m256i prev = _mm256_setzero_si256();
+    size_t i = 0;
+    while (len - i >= 32) {
+        __m256i in = _mm256_loadu_si256((const __m256i *)(s + i));
+        __m256i error;
+        if (_mm256_movemask_epi8(in) == 0) {
+            error = _mm256_subs_epu8(prev, max);
+        } else {
+            // The upper lane of `prev` followed by the lower lane of `in`,
+            // for the shifts across the 128-bit lane boundary.
+            __m256i seam = _mm256_permute2x128_si256(prev, in, 0x21);
+            __m256i prev1 = _mm256_alignr_epi8(in, seam, 15);
+            __m256i special = _mm256_and_si256(
+                _mm256_and_si256(_mm256_shuffle_epi8(byte_1_high, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble)),
+                                 _mm256_shuffle_epi8(byte_1_low, _mm256_and_si256(prev1, nibble))),
+                _mm256_shuffle_epi8(byte_2_high, _mm256_and_si256(_mm256_srli_epi16(in, 4), nibble)));
+            __m256i third = _mm256_subs_epu8(_mm256_alignr_epi8(in, seam, 14), _mm256_set1_epi8(0xE0 - 0x80));
+            __m256i fourth = _mm256_subs_epu8(_mm256_alignr_epi8(in, seam, 13), _mm256_set1_epi8((char)(0xF0 - 0x80)));
+            __m256i must23 = _mm256_and_si256(_mm256_or_si256(third, fourth), _mm256_set1_epi8((char)0x80));
+            error = _mm256_xor_si256(must23, special);
+        }
+        if (!_mm256_testz_si256(error, error)) {
+            break;
+        }
+        prev = in;
+        i += 32;
+    }
+    return utf8_boundary(s, i);
+}
+#endif
+
+static size_t ascii_run_scalar(const uint8_t *s, size_t len) {
+    size_t i = 0;
+    while (len - i >= 8) {
+        uint64_t word;
+        memcpy(&word, s + i, sizeof(word));
+        if (word & 0x8080808080808080ull) {
+            break;
+        }
+        i += 8;
+    }
+    return i;
+}
+
+// Length of the multi-byte sequence at `s` (lead byte >= 0x80): 2 to 4,
+// 0 if it is cut off by the end of the buffer, -1 if it is malformed.
+static int utf8_sequence(const uint8_t *s, size_t avail) {
+    uint8_t c = s[0];
+    int n;
+    uint8_t lo = 0x80, hi = 0xBF;
+    if (c >= 0xC2 && c <= 0xDF) {
+        n = 2;
+    } else if (c >= 0xE0 && c <= 0xEF) {
+        n = 3;
+        if (c == 0xE0) lo = 0xA0;       // overlong
+        else if (c == 0xED) hi = 0x9F;  // surrogates
+    } else if (c >= 0xF0 && c <= 0xF4) {
+        n = 4;
+        if (c == 0xF0) lo = 0x90;       // overlong
+        else if (c == 0xF4) hi = 0x8F;  // > U+10FFFF
+    } else {
+        return -1;
+    }
+    if (avail < (size_t)n) {
+        return 0;
+    }
+    if (s[1] < lo || s[1] > hi) {
+        return -1;
+    }
+    for (int k = 2; k < n; ++k) {
+        if ((s[k] & 0xC0) != 0x80) {
+            return -1;
+        }
+    }
+    return n;
+}
+
+// Validates complete sequences from the start of `s`. Returns how many bytes
+// were consumed; a sequence cut off by the end of the buffer is left
+// unconsumed so the caller can retry once more bytes are available.
+static size_t utf8_validate_prefix(const uint8_t *s, size_t len, bool *ok) {
+    size_t (*run)(const uint8_t *, size_t) = ascii_run_scalar;
+#ifdef CODEC_X86
+    int level = codec_cpu_level();
+    if (level == CODEC_LEVEL_AVX2) {
+        run = utf8_run_avx2;
+    } else if (level == CODEC_LEVEL_SSE41) {
+        run = utf8_run_sse41;
+    }
+#endif
+    *ok = true;
+    size_t i = 0;
+    size_t block_end = 0;
+    while (i < len) {
+        if (i >= block_end) {
+            // Skip the whole blocks the kernel vouches for (only ASCII ones
+            // in the scalar case), then walk at least one block by hand
+            // before trying again so mixed text does not pay for both.
+            i += run(s + i, len - i);
+            if (i >= len) {
+                break;
+            }
+            block_end = i + 32;
+        }
+        uint8_t c = s[i];
+        if (c < 0x80) {
+            i++;
+            continue;
+        }
+        int n = utf8_sequence(s + i, len - i);
+        if (n == 0) {
+            return i;       // cut off
+        }
+        if (n < 0) {
+            *ok = false;
+            return i;
+        }
+        i += (size_t)n;
+    }
+    return i;
+}
+
+bool codec_utf8_validate(const void *in, size_t len) {
+    bool ok;
+    size_t consumed = utf8_validate_prefix((const uint8_t *)in, len, &ok);
+    return ok && consumed == len;
+}
+
+// Multiple of 4 so every chunk but the last decodes to whole bytes.
+#define CODEC_FUSED_CHUNK 16384
+
+bool codec_base64_decode_utf8(const char *in, size_t len, void *out, size_t out_cap,
+                              size_t *written, CodecBase64Variant variant) {
+    uint8_t *dst = (uint8_t *)out;
+    size_t in_pos = 0, out_pos = 0, validated = 0;
+    bool padded = false;
+    while (in_pos < len && !padded) {
+        size_t chunk = len - in_pos;
+        if (chunk > CODEC_FUSED_CHUNK) {
+            chunk = CODEC_FUSED_CHUNK;
+        }
+        size_t n = 0;
+        if (!base64_decode_core(in + in_pos, chunk, dst + out_pos, out_cap - out_pos, &n, variant, &padded)) {
+            return false;
+        }
+        in_pos += chunk;
+        out_pos += n;
+        if (padded) {
+            for (; in_pos < len; ++in_pos) {
+                if (in[in_pos] != '=') {
+                    return false;
+                }
+            }
+        }
+        bool ok;
+        validated += utf8_validate_prefix(dst + validated, out_pos - validated, &ok);
+        if (!ok) {
+            return false;
+        }
+    }
+    if (validated != out_pos) {
+        return false;   // truncated sequence at the very end
+    }
+    if (out_pos < out_cap) {
+        dst[out_pos] = '\0';
+    }
+    if (written) {
+        *written = out_pos;
+    }
+    return true;
+}
+
+// ============================================================================
+// hex
+// ============================================================================
+
+#ifdef CODEC_X86
+CODEC_TARGET("sse4.1")
+static size_t hex_encode_sse41(const uint8_t *in, size_t len, char *out) {
+    const __m128i lut = _mm_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f');
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    size_t i = 0;
+    while (len - i >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+        __m128i hi = _mm_shuffle_epi8(lut, _mm_and_si128(_mm_srli_epi16(v, 4), nibble));
+        __m128i lo = _mm_shuffle_epi8(lut, _mm_and_si128(v, nibble));
+        _mm_storeu_si128((__m128i *)(out + i * 2), _mm_unpacklo_epi8(hi, lo));
+        _mm_storeu_si128((__m128i *)(out + i * 2 + 16), _mm_unpackhi_epi8(hi, lo));
+        i += 16;
+    }
+    return i;
+}
+
+CODEC_TARGET("avx2")
+static size_t hex_encode_avx2(const uint8_t *in, size_t len, char *out) {
+    const __m256i lut = _mm256_setr_epi8(
+        '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f',
+        '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f');
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    size_t i = 0;
+    while (len - i >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(in + i));
+        __m256i hi = _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble));
+        __m256i lo = _mm256_shuffle_epi8(lut, _mm256_and_si256(v, nibble));
+        // unpack works per 128-bit lane; reorder lanes on the way out.
+        __m256i a = _mm256_unpacklo_epi8(hi, lo);
+        __m256i b = _mm256_unpackhi_epi8(hi, lo);
+        _mm256_storeu_si256((__m256i *)(out + i * 2), _mm256_permute2x128_si256(a, b, 0x20));
+        _mm256_storeu_si256((__m256i *)(out + i * 2 + 32), _mm256_permute2x128_si256(a, b, 0x31));
+        i += 32;
+    }
+    return i;
+}
+
+// Returns the number of input characters consumed (stops at invalid input).
+CODEC_TARGET("sse4.1")
+static size_t hex_decode_sse41(const char *in, size_t len, uint8_t *out) {
+    size_t i = 0;
+    while (len - i >= 16) {
+        __m128i c = _mm_loadu_si128((const __m128i *)(in + i));
+        __m128i lower = _mm_or_si128(c, _mm_set1_epi8(0x20));
+        __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('9' + 1), c));
+        __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('f' + 1), lower));
+        if (_mm_movemask_epi8(_mm_or_si128(digit, alpha)) != 0xFFFF) {
+            break;
+        }
+        __m128i val = _mm_blendv_epi8(_mm_sub_epi8(lower, _mm_set1_epi8('a' - 10)), _mm_sub_epi8(c, _mm_set1_epi8('0')), digit);
+        __m128i words = _mm_maddubs_epi16(val, _mm_set1_epi16(0x0110));
+        _mm_storel_epi64((__m128i *)(out + i / 2), _mm_packus_epi16(words, words));
+        i += 16;
+    }
+    return i;
+}
+
+CODEC_TARGET("avx2")
+static size_t hex_decode_avx2(const char *in, size_t len, uint8_t *out) {
+    size_t i = 0;
+    while (len - i >= 32) {
+        __m256i c = _mm256_loadu_si256((const __m256i *)(in + i));
+        __m256i lower = _mm256_or_si256(c, _mm256_set1_epi8(0x20));
+        __m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('0' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), c));
+        __m256i alpha = _mm256_and_si256(_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('f' + 1), lower));
+        if ((uint32_t)_mm256_movemask_epi8(_mm256_or_si256(digit, alpha)) != 0xFFFFFFFFu) {
+            break;
+        }
+        __m256i val = _mm256_blendv_epi8(_mm256_sub_epi8(lower, _mm256_set1_epi8('a' - 10)), _mm256_sub_epi8(c, _mm256_set1_epi8('0')), digit);
+        __m256i words = _mm256_maddubs_epi16(val, _mm256_set1_epi16(0x0110));
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(words, words), 0xD8);
+        _mm_storeu_si128((__m128i *)(out + i / 2), _mm256_castsi256_si128(packed));
+        i += 32;
+    }
+    return i;
+}
+#endif // CODEC_X86
+
+size_t codec_hex_encode(const void *in, size_t len, char *out) {
+    static const char digits[] = "0123456789abcdef";
+    const uint8_t *src = (const uint8_t *)in;
+    size_t i = 0;
+#ifdef CODEC_X86
+    int level = codec_cpu_level();
+    if (level == CODEC_LEVEL_AVX2) {
+        i = hex_encode_avx2(src, len, out);
+    } else if (level == CODEC_LEVEL_SSE41) {
+        i = hex_encode_sse41(src, len, out);
+    }
+#endif
+    for (; i < len; ++i) {
+        out[i * 2] = digits[src[i] >> 4];
+        out[i * 2 + 1] = digits[src[i] & 0x0F];
+    }
+    out[len * 2] = '\0';
+    return len * 2;
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+bool codec_hex_decode(const char *in, size_t len, void *out, size_t *written) {
+    if ((len % 2) != 0) {
+        return false;
+    }
+    uint8_t *dst = (uint8_t *)out;
+    size_t i = 0;
+#ifdef CODEC_X86
+    int level = codec_cpu_level();
+    if (level == CODEC_LEVEL_AVX2) {
+        i = hex_decode_avx2(in, len, dst);
+    } else if (level == CODEC_LEVEL_SSE41) {
+        i = hex_decode_sse41(in, len, dst);
+    }
+#endif
+    for (; i < len; i += 2) {
+        int hi = hex_value(in[i]);
+        int lo = hex_value(in[i + 1]);
+        if (hi < 0 || lo < 0) {
+            return false;
+        }
+        dst[i / 2] = (uint8_t)((hi << 4) | lo);
+    }
+    if (written) {
+        *written = len / 2;
+    }
+    return true;
+}
+
+// ============================================================================
+// JSON to JavaScript
+// ============================================================================
+// One pass: validate against RFC 8259 (strings strictly UTF-8), drop the
+// insignificant whitespace and copy the rest into a single-quoted string
+// literal. Plain runs inside strings are scanned and copied a block at a
+// time, like ascii_run does for UTF-8. Besides '\'' and '\\', the literal escapes raw U+2028/U+2029
+// (line terminators to engines before ES2019) and "</", so it can also sit
+// in a <script> element.
+//
+// A string for JSON.parse() rather than an object literal: V8 parses big
+// literals as code, which is slower than JSON.parse() on the same text, and
+// JSON.parse() keeps "__proto__" an ordinary key where a literal would not.
+// ============================================================================
+
+#define JSON_MAX_DEPTH 256
+
+// The converter is instantiated once per kernel set (json_to_js_avx2() and
+// friends), with the kernel inlined into it rather than called per string.
+#define JSON_INLINE static inline __attribute__((always_inline))
+
+typedef size_t (*JsonPlainCopy)(const uint8_t *, size_t, char *);
+
+// Bytes a string run stops at: controls, quotes, '\\', '<' and non-ASCII.
+static bool json_plain(uint8_t c) {
+    return c >= 0x20 && c < 0x80 && c != '"' && c != '\'' && c != '\\' && c != '<';
+}
+
+// The plain-run kernels copy the run to `out` as they scan it and return its
+// length. The SIMD ones store whole blocks, including bytes past the end of
+// the run; the output bound in codec_json_js_string_cap() leaves room for
+// that while a full block of input remains.
+JSON_INLINE size_t json_plain_copy_scalar(const uint8_t *s, size_t len, char *out) {
+    size_t i = 0;
+    while (i < len && json_plain(s[i])) {
+        out[i] = (char)s[i];
+        i++;
+    }
+    return i;
+}
+
+#ifdef CODEC_X86
+CODEC_TARGET("sse4.1")
+JSON_INLINE size_t json_plain_copy_sse41(const uint8_t *s, size_t len, char *out) {
+    const __m128i space = _mm_set1_epi8(0x20);
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i apostrophe = _mm_set1_epi8('\'');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i lt = _mm_set1_epi8('<');
+    size_t i = 0;
+    while (len - i >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        _mm_storeu_si128((__m128i *)(out + i), v);
+        // Signed compare: bytes >= 0x80 are negative, so they stop it too.
+        __m128i stop = _mm_or_si128(_mm_or_si128(_mm_cmplt_epi8(v, space), _mm_cmpeq_epi8(v, quote)),
+                                    _mm_or_si128(_mm_cmpeq_epi8(v, backslash), _mm_cmpeq_epi8(v, lt)));
+        stop = _mm_or_si128(stop, _mm_cmpeq_epi8(v, apostrophe));
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(stop);
+        if (mask != 0) {
+            return i + (size_t)__builtin_ctz(mask);
+        }
+        i += 16;
+    }
+    return i + json_plain_copy_scalar(s + i, len - i, out + i);
+}
+
+CODEC_TARGET("avx2")
+JSON_INLINE size_t json_plain_copy_avx2(const uint8_t *s, size_t len, char *out) {
+    const __m256i space = _mm256_set1_epi8(0x20);
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i apostrophe = _mm256_set1_epi8('\'');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i lt = _mm256_set1_epi8('<');
+    size_t i = 0;
+    while (len - i >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+        _mm256_storeu_si256((__m256i *)(out + i), v);
+        __m256i stop = _mm256_or_si256(_mm256_or_si256(_mm256_cmpgt_epi8(space, v), _mm256_cmpeq_epi8(v, quote)),
+                                       _mm256_or_si256(_mm256_cmpeq_epi8(v, backslash), _mm256_cmpeq_epi8(v, lt)));
+        stop = _mm256_or_si256(stop, _mm256_cmpeq_epi8(v, apostrophe));
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(stop);
+        if (mask != 0) {
+            return i + (size_t)__builtin_ctz(mask);
+        }
+        i += 32;
+    }
+    return i + json_plain_copy_scalar(s + i, len - i, out + i);
+}
+#endif
+
+static bool json_space(uint8_t b) {
+    return b == ' ' || b == '\t' || b == '\n' || b == '\r';
+}
+
+// Copies the string at `*pos`, quotes included, and moves both cursors past it.
+JSON_INLINE bool json_string(const uint8_t *in, size_t len, size_t *pos_io, char *out, size_t *out_io,
+                             JsonPlainCopy plain_copy) {
+    size_t pos = *pos_io + 1;
+    size_t o = *out_io;
+    out[o++] = '"';
+    for (;;) {
+        size_t n = plain_copy(in + pos, len - pos, out + o);
+        pos += n;
+        o += n;
+        if (pos >= len) {
+            return false;
+        }
+        uint8_t b = in[pos];
+        if (b == '"') {
+            break;
+        }
+        if (b == '\\') {
+            if (pos + 1 >= len) {
+                return false;
+            }
+            uint8_t e = in[pos + 1];
+            if (e == 'u') {
+                if (len - pos < 6 || hex_value((char)in[pos + 2]) < 0 || hex_value((char)in[pos + 3]) < 0 ||
+                    hex_value((char)in[pos + 4]) < 0 || hex_value((char)in[pos + 5]) < 0) {
+                    return false;
+                }
+            } else if (e == '\0' || strchr("\"\\/bfnrt", e) == NULL) {
+                return false;
+            }
+            // The JSON escape itself is kept for JSON.parse(), so only its
+            // backslash needs escaping; the rest goes out with the next run.
+            out[o++] = '\\';
+            out[o++] = '\\';
+            pos++;
+            if (e == '\\') {
+                out[o++] = '\\';
+                out[o++] = '\\';
+                pos++;
+            } else if (e == '"') {
+                out[o++] = '"';
+                pos++;
+            }
+        } else if (b == '\'') {
+            out[o++] = '\\';
+            out[o++] = '\'';
+            pos++;
+        } else if (b == '<') {
+            out[o++] = '<';
+            if (pos + 1 < len && in[pos + 1] == '/') {
+                out[o++] = '\\';
+            }
+            pos++;
+        } else if (b < 0x20) {
+            return false;
+        } else {
+            int n = utf8_sequence(in + pos, len - pos);
+            if (n <= 0) {
+                return false;
+            }
+            if (n == 3 && b == 0xE2 && in[pos + 1] == 0x80 && (in[pos + 2] == 0xA8 || in[pos + 2] == 0xA9)) {
+                memcpy(out + o, in[pos + 2] == 0xA8 ? "\\u2028" : "\\u2029", 6);
+                o += 6;
+            } else {
+                memcpy(out + o, in + pos, (size_t)n);
+                o += (size_t)n;
+            }
+            pos += (size_t)n;
+        }
+    }
+    out[o++] = '"';
+    *pos_io = pos + 1;
+    *out_io = o;
+    return true;
+}
+
+// Copies the digits at `pos` to `out`, returns how many there were.
+JSON_INLINE size_t json_digits(const uint8_t *in, size_t len, size_t pos, char *out) {
+    size_t n = 0;
+    while (pos + n < len && in[pos + n] >= '0' && in[pos + n] <= '9') {
+        out[n] = (char)in[pos + n];
+        n++;
+    }
+    return n;
+}
+
+// The grammar is walked iteratively, with the open containers kept on a
+// stack of closing brackets, so both cursors stay in registers throughout.
+JSON_INLINE bool json_to_js(const uint8_t *in, size_t len, char *out, size_t *written, JsonPlainCopy plain_copy) {
+    uint8_t closers[JSON_MAX_DEPTH];
+    int depth = 0;
+    size_t pos = 0;
+    size_t o = 0;
+    size_t n;
+    out[o++] = '\'';
+
+value:
+    while (pos < len && json_space(in[pos])) pos++;
+    if (pos >= len) {
+        return false;
+    }
+    switch (in[pos]) {
+        case '"':
+            if (!json_string(in, len, &pos, out, &o, plain_copy)) {
+                return false;
+            }
+            goto next;
+        case '{':
+        case '[':
+            if (depth >= JSON_MAX_DEPTH) {
+                return false;
+            }
+            closers[depth++] = in[pos] == '{' ? '}' : ']';
+            out[o++] = (char)in[pos++];
+            while (pos < len && json_space(in[pos])) pos++;
+            if (pos < len && in[pos] == closers[depth - 1]) {
+                out[o++] = (char)in[pos++];
+                depth--;
+                goto next;
+            }
+            if (closers[depth - 1] == '}') {
+                goto key;
+            }
+            goto value;
+        case 't':
+            n = 4;
+            if (len - pos < n || memcmp(in + pos, "true", n) != 0) return false;
+            goto literal;
+        case 'f':
+            n = 5;
+            if (len - pos < n || memcmp(in + pos, "false", n) != 0) return false;
+            goto literal;
+        case 'n':
+            n = 4;
+            if (len - pos < n || memcmp(in + pos, "null", n) != 0) return false;
+        literal:
+            memcpy(out + o, in + pos, n);
+            pos += n;
+            o += n;
+            goto next;
+        default:
+            break;
+    }
+    // Number: -?(0|[1-9][0-9]*)(\.[0-9]+)?([eE][+-]?[0-9]+)?
+    if (in[pos] == '-') {
+        out[o++] = '-';
+        pos++;
+    }
+    if (pos < len && in[pos] == '0') {
+        out[o++] = '0';
+        pos++;
+    } else if (pos < len && in[pos] >= '1' && in[pos] <= '9') {
+        n = json_digits(in, len, pos, out + o);
+        pos += n;
+        o += n;
+    } else {
+        return false;
+    }
+    if (pos < len && in[pos] == '.') {
+        out[o++] = '.';
+        pos++;
+        n = json_digits(in, len, pos, out + o);
+        if (n == 0) {
+            return false;
+        }
+        pos += n;
+        o += n;
+    }
+    if (pos < len && (in[pos] == 'e' || in[pos] == 'E')) {
+        out[o++] = (char)in[pos++];
+        if (pos < len && (in[pos] == '+' || in[pos] == '-')) {
+            out[o++] = (char)in[pos++];
+        }
+        n = json_digits(in, len, pos, out + o);
+        if (n == 0) {
+            return false;
+        }
+        pos += n;
+        o += n;
+    }
+
+next:
+    while (pos < len && json_space(in[pos])) pos++;
+    if (depth == 0) {
+        if (pos != len) {
+            return false;
+        }
+        out[o++] = '\'';
+        out[o] = '\0';
+        if (written) {
+            *written = o;
+        }
+        return true;
+    }
+    if (pos >= len) {
+        return false;
+    }
+    if (in[pos] == closers[depth - 1]) {
+        out[o++] = (char)in[pos++];
+        depth--;
+        goto next;
+    }
+    if (in[pos] != ',') {
+        return false;
+    }
+    out[o++] = ',';
+    pos++;
+    if (closers[depth - 1] == ']') {
+        goto value;
+    }
+
+key:
+    while (pos < len && json_space(in[pos])) pos++;
+    if (pos >= len || in[pos] != '"' || !json_string(in, len, &pos, out, &o, plain_copy)) {
+        return false;
+    }
+    while (pos < len && json_space(in[pos])) pos++;
+    if (pos >= len || in[pos] != ':') {
+        return false;
+    }
+    out[o++] = ':';
+    pos++;
+    goto value;
+}
+
+static bool json_to_js_scalar(const uint8_t *in, size_t len, char *out, size_t *written) {
+    return json_to_js(in, len, out, written, json_plain_copy_scalar);
+}
+
+#ifdef CODEC_X86
+CODEC_TARGET("sse4.1")
+static bool json_to_js_sse41(const uint8_t *in, size_t len, char *out, size_t *written) {
+    return json_to_js(in, len, out, written, json_plain_copy_sse41);
+}
+
+CODEC_TARGET("avx2")
+static bool json_to_js_avx2(const uint8_t *in, size_t len, char *out, size_t *written) {
+    return json_to_js(in, len, out, written, json_plain_copy_avx2);
+}
+#endif
+
+size_t codec_json_js_string_cap(size_t len) {
+    return len * 2 + 3;
+}
+
+bool codec_json_to_js_string(const char *in, size_t len, char *out, size_t *written) {
+#ifdef CODEC_X86
+    int level = codec_cpu_level();
+    if (level == CODEC_LEVEL_AVX2) {
+        return json_to_js_avx2((const uint8_t *)in, len, out, written);
+    }
+    if (level == CODEC_LEVEL_SSE41) {
+        return json_to_js_sse41((const uint8_t *)in, len, out, written);
+    }
+#endif
+    return json_to_js_scalar((const uint8_t *)in, len, out, written);
+}
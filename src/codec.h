@@ -0,0 +1,65 @@
+#ifndef CODEC_H_
+#define CODEC_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// ============================================================================
+// codec.h - Shared text codecs for the IPC layer and plugins
+// ============================================================================
+// base64 / base64url / hex encoding and decoding, UTF-8 validation and
+// JSON validation into JavaScript string literals.
+// On x86 the hot loops have SSE4.1 and AVX2 kernels selected at runtime; every
+// other target (and CROSSWEB_CODEC=scalar in the environment) uses the portable
+// scalar code. All variants produce identical output.
+// ============================================================================
+
+typedef enum {
+    CODEC_BASE64,      // RFC 4648 alphabet, '=' padded
+    CODEC_BASE64URL,   // URL-safe alphabet, unpadded
+} CodecBase64Variant;
+
+// Name of the kernel set in use: "avx2", "sse4.1" or "scalar".
+const char *codec_backend(void);
+
+// Exact number of characters codec_base64_encode() writes (excluding NUL).
+size_t codec_base64_encoded_len(size_t len, CodecBase64Variant variant);
+// Upper bound on the bytes codec_base64_decode() produces for `len` chars.
+size_t codec_base64_decoded_cap(size_t len);
+
+// Encodes `len` bytes into `out`, which must hold encoded_len + 1 bytes.
+// Returns the number of characters written; `out` is NUL-terminated.
+size_t codec_base64_encode(const void *in, size_t len, char *out, CodecBase64Variant variant);
+
+// Decodes `len` characters. Padding is optional for both variants and
+// only '=' may follow the first '='. Fails on any other character outside the
+// variant's alphabet or when `out_cap` is too small. Writes a NUL after the
+// decoded bytes when there is room for it.
+bool codec_base64_decode(const char *in, size_t len, void *out, size_t out_cap,
+                         size_t *written, CodecBase64Variant variant);
+
+// Same as codec_base64_decode(), additionally requiring the decoded bytes to
+// be well-formed UTF-8. Validation runs chunk by chunk right behind the
+// decoder while the data is still in cache.
+bool codec_base64_decode_utf8(const char *in, size_t len, void *out, size_t out_cap,
+                              size_t *written, CodecBase64Variant variant);
+
+// Lowercase hex. `out` must hold len * 2 + 1 bytes; it is NUL-terminated.
+size_t codec_hex_encode(const void *in, size_t len, char *out);
+// Accepts upper and lower case digits; `len` must be even and `out` must
+// hold len / 2 bytes.
+bool codec_hex_decode(const char *in, size_t len, void *out, size_t *written);
+
+// Strict UTF-8: rejects overlong forms, surrogates and code points > U+10FFFF.
+bool codec_utf8_validate(const void *in, size_t len);
+
+// Upper bound on what codec_json_to_js_string() writes, NUL included.
+size_t codec_json_js_string_cap(size_t len);
+// Validates `len` bytes of JSON in one pass and writes them, minus
+// whitespace, as a single-quoted JavaScript string literal for the page to
+// JSON.parse(). Besides quotes and backslashes, U+2028/U+2029 and "</" are
+// escaped. Fails on invalid JSON or UTF-8 and on nesting deeper than 256.
+// `out` must hold codec_json_js_string_cap(len) bytes; it is NUL-terminated.
+bool codec_json_to_js_string(const char *in, size_t len, char *out, size_t *written);
+
+#endif // CODEC_H_
@@ -0,0 +1,345 @@
+// ============================================================================
+// codec_bench.c - codec throughput against the loops it replaced
+// ============================================================================
+// Runs every kernel set this CPU supports next to the scalar base64 loops
+// ipc.c used to carry and the sprintf/sscanf hex of the keystore plugin.
+// The json columns convert reply bodies for the page (a directory listing and
+// a file's text); the old path base64-encoded them instead. Numbers are GB/s
+// of raw (decoded) bytes, or of JSON, best of several runs.
+//
+//   ./nob bench
+//   cc -O2 -o build/codec-bench src/codec_bench.c && ./build/codec-bench [MiB]
+//
+// codec.c is compiled into this file so the bench can switch kernel sets,
+// which the library otherwise picks once per process.
+// ============================================================================
+
+#include "codec.c"
+
+#include <stdio.h>
+#include <time.h>
+
+#define BENCH_MIN_SECONDS 0.25
+#define BENCH_ROUNDS 5
+// sscanf() takes the length of its whole input on every call, so the old hex
+// decoder gets key-sized strings, as it did in the keystore plugin.
+#define BENCH_KEY_LEN 32
+
+// ============================================================================
+// The old loops, as they were
+// ============================================================================
+
+static bool old_base64_encode(const unsigned char *input, size_t len, char *output, size_t output_cap) {
+    static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t needed = ((len + 2) / 3) * 4;
+    if (output_cap < needed + 1) {
+        return false;
+    }
+    size_t j = 0;
+    for (size_t i = 0; i < len; i += 3) {
+        unsigned int octet_a = input[i];
+        unsigned int octet_b = (i + 1) < len ? input[i + 1] : 0;
+        unsigned int octet_c = (i + 2) < len ? input[i + 2] : 0;
+
+        unsigned int triple = (octet_a << 16) | (octet_b << 8) | octet_c;
+
+        output[j++] = table[(triple >> 18) & 0x3F];
+        output[j++] = table[(triple >> 12) & 0x3F];
+        output[j++] = (i + 1) < len ? table[(triple >> 6) & 0x3F] : '=';
+        output[j++] = (i + 2) < len ? table[triple & 0x3F] : '=';
+    }
+    output[j] = '\0';
+    return true;
+}
+
+static int old_base64_value(char c) {
+    if (c >= 'A' && c <= 'Z') return c - 'A';
+    if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+    if (c >= '0' && c <= '9') return c - '0' + 52;
+    if (c == '+') return 62;
+    if (c == '/') return 63;
+    if (c == '=') return -2; // padding
+    return -1;
+}
+
+static bool old_base64_decode(const char *input, size_t input_len, unsigned char *output, size_t output_cap, size_t *written) {
+    unsigned int val = 0;
+    int valb = -8;
+    size_t out_len = 0;
+    for (size_t i = 0; i < input_len; ++i) {
+        int v = old_base64_value(input[i]);
+        if (v == -1) {
+            return false;
+        }
+        if (v == -2) {
+            break;
+        }
+        val = ((val << 6) | (unsigned int)v) & 0xFFFFFF;
+        valb += 6;
+        if (valb >= 0) {
+            if (out_len >= output_cap) {
+                return false;
+            }
+            output[out_len++] = (unsigned char)((val >> valb) & 0xFF);
+            valb -= 8;
+        }
+    }
+    if (written) {
+        *written = out_len;
+    }
+    if (out_len < output_cap) {
+        output[out_len] = '\0';
+    }
+    return true;
+}
+
+static void old_hex_encode(const unsigned char *buf, size_t len, char *hex) {
+    for (size_t i = 0; i < len; ++i) {
+        sprintf(hex + 2 * i, "%02x", buf[i]);
+    }
+}
+
+static bool old_hex_decode(const char *in, size_t len, unsigned char *out) {
+    for (size_t i = 0; i < len / 2; ++i) {
+        unsigned int v;
+        if (sscanf(in + (i * 2), "%2x", &v) != 1) {
+            return false;
+        }
+        out[i] = (unsigned char)v;
+    }
+    return true;
+}
+
+// ============================================================================
+// Harness
+// ============================================================================
+
+typedef struct BenchData {
+    size_t len;
+    unsigned char *raw;   // random bytes
+    unsigned char *text;  // valid UTF-8, mostly ASCII with some 2-4 byte sequences
+    char *b64;            // base64 of raw
+    char *b64_text;       // base64 of text
+    char *hex;            // hex of raw
+    char *hex_keys;       // the same, as NUL-terminated keys of BENCH_KEY_LEN bytes
+    char *json_listing;   // a reply listing directory entries
+    char *json_text;      // a reply carrying a source file as one string
+    size_t b64_len, b64_text_len, json_listing_len, json_text_len;
+    unsigned char *out;
+    char *out_text;
+} BenchData;
+
+typedef enum {
+    BENCH_B64_ENCODE,
+    BENCH_B64_DECODE,
+    BENCH_B64_DECODE_UTF8,
+    BENCH_UTF8,
+    BENCH_HEX_ENCODE,
+    BENCH_HEX_DECODE,
+    BENCH_JSON_LISTING,
+    BENCH_JSON_TEXT,
+    BENCH_COUNT,
+} BenchOp;
+
+static const char *bench_names[BENCH_COUNT] = { "b64 enc", "b64 dec", "dec+utf8", "utf8", "hex enc", "hex dec", "json lst", "json txt" };
+
+static volatile size_t bench_sink;
+
+static double bench_now(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static bool bench_run_once(BenchData *d, BenchOp op, bool old) {
+    size_t written = 0;
+    bool ok = true;
+    switch (op) {
+        case BENCH_B64_ENCODE:
+            if (old) ok = old_base64_encode(d->raw, d->len, d->out_text, d->b64_len + 1);
+            else written = codec_base64_encode(d->raw, d->len, d->out_text, CODEC_BASE64);
+            break;
+        case BENCH_B64_DECODE:
+            if (old) ok = old_base64_decode(d->b64, d->b64_len, d->out, d->len + 1, &written);
+            else ok = codec_base64_decode(d->b64, d->b64_len, d->out, d->len + 1, &written, CODEC_BASE64);
+            break;
+        case BENCH_B64_DECODE_UTF8:
+            if (old) return false; // the old path never validated
+            ok = codec_base64_decode_utf8(d->b64_text, d->b64_text_len, d->out, d->len + 1, &written, CODEC_BASE64);
+            break;
+        case BENCH_UTF8:
+            if (old) return false;
+            ok = codec_utf8_validate(d->text, d->len);
+            break;
+        case BENCH_HEX_ENCODE:
+            if (old) old_hex_encode(d->raw, d->len, d->out_text);
+            else written = codec_hex_encode(d->raw, d->len, d->out_text);
+            break;
+        case BENCH_HEX_DECODE:
+            if (old) {
+                for (size_t i = 0; ok && i < d->len; i += BENCH_KEY_LEN) {
+                    ok = old_hex_decode(d->hex_keys + i / BENCH_KEY_LEN * (BENCH_KEY_LEN * 2 + 1), BENCH_KEY_LEN * 2, d->out + i);
+                }
+            }
+            else ok = codec_hex_decode(d->hex, d->len * 2, d->out, &written);
+            break;
+        case BENCH_JSON_LISTING:
+            if (old) ok = old_base64_encode((const unsigned char *)d->json_listing, d->json_listing_len, d->out_text, d->b64_len + 1);
+            else ok = codec_json_to_js_string(d->json_listing, d->json_listing_len, d->out_text, &written);
+            break;
+        case BENCH_JSON_TEXT:
+            if (old) ok = old_base64_encode((const unsigned char *)d->json_text, d->json_text_len, d->out_text, d->b64_len + 1);
+            else ok = codec_json_to_js_string(d->json_text, d->json_text_len, d->out_text, &written);
+            break;
+        default:
+            return false;
+    }
+    if (!ok) {
+        fprintf(stderr, "codec-bench: %s failed\n", bench_names[op]);
+        exit(1);
+    }
+    bench_sink += written + d->out[0] + (unsigned char)d->out_text[0];
+    return true;
+}
+
+static size_t bench_bytes(const BenchData *d, BenchOp op) {
+    if (op == BENCH_JSON_LISTING) return d->json_listing_len;
+    if (op == BENCH_JSON_TEXT) return d->json_text_len;
+    return d->len;
+}
+
+// GB/s of raw bytes, 0 if the variant has no such operation.
+static double bench_measure(BenchData *d, BenchOp op, bool old) {
+    double best = 0.0;
+    for (int round = 0; round < BENCH_ROUNDS; ++round) {
+        int iterations = 0;
+        double start = bench_now(), elapsed = 0.0;
+        do {
+            if (!bench_run_once(d, op, old)) {
+                return 0.0;
+            }
+            iterations++;
+            elapsed = bench_now() - start;
+        } while (elapsed < BENCH_MIN_SECONDS / BENCH_ROUNDS);
+        double rate = (double)bench_bytes(d, op) * iterations / elapsed / 1e9;
+        if (rate > best) {
+            best = rate;
+        }
+    }
+    return best;
+}
+
+static void bench_row(BenchData *d, const char *name, bool old) {
+    printf("%-10s", name);
+    for (int op = 0; op < BENCH_COUNT; ++op) {
+        double rate = bench_measure(d, (BenchOp)op, old);
+        if (rate > 0.0) {
+            printf("%10.2f", rate);
+        } else {
+            printf("%10s", "-");
+        }
+    }
+    printf("\n");
+    fflush(stdout);
+}
+
+static void bench_fill(BenchData *d) {
+    uint64_t state = 0x9e3779b97f4a7c15ull;
+    for (size_t i = 0; i < d->len; ++i) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        d->raw[i] = (unsigned char)state;
+    }
+    // JSON-like text: ASCII runs with an occasional é, € or 😀.
+    static const char *const pieces[] = { "{\"name\":\"value\",\"n\":12345}", "caf\xc3\xa9 ", "\xe2\x82\xac 9,99 ", "\xf0\x9f\x98\x80" };
+    size_t t = 0;
+    for (size_t i = 0; t < d->len; ++i) {
+        const char *piece = pieces[(d->raw[i % d->len] & 7) < 5 ? 0 : 1 + d->raw[i % d->len] % 3];
+        size_t n = strlen(piece);
+        if (n > d->len - t) {
+            memset(d->text + t, ' ', d->len - t);
+            break;
+        }
+        memcpy(d->text + t, piece, n);
+        t += n;
+    }
+
+    // Both replies stay under d->len bytes, closers included.
+    size_t cap = d->len - 64, n = 0;
+    n += (size_t)sprintf(d->json_listing, "{\"ok\":true,\"entries\":[");
+    for (int i = 0; n < cap - 256; ++i) {
+        n += (size_t)sprintf(d->json_listing + n,
+                             "%s{\"name\":\"file_%d.txt\",\"path\":\"/home/user/projects/crossweb/src/file_%d.txt\","
+                             "\"size\":%d,\"isDirectory\":%s,\"modified\":1697040000%03d}",
+                             i ? "," : "", i, i, i * 37 % 100000, i % 5 ? "false" : "true", i % 1000);
+    }
+    n += (size_t)sprintf(d->json_listing + n, "]}");
+    d->json_listing_len = n;
+    n = (size_t)sprintf(d->json_text, "{\"content\":\"");
+    for (int i = 0; n < cap - 256; ++i) {
+        n += (size_t)sprintf(d->json_text + n, "    int value_%d = compute(\\\"arg %d\\\", &ctx); // it's line %d\\n", i, i, i);
+    }
+    n += (size_t)sprintf(d->json_text + n, "\"}");
+    d->json_text_len = n;
+}
+
+int main(int argc, char **argv) {
+    size_t mib = argc > 1 ? (size_t)strtoul(argv[1], NULL, 10) : 16;
+    if (mib == 0) {
+        fprintf(stderr, "usage: %s [MiB]\n", argv[0]);
+        return 1;
+    }
+    BenchData d = { .len = mib << 20 };
+    d.b64_len = codec_base64_encoded_len(d.len, CODEC_BASE64);
+    d.raw = malloc(d.len);
+    d.text = malloc(d.len);
+    d.b64 = malloc(d.b64_len + 1);
+    d.b64_text = malloc(d.b64_len + 1);
+    d.hex = malloc(d.len * 2 + 1);
+    d.hex_keys = malloc(d.len / BENCH_KEY_LEN * (BENCH_KEY_LEN * 2 + 1));
+    d.json_listing = malloc(d.len);
+    d.json_text = malloc(d.len);
+    d.out = malloc(d.len + 1);
+    d.out_text = malloc(d.len * 2 + d.b64_len + 1);
+    if (!d.raw || !d.text || !d.b64 || !d.b64_text || !d.hex || !d.hex_keys || !d.json_listing || !d.json_text || !d.out || !d.out_text) {
+        fprintf(stderr, "codec-bench: out of memory\n");
+        return 1;
+    }
+    bench_fill(&d);
+    codec_base64_encode(d.raw, d.len, d.b64, CODEC_BASE64);
+    d.b64_text_len = codec_base64_encode(d.text, d.len, d.b64_text, CODEC_BASE64);
+    codec_hex_encode(d.raw, d.len, d.hex);
+    for (size_t i = 0; i < d.len; i += BENCH_KEY_LEN) {
+        codec_hex_encode(d.raw + i, BENCH_KEY_LEN, d.hex_keys + i / BENCH_KEY_LEN * (BENCH_KEY_LEN * 2 + 1));
+    }
+
+    printf("%zu MiB, GB/s of raw bytes\n%-10s", mib, "");
+    for (int op = 0; op < BENCH_COUNT; ++op) {
+        printf("%10s", bench_names[op]);
+    }
+    printf("\n");
+    bench_row(&d, "old", true);
+
+    static const struct { int level; const char *name; const char *feature; } sets[] = {
+        { CODEC_LEVEL_SCALAR, "scalar", NULL },
+        { CODEC_LEVEL_SSE41, "sse4.1", "sse4.1" },
+        { CODEC_LEVEL_AVX2, "avx2", "avx2" },
+    };
+    for (size_t i = 0; i < sizeof(sets) / sizeof(sets[0]); ++i) {
+#ifdef CODEC_X86
+        __builtin_cpu_init();
+        if (sets[i].feature != NULL &&
+            !(sets[i].level == CODEC_LEVEL_AVX2 ? __builtin_cpu_supports("avx2") : __builtin_cpu_supports("sse4.1"))) {
+            continue;
+        }
+#else
+        if (sets[i].feature != NULL) {
+            continue;
+        }
+#endif
+        atomic_store(&codec_level, sets[i].level);
+        bench_row(&d, sets[i].name, false);
+    }
+    return 0;
+}
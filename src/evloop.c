@@ -0,0 +1,437 @@
+#include "evloop.h"
+#include "sync.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__linux__)
+#define EVLOOP_EPOLL 1
+#include <errno.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#elif !defined(_WIN32)
+#define EVLOOP_POLL 1
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+typedef struct EvWatch {
+    int fd;
+    unsigned int events;
+    EvFdFn fn;
+    void *arg;
+} EvWatch;
+
+typedef struct EvTimer {
+    struct EvTimer *next;
+    unsigned long id;
+    unsigned long long due_ms;
+    unsigned int period_ms;
+    EvTimerFn fn;
+    void *arg;
+} EvTimer;
+
+static SyncMutex loop_lock = SYNC_MUTEX_INIT;
+static bool loop_ready = false;
+static EvWatch *watches = NULL;
+static size_t watch_count = 0;
+static size_t watch_cap = 0;
+static EvTimer *timers = NULL;   // sorted by due_ms
+static unsigned long next_timer_id = 1;
+
+#if EVLOOP_EPOLL
+static int epoll_fd = -1;
+static int wake_fd = -1;
+static int timer_fd = -1;
+static unsigned long long timer_armed_ms = 0;   // what timer_fd is set to, 0 = disarmed
+#elif EVLOOP_POLL
+static int wake_pipe[2] = { -1, -1 };
+#else
+static HANDLE wake_event = NULL;
+#endif
+
+static void loop_close_fds(void) {
+#if EVLOOP_EPOLL
+    if (epoll_fd >= 0) close(epoll_fd);
+    if (wake_fd >= 0) close(wake_fd);
+    if (timer_fd >= 0) close(timer_fd);
+    epoll_fd = wake_fd = timer_fd = -1;
+    timer_armed_ms = 0;
+#elif EVLOOP_POLL
+    for (int i = 0; i < 2; ++i) {
+        if (wake_pipe[i] >= 0) close(wake_pipe[i]);
+        wake_pipe[i] = -1;
+    }
+#else
+    if (wake_event != NULL) CloseHandle(wake_event);
+    wake_event = NULL;
+#endif
+}
+
+bool evloop_init(void) {
+    sync_mutex_lock(&loop_lock);
+    if (loop_ready) {
+        sync_mutex_unlock(&loop_lock);
+        return true;
+    }
+    bool ok;
+#if EVLOOP_EPOLL
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    ok = epoll_fd >= 0 && wake_fd >= 0 && timer_fd >= 0;
+    for (int i = 0; ok && i < 2; ++i) {
+        struct epoll_event ev = { .events = EPOLLIN };
+        ev.data.fd = i == 0 ? wake_fd : timer_fd;
+        ok = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, ev.data.fd, &ev) == 0;
+    }
+#elif EVLOOP_POLL
+    ok = pipe(wake_pipe) == 0;
+    for (int i = 0; ok && i < 2; ++i) {
+        fcntl(wake_pipe[i], F_SETFL, fcntl(wake_pipe[i], F_GETFL) | O_NONBLOCK);
+        fcntl(wake_pipe[i], F_SETFD, FD_CLOEXEC);
+    }
+#else
+    wake_event = CreateEventA(NULL, FALSE, FALSE, NULL);
+    ok = wake_event != NULL;
+#endif
+    if (!ok) {
+        fprintf(stderr, "evloop: failed to set up the event loop\n");
+        loop_close_fds();
+    }
+    loop_ready = ok;
+    sync_mutex_unlock(&loop_lock);
+    return ok;
+}
+
+void evloop_deinit(void) {
+    sync_mutex_lock(&loop_lock);
+    loop_close_fds();
+    free(watches);
+    watches = NULL;
+    watch_count = watch_cap = 0;
+    while (timers != NULL) {
+        EvTimer *t = timers;
+        timers = t->next;
+        free(t);
+    }
+    loop_ready = false;
+    sync_mutex_unlock(&loop_lock);
+}
+
+void evloop_wake(void) {
+#if EVLOOP_EPOLL
+    if (wake_fd >= 0) {
+        uint64_t one = 1;
+        if (write(wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            fprintf(stderr, "evloop: wake failed: %s\n", strerror(errno));
+        }
+    }
+#elif EVLOOP_POLL
+    if (wake_pipe[1] >= 0) {
+        char byte = 0;
+        (void)!write(wake_pipe[1], &byte, 1);   // a full pipe is already a wakeup
+    }
+#else
+    if (wake_event != NULL) {
+        SetEvent(wake_event);
+    }
+#endif
+}
+
+int evloop_fd(void) {
+#if EVLOOP_EPOLL
+    return evloop_init() ? epoll_fd : -1;
+#else
+    return -1;
+#endif
+}
+
+// ============================================================================
+// File descriptors
+// ============================================================================
+
+#if EVLOOP_EPOLL
+static uint32_t epoll_events(unsigned int events) {
+    return (events & EVLOOP_READ ? EPOLLIN : 0) | (events & EVLOOP_WRITE ? EPOLLOUT : 0);
+}
+#endif
+
+bool evloop_watch_fd(int fd, unsigned int events, EvFdFn fn, void *arg) {
+#if EVLOOP_EPOLL || EVLOOP_POLL
+    if (fd < 0 || fn == NULL || !evloop_init()) {
+        return false;
+    }
+    sync_mutex_lock(&loop_lock);
+    size_t i = 0;
+    while (i < watch_count && watches[i].fd != fd) {
+        i++;
+    }
+    bool added = i == watch_count;
+    if (added && watch_count == watch_cap) {
+        size_t cap = watch_cap ? watch_cap * 2 : 16;
+        EvWatch *grown = (EvWatch *)realloc(watches, cap * sizeof(EvWatch));
+        if (grown == NULL) {
+            sync_mutex_unlock(&loop_lock);
+            return false;
+        }
+        watches = grown;
+        watch_cap = cap;
+    }
+    bool ok = true;
+#if EVLOOP_EPOLL
+    struct epoll_event ev = { .events = epoll_events(events) };
+    ev.data.fd = fd;
+    ok = epoll_ctl(epoll_fd, added ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, fd, &ev) == 0;
+    if (!ok) {
+        fprintf(stderr, "evloop: cannot watch fd %d: %s\n", fd, strerror(errno));
+    }
+#endif
+    if (ok) {
+        watches[i] = (EvWatch){ .fd = fd, .events = events, .fn = fn, .arg = arg };
+        if (added) {
+            watch_count++;
+        }
+    }
+    sync_mutex_unlock(&loop_lock);
+#if EVLOOP_POLL
+    evloop_wake();   // the blocked poll() has a stale set
+#endif
+    return ok;
+#else
+    (void)fd;
+    (void)events;
+    (void)fn;
+    (void)arg;
+    return false;
+#endif
+}
+
+void evloop_unwatch_fd(int fd) {
+    sync_mutex_lock(&loop_lock);
+    for (size_t i = 0; i < watch_count; ++i) {
+        if (watches[i].fd == fd) {
+            watches[i] = watches[--watch_count];
+#if EVLOOP_EPOLL
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+#endif
+            break;
+        }
+    }
+    sync_mutex_unlock(&loop_lock);
+}
+
+// Looked up again at dispatch time: an earlier callback may have removed or
+// replaced the watch.
+static int loop_dispatch_fd(int fd, unsigned int revents) {
+    sync_mutex_lock(&loop_lock);
+    EvWatch watch = { .fd = -1 };
+    for (size_t i = 0; i < watch_count; ++i) {
+        if (watches[i].fd == fd) {
+            watch = watches[i];
+            break;
+        }
+    }
+    sync_mutex_unlock(&loop_lock);
+    revents &= watch.events | EVLOOP_ERROR;
+    if (watch.fd < 0 || revents == 0) {
+        return 0;
+    }
+    watch.fn(fd, revents, watch.arg);
+    return 1;
+}
+
+// ============================================================================
+// Timers
+// ============================================================================
+
+// Caller holds loop_lock.
+static void loop_arm_timer(void) {
+#if EVLOOP_EPOLL
+    unsigned long long due = timers ? timers->due_ms : 0;
+    if (due == timer_armed_ms || timer_fd < 0) {
+        return;
+    }
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    if (due != 0) {
+        spec.it_value.tv_sec = (time_t)(due / 1000);
+        spec.it_value.tv_nsec = (long)(due % 1000) * 1000000L;
+        if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0) {
+            spec.it_value.tv_nsec = 1;   // all zero would disarm it
+        }
+    }
+    timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, NULL);
+    timer_armed_ms = due;
+#endif
+}
+
+// Caller holds loop_lock.
+static void loop_insert_timer(EvTimer *timer) {
+    EvTimer **link = &timers;
+    while (*link != NULL && (*link)->due_ms <= timer->due_ms) {
+        link = &(*link)->next;
+    }
+    timer->next = *link;
+    *link = timer;
+}
+
+unsigned long evloop_timer_start(unsigned int delay_ms, unsigned int period_ms, EvTimerFn fn, void *arg) {
+    if (fn == NULL || !evloop_init()) {
+        return 0;
+    }
+    EvTimer *timer = (EvTimer *)malloc(sizeof(EvTimer));
+    if (timer == NULL) {
+        return 0;
+    }
+    timer->due_ms = sync_now_ms() + delay_ms;
+    timer->period_ms = period_ms;
+    timer->fn = fn;
+    timer->arg = arg;
+    sync_mutex_lock(&loop_lock);
+    timer->id = next_timer_id++;
+    unsigned long id = timer->id;
+    loop_insert_timer(timer);
+    loop_arm_timer();
+    sync_mutex_unlock(&loop_lock);
+#if !EVLOOP_EPOLL
+    evloop_wake();   // a blocked wait may be due later than this timer
+#endif
+    return id;
+}
+
+bool evloop_timer_cancel(unsigned long id) {
+    sync_mutex_lock(&loop_lock);
+    bool found = false;
+    for (EvTimer **link = &timers; *link != NULL; link = &(*link)->next) {
+        if ((*link)->id == id) {
+            EvTimer *timer = *link;
+            *link = timer->next;
+            free(timer);
+            found = true;
+            break;
+        }
+    }
+    loop_arm_timer();
+    sync_mutex_unlock(&loop_lock);
+    return found;
+}
+
+int evloop_timeout_ms(void) {
+    sync_mutex_lock(&loop_lock);
+    long long due = timers ? (long long)timers->due_ms : -1;
+    sync_mutex_unlock(&loop_lock);
+    if (due < 0) {
+        return -1;
+    }
+    long long left = due - (long long)sync_now_ms();
+    return left > 0 ? (int)(left < 0x7fffffff ? left : 0x7fffffff) : 0;
+}
+
+static int loop_run_timers(void) {
+    int ran = 0;
+    unsigned long long now = sync_now_ms();
+    for (;;) {
+        sync_mutex_lock(&loop_lock);
+        EvTimer *timer = timers;
+        if (timer == NULL || timer->due_ms > now) {
+            loop_arm_timer();
+            sync_mutex_unlock(&loop_lock);
+            return ran;
+        }
+        timers = timer->next;
+        EvTimerFn fn = timer->fn;
+        void *arg = timer->arg;
+        if (timer->period_ms != 0) {
+            // Skip missed periods instead of firing them back to back.
+            timer->due_ms += timer->period_ms;
+            if (timer->due_ms <= now) {
+                timer->due_ms = now + timer->period_ms;
+            }
+            loop_insert_timer(timer);
+        } else {
+            free(timer);
+        }
+        sync_mutex_unlock(&loop_lock);
+        fn(arg);
+        ran++;
+    }
+}
+
+// ============================================================================
+// Waiting
+// ============================================================================
+
+int evloop_run_once(int timeout_ms) {
+    if (!evloop_init()) {
+        return 0;
+    }
+    int ran = 0;
+#if EVLOOP_EPOLL
+    // Timers come in through timer_fd, so the timeout is only the caller's.
+    struct epoll_event events[64];
+    int n = epoll_wait(epoll_fd, events, 64, timeout_ms);
+    for (int i = 0; i < n; ++i) {
+        int fd = events[i].data.fd;
+        if (fd == wake_fd || fd == timer_fd) {
+            uint64_t count;
+            (void)!read(fd, &count, sizeof(count));
+            continue;
+        }
+        uint32_t e = events[i].events;
+        unsigned int revents = (e & EPOLLIN ? EVLOOP_READ : 0) | (e & EPOLLOUT ? EVLOOP_WRITE : 0) |
+                               (e & (EPOLLERR | EPOLLHUP) ? EVLOOP_ERROR : 0);
+        ran += loop_dispatch_fd(fd, revents);
+    }
+#else
+    int timer_in = evloop_timeout_ms();
+    if (timer_in >= 0 && (timeout_ms < 0 || timer_in < timeout_ms)) {
+        timeout_ms = timer_in;
+    }
+#if EVLOOP_POLL
+    sync_mutex_lock(&loop_lock);
+    size_t count = watch_count + 1;
+    struct pollfd *fds = (struct pollfd *)malloc(count * sizeof(struct pollfd));
+    if (fds == NULL) {
+        count = 1;
+        fds = (struct pollfd *)malloc(sizeof(struct pollfd));
+    }
+    if (fds != NULL) {
+        fds[0] = (struct pollfd){ .fd = wake_pipe[0], .events = POLLIN };
+        for (size_t i = 1; i < count; ++i) {
+            short e = (watches[i - 1].events & EVLOOP_READ ? POLLIN : 0) | (watches[i - 1].events & EVLOOP_WRITE ? POLLOUT : 0);
+            fds[i] = (struct pollfd){ .fd = watches[i - 1].fd, .events = e };
+        }
+    }
+    sync_mutex_unlock(&loop_lock);
+    if (fds != NULL && poll(fds, (nfds_t)count, timeout_ms) > 0) {
+        if (fds[0].revents != 0) {
+            char drain[64];
+            while (read(wake_pipe[0], drain, sizeof(drain)) > 0) {
+            }
+        }
+        for (size_t i = 1; i < count; ++i) {
+            short e = fds[i].revents;
+            if (e != 0) {
+                unsigned int revents = (e & POLLIN ? EVLOOP_READ : 0) | (e & POLLOUT ? EVLOOP_WRITE : 0) |
+                                       (e & (POLLERR | POLLHUP | POLLNVAL) ? EVLOOP_ERROR : 0);
+                ran += loop_dispatch_fd(fds[i].fd, revents);
+            }
+        }
+    }
+    free(fds);
+#else
+    if (timeout_ms != 0) {
+        WaitForSingleObject(wake_event, timeout_ms < 0 ? INFINITE : (DWORD)timeout_ms);
+    }
+#endif
+#endif
+    ran += loop_run_timers();
+    return ran;
+}
@@ -0,0 +1,53 @@
+#ifndef EVLOOP_H_
+#define EVLOOP_H_
+
+#include <stdbool.h>
+
+// ============================================================================
+// evloop.h - Core event loop
+// ============================================================================
+// Blocks the calling thread until a watched file descriptor is ready, a
+// timer is due or another thread calls evloop_wake(), then runs the
+// callbacks. Linux uses epoll with an eventfd for wakeups and a timerfd for
+// timers; other POSIX systems fall back to poll() and a self-pipe. Windows
+// hosts block in their own message loop, so there the loop only keeps
+// timers (run by a non-blocking evloop_run_once()) and cannot watch fds.
+//
+// Watches and timers may be added and removed from any thread; callbacks
+// run on the thread calling evloop_run_once().
+// ============================================================================
+
+#define EVLOOP_READ  0x1u
+#define EVLOOP_WRITE 0x2u
+#define EVLOOP_ERROR 0x4u   // Error or hangup, always reported
+
+typedef void (*EvFdFn)(int fd, unsigned int revents, void *arg);
+typedef void (*EvTimerFn)(void *arg);
+
+// Idempotent; the other calls initialise the loop on first use.
+bool evloop_init(void);
+// Drops every watch and timer without running them.
+void evloop_deinit(void);
+
+// One watch per fd: watching it again replaces the callback and events.
+bool evloop_watch_fd(int fd, unsigned int events, EvFdFn fn, void *arg);
+void evloop_unwatch_fd(int fd);
+
+// First fires after delay_ms, then every period_ms (0 = once). Returns an
+// id for evloop_timer_cancel(), 0 on failure.
+unsigned long evloop_timer_start(unsigned int delay_ms, unsigned int period_ms, EvTimerFn fn, void *arg);
+bool evloop_timer_cancel(unsigned long id);
+// Milliseconds until the next timer is due, 0 if overdue, -1 if none.
+int evloop_timeout_ms(void);
+
+// Waits up to timeout_ms (-1 = until woken) and runs whatever is ready.
+// Returns the number of callbacks run.
+int evloop_run_once(int timeout_ms);
+// Thread-safe: makes a blocked (or the next) evloop_run_once() return.
+void evloop_wake(void);
+// A descriptor that polls readable whenever evloop_run_once(0) has work, so
+// the loop can be nested in a foreign one (GLib). -1 where there is none:
+// only the epoll backend has a single fd covering watches, timers and wakes.
+int evloop_fd(void);
+
+#endif // EVLOOP_H_
@@ -0,0 +1,981 @@
+// ============================================================================
+// headless.c - Plugin runtime without a webview
+// ============================================================================
+// Speaks the bridge's framing over stdin/stdout or a Unix domain socket, so
+// plugins can be load-tested and soak-tested in CI or run as a local sidecar.
+// One request per line, exactly what the page hands window.external.invoke:
+//   id[@timeout_ms] <RS> cmd <RS> base64(payload) [<RS> base64(bytes)]
+// and one line per reply, the same tuples the page's batches carry:
+//   0 <RS> id <RS> base64(json)       response to that client's request
+//   1 <RS> event <RS> base64(json)    event, sent to every client
+// where <RS> is the 0x1E record separator. Ids only have to be unique per
+// client: each is tagged with its client before it enters the IPC queue and
+// untagged on the way out. All clients are multiplexed on the core event
+// loop (epoll on Linux). With stdio, the host exits once stdin is closed and
+// every request read from it has been answered.
+//
+// With --ws PORT the same protocol is also served to browsers over a
+// loopback WebSocket, so a page on the Vite dev server can reach the plugins
+// (ipc.js connects on its own when there is no native bridge). Text messages
+// carry the request lines above. Binary messages skip base64 altogether:
+//   0 <RS> id[@timeout_ms] <RS> cmd <RS> payload
+//   2 <RS> id[@timeout_ms] <RS> cmd <RS> payload length <RS> payload bytes
+// and replies go out as binary messages holding 0|1 <RS> id|event <RS> json.
+// JSON never contains a raw <RS>, so nothing on the way out needs escaping.
+// ============================================================================
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "codec.h"
+#include "evloop.h"
+#include "ipc.h"
+#include "plug.h"
+#include "ws.h"
+
+#define HEADLESS_SEP '\x1e'
+#define HEADLESS_MAX_CLIENTS 1024
+#define HEADLESS_READ_CHUNK (64 * 1024)
+// Longest request line: payload and bytes together are capped at
+// IPC_MAX_PAYLOAD_LEN decoded, so base64 plus the header fits in this.
+#define HEADLESS_MAX_LINE ((size_t)IPC_MAX_PAYLOAD_LEN / 3 * 4 + 4096)
+// A client is not read from while its replies pile up past the high-water
+// mark or it has this many requests in flight, so a slow reader cannot make
+// the host buffer without bound and a pipelining one is paced instead of
+// being refused as busy by the IPC queue.
+#define HEADLESS_OUT_HIGH_WATER (4u * 1024u * 1024u)
+#define HEADLESS_MAX_PENDING 32
+// Requests in flight over all clients, kept below the IPC queue's per-plugin
+// cap so that many clients are paced here, fairly, rather than answered busy.
+// Room that frees up is offered to waiting clients in turn.
+#define HEADLESS_MAX_INFLIGHT 48
+#define HEADLESS_WS_MAX_MESSAGE ((size_t)IPC_MAX_PAYLOAD_LEN + 4096)
+#define HEADLESS_WS_MAX_HEAD 8192
+
+typedef struct Client {
+    int in_fd;
+    int out_fd;                // same as in_fd for sockets
+    unsigned int gen;          // bumped each time the slot is reused
+    bool used;
+    bool eof;                  // nothing more will be read
+    bool paused;               // reading stopped for backpressure
+    bool in_pollable;          // false for a regular file on stdin
+    size_t pending;            // requests read but not answered yet
+    char *in_buf;
+    size_t in_len;
+    size_t in_cap;
+    size_t in_scanned;         // leading bytes of in_buf known to hold no '\n'
+    char *out_buf;
+    size_t out_off;            // already written
+    size_t out_len;
+    size_t out_cap;
+    bool ws;                   // WebSocket connection
+    bool ws_open;              // handshake done
+    int msg_opcode;            // first frame's opcode while msg_buf is in use
+    char *msg_buf;             // fragments of a message split across frames
+    size_t msg_len;
+    size_t msg_cap;
+} Client;
+
+static Client clients[HEADLESS_MAX_CLIENTS];
+static int listen_fd = -1;
+static int ws_listen_fd = -1;
+static const char *ws_origin = NULL;   // allowed besides localhost pages
+static const char *socket_path = NULL;
+static bool stdio_mode = false;
+static bool quit = false;
+static size_t inflight = 0;        // pending, summed over all clients
+static int resume_next = 0;        // client offered the next free slot
+static char *frame_buf = NULL;   // a request line with its client tag in front
+static size_t frame_cap = 0;
+
+static void complete_request(void *host_ctx, const char *content_type, const void *data, size_t len) {
+    ipc_complete((IpcMessage *)host_ctx, content_type, data, len);
+}
+
+static void host_emit_event(const char *event, const char *data_json) {
+    if (event == NULL || event[0] == '\0') {
+        return;
+    }
+    ipc_emit_event(event, data_json ? data_json : "null");
+}
+
+static void wake_loop(void *arg) {
+    (void)arg;
+    evloop_wake();
+}
+
+static void process_ipc_queue(void) {
+    IpcMessage *msg;
+    while ((msg = ipc_receive()) != NULL) {
+        PlugRequest req = {
+            .id = msg->id,
+            .cmd = msg->cmd,
+            .payload = msg->payload,
+            .payload_len = msg->payload_len,
+            .data = msg->data,
+            .data_len = msg->data_len,
+            .deadline_ms = msg->deadline_ms,
+            .host_ctx = msg,
+        };
+        if (msg->data != NULL) {
+            plug_invoke_bytes(&req, NULL);
+        } else {
+            plug_invoke(&req, NULL);
+        }
+    }
+}
+
+static bool set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+static bool grow(char **buf, size_t *cap, size_t needed) {
+    if (needed <= *cap) {
+        return true;
+    }
+    size_t new_cap = *cap ? *cap : 4096;
+    while (new_cap < needed) {
+        new_cap *= 2;
+    }
+    char *p = (char *)realloc(*buf, new_cap);
+    if (p == NULL) {
+        return false;
+    }
+    *buf = p;
+    *cap = new_cap;
+    return true;
+}
+
+// ============================================================================
+// Clients
+// ============================================================================
+
+static void client_fd_ready(int fd, unsigned int revents, void *arg);
+
+static void client_update_watch(Client *c) {
+    bool want_read = !c->eof && !c->paused;
+    bool want_write = c->out_len > c->out_off;
+    if (c->in_fd == c->out_fd) {
+        unsigned int events = (want_read ? EVLOOP_READ : 0) | (want_write ? EVLOOP_WRITE : 0);
+        if (events != 0 || !c->eof) {
+            evloop_watch_fd(c->in_fd, events, client_fd_ready, c);
+        } else {
+            evloop_unwatch_fd(c->in_fd);
+        }
+        return;
+    }
+    if (c->in_pollable) {
+        if (want_read) {
+            evloop_watch_fd(c->in_fd, EVLOOP_READ, client_fd_ready, c);
+        } else {
+            evloop_unwatch_fd(c->in_fd);
+        }
+    }
+    if (want_write) {
+        evloop_watch_fd(c->out_fd, EVLOOP_WRITE, client_fd_ready, c);
+    } else {
+        evloop_unwatch_fd(c->out_fd);
+    }
+}
+
+static void client_add_pending(Client *c) {
+    c->pending++;
+    inflight++;
+}
+
+static void client_drop_pending(Client *c, size_t n) {
+    c->pending -= n;
+    inflight -= n;
+}
+
+static Client *client_open(int in_fd, int out_fd) {
+    for (int i = 0; i < HEADLESS_MAX_CLIENTS; ++i) {
+        Client *c = &clients[i];
+        if (!c->used) {
+            unsigned int gen = c->gen + 1;
+            memset(c, 0, sizeof(*c));
+            c->used = true;
+            c->gen = gen;
+            c->in_fd = in_fd;
+            c->out_fd = out_fd;
+            // epoll refuses regular files; those never block, so main()
+            // reads them between loop iterations instead.
+            struct stat st;
+            c->in_pollable = fstat(in_fd, &st) != 0 || !S_ISREG(st.st_mode);
+            client_update_watch(c);
+            return c;
+        }
+    }
+    return NULL;
+}
+
+// Replies still on their way to a closed client are dropped when they
+// arrive: the slot's generation no longer matches their tag.
+static void client_close(Client *c) {
+    evloop_unwatch_fd(c->in_fd);
+    if (c->out_fd != c->in_fd) {
+        evloop_unwatch_fd(c->out_fd);
+    }
+    if (!stdio_mode) {
+        close(c->in_fd);
+    }
+    free(c->in_buf);
+    free(c->out_buf);
+    free(c->msg_buf);
+    client_drop_pending(c, c->pending);
+    unsigned int gen = c->gen;
+    memset(c, 0, sizeof(*c));
+    c->gen = gen;
+}
+
+static bool client_done(const Client *c) {
+    return c->eof && c->pending == 0 && c->out_len == c->out_off;
+}
+
+static void client_finish_if_done(Client *c) {
+    if (!client_done(c)) {
+        return;
+    }
+    if (stdio_mode) {
+        quit = true;
+    }
+    client_close(c);
+}
+
+// Writes as much of the backlog as the fd takes right now.
+static void client_flush(Client *c) {
+    while (c->out_off < c->out_len) {
+        ssize_t n = write(c->out_fd, c->out_buf + c->out_off, c->out_len - c->out_off);
+        if (n > 0) {
+            c->out_off += (size_t)n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        // The reader went away; nothing more can be delivered.
+        c->eof = true;
+        client_drop_pending(c, c->pending);
+        c->out_off = c->out_len;
+        break;
+    }
+    if (c->out_off == c->out_len) {
+        c->out_off = c->out_len = 0;
+    }
+    client_update_watch(c);
+}
+
+static void client_update_pause(Client *c) {
+    c->paused = c->out_len - c->out_off > HEADLESS_OUT_HIGH_WATER || c->pending >= HEADLESS_MAX_PENDING ||
+                inflight >= HEADLESS_MAX_INFLIGHT;
+}
+
+static void client_send(Client *c, bool event, const char *name, size_t name_len, const char *json, size_t len) {
+    if (c->ws) {
+        size_t body = 2 + name_len + 1 + len;
+        if (!grow(&c->out_buf, &c->out_cap, c->out_len + WS_MAX_HEADER + body)) {
+            fprintf(stderr, "headless: out of memory, dropping reply for %.*s\n", (int)name_len, name);
+            return;
+        }
+        char *cursor = c->out_buf + c->out_len;
+        cursor += ws_frame_header((unsigned char *)cursor, WS_OP_BINARY, body);
+        *cursor++ = event ? '1' : '0';
+        *cursor++ = HEADLESS_SEP;
+        memcpy(cursor, name, name_len);
+        cursor += name_len;
+        *cursor++ = HEADLESS_SEP;
+        memcpy(cursor, json, len);
+        c->out_len = (size_t)(cursor + len - c->out_buf);
+        return;
+    }
+    size_t needed = c->out_len + 2 + name_len + 1 + codec_base64_encoded_len(len, CODEC_BASE64) + 1;
+    if (!grow(&c->out_buf, &c->out_cap, needed)) {
+        fprintf(stderr, "headless: out of memory, dropping reply for %.*s\n", (int)name_len, name);
+        return;
+    }
+    char *cursor = c->out_buf + c->out_len;
+    *cursor++ = event ? '1' : '0';
+    *cursor++ = HEADLESS_SEP;
+    memcpy(cursor, name, name_len);
+    cursor += name_len;
+    *cursor++ = HEADLESS_SEP;
+    cursor += codec_base64_encode(json, len, cursor, CODEC_BASE64);
+    *cursor++ = '\n';
+    c->out_len = (size_t)(cursor - c->out_buf);
+}
+
+static void client_send_raw(Client *c, const void *data, size_t len) {
+    if (!grow(&c->out_buf, &c->out_cap, c->out_len + len)) {
+        return;
+    }
+    memcpy(c->out_buf + c->out_len, data, len);
+    c->out_len += len;
+}
+
+static int client_tag(const Client *c, char *out, size_t cap) {
+    return snprintf(out, cap, "%d.%u/", (int)(c - clients), c->gen);
+}
+
+// Hands a request whose fields are already split to the IPC queue under the
+// client's tag. A "__cancel" names the request it cancels by the client's
+// own id, so its payload gets the same tag. Returns false if the header is
+// malformed; anything accepted is answered and counts as pending.
+static bool client_submit(Client *c, const char *id, size_t id_len, const char *cmd, size_t cmd_len,
+                          const char *payload, size_t payload_len, const void *data, size_t data_len) {
+    char tagged[IPC_MAX_ID_LEN];
+    int tag_len = client_tag(c, tagged, sizeof(tagged));
+    const char *at = memchr(id, '@', id_len);
+    unsigned long timeout_ms = 0;
+    if (at != NULL) {
+        char digits[24];
+        size_t digits_len = id_len - (size_t)(at + 1 - id);
+        if (digits_len >= sizeof(digits)) {
+            return false;
+        }
+        memcpy(digits, at + 1, digits_len);
+        digits[digits_len] = '\0';
+        timeout_ms = strtoul(digits, NULL, 10);
+        id_len = (size_t)(at - id);
+    }
+    if (id_len == 0 || (size_t)tag_len + id_len >= IPC_MAX_ID_LEN || memchr(id, '\0', id_len) != NULL ||
+        cmd_len == 0 || cmd_len >= IPC_MAX_CMD_LEN) {
+        return false;
+    }
+    memcpy(tagged + tag_len, id, id_len);
+
+    char target[IPC_MAX_ID_LEN];
+    if (cmd_len == 8 && memcmp(cmd, "__cancel", 8) == 0 && (size_t)tag_len + payload_len < sizeof(target)) {
+        memcpy(target, tagged, (size_t)tag_len);
+        memcpy(target + tag_len, payload, payload_len);
+        payload = target;
+        payload_len += (size_t)tag_len;
+    }
+    client_add_pending(c);
+    ipc_handle_message(tagged, (size_t)tag_len + id_len, cmd, cmd_len, payload, payload_len,
+                       data, data_len, timeout_ms);
+    return true;
+}
+
+// Validates the framing the way ipc_handle_js_message() does, so every line
+// passed on is guaranteed an answer and can be counted as pending.
+static bool client_handle_line(Client *c, const char *line, size_t len) {
+    const char *first = memchr(line, HEADLESS_SEP, len);
+    const char *second = first ? memchr(first + 1, HEADLESS_SEP, len - (size_t)(first + 1 - line)) : NULL;
+    if (second == NULL || memchr(line, '\0', len) != NULL) {
+        return false;
+    }
+    size_t cmd_len = (size_t)(second - first - 1);
+    if (first == line || cmd_len == 0 || cmd_len >= IPC_MAX_CMD_LEN) {
+        return false;
+    }
+    if (cmd_len == 8 && memcmp(first + 1, "__cancel", 8) == 0) {
+        char target[IPC_MAX_ID_LEN];
+        size_t target_len = 0;
+        size_t encoded_len = len - (size_t)(second + 1 - line);
+        if (codec_base64_decoded_cap(encoded_len) > sizeof(target) ||
+            !codec_base64_decode(second + 1, encoded_len, target, sizeof(target), &target_len, CODEC_BASE64)) {
+            return false;
+        }
+        return client_submit(c, line, (size_t)(first - line), first + 1, cmd_len, target, target_len, NULL, 0);
+    }
+
+    char tag[32];
+    int tag_len = client_tag(c, tag, sizeof(tag));
+    size_t id_len = (size_t)(first - line);
+    if ((size_t)tag_len + id_len >= IPC_MAX_ID_LEN || line[0] == '@') {
+        return false;
+    }
+    if (!grow(&frame_buf, &frame_cap, (size_t)tag_len + len + 1)) {
+        return false;
+    }
+    memcpy(frame_buf, tag, (size_t)tag_len);
+    memcpy(frame_buf + tag_len, line, len);
+    frame_buf[(size_t)tag_len + len] = '\0';
+    client_add_pending(c);
+    ipc_handle_js_message(frame_buf);
+    return true;
+}
+
+// Hands over complete lines until the client has to wait for replies; the
+// rest stays buffered.
+static void client_process_lines(Client *c) {
+    size_t start = 0;
+    size_t scan = c->in_scanned;
+    char *nl;
+    client_update_pause(c);
+    while (!c->paused && scan < c->in_len && (nl = memchr(c->in_buf + scan, '\n', c->in_len - scan)) != NULL) {
+        size_t end = (size_t)(nl - c->in_buf);
+        size_t line_len = end - start;
+        if (line_len > 0 && c->in_buf[end - 1] == '\r') {
+            line_len--;
+        }
+        if (line_len > 0 && !client_handle_line(c, c->in_buf + start, line_len)) {
+            fprintf(stderr, "headless: dropped malformed request\n");
+        }
+        start = scan = end + 1;
+        client_update_pause(c);
+    }
+    if (start > 0) {
+        memmove(c->in_buf, c->in_buf + start, c->in_len - start);
+        c->in_len -= start;
+    }
+    // Stopped early, the rest has not been looked at; otherwise a long line
+    // is not scanned again from its start on every read.
+    c->in_scanned = c->paused ? 0 : c->in_len;
+}
+
+// ============================================================================
+// WebSocket clients
+// ============================================================================
+
+// Browsers send an Origin with every WebSocket. Only pages served from this
+// machine (the Vite dev server) or from --ws-origin get in, so an arbitrary
+// website cannot drive the plugins. Clients without one (scripts, load
+// generators) already run locally and are let in too.
+static bool origin_allowed(const char *origin, size_t len) {
+    if (origin == NULL) {
+        return true;
+    }
+    if (ws_origin != NULL && strlen(ws_origin) == len && memcmp(ws_origin, origin, len) == 0) {
+        return true;
+    }
+    const char *host;
+    if (len > 7 && memcmp(origin, "http://", 7) == 0) {
+        host = origin + 7;
+    } else if (len > 8 && memcmp(origin, "https://", 8) == 0) {
+        host = origin + 8;
+    } else {
+        return false;
+    }
+    size_t host_len = len - (size_t)(host - origin);
+    const char *port = host[0] == '[' ? memchr(host, ']', host_len) : host;
+    port = port ? memchr(port, ':', host_len - (size_t)(port - host)) : NULL;
+    if (port != NULL) {
+        host_len = (size_t)(port - host);
+    }
+#define HOST_IS(name) (host_len == sizeof(name) - 1 && memcmp(host, name, host_len) == 0)
+    return HOST_IS("localhost") || HOST_IS("127.0.0.1") || HOST_IS("[::1]");
+#undef HOST_IS
+}
+
+static void client_ws_handshake(Client *c, const char *head, size_t len) {
+    WsUpgrade upgrade;
+    if (!ws_parse_upgrade(head, len, &upgrade)) {
+        static const char reply[] = "HTTP/1.1 400 Bad Request\r\nConnection: close\r\nContent-Length: 0\r\n\r\n";
+        client_send_raw(c, reply, sizeof(reply) - 1);
+        c->eof = true;
+        return;
+    }
+    if (!origin_allowed(upgrade.origin, upgrade.origin_len)) {
+        static const char reply[] = "HTTP/1.1 403 Forbidden\r\nConnection: close\r\nContent-Length: 0\r\n\r\n";
+        fprintf(stderr, "headless: refusing WebSocket from origin %.*s\n", (int)upgrade.origin_len, upgrade.origin);
+        client_send_raw(c, reply, sizeof(reply) - 1);
+        c->eof = true;
+        return;
+    }
+    char accept_key[WS_ACCEPT_LEN + 1];
+    ws_accept_key(upgrade.key, upgrade.key_len, accept_key);
+    char reply[160];
+    int reply_len = snprintf(reply, sizeof(reply),
+                             "HTTP/1.1 101 Switching Protocols\r\n"
+                             "Upgrade: websocket\r\n"
+                             "Connection: Upgrade\r\n"
+                             "Sec-WebSocket-Accept: %s\r\n\r\n",
+                             accept_key);
+    client_send_raw(c, reply, (size_t)reply_len);
+    c->ws_open = true;
+}
+
+static void client_ws_control(Client *c, int opcode, const void *data, size_t len) {
+    unsigned char header[WS_MAX_HEADER];
+    client_send_raw(c, header, ws_frame_header(header, opcode, len));
+    client_send_raw(c, data, len);
+}
+
+// Sends a close frame and stops reading. Replies still due are dropped.
+static void client_ws_close(Client *c, unsigned int code) {
+    unsigned char status[2] = { (unsigned char)(code >> 8), (unsigned char)code };
+    client_ws_control(c, WS_OP_CLOSE, status, sizeof(status));
+    c->eof = true;
+    client_drop_pending(c, c->pending);
+}
+
+static bool client_ws_binary(Client *c, const char *msg, size_t len) {
+    const char *end = msg + len;
+    const char *fields[4];
+    size_t count = len > 2 && (msg[0] == '0' || msg[0] == '2') && msg[1] == HEADLESS_SEP ? 1 : 0;
+    size_t wanted = count && msg[0] == '2' ? 4 : 3;
+    if (count == 0) {
+        return false;
+    }
+    fields[0] = msg + 2;
+    while (count < wanted) {
+        const char *sep = memchr(fields[count - 1], HEADLESS_SEP, (size_t)(end - fields[count - 1]));
+        if (sep == NULL) {
+            return false;
+        }
+        fields[count++] = sep + 1;
+    }
+    const char *id = fields[0];
+    size_t id_len = (size_t)(fields[1] - 1 - id);
+    const char *cmd = fields[1];
+    size_t cmd_len = (size_t)(fields[2] - 1 - cmd);
+    if (wanted == 3) {
+        return client_submit(c, id, id_len, cmd, cmd_len, fields[2], (size_t)(end - fields[2]), NULL, 0);
+    }
+    char *digits_end;
+    unsigned long payload_len = strtoul(fields[2], &digits_end, 10);
+    if (digits_end != fields[3] - 1 || payload_len > (size_t)(end - fields[3])) {
+        return false;
+    }
+    const char *payload = fields[3];
+    const char *data = payload + payload_len;
+    return client_submit(c, id, id_len, cmd, cmd_len, payload, payload_len, data, (size_t)(end - data));
+}
+
+static void client_ws_message(Client *c, int opcode, char *msg, size_t len) {
+    bool ok;
+    if (opcode == WS_OP_TEXT) {
+        if (len > 0 && msg[len - 1] == '\n') {
+            len--;
+        }
+        ok = client_handle_line(c, msg, len);
+    } else {
+        ok = client_ws_binary(c, msg, len);
+    }
+    if (!ok) {
+        fprintf(stderr, "headless: dropped malformed request\n");
+    }
+}
+
+static bool client_ws_frame(Client *c, const WsFrame *frame, char *payload, size_t len) {
+    switch (frame->opcode) {
+    case WS_OP_PING:
+        client_ws_control(c, WS_OP_PONG, payload, len);
+        return true;
+    case WS_OP_PONG:
+        return true;
+    case WS_OP_CLOSE:
+        client_ws_close(c, len >= 2 ? ((unsigned char)payload[0] << 8 | (unsigned char)payload[1]) : 1000);
+        return true;
+    case WS_OP_CONTINUATION:
+        if (c->msg_opcode == 0) {
+            return false;
+        }
+        break;
+    default:
+        if (c->msg_opcode != 0) {
+            return false;
+        }
+        if (frame->fin) {
+            client_ws_message(c, frame->opcode, payload, len);
+            return true;
+        }
+        c->msg_opcode = frame->opcode;
+        break;
+    }
+    if (c->msg_len + len > HEADLESS_WS_MAX_MESSAGE || !grow(&c->msg_buf, &c->msg_cap, c->msg_len + len)) {
+        return false;
+    }
+    memcpy(c->msg_buf + c->msg_len, payload, len);
+    c->msg_len += len;
+    if (frame->fin) {
+        client_ws_message(c, c->msg_opcode, c->msg_buf, c->msg_len);
+        c->msg_opcode = 0;
+        c->msg_len = 0;
+    }
+    return true;
+}
+
+// Same contract as client_process_lines(), one frame at a time. Frames are
+// unmasked in place once they are complete.
+static void client_process_ws(Client *c) {
+    size_t start = 0;
+    client_update_pause(c);
+    while (!c->paused && !c->eof && start < c->in_len) {
+        unsigned char *p = (unsigned char *)c->in_buf + start;
+        size_t avail = c->in_len - start;
+        if (!c->ws_open) {
+            size_t head_len = ws_request_head_len((const char *)p, avail);
+            if (head_len == 0) {
+                if (avail > HEADLESS_WS_MAX_HEAD) {
+                    c->eof = true;
+                }
+                break;
+            }
+            client_ws_handshake(c, (const char *)p, head_len);
+            start += head_len;
+            continue;
+        }
+        WsFrame frame;
+        int parsed = ws_parse_frame_header(p, avail, &frame);
+        if (parsed < 0 || (parsed > 0 && !frame.masked)) {
+            client_ws_close(c, 1002);
+            break;
+        }
+        if (parsed > 0 && frame.payload_len > HEADLESS_WS_MAX_MESSAGE) {
+            client_ws_close(c, 1009);
+            break;
+        }
+        if (parsed == 0 || avail - frame.header_len < frame.payload_len) {
+            break;
+        }
+        char *payload = (char *)p + frame.header_len;
+        size_t len = (size_t)frame.payload_len;
+        ws_unmask((unsigned char *)payload, len, frame.mask, 0);
+        start += frame.header_len + len;
+        if (!client_ws_frame(c, &frame, payload, len)) {
+            client_ws_close(c, 1002);
+            break;
+        }
+        client_update_pause(c);
+    }
+    if (c->eof) {
+        start = c->in_len;
+    }
+    if (start > 0) {
+        memmove(c->in_buf, c->in_buf + start, c->in_len - start);
+        c->in_len -= start;
+    }
+}
+
+static void client_process(Client *c) {
+    if (c->ws) {
+        client_process_ws(c);
+    } else {
+        client_process_lines(c);
+    }
+}
+
+static void client_read(Client *c) {
+    client_process(c);
+    while (!c->eof && !c->paused) {
+        if (c->in_len > HEADLESS_MAX_LINE) {
+            fprintf(stderr, "headless: request line too long, closing client\n");
+            c->eof = true;
+            c->in_len = c->in_scanned = 0;
+            break;
+        }
+        if (!grow(&c->in_buf, &c->in_cap, c->in_len + HEADLESS_READ_CHUNK)) {
+            fprintf(stderr, "headless: out of memory reading a request\n");
+            c->eof = true;
+            break;
+        }
+        ssize_t n = read(c->in_fd, c->in_buf + c->in_len, HEADLESS_READ_CHUNK);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        if (n <= 0) {
+            c->eof = true;   // a final line without '\n' is dropped
+            break;
+        }
+        c->in_len += (size_t)n;
+        client_process(c);
+    }
+    client_update_watch(c);
+}
+
+static void client_fd_ready(int fd, unsigned int revents, void *arg) {
+    Client *c = (Client *)arg;
+    if ((revents & EVLOOP_WRITE) && fd == c->out_fd) {
+        client_flush(c);
+        if (c->paused && !c->eof) {
+            client_read(c);
+        }
+    }
+    if ((revents & (EVLOOP_READ | EVLOOP_ERROR)) && fd == c->in_fd && !c->eof) {
+        client_read(c);
+    } else if ((revents & EVLOOP_ERROR) && fd == c->out_fd && c->out_off < c->out_len) {
+        c->eof = true;
+        client_drop_pending(c, c->pending);
+        c->out_off = c->out_len = 0;
+    }
+    client_finish_if_done(c);
+}
+
+// Hands room in the in-flight budget to paused clients one at a time,
+// starting after the last one served, so a client with thousands of requests
+// queued cannot starve the others. Resumed clients carry on with what they
+// have buffered before reading more.
+static void resume_clients(void) {
+    for (int n = 0; n < HEADLESS_MAX_CLIENTS && inflight < HEADLESS_MAX_INFLIGHT; ++n) {
+        Client *c = &clients[resume_next];
+        resume_next = (resume_next + 1) % HEADLESS_MAX_CLIENTS;
+        if (c->used && c->paused && !c->eof) {
+            client_read(c);
+            client_finish_if_done(c);
+        }
+    }
+}
+
+// Parses the "slot.gen/" tag client_handle_line() put in front of an id.
+static Client *client_for_id(const char *id, const char **rest) {
+    char *end;
+    unsigned long slot = strtoul(id, &end, 10);
+    if (end == id || *end != '.' || slot >= HEADLESS_MAX_CLIENTS) {
+        return NULL;
+    }
+    unsigned long gen = strtoul(end + 1, &end, 10);
+    if (*end != '/') {
+        return NULL;
+    }
+    Client *c = &clients[slot];
+    if (!c->used || c->gen != gen) {
+        return NULL;
+    }
+    *rest = end + 1;
+    return c;
+}
+
+static void deliver(bool event, const char *name, const char *json, size_t len, void *arg) {
+    (void)arg;
+    if (event) {
+        size_t name_len = strlen(name);
+        for (int i = 0; i < HEADLESS_MAX_CLIENTS; ++i) {
+            Client *c = &clients[i];
+            if (c->used && (!c->ws || c->ws_open)) {
+                client_send(c, true, name, name_len, json, len);
+                client_flush(c);
+            }
+        }
+        return;
+    }
+    const char *id;
+    Client *c = client_for_id(name, &id);
+    if (c == NULL) {
+        return;
+    }
+    client_send(c, false, id, strlen(id), json, len);
+    if (c->pending > 0) {
+        client_drop_pending(c, 1);
+    }
+    client_flush(c);
+    client_finish_if_done(c);
+    resume_clients();
+}
+
+// ============================================================================
+// Listening socket
+// ============================================================================
+
+static void accept_clients(int fd, unsigned int revents, void *arg) {
+    (void)revents;
+    (void)arg;
+    bool ws = fd == ws_listen_fd;
+    for (;;) {
+        int conn = accept(fd, NULL, NULL);
+        if (conn < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                fprintf(stderr, "headless: accept failed: %s\n", strerror(errno));
+            }
+            return;
+        }
+        fcntl(conn, F_SETFD, FD_CLOEXEC);
+        Client *c = set_nonblocking(conn) ? client_open(conn, conn) : NULL;
+        if (c == NULL) {
+            fprintf(stderr, "headless: refusing client, %d already connected\n", HEADLESS_MAX_CLIENTS);
+            close(conn);
+            continue;
+        }
+        if (ws) {
+            // Replies are small and latency is what a page notices.
+            int one = 1;
+            setsockopt(conn, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            c->ws = true;
+        }
+    }
+}
+
+static bool listen_on(const char *path) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "headless: socket path too long: %s\n", path);
+        return false;
+    }
+    strcpy(addr.sun_path, path);
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        fprintf(stderr, "headless: socket failed: %s\n", strerror(errno));
+        return false;
+    }
+    fcntl(listen_fd, F_SETFD, FD_CLOEXEC);
+    unlink(path);
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listen_fd, 128) != 0 ||
+        !set_nonblocking(listen_fd)) {
+        fprintf(stderr, "headless: cannot listen on %s: %s\n", path, strerror(errno));
+        close(listen_fd);
+        listen_fd = -1;
+        return false;
+    }
+    socket_path = path;
+    return evloop_watch_fd(listen_fd, EVLOOP_READ, accept_clients, NULL);
+}
+
+// Loopback only: this is a development endpoint, not a server.
+static bool listen_ws(int port) {
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons((unsigned short)port),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    ws_listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (ws_listen_fd < 0) {
+        fprintf(stderr, "headless: socket failed: %s\n", strerror(errno));
+        return false;
+    }
+    int one = 1;
+    fcntl(ws_listen_fd, F_SETFD, FD_CLOEXEC);
+    setsockopt(ws_listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(ws_listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(ws_listen_fd, 128) != 0 ||
+        !set_nonblocking(ws_listen_fd)) {
+        fprintf(stderr, "headless: cannot listen on 127.0.0.1:%d: %s\n", port, strerror(errno));
+        close(ws_listen_fd);
+        ws_listen_fd = -1;
+        return false;
+    }
+    return evloop_watch_fd(ws_listen_fd, EVLOOP_READ, accept_clients, NULL);
+}
+
+static void on_signal(int sig) {
+    (void)sig;
+    quit = true;
+    evloop_wake();
+}
+
+static void usage(const char *program) {
+    fprintf(stderr,
+            "Usage: %s [--socket PATH] [--ws PORT [--ws-origin ORIGIN]]\n"
+            "Runs the plugins without a webview. Requests are read one per line as\n"
+            "id<RS>cmd<RS>base64(payload), from stdin or from each client of the Unix\n"
+            "socket at PATH; replies are written as 0<RS>id<RS>base64(json) and events\n"
+            "as 1<RS>name<RS>base64(json).\n"
+            "--ws also serves pages on 127.0.0.1:PORT over WebSocket. Pages from\n"
+            "localhost are allowed, plus ORIGIN (e.g. http://192.168.1.5:5173).\n",
+            program);
+}
+
+int main(int argc, char **argv) {
+    const char *path = NULL;
+    int ws_port = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc) {
+            path = argv[++i];
+        } else if (strcmp(argv[i], "--ws") == 0 && i + 1 < argc) {
+            ws_port = atoi(argv[++i]);
+            if (ws_port <= 0 || ws_port > 65535) {
+                fprintf(stderr, "headless: invalid port %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--ws-origin") == 0 && i + 1 < argc) {
+            ws_origin = argv[++i];
+        } else {
+            usage(argv[0]);
+            return strcmp(argv[i], "--help") == 0 ? 0 : 1;
+        }
+    }
+
+    struct sigaction act = {0};
+    act.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &act, NULL);
+    act.sa_handler = on_signal;
+    sigaction(SIGINT, &act, NULL);
+    sigaction(SIGTERM, &act, NULL);
+
+    // Plugins log with printf; in stdio mode that must not end up in the
+    // reply stream, so replies get their own copy of stdout and plain stdout
+    // goes to stderr.
+    int out_fd = -1;
+    if (path == NULL && ws_port == 0) {
+        out_fd = dup(STDOUT_FILENO);
+        if (out_fd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0 ||
+            !set_nonblocking(STDIN_FILENO) || !set_nonblocking(out_fd)) {
+            fprintf(stderr, "headless: cannot set up stdio\n");
+            return 1;
+        }
+    }
+
+    // Workers wake the loop as soon as requests are dispatched; with stdin
+    // a regular file nothing else would set it up before the first wake.
+    if (!evloop_init()) {
+        return 1;
+    }
+    ipc_init(NULL);
+    ipc_set_deliver(deliver, NULL);
+    ipc_set_wakeup(wake_loop, NULL);
+    plug_set_host_emit_event(host_emit_event);
+    plug_set_host_complete(complete_request);
+    plug_init(NULL);
+
+    if (path != NULL) {
+        if (!listen_on(path)) {
+            return 1;
+        }
+        fprintf(stderr, "headless: listening on %s\n", path);
+    }
+    if (ws_port != 0) {
+        if (!listen_ws(ws_port)) {
+            return 1;
+        }
+        fprintf(stderr, "headless: listening on ws://127.0.0.1:%d/\n", ws_port);
+    }
+    if (path == NULL && ws_port == 0) {
+        stdio_mode = true;
+        client_open(STDIN_FILENO, out_fd);
+    }
+
+    while (!quit) {
+        Client *in = &clients[0];
+        if (stdio_mode && in->used && !in->in_pollable && !in->eof && !in->paused) {
+            client_read(in);
+            client_finish_if_done(in);
+            continue;
+        }
+        process_ipc_queue();
+        plug_poll(NULL, ipc_flush_timeout_ms());
+        ipc_drain_outbox();
+        resume_clients();   // room freed by clients that went away
+    }
+
+    for (int i = 0; i < HEADLESS_MAX_CLIENTS; ++i) {
+        if (clients[i].used) {
+            client_close(&clients[i]);
+        }
+    }
+    if (listen_fd >= 0) {
+        evloop_unwatch_fd(listen_fd);
+        close(listen_fd);
+        unlink(socket_path);
+    }
+    if (ws_listen_fd >= 0) {
+        evloop_unwatch_fd(ws_listen_fd);
+        close(ws_listen_fd);
+    }
+    plug_cleanup(NULL);
+    ipc_set_wakeup(NULL, NULL);
+    ipc_set_deliver(NULL, NULL);
+    ipc_deinit();
+    free(frame_buf);
+    return 0;
+}
@@ -1,11 +1,16 @@
 
 #include "ipc.h"
+#include "codec.h"
 
+#include <limits.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "sync.h"
+
 #ifdef _WIN32
 #ifndef CROSSWEB_BUILDING_PLUG
 #include "./thirdparty/webview-c/webview.h"
@@ -16,98 +21,528 @@
 extern void android_response(const char *id, const char *response_json);
 #endif
 
-#define IPC_QUEUE_CAP 64
+// Admission limits: all lanes together, and any single plugin's lane.
+#define IPC_QUEUE_CAP 256
+#define IPC_LANE_CAP 64
+#define IPC_MAX_LANES 64
+#define IPC_MAX_POLICIES 64
+#define IPC_LANE_NAME_CAP 32
+#define IPC_BUSY_RETRY_MS 50
+#define IPC_STARVATION_MS 1000
 #define IPC_SEPARATOR '\x1e'
 
-static IpcMessage queue[IPC_QUEUE_CAP];
-static int queue_head = 0;
-static int queue_tail = 0;
+// Framing v2 (see "Framed messages" below).
+#define IPC_FRAME_V2_MARK '\x1f'
+#define IPC_FRAME_V2_HEADER 32
+#define IPC_FRAME_DEFINE 1
+#define IPC_FRAME_BYTES 2
+#define IPC_MAX_COMMAND_IDS 0x1000
+#define IPC_NUMERIC_ID_MARK '#'
+
+// Message slots come from per-size-class slabs so the common case (small
+// id/cmd/payload) is a free-list pop instead of a malloc, and a request is
+// decoded exactly once, straight into the slot it is dispatched from.
+// Anything larger than the biggest class is a dedicated allocation.
+#define IPC_SLAB_CLASSES 4
+#define IPC_SLAB_SLOTS_PER_BLOCK 16
+
+static const size_t slab_class_sizes[IPC_SLAB_CLASSES] = { 512, 2048, 8192, 32768 };
+
+typedef struct IpcSlabBlock {
+    struct IpcSlabBlock *next;
+} IpcSlabBlock;
+
+static IpcMessage *slab_free[IPC_SLAB_CLASSES];
+static IpcSlabBlock *slab_blocks = NULL;
+
+typedef struct IpcFifo {
+    IpcMessage *head;
+    IpcMessage *tail;
+} IpcFifo;
+
+// One lane per plugin (the command prefix before '.') and window; lane 0 is
+// shared by anything that does not get a lane of its own. A lane holds its
+// name only while requests wait in it: empty lanes are handed to the next
+// name that needs one, so made-up plugin names cannot use them all up.
+typedef struct IpcLane {
+    char name[IPC_LANE_NAME_CAP];
+    size_t name_len;
+    int window;
+    IpcFifo fifo[IPC_PRIORITY_COUNT];
+    int count;
+} IpcLane;
+
+typedef struct IpcPolicyState {
+    IpcCommandPolicy policy;   // cmd is owned
+    double tokens;
+    unsigned long long refill_ms;
+    unsigned int queued;
+    unsigned int in_flight;
+} IpcPolicyState;
+
+static IpcLane lanes[IPC_MAX_LANES] = { { .name = "*", .name_len = 1 } };
+static int lane_count = 1;
+static int rr_cursor[IPC_PRIORITY_COUNT];
 static int queue_count = 0;
+static IpcPolicyState policies[IPC_MAX_POLICIES];
+static int policy_count = 0;
 static webview_t active_webview = NULL;
+static IpcSchemeFinish scheme_finish = NULL;
+static IpcDeliverFn deliver_fn = NULL;
+static void *deliver_arg = NULL;
+static unsigned int scheme_request_seq = 0;
+static int framing_version = 2;
+
+// Only the UI thread (the one that called ipc_init) may touch the queue and
+// the slab; requests completed elsewhere are handed back through the outbox.
+static SYNC_THREAD_LOCAL bool ipc_on_ui_thread = false;
+
+// A command name interned by the page under a framing v2 command id.
+typedef struct IpcCommandName {
+    size_t len;
+    char name[];
+} IpcCommandName;
+
+// A page sharing the runtime. Slot 0 is window 0, which is always open; the
+// others are handed out by ipc_window_open() under a handle that also counts
+// how often slots were reused, so a late reply for a closed window never
+// reaches the next one in its slot.
+typedef struct IpcWindow {
+    bool open;
+    int handle;                    // slot + IPC_MAX_WINDOWS * reuse count
+    IpcEvalFn eval;
+    void *eval_arg;
+    int queued;                    // requests waiting in the queue
+    char *batch_buf;               // see "Batched dispatch" below
+    size_t batch_len;
+    size_t batch_cap;
+    size_t batch_count;
+    unsigned long long batch_started_ms;
+    IpcCommandName **commands;     // by the page's v2 command id
+    unsigned long command_cap;
+} IpcWindow;
+
+static IpcWindow windows[IPC_MAX_WINDOWS] = { { .open = true } };
+static int window_reuse = 0;
+
+static IpcWindow *ipc_window_get(int handle) {
+    if (handle < 0) {
+        return NULL;
+    }
+    IpcWindow *w = &windows[handle % IPC_MAX_WINDOWS];
+    return w->open && w->handle == handle ? w : NULL;
+}
+
+// Writes the id prefix for `handle` (nothing for window 0) and returns its length.
+static size_t ipc_window_tag(int handle, char *out, size_t cap) {
+    if (handle == 0) {
+        out[0] = '\0';
+        return 0;
+    }
+    int len = snprintf(out, cap, "%d%c", handle, PLUG_ORIGIN_SEP);
+    return len > 0 && (size_t)len < cap ? (size_t)len : 0;
+}
+
+static size_t ipc_origin_len(const char *id) {
+    const char *sep = strchr(id, PLUG_ORIGIN_SEP);
+    return sep ? (size_t)(sep - id) + 1 : 0;
+}
+
+// Ids chosen by a page must leave room for the prefix and must not forge one,
+// nor pass for the numeric ids of framing v2.
+static bool ipc_page_id_ok(const char *id, size_t id_len, size_t tag_len) {
+    return id_len > 0 && tag_len + id_len < IPC_MAX_ID_LEN && id[0] != IPC_NUMERIC_ID_MARK &&
+           memchr(id, PLUG_ORIGIN_SEP, id_len) == NULL && memchr(id, '\0', id_len) == NULL;
+}
+
+static IpcMessage *ipc_slot_alloc(size_t size) {
+    for (int c = 0; c < IPC_SLAB_CLASSES; ++c) {
+        size_t class_size = slab_class_sizes[c];
+        if (size > class_size) {
+            continue;
+        }
+        if (slab_free[c] == NULL) {
+            // Carve a fresh block into slots of this class. The block header is
+            // padded to the slot alignment so every slot stays aligned.
+            size_t header = (sizeof(IpcSlabBlock) + sizeof(max_align_t) - 1) & ~(sizeof(max_align_t) - 1);
+            char *block = (char *)malloc(header + class_size * IPC_SLAB_SLOTS_PER_BLOCK);
+            if (block == NULL) {
+                return NULL;
+            }
+            ((IpcSlabBlock *)block)->next = slab_blocks;
+            slab_blocks = (IpcSlabBlock *)block;
+            for (int i = IPC_SLAB_SLOTS_PER_BLOCK - 1; i >= 0; --i) {
+                IpcMessage *slot = (IpcMessage *)(block + header + class_size * (size_t)i);
+                slot->next = slab_free[c];
+                slab_free[c] = slot;
+            }
+        }
+        IpcMessage *slot = slab_free[c];
+        slab_free[c] = slot->next;
+        slot->slot_size = class_size;
+        return slot;
+    }
+    IpcMessage *slot = (IpcMessage *)malloc(size);
+    if (slot != NULL) {
+        slot->slot_size = size;
+    }
+    return slot;
+}
+
+static void ipc_slot_free(IpcMessage *slot) {
+    for (int c = 0; c < IPC_SLAB_CLASSES; ++c) {
+        if (slot->slot_size == slab_class_sizes[c]) {
+            slot->next = slab_free[c];
+            slab_free[c] = slot;
+            return;
+        }
+    }
+    free(slot);
+}
 
 static void ipc_queue_clear(void) {
-    queue_head = 0;
-    queue_tail = 0;
+    for (int l = 0; l < lane_count; ++l) {
+        for (int c = 0; c < IPC_PRIORITY_COUNT; ++c) {
+            IpcFifo *fifo = &lanes[l].fifo[c];
+            while (fifo->head != NULL) {
+                IpcMessage *msg = fifo->head;
+                fifo->head = msg->next;
+                if (msg->reply_ctx != NULL && scheme_finish != NULL) {
+                    scheme_finish(msg->reply_ctx, NULL, NULL, 0, NULL);
+                }
+                ipc_slot_free(msg);
+            }
+            fifo->tail = NULL;
+        }
+        lanes[l].count = 0;
+    }
+    for (int i = 0; i < policy_count; ++i) {
+        policies[i].queued = 0;
+    }
+    for (int w = 0; w < IPC_MAX_WINDOWS; ++w) {
+        windows[w].queued = 0;
+    }
     queue_count = 0;
 }
 
-static bool ipc_queue_push(const IpcMessage *msg) {
-    if (queue_count >= IPC_QUEUE_CAP) {
-        return false;
+// ============================================================================
+// Scheduling and admission
+// ============================================================================
+
+static int ipc_lane_for(int window, const char *cmd, size_t cmd_len) {
+    const char *dot = memchr(cmd, '.', cmd_len);
+    size_t name_len = dot ? (size_t)(dot - cmd) : cmd_len;
+    if (name_len == 0 || name_len >= IPC_LANE_NAME_CAP) {
+        return 0;
     }
-    queue[queue_tail] = *msg;
-    queue_tail = (queue_tail + 1) % IPC_QUEUE_CAP;
-    queue_count++;
-    return true;
+    int free_lane = 0;
+    for (int l = 1; l < lane_count; ++l) {
+        if (lanes[l].name_len != 0 && lanes[l].window == window && lanes[l].name_len == name_len &&
+            memcmp(lanes[l].name, cmd, name_len) == 0) {
+            return l;
+        }
+        if (free_lane == 0 && (lanes[l].name_len == 0 || lanes[l].count == 0)) {
+            free_lane = l;
+        }
+    }
+    if (free_lane == 0) {
+        if (lane_count == IPC_MAX_LANES) {
+            return 0;
+        }
+        free_lane = lane_count++;
+    }
+    IpcLane *lane = &lanes[free_lane];
+    memset(lane, 0, sizeof(*lane));
+    memcpy(lane->name, cmd, name_len);
+    lane->name_len = name_len;
+    lane->window = window;
+    return free_lane;
 }
 
-static bool base64_encode(const unsigned char *input, size_t len, char *output, size_t output_cap) {
-    static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
-    size_t needed = ((len + 2) / 3) * 4;
-    if (output_cap < needed + 1) {
-        return false;
+// Exact match wins, then the longest matching prefix.
+static int ipc_policy_for(const char *cmd, size_t cmd_len) {
+    int best = -1;
+    size_t best_len = 0;
+    for (int i = 0; i < policy_count; ++i) {
+        const char *name = policies[i].policy.cmd;
+        size_t len = strlen(name);
+        if (len > 0 && name[len - 1] == '*') {
+            len--;
+            if (len <= cmd_len && memcmp(name, cmd, len) == 0 && (best < 0 || len > best_len)) {
+                best = i;
+                best_len = len;
+            }
+        } else if (len == cmd_len && memcmp(name, cmd, len) == 0) {
+            return i;
+        }
     }
-    size_t j = 0;
-    for (size_t i = 0; i < len; i += 3) {
-        unsigned int octet_a = input[i];
-        unsigned int octet_b = (i + 1) < len ? input[i + 1] : 0;
-        unsigned int octet_c = (i + 2) < len ? input[i + 2] : 0;
-
-        unsigned int triple = (octet_a << 16) | (octet_b << 8) | octet_c;
+    return best;
+}
 
-        output[j++] = table[(triple >> 18) & 0x3F];
-        output[j++] = table[(triple >> 12) & 0x3F];
-        output[j++] = (i + 1) < len ? table[(triple >> 6) & 0x3F] : '=';
-        output[j++] = (i + 2) < len ? table[triple & 0x3F] : '=';
+bool ipc_set_command_policy(const IpcCommandPolicy *policy) {
+    if (policy == NULL || policy->cmd == NULL || policy->cmd[0] == '\0' ||
+        (unsigned)policy->priority >= IPC_PRIORITY_COUNT) {
+        return false;
+    }
+    IpcPolicyState *state = NULL;
+    for (int i = 0; i < policy_count; ++i) {
+        if (strcmp(policies[i].policy.cmd, policy->cmd) == 0) {
+            state = &policies[i];
+            break;
+        }
+    }
+    char *cmd = NULL;
+    if (state == NULL) {
+        if (policy_count == IPC_MAX_POLICIES) {
+            fprintf(stderr, "IPC: too many command policies, ignoring %s\n", policy->cmd);
+            return false;
+        }
+        size_t len = strlen(policy->cmd);
+        cmd = (char *)malloc(len + 1);
+        if (cmd == NULL) {
+            return false;
+        }
+        memcpy(cmd, policy->cmd, len + 1);
+        state = &policies[policy_count++];
+        memset(state, 0, sizeof(*state));
+    } else {
+        cmd = (char *)state->policy.cmd;
     }
-    output[j] = '\0';
+    state->policy = *policy;
+    state->policy.cmd = cmd;
+    state->tokens = policy->max_rate_hz;
+    state->refill_ms = sync_now_ms();
     return true;
 }
 
-static int base64_value(char c) {
-    if (c >= 'A' && c <= 'Z') return c - 'A';
-    if (c >= 'a' && c <= 'z') return c - 'a' + 26;
-    if (c >= '0' && c <= '9') return c - '0' + 52;
-    if (c == '+') return 62;
-    if (c == '/') return 63;
-    if (c == '=') return -2; // padding
-    return -1;
+// Parses CROSSWEB_IPC_POLICY: entries "cmd=class[,rate=N][,concurrent=N][,queued=N]"
+// separated by ';', where class is interactive, normal or bulk.
+static void ipc_load_policies_from_env(void) {
+    const char *spec = getenv("CROSSWEB_IPC_POLICY");
+    while (spec != NULL && *spec) {
+        size_t entry_len = strcspn(spec, ";");
+        char entry[256];
+        if (entry_len > 0 && entry_len < sizeof(entry)) {
+            memcpy(entry, spec, entry_len);
+            entry[entry_len] = '\0';
+            char *eq = strchr(entry, '=');
+            if (eq != NULL) {
+                *eq = '\0';
+                IpcCommandPolicy policy = { .cmd = entry, .priority = IPC_PRIORITY_NORMAL };
+                for (char *opt = strtok(eq + 1, ","); opt != NULL; opt = strtok(NULL, ",")) {
+                    if (strcmp(opt, "interactive") == 0) policy.priority = IPC_PRIORITY_INTERACTIVE;
+                    else if (strcmp(opt, "normal") == 0) policy.priority = IPC_PRIORITY_NORMAL;
+                    else if (strcmp(opt, "bulk") == 0) policy.priority = IPC_PRIORITY_BULK;
+                    else if (strncmp(opt, "rate=", 5) == 0) policy.max_rate_hz = (unsigned int)strtoul(opt + 5, NULL, 10);
+                    else if (strncmp(opt, "concurrent=", 11) == 0) policy.max_concurrent = (unsigned int)strtoul(opt + 11, NULL, 10);
+                    else if (strncmp(opt, "queued=", 7) == 0) policy.max_queued = (unsigned int)strtoul(opt + 7, NULL, 10);
+                    else fprintf(stderr, "CROSSWEB_IPC_POLICY: unknown option '%s'\n", opt);
+                }
+                ipc_set_command_policy(&policy);
+            }
+        }
+        spec += entry_len;
+        if (*spec == ';') {
+            spec++;
+        }
+    }
 }
 
-static bool base64_decode(const char *input, unsigned char *output, size_t output_cap, size_t *written) {
-    int val = 0;
-    int valb = -8;
-    size_t out_len = 0;
-    for (const char *p = input; *p; ++p) {
-        int v = base64_value(*p);
-        if (v == -1) {
-            return false;
+typedef struct IpcAdmission {
+    int window;
+    int lane;
+    int policy;
+    int priority;
+} IpcAdmission;
+
+// A window may fill the queue on its own, but once others are waiting too
+// each gets an equal share, so one page flooding the runtime cannot lock
+// the rest out.
+static bool ipc_window_over_share(int window) {
+    const IpcWindow *self = &windows[window % IPC_MAX_WINDOWS];
+    int waiting = 1;
+    for (int w = 0; w < IPC_MAX_WINDOWS; ++w) {
+        if (&windows[w] != self && windows[w].queued > 0) {
+            waiting++;
         }
-        if (v == -2) {
-            break;
+    }
+    int share = IPC_QUEUE_CAP / waiting;
+    return self->queued >= (share > IPC_LANE_CAP ? share : IPC_LANE_CAP);
+}
+
+// Decides whether a decoded request may be queued. Returns 0 when
+// admitted, otherwise the retry-after hint in milliseconds. Only requests
+// that made it through decoding get here, so malformed ones never use up
+// the rate budget of well-formed ones.
+static int ipc_admit(int window, const char *cmd, size_t cmd_len, IpcAdmission *out) {
+    out->window = window;
+    out->lane = ipc_lane_for(window, cmd, cmd_len);
+    out->policy = ipc_policy_for(cmd, cmd_len);
+    // Runtime builtins (stream credit, cancellation) keep the page responsive.
+    out->priority = (cmd_len >= 2 && cmd[0] == '_' && cmd[1] == '_') ? IPC_PRIORITY_INTERACTIVE : IPC_PRIORITY_NORMAL;
+    if (queue_count >= IPC_QUEUE_CAP || lanes[out->lane].count >= IPC_LANE_CAP || ipc_window_over_share(window)) {
+        return IPC_BUSY_RETRY_MS;
+    }
+    if (out->policy < 0) {
+        return 0;
+    }
+    IpcPolicyState *state = &policies[out->policy];
+    out->priority = state->policy.priority;
+    if (state->policy.max_queued != 0 && state->queued >= state->policy.max_queued) {
+        return IPC_BUSY_RETRY_MS;
+    }
+    unsigned int rate = state->policy.max_rate_hz;
+    if (rate != 0) {
+        // Token bucket holding up to one second's worth of requests.
+        unsigned long long now = sync_now_ms();
+        state->tokens += (double)(now - state->refill_ms) * rate / 1000.0;
+        if (state->tokens > rate) {
+            state->tokens = rate;
         }
-        val = (val << 6) | v;
-        valb += 6;
-        if (valb >= 0) {
-            if (out_len >= output_cap) {
-                return false;
+        state->refill_ms = now;
+        if (state->tokens < 1.0) {
+            int wait = (int)((1.0 - state->tokens) * 1000.0 / rate) + 1;
+            return wait;
+        }
+        state->tokens -= 1.0;
+    }
+    return 0;
+}
+
+static void ipc_busy_json(char *buf, size_t cap, int retry_after_ms) {
+    snprintf(buf, cap, "{\"ok\":false,\"error\":\"busy\",\"busy\":true,\"retryAfterMs\":%d}", retry_after_ms);
+}
+
+// Capacity was reserved by ipc_admit(), so this cannot fail.
+static void ipc_queue_push(IpcMessage *msg, const IpcAdmission *admission) {
+    msg->next = NULL;
+    msg->lane = admission->lane;
+    msg->policy = admission->policy;
+    msg->priority = admission->priority;
+    msg->window = admission->window;
+    msg->dispatched = false;
+    msg->enqueued_ms = sync_now_ms();
+    IpcFifo *fifo = &lanes[msg->lane].fifo[msg->priority];
+    if (fifo->tail != NULL) {
+        fifo->tail->next = msg;
+    } else {
+        fifo->head = msg;
+    }
+    fifo->tail = msg;
+    lanes[msg->lane].count++;
+    windows[msg->window % IPC_MAX_WINDOWS].queued++;
+    queue_count++;
+    if (msg->policy >= 0) {
+        policies[msg->policy].queued++;
+    }
+}
+
+static void ipc_fifo_unlink(IpcFifo *fifo, IpcMessage *prev, IpcMessage *msg) {
+    if (prev != NULL) {
+        prev->next = msg->next;
+    } else {
+        fifo->head = msg->next;
+    }
+    if (fifo->tail == msg) {
+        fifo->tail = prev;
+    }
+    msg->next = NULL;
+}
+
+static void ipc_scheme_fail(void *reply_ctx, const char *error_json);
+
+// Answers a request that will never reach a plugin.
+static void ipc_fail_message(IpcMessage *msg, const char *error_json) {
+    if (msg->reply_ctx != NULL) {
+        ipc_scheme_fail(msg->reply_ctx, error_json);
+    } else {
+        ipc_response(msg->id, error_json);
+    }
+}
+
+static void ipc_dequeued(IpcMessage *msg) {
+    lanes[msg->lane].count--;
+    windows[msg->window % IPC_MAX_WINDOWS].queued--;
+    queue_count--;
+    if (msg->policy >= 0) {
+        policies[msg->policy].queued--;
+    }
+}
+
+// Drops a queued request the page has given up on. Returns false when no
+// request with that id is waiting (it may already be running).
+static bool ipc_queue_cancel(const char *id, size_t id_len) {
+    for (int l = 0; l < lane_count; ++l) {
+        for (int c = 0; c < IPC_PRIORITY_COUNT; ++c) {
+            IpcFifo *fifo = &lanes[l].fifo[c];
+            IpcMessage *prev = NULL;
+            for (IpcMessage *msg = fifo->head; msg != NULL; prev = msg, msg = msg->next) {
+                if (msg->id_len == id_len && memcmp(msg->id, id, id_len) == 0) {
+                    ipc_fifo_unlink(fifo, prev, msg);
+                    ipc_dequeued(msg);
+                    ipc_fail_message(msg, "{\"ok\":false,\"error\":\"cancelled\",\"cancelled\":true}");
+                    ipc_slot_free(msg);
+                    return true;
+                }
             }
-            output[out_len++] = (unsigned char)((val >> valb) & 0xFF);
-            valb -= 8;
         }
     }
-    if (written) {
-        *written = out_len;
+    return false;
+}
+
+static bool ipc_may_dispatch(const IpcMessage *msg) {
+    if (msg->policy < 0) {
+        return true;
     }
-    if (out_len < output_cap) {
-        output[out_len] = '\0';
+    const IpcPolicyState *state = &policies[msg->policy];
+    return state->policy.max_concurrent == 0 || state->in_flight < state->policy.max_concurrent;
+}
+
+// First message in `fifo` that is not held back by its concurrency limit.
+static IpcMessage *ipc_fifo_find(IpcFifo *fifo, IpcMessage **prev_out) {
+    IpcMessage *prev = NULL;
+    for (IpcMessage *msg = fifo->head; msg != NULL; prev = msg, msg = msg->next) {
+        if (ipc_may_dispatch(msg)) {
+            *prev_out = prev;
+            return msg;
+        }
     }
-    return true;
+    return NULL;
 }
 
+static void ipc_slab_destroy(void) {
+    while (slab_blocks != NULL) {
+        IpcSlabBlock *block = slab_blocks;
+        slab_blocks = block->next;
+        free(block);
+    }
+    for (int c = 0; c < IPC_SLAB_CLASSES; ++c) {
+        slab_free[c] = NULL;
+    }
+}
+
+// Whether anything reads the window's scripts: its evaluator, or webview-c
+// for window 0 on Windows.
+static bool ipc_window_live(const IpcWindow *w) {
+#ifdef _WIN32
+    if (w == &windows[0] && active_webview != NULL) {
+        return true;
+    }
+#endif
+    return w->eval != NULL;
+}
+
+// Scripts go through the host's evaluator when it registered one; the
+// Windows host can also leave window 0's to webview-c.
+static bool ipc_eval_js(const IpcWindow *w, const char *script, size_t len) {
+    if (script == NULL) {
+        return false;
+    }
+    if (w->eval != NULL) {
+        return w->eval(script, len, w->eval_arg);
+    }
 #ifdef _WIN32
-static bool ipc_eval_js(const char *script) {
-    if (active_webview == NULL || script == NULL) {
+    if (w != &windows[0] || active_webview == NULL) {
         return false;
     }
     struct webview *wv = (struct webview *)active_webview;
@@ -116,15 +551,36 @@ static bool ipc_eval_js(const char *script) {
         return false;
     }
     return true;
+#else
+    (void)len;
+    return false;
+#endif
 }
 
-void ipc_inject_bridge(void) {
-    static const char *bridge_js =
+void ipc_set_eval(IpcEvalFn eval, void *arg) {
+    windows[0].eval_arg = arg;
+    windows[0].eval = eval;
+}
+
+// The page side of the bridge. Requests go out through a WebKit script
+// message handler named "crossweb" when the host registered one, as plain
+// objects (binary data as a Uint8Array), and otherwise as framed strings
+// through window.external.invoke: v2 frames once the host has advertised
+// them, v1 before that and for what v2 cannot carry (NULs in the payload,
+// command names that are not ASCII). With a message handler the script is
+// injected at document start, so it installs itself right away.
+const char *ipc_bridge_script(void) {
+    return
         "(function(){"
         "var SEP=String.fromCharCode(30);"
-        "function encodePayload(value){"
+        "var mh=window.webkit&&window.webkit.messageHandlers&&window.webkit.messageHandlers.crossweb;"
+        "function normalize(value){"
         "  if(value===undefined||value===null){return '';}"
-        "  var text=(typeof value==='string')?value:JSON.stringify(value);"
+        "  return (typeof value==='string')?value:JSON.stringify(value);"
+        "}"
+        "function encodePayload(value){"
+        "  var text=normalize(value);"
+        "  if(text===''){return '';}"
         "  if(window.TextEncoder){"
         "    var bytes=new TextEncoder().encode(text);"
         "    var bin='';"
@@ -133,30 +589,108 @@ void ipc_inject_bridge(void) {
         "  }"
         "  return btoa(unescape(encodeURIComponent(text)));"
         "}"
+        "function newId(){return Math.random().toString(36).slice(2)+Date.now().toString(36);}"
+        "var FS=String.fromCharCode(31),ASCII=/^[\\x01-\\x7f]*$/,enc=null,cmdIds=Object.create(null),cmdCount=0;"
+        // A reloaded page may still get replies meant for the last one, so
+        // its counter does not restart at a predictable value.
+        "var seq=(Math.random()*0xfffffff)>>>0;"
+        "function utf8Length(text){"
+        "  if(ASCII.test(text)){return text.length;}"
+        "  if(window.TextEncoder){enc=enc||new TextEncoder();return enc.encode(text).length;}"
+        "  return unescape(encodeURIComponent(text)).length;"
+        "}"
+        "function hex(n,width){return ('0000000'+n.toString(16)).slice(-width);}"
+        "function frameV2(cmd,text,budget,bin){"
+        "  if(window.external.__framing!==2||text.indexOf('\\u0000')>=0){return null;}"
+        "  var c=cmdIds[cmd],name='';"
+        "  if(c===undefined){"
+        "    if(cmdCount>=0xfff||!cmd.length||cmd.length>255||!ASCII.test(cmd)){return null;}"
+        "    c=cmdIds[cmd]=++cmdCount;name=cmd;"
+        "  }"
+        "  seq=seq>=0xffffffff?1:seq+1;"
+        "  var flags=(name?1:0)|(bin!==undefined?2:0);"
+        "  return FS+flags+hex(seq,8)+hex(c,4)+hex(name.length,2)+hex(Math.min(budget,0xffffffff),8)+hex(utf8Length(text),8)+"
+        "    name+text+(bin!==undefined?btoa(bin):'');"
+        "}"
         "function install(){"
         "  if(window.external&&window.external.__bridgeInstalled){return;}"
         "  window.external=window.external||{};"
         "  var nativeInvoke=window.external.invoke;"
         "  window.external.__bridgeInstalled=true;"
-        "  window.external.invoke=function(cmd,payload){"
-        "    var id=Math.random().toString(36).slice(2)+Date.now().toString(36);"
-        "    var normalized=(payload===undefined||payload===null)?'':(typeof payload==='string'?payload:JSON.stringify(payload));"
-        "    var encoded=encodePayload(normalized);"
-        "    if(typeof nativeInvoke==='function'){nativeInvoke(id+SEP+String(cmd||'')+SEP+encoded);}"
+        "  window.external.invoke=function(cmd,payload,timeoutMs){"
+        "    var budget=timeoutMs>0?Math.ceil(timeoutMs):0;"
+        "    if(!mh&&typeof nativeInvoke==='function'){"
+        "      var frame=frameV2(String(cmd||''),normalize(payload),budget);"
+        "      if(frame!==null){nativeInvoke(frame);return seq;}"
+        "    }"
+        "    var id=newId();"
+        "    if(mh){mh.postMessage({id:id,cmd:String(cmd||''),payload:normalize(payload),timeoutMs:budget});}"
+        "    else if(typeof nativeInvoke==='function'){nativeInvoke(id+(budget?'@'+budget:'')+SEP+String(cmd||'')+SEP+encodePayload(payload));}"
+        "    return id;"
+        "  };"
+        "  window.external.invokeBytes=function(cmd,args,bytes,timeoutMs){"
+        "    var u8=bytes instanceof Uint8Array?bytes:new Uint8Array(bytes||[]);"
+        "    var budget=timeoutMs>0?Math.ceil(timeoutMs):0;"
+        "    if(mh){var mid=newId();mh.postMessage({id:mid,cmd:String(cmd||''),payload:normalize(args),timeoutMs:budget,bytes:u8});return mid;}"
+        "    var bin='';"
+        "    for(var i=0;i<u8.length;i+=32768){bin+=String.fromCharCode.apply(null,u8.subarray(i,i+32768));}"
+        "    if(typeof nativeInvoke!=='function'){return newId();}"
+        "    var frame=frameV2(String(cmd||''),normalize(args),budget,bin);"
+        "    if(frame!==null){nativeInvoke(frame);return seq;}"
+        "    var id=newId();"
+        "    nativeInvoke(id+(budget?'@'+budget:'')+SEP+String(cmd||'')+SEP+encodePayload(args)+SEP+btoa(bin));"
         "    return id;"
         "  };"
         "  window.external.listen=function(cb){window.external.onEvent=cb;};"
+        "  window.external.__dispatchBatch=function(batch){"
+        "    for(var i=0;i<batch.length;i++){"
+        "      var m=batch[i],value=null;"
+        "      try{value=JSON.parse(m[2]);}catch(e){}"
+        "      var cb=m[0]?window.external.onEvent:window.external.onMessage;"
+        "      if(typeof cb==='function'){try{cb(m[1],value);}catch(e){}}"
+        "    }"
+        "  };"
         "}"
-        "if(document.readyState==='loading'){document.addEventListener('DOMContentLoaded',install);}"
-        "else{install();}"
+        "if(mh||document.readyState!=='loading'){install();}"
+        "else{document.addEventListener('DOMContentLoaded',install);}"
         "})();";
-    ipc_eval_js(bridge_js);
 }
-#endif
+
+const char *ipc_scheme_script(void) {
+    if (scheme_finish == NULL) {
+        return NULL;
+    }
+    return "window.external=window.external||{};window.external.__binaryScheme=true;";
+}
+
+void ipc_inject_bridge(void) {
+    const char *bridge_js = ipc_bridge_script();
+    const char *scheme_js = ipc_scheme_script();
+    for (int i = 0; i < IPC_MAX_WINDOWS; ++i) {
+        const IpcWindow *w = &windows[i];
+        if (!w->open || !ipc_window_live(w)) {
+            continue;
+        }
+        // The scheme flag goes first, as ipc_scheme_script() asks.
+        if (scheme_js != NULL) {
+            ipc_eval_js(w, scheme_js, strlen(scheme_js));
+        }
+        ipc_eval_js(w, bridge_js, strlen(bridge_js));
+        if (framing_version >= 2) {
+            static const char framing_js[] = "window.external=window.external||{};window.external.__framing=2;";
+            ipc_eval_js(w, framing_js, sizeof(framing_js) - 1);
+        }
+    }
+}
 
 void ipc_init(webview_t wv) {
     active_webview = wv;
+    ipc_on_ui_thread = true;
     ipc_queue_clear();
+    ipc_load_policies_from_env();
+    // CROSSWEB_IPC_FRAMING=1 keeps pages on the v1 framing.
+    const char *framing = getenv("CROSSWEB_IPC_FRAMING");
+    framing_version = framing != NULL && strcmp(framing, "1") == 0 ? 1 : 2;
 #ifdef _WIN32
     if (wv != NULL) {
         ipc_inject_bridge();
@@ -166,37 +700,332 @@ void ipc_init(webview_t wv) {
 #endif
 }
 
-bool ipc_receive(IpcMessage *msg) {
-    if (queue_count == 0 || msg == NULL) {
+IpcMessage *ipc_receive(void) {
+retry:
+    if (queue_count == 0) {
+        return NULL;
+    }
+    IpcFifo *from = NULL;
+    IpcMessage *pick = NULL, *pick_prev = NULL;
+
+    // Anti-starvation: a normal or bulk request that has waited too long is
+    // served ahead of its class.
+    unsigned long long now = sync_now_ms();
+    for (int l = 0; l < lane_count; ++l) {
+        for (int c = IPC_PRIORITY_NORMAL; c < IPC_PRIORITY_COUNT; ++c) {
+            IpcMessage *head = lanes[l].fifo[c].head;
+            if (head != NULL && now - head->enqueued_ms >= IPC_STARVATION_MS && ipc_may_dispatch(head) &&
+                (pick == NULL || head->enqueued_ms < pick->enqueued_ms)) {
+                from = &lanes[l].fifo[c];
+                pick = head;
+                pick_prev = NULL;
+            }
+        }
+    }
+    // Otherwise: highest class first, round-robin across plugin lanes.
+    for (int c = 0; c < IPC_PRIORITY_COUNT && pick == NULL; ++c) {
+        for (int k = 0; k < lane_count; ++k) {
+            int l = (rr_cursor[c] + k) % lane_count;
+            IpcMessage *prev = NULL;
+            IpcMessage *msg = ipc_fifo_find(&lanes[l].fifo[c], &prev);
+            if (msg != NULL) {
+                from = &lanes[l].fifo[c];
+                pick = msg;
+                pick_prev = prev;
+                rr_cursor[c] = (l + 1) % lane_count;
+                break;
+            }
+        }
+    }
+    if (pick == NULL) {
+        return NULL;   // everything queued is waiting on a concurrency limit
+    }
+    ipc_fifo_unlink(from, pick_prev, pick);
+    ipc_dequeued(pick);
+    if (pick->deadline_ms != 0 && now >= pick->deadline_ms) {
+        // Nobody is waiting for the answer any more.
+        ipc_fail_message(pick, "{\"ok\":false,\"error\":\"deadline exceeded\",\"timeout\":true}");
+        ipc_slot_free(pick);
+        goto retry;
+    }
+    if (pick->policy >= 0) {
+        policies[pick->policy].in_flight++;
+    }
+    pick->dispatched = true;
+    return pick;
+}
+
+void ipc_release(IpcMessage *msg) {
+    if (msg != NULL) {
+        if (msg->dispatched && msg->policy >= 0 && policies[msg->policy].in_flight > 0) {
+            policies[msg->policy].in_flight--;
+        }
+        ipc_slot_free(msg);
+    }
+}
+
+// ============================================================================
+// Framed messages
+// ============================================================================
+// Transports that hand over one string per request use one of two layouts.
+// v1, the original, is
+//   id[@timeout_ms] RS cmd RS base64(payload) [RS base64(bytes)]
+// and has to be scanned for its separators and base64-decoded. v2 is what
+// the bridge sends once ipc_inject_bridge() has advertised it
+// (window.external.__framing = 2): after a 0x1F marker, which no v1 id may
+// contain, a fixed header of lowercase hex fields
+//   flags:1 id:8 command:4 name_len:2 timeout_ms:8 payload_len:8
+// then the command name when flags has IPC_FRAME_DEFINE, the payload as
+// plain UTF-8 and, with IPC_FRAME_BYTES, the binary data in base64. The id
+// is a 32-bit counter that plugins see as "#<decimal>" and the reply hands
+// back to the page as a number. Command ids are numbered by the page, per
+// window: the first frame using one carries its name, later ones just the
+// id, and a reloaded page simply defines them again.
+
+static bool ipc_is_cancel(const char *cmd, size_t cmd_len) {
+    return cmd_len == 8 && memcmp(cmd, "__cancel", 8) == 0;
+}
+
+// Where every transport ends once its request sits decoded in a slot:
+// admission, the window prefix on "__cancel" targets and the queue. A
+// "__cancel" slot needs tag_len spare bytes after its payload's NUL.
+// Anything refused is answered and its slot freed.
+static bool ipc_submit(IpcMessage *msg, int window, size_t tag_len) {
+    bool cancel = ipc_is_cancel(msg->cmd, msg->cmd_len);
+    if (cancel) {
+        // A "__cancel" names its target by the page's own id, so it gets the same prefix.
+        char *target = (char *)msg->payload;
+        if (memchr(target, PLUG_ORIGIN_SEP, msg->payload_len) != NULL) {
+            ipc_fail_message(msg, "{\"ok\":false,\"error\":\"invalid payload\"}");
+            ipc_slot_free(msg);
+            return false;
+        }
+        memmove(target + tag_len, target, msg->payload_len + 1);
+        memcpy(target, msg->id, tag_len);
+        msg->payload_len += tag_len;
+    }
+
+    IpcAdmission admission;
+    int retry_after_ms = ipc_admit(window, msg->cmd, msg->cmd_len, &admission);
+    if (retry_after_ms != 0) {
+        char busy[128];
+        ipc_busy_json(busy, sizeof(busy), retry_after_ms);
+        ipc_fail_message(msg, busy);
+        ipc_slot_free(msg);
         return false;
     }
-    *msg = queue[queue_head];
-    queue_head = (queue_head + 1) % IPC_QUEUE_CAP;
-    queue_count--;
+
+    // A cancel for a request that has not been dispatched yet is settled
+    // here; otherwise it goes on to flag the running request's token.
+    if (cancel && ipc_queue_cancel(msg->payload, msg->payload_len)) {
+        ipc_fail_message(msg, "{\"ok\":true}");
+        ipc_slot_free(msg);
+        return true;
+    }
+    ipc_queue_push(msg, &admission);
     return true;
 }
 
-static bool decode_payload_field(const char *encoded, char *out, size_t out_cap) {
-    if (encoded == NULL) {
-        if (out_cap > 0) out[0] = '\0';
-        return true;
+// The common tail once the fields are split: `id` already carries the
+// window's prefix (tag_len bytes of it), and the data is raw or, from
+// framed strings, base64. Anything refused past this point is answered.
+static bool ipc_enqueue(int window, const char *id, size_t id_len, size_t tag_len,
+                        const char *cmd, size_t cmd_len, const char *payload, size_t payload_len,
+                        const char *data, size_t data_len, bool data_base64, unsigned long long deadline_ms) {
+    size_t extra = ipc_is_cancel(cmd, cmd_len) ? tag_len : 0;
+    size_t data_cap = data_base64 ? codec_base64_decoded_cap(data_len) : data_len;
+    if (payload_len > IPC_MAX_PAYLOAD_LEN || data_cap > IPC_MAX_PAYLOAD_LEN - payload_len) {
+        fprintf(stderr, "IPC: payload too large for %s\n", id);
+        ipc_response(id, "{\"ok\":false,\"error\":\"payload too large\"}");
+        return false;
     }
-    size_t max_bytes = out_cap ? out_cap - 1 : 0;
-    unsigned char *buffer = (unsigned char *)out;
-    size_t written = 0;
-    if (!base64_decode(encoded, buffer, max_bytes, &written)) {
+    if (!codec_utf8_validate(payload, payload_len)) {
+        ipc_response(id, "{\"ok\":false,\"error\":\"invalid payload\"}");
+        return false;
+    }
+
+    IpcMessage *msg = ipc_slot_alloc(sizeof(IpcMessage) + id_len + 1 + cmd_len + 1 + payload_len + 1 + extra + data_cap);
+    if (msg == NULL) {
+        ipc_response(id, "{\"ok\":false,\"error\":\"out of memory\"}");
+        return false;
+    }
+    char *cursor = (char *)(msg + 1);
+    memcpy(cursor, id, id_len);
+    cursor[id_len] = '\0';
+    msg->id = cursor;
+    msg->id_len = id_len;
+    cursor += id_len + 1;
+    memcpy(cursor, cmd, cmd_len);
+    cursor[cmd_len] = '\0';
+    msg->cmd = cursor;
+    msg->cmd_len = cmd_len;
+    cursor += cmd_len + 1;
+    if (payload_len > 0) {
+        memcpy(cursor, payload, payload_len);
+    }
+    cursor[payload_len] = '\0';
+    msg->payload = cursor;
+    msg->payload_len = payload_len;
+    cursor += payload_len + 1 + extra;
+    msg->data = NULL;
+    msg->data_len = 0;
+    if (data != NULL) {
+        size_t written = data_len;
+        if (data_base64) {
+            if (!codec_base64_decode(data, data_len, cursor, data_cap, &written, CODEC_BASE64)) {
+                fprintf(stderr, "IPC: failed to decode binary data for %s\n", msg->cmd);
+                ipc_slot_free(msg);
+                ipc_response(id, "{\"ok\":false,\"error\":\"invalid payload\"}");
+                return false;
+            }
+        } else if (data_len > 0) {
+            memcpy(cursor, data, data_len);
+        }
+        msg->data = cursor;
+        msg->data_len = written;
+    }
+    msg->reply_ctx = NULL;
+    msg->deadline_ms = deadline_ms;
+    return ipc_submit(msg, window, tag_len);
+}
+
+// Fixed-width lowercase hex as the bridge writes it. Stops at the first
+// byte that is not a digit, so a short message is never read past its NUL.
+static bool ipc_hex_field(const char *s, int digits, unsigned long *out) {
+    unsigned long value = 0;
+    for (int i = 0; i < digits; ++i) {
+        unsigned char c = (unsigned char)s[i];
+        if (c >= '0' && c <= '9') {
+            value = value << 4 | (unsigned long)(c - '0');
+        } else if (c >= 'a' && c <= 'f') {
+            value = value << 4 | (unsigned long)(c - 'a' + 10);
+        } else {
+            return false;
+        }
+    }
+    *out = value;
+    return true;
+}
+
+// Writes "#<decimal>" and returns its length.
+static size_t ipc_numeric_id(char *out, unsigned long value) {
+    char digits[16];
+    size_t n = 0;
+    do {
+        digits[n++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    out[0] = IPC_NUMERIC_ID_MARK;
+    for (size_t i = 0; i < n; ++i) {
+        out[1 + i] = digits[n - 1 - i];
+    }
+    out[n + 1] = '\0';
+    return n + 1;
+}
+
+static bool ipc_is_numeric_id(const char *id, size_t len) {
+    if (len < 2 || len > 11 || id[0] != IPC_NUMERIC_ID_MARK) {
         return false;
     }
-    if (written < out_cap) {
-        out[written] = '\0';
+    for (size_t i = 1; i < len; ++i) {
+        if (id[i] < '0' || id[i] > '9') {
+            return false;
+        }
     }
     return true;
 }
 
+static bool ipc_intern_command(IpcWindow *w, unsigned long command, const char *name, size_t len) {
+    if (command >= w->command_cap) {
+        unsigned long cap = w->command_cap ? w->command_cap : 64;
+        while (cap <= command) {
+            cap *= 2;
+        }
+        IpcCommandName **commands = (IpcCommandName **)realloc(w->commands, cap * sizeof(*commands));
+        if (commands == NULL) {
+            return false;
+        }
+        memset(commands + w->command_cap, 0, (cap - w->command_cap) * sizeof(*commands));
+        w->commands = commands;
+        w->command_cap = cap;
+    }
+    IpcCommandName *old = w->commands[command];
+    if (old != NULL && old->len == len && memcmp(old->name, name, len) == 0) {
+        return true;
+    }
+    IpcCommandName *entry = (IpcCommandName *)malloc(sizeof(IpcCommandName) + len + 1);
+    if (entry == NULL) {
+        return false;
+    }
+    entry->len = len;
+    memcpy(entry->name, name, len);
+    entry->name[len] = '\0';
+    free(old);
+    w->commands[command] = entry;
+    return true;
+}
+
+static void ipc_commands_free(IpcWindow *w) {
+    for (unsigned long i = 0; i < w->command_cap; ++i) {
+        free(w->commands[i]);
+    }
+    free(w->commands);
+    w->commands = NULL;
+    w->command_cap = 0;
+}
+
+static bool ipc_handle_frame_v2(int window, IpcWindow *w, const char *message) {
+    unsigned long flags, request, command, name_len, timeout_ms, payload_len;
+    const char *h = message + 1;
+    if (!ipc_hex_field(h, 1, &flags) || !ipc_hex_field(h + 1, 8, &request) ||
+        !ipc_hex_field(h + 9, 4, &command) || !ipc_hex_field(h + 13, 2, &name_len) ||
+        !ipc_hex_field(h + 15, 8, &timeout_ms) || !ipc_hex_field(h + 23, 8, &payload_len) ||
+        (flags & ~(unsigned long)(IPC_FRAME_DEFINE | IPC_FRAME_BYTES)) != 0 ||
+        request == 0 || command == 0 || command >= IPC_MAX_COMMAND_IDS) {
+        return false;
+    }
+    const char *body = message + IPC_FRAME_V2_HEADER;
+    size_t body_len = strlen(body);
+    if (flags & IPC_FRAME_DEFINE) {
+        if (name_len == 0 || name_len > body_len || !ipc_intern_command(w, command, body, name_len)) {
+            return false;
+        }
+        body += name_len;
+        body_len -= name_len;
+    }
+
+    char id[IPC_MAX_ID_LEN];
+    size_t tag_len = ipc_window_tag(window, id, sizeof(id));
+    size_t id_len = tag_len + ipc_numeric_id(id + tag_len, request);
+    const IpcCommandName *cmd = command < w->command_cap ? w->commands[command] : NULL;
+    if (cmd == NULL) {
+        ipc_response(id, "{\"ok\":false,\"error\":\"unknown command id\"}");
+        return false;
+    }
+    // A payload cut short (the transport stopped at a NUL) or followed by
+    // bytes the flags do not account for is refused.
+    bool bytes = (flags & IPC_FRAME_BYTES) != 0;
+    if (payload_len > body_len || (!bytes && payload_len != body_len)) {
+        ipc_response(id, "{\"ok\":false,\"error\":\"invalid payload\"}");
+        return false;
+    }
+    return ipc_enqueue(window, id, id_len, tag_len, cmd->name, cmd->len, body, payload_len,
+                       bytes ? body + payload_len : NULL, body_len - payload_len, true,
+                       timeout_ms > 0 ? sync_now_ms() + timeout_ms : 0);
+}
+
 bool ipc_handle_js_message(const char *message) {
-    if (message == NULL) {
+    return ipc_handle_js_message_from(0, message);
+}
+
+bool ipc_handle_js_message_from(int window, const char *message) {
+    IpcWindow *w = message != NULL ? ipc_window_get(window) : NULL;
+    if (w == NULL) {
         return false;
     }
+    if (message[0] == IPC_FRAME_V2_MARK) {
+        return ipc_handle_frame_v2(window, w, message);
+    }
     const char *first = strchr(message, IPC_SEPARATOR);
     if (!first) {
         return false;
@@ -215,40 +1044,474 @@ bool ipc_handle_js_message(const char *message) {
         return false;
     }
 
-    IpcMessage msg = {0};
-    memcpy(msg.id, message, id_len);
-    msg.id[id_len] = '\0';
-    memcpy(msg.cmd, first + 1, cmd_len);
-    msg.cmd[cmd_len] = '\0';
+    // The id may carry the caller's time budget as "id@timeout_ms".
+    unsigned long long deadline_ms = 0;
+    const char *at = memchr(message, '@', id_len);
+    if (at != NULL) {
+        unsigned long timeout_ms = strtoul(at + 1, NULL, 10);
+        id_len = (size_t)(at - message);
+        if (timeout_ms > 0) {
+            deadline_ms = sync_now_ms() + timeout_ms;
+        }
+    }
 
-    if (!decode_payload_field(second + 1, msg.payload, sizeof(msg.payload))) {
-        fprintf(stderr, "IPC: failed to decode payload for %s\n", msg.cmd);
-        ipc_response(msg.id, "{\"ok\":false,\"error\":\"invalid payload\"}");
+    // Stored with the window's prefix, which is what plugins see.
+    char id[IPC_MAX_ID_LEN];
+    size_t tag_len = ipc_window_tag(window, id, sizeof(id));
+    if (!ipc_page_id_ok(message, id_len, tag_len)) {
         return false;
     }
+    memcpy(id + tag_len, message, id_len);
+    id_len += tag_len;
+    id[id_len] = '\0';
 
-    if (!ipc_queue_push(&msg)) {
-        fprintf(stderr, "IPC: queue full, dropping %s\n", msg.id);
-        ipc_response(msg.id, "{\"ok\":false,\"error\":\"ipc queue full\"}");
+    // An optional fourth field carries raw bytes for binary calls on hosts
+    // without the crossweb:// scheme.
+    const char *encoded = second + 1;
+    const char *third = strchr(encoded, IPC_SEPARATOR);
+    size_t encoded_len = third ? (size_t)(third - encoded) : strlen(encoded);
+    size_t extra = ipc_is_cancel(first + 1, cmd_len) ? tag_len : 0;
+    size_t payload_cap = codec_base64_decoded_cap(encoded_len);
+    size_t data_encoded_len = third ? strlen(third + 1) : 0;
+    size_t data_cap = third ? codec_base64_decoded_cap(data_encoded_len) : 0;
+    if (payload_cap > IPC_MAX_PAYLOAD_LEN || data_cap > IPC_MAX_PAYLOAD_LEN - payload_cap) {
+        fprintf(stderr, "IPC: payload too large for %s\n", id);
+        ipc_response(id, "{\"ok\":false,\"error\":\"payload too large\"}");
         return false;
     }
-    return true;
+
+    // One slot holds the header, both strings and the payload, which is
+    // decoded straight into place: no intermediate copies.
+    IpcMessage *msg = ipc_slot_alloc(sizeof(IpcMessage) + id_len + 1 + cmd_len + 1 + payload_cap + 1 + extra + data_cap);
+    if (msg == NULL) {
+        ipc_response(id, "{\"ok\":false,\"error\":\"out of memory\"}");
+        return false;
+    }
+    char *cursor = (char *)(msg + 1);
+    memcpy(cursor, id, id_len + 1);
+    msg->id = cursor;
+    msg->id_len = id_len;
+    cursor += id_len + 1;
+    memcpy(cursor, first + 1, cmd_len);
+    cursor[cmd_len] = '\0';
+    msg->cmd = cursor;
+    msg->cmd_len = cmd_len;
+    cursor += cmd_len + 1;
+
+    // Payloads are JSON text, so malformed UTF-8 is rejected here, validated
+    // right behind the decoder while the bytes are still in cache.
+    size_t written = 0;
+    if (!codec_base64_decode_utf8(encoded, encoded_len, cursor, payload_cap + 1, &written, CODEC_BASE64)) {
+        fprintf(stderr, "IPC: failed to decode payload for %s\n", msg->cmd);
+        ipc_slot_free(msg);
+        ipc_response(id, "{\"ok\":false,\"error\":\"invalid payload\"}");
+        return false;
+    }
+    cursor[written] = '\0';
+    msg->payload = cursor;
+    msg->payload_len = written;
+    cursor += written + 1 + extra;
+
+    msg->data = NULL;
+    msg->data_len = 0;
+    msg->reply_ctx = NULL;
+    msg->deadline_ms = deadline_ms;
+    if (third != NULL) {
+        if (!codec_base64_decode(third + 1, data_encoded_len, cursor, data_cap, &written, CODEC_BASE64)) {
+            fprintf(stderr, "IPC: failed to decode binary data for %s\n", msg->cmd);
+            ipc_slot_free(msg);
+            ipc_response(id, "{\"ok\":false,\"error\":\"invalid payload\"}");
+            return false;
+        }
+        msg->data = cursor;
+        msg->data_len = written;
+    }
+    return ipc_submit(msg, window, tag_len);
 }
 
-static char *build_dispatch_script(const char *format, const char *id, const char *encoded_payload) {
-    if (id == NULL || encoded_payload == NULL) {
-        return NULL;
+bool ipc_handle_message(const char *id, size_t id_len, const char *cmd, size_t cmd_len,
+                        const char *payload, size_t payload_len,
+                        const void *data, size_t data_len, unsigned long timeout_ms) {
+    return ipc_handle_message_from(0, id, id_len, cmd, cmd_len, payload, payload_len, data, data_len, timeout_ms);
+}
+
+bool ipc_handle_message_from(int window, const char *id, size_t id_len, const char *cmd, size_t cmd_len,
+                             const char *payload, size_t payload_len,
+                             const void *data, size_t data_len, unsigned long timeout_ms) {
+    char id_buf[IPC_MAX_ID_LEN];
+    size_t tag_len = ipc_window_tag(window, id_buf, sizeof(id_buf));
+    if (id == NULL || cmd == NULL || ipc_window_get(window) == NULL || !ipc_page_id_ok(id, id_len, tag_len) ||
+        cmd_len == 0 || cmd_len >= IPC_MAX_CMD_LEN) {
+        return false;
+    }
+    memcpy(id_buf + tag_len, id, id_len);
+    id_len += tag_len;
+    id_buf[id_len] = '\0';
+    if (payload == NULL) {
+        payload = "";
+        payload_len = 0;
     }
-    int needed = snprintf(NULL, 0, format, id, encoded_payload);
-    if (needed <= 0) {
+    // The transport already split the fields, so this is a straight copy
+    // into the slot, with no base64 stage in between.
+    return ipc_enqueue(window, id_buf, id_len, tag_len, cmd, cmd_len, payload, payload_len,
+                       (const char *)data, data_len, false, timeout_ms > 0 ? sync_now_ms() + timeout_ms : 0);
+}
+
+// ============================================================================
+// Outbox
+// ============================================================================
+// Responses and events may be produced on any thread. They are pushed onto an
+// intrusive lock-free MPSC queue (Vyukov) and delivered to the webview by the
+// UI thread in ipc_drain_outbox(). Producers never block; the first push after
+// a drain pokes the host's wakeup hook so the UI loop does not have to poll.
+// ============================================================================
+
+typedef enum {
+    IPC_OUT_RESPONSE,
+    IPC_OUT_EVENT,
+    IPC_OUT_BYTES,         // raw reply to a scheme request
+    IPC_OUT_RELEASE,       // request completed off the UI thread; reply_ctx is the IpcMessage
+} IpcOutKind;
+
+typedef struct IpcOutItem {
+    _Atomic(struct IpcOutItem *) next;
+    IpcOutKind kind;
+    const char *name;      // request id, event name or content type; points into data[]
+    const char *json;      // body, points into data[] (raw bytes for IPC_OUT_BYTES)
+    size_t len;            // IPC_OUT_BYTES only
+    void *reply_ctx;       // IPC_OUT_BYTES only
+    int window;            // IPC_OUT_EVENT only: target, or IPC_ALL_WINDOWS
+    char data[];
+} IpcOutItem;
+
+#define IPC_ALL_WINDOWS (-1)
+
+static IpcOutItem outbox_stub;
+static _Atomic(IpcOutItem *) outbox_tail = &outbox_stub;
+static IpcOutItem *outbox_head = &outbox_stub;   // consumer (UI thread) only
+static atomic_bool outbox_wake_pending = false;
+static void (*outbox_wake)(void *arg) = NULL;
+static void *outbox_wake_arg = NULL;
+
+static void ipc_outbox_link(IpcOutItem *item) {
+    atomic_store_explicit(&item->next, NULL, memory_order_relaxed);
+    IpcOutItem *prev = atomic_exchange_explicit(&outbox_tail, item, memory_order_acq_rel);
+    atomic_store_explicit(&prev->next, item, memory_order_release);
+}
+
+static IpcOutItem *ipc_outbox_pop(void) {
+    IpcOutItem *head = outbox_head;
+    IpcOutItem *next = atomic_load_explicit(&head->next, memory_order_acquire);
+    if (head == &outbox_stub) {
+        if (next == NULL) {
+            return NULL;
+        }
+        outbox_head = next;
+        head = next;
+        next = atomic_load_explicit(&head->next, memory_order_acquire);
+    }
+    if (next != NULL) {
+        outbox_head = next;
+        return head;
+    }
+    if (head != atomic_load_explicit(&outbox_tail, memory_order_acquire)) {
+        // A producer swapped the tail but has not linked it yet; pick it up
+        // on the next drain.
         return NULL;
     }
-    char *buffer = (char *)malloc((size_t)needed + 1);
-    if (buffer == NULL) {
+    ipc_outbox_link(&outbox_stub);
+    next = atomic_load_explicit(&head->next, memory_order_acquire);
+    if (next != NULL) {
+        outbox_head = next;
+        return head;
+    }
+    return NULL;
+}
+
+static void ipc_outbox_post(IpcOutItem *item) {
+    ipc_outbox_link(item);
+    if (!atomic_exchange_explicit(&outbox_wake_pending, true, memory_order_acq_rel)) {
+        void (*wake)(void *) = outbox_wake;
+        if (wake != NULL) {
+            wake(outbox_wake_arg);
+        }
+    }
+}
+
+static void ipc_outbox_push(IpcOutKind kind, int window, const char *name, const char *json) {
+    size_t name_len = strlen(name);
+    size_t json_len = strlen(json);
+    IpcOutItem *item = (IpcOutItem *)malloc(sizeof(IpcOutItem) + name_len + 1 + json_len + 1);
+    if (item == NULL) {
+        fprintf(stderr, "IPC: out of memory, dropping outgoing message for %s\n", name);
+        return;
+    }
+    item->kind = kind;
+    memcpy(item->data, name, name_len + 1);
+    memcpy(item->data + name_len + 1, json, json_len + 1);
+    item->name = item->data;
+    item->json = item->data + name_len + 1;
+    item->len = json_len;
+    item->reply_ctx = NULL;
+    item->window = window;
+    ipc_outbox_post(item);
+}
+
+void ipc_set_wakeup(void (*wake)(void *arg), void *arg) {
+    outbox_wake_arg = arg;
+    outbox_wake = wake;
+}
+
+void ipc_set_deliver(IpcDeliverFn deliver, void *arg) {
+    deliver_arg = arg;
+    deliver_fn = deliver;
+}
+
+// ============================================================================
+// Batched dispatch
+// ============================================================================
+// Responses and events are not evaluated one script each. The drain appends
+// them to a single batch that the bridge demultiplexes, so a burst of
+// hundreds of replies costs one script compile per flush.
+
+#define IPC_BATCH_HEAD "window.external&&window.external.__dispatchBatch&&window.external.__dispatchBatch(["
+#define IPC_BATCH_TAIL "]);"
+
+static IpcFlushPolicy flush_policy = { .max_batch_bytes = 1024 * 1024, .max_delay_ms = 0 };
+
+static bool ipc_batch_reserve(IpcWindow *w, size_t extra) {
+    if (w->batch_len + extra <= w->batch_cap) {
+        return true;
+    }
+    size_t cap = w->batch_cap ? w->batch_cap : 4096;
+    while (cap < w->batch_len + extra) {
+        cap *= 2;
+    }
+    char *buf = (char *)realloc(w->batch_buf, cap);
+    if (buf == NULL) {
+        return false;
+    }
+    w->batch_buf = buf;
+    w->batch_cap = cap;
+    return true;
+}
+
+// Writes `s` as a double-quoted JS string literal, at most len * 6 + 2
+// bytes. Ids and event names come from the page or from plugins, so nothing
+// is assumed about their contents.
+static size_t ipc_js_string(char *out, const char *s, size_t len) {
+    static const char hex[] = "0123456789abcdef";
+    size_t o = 0;
+    out[o++] = '"';
+    for (size_t i = 0; i < len; ++i) {
+        unsigned char c = (unsigned char)s[i];
+        if (c == '"' || c == '\\') {
+            out[o++] = '\\';
+            out[o++] = (char)c;
+        } else if (c < 0x20 || c == '<') {
+            memcpy(out + o, "\\u00", 4);
+            out[o + 4] = hex[c >> 4];
+            out[o + 5] = hex[c & 0xF];
+            o += 6;
+        } else if (c == 0xE2 && i + 2 < len && (unsigned char)s[i + 1] == 0x80 &&
+                   ((unsigned char)s[i + 2] == 0xA8 || (unsigned char)s[i + 2] == 0xA9)) {
+            // U+2028/U+2029 end a string literal in older engines.
+            memcpy(out + o, (unsigned char)s[i + 2] == 0xA8 ? "\\u2028" : "\\u2029", 6);
+            o += 6;
+            i += 2;
+        } else {
+            out[o++] = (char)c;
+        }
+    }
+    out[o++] = '"';
+    return o;
+}
+
+#define IPC_JSON_PARSE_HEAD "JSON.parse("
+#define IPC_JSON_TRY_HEAD "(function(t){try{return JSON.parse(t);}catch(e){return null;}})("
+
+char *ipc_json_to_js(const char *json, size_t *out_len) {
+    if (json == NULL) {
+        json = "null";
+    }
+    size_t len = strlen(json);
+    // Room for either form: the validated literal, or the raw text with
+    // every byte escaped to \u00XX.
+    char *out = (char *)malloc(sizeof(IPC_JSON_TRY_HEAD) + len * 6 + 4);
+    if (out == NULL) {
         return NULL;
     }
-    snprintf(buffer, (size_t)needed + 1, format, id, encoded_payload);
-    return buffer;
+    size_t head = sizeof(IPC_JSON_PARSE_HEAD) - 1;
+    size_t written = 0;
+    memcpy(out, IPC_JSON_PARSE_HEAD, head);
+    if (!codec_json_to_js_string(json, len, out + head, &written)) {
+        // Invalid: the page gets null, as a throwing JSON.parse() would give.
+        head = sizeof(IPC_JSON_TRY_HEAD) - 1;
+        memcpy(out, IPC_JSON_TRY_HEAD, head);
+        written = ipc_js_string(out + head, json, len);
+    }
+    written += head;
+    out[written++] = ')';
+    out[written] = '\0';
+    *out_len = written;
+    return out;
+}
+
+// Each entry is [event, name, body]. The body is the JSON as a string for
+// the page to JSON.parse(), which V8 does faster than parsing the same value
+// as script. It is validated on the way in (codec_json_to_js_string()), so
+// the page has no base64 or UTF-8 decoding left to do; text that fails goes
+// in as it is and comes out as null.
+static void ipc_batch_append(IpcWindow *w, bool event, const char *name, const char *json, size_t json_len) {
+    // Worst case: every name byte escaped to \u00XX, plus the body as a
+    // literal. A body that fails validation reserves again.
+    size_t name_len = strlen(name);
+    size_t needed = sizeof(IPC_BATCH_HEAD) + sizeof(IPC_BATCH_TAIL) + 16 + name_len * 6 +
+                    codec_json_js_string_cap(json_len);
+    if (!ipc_batch_reserve(w, needed)) {
+        fprintf(stderr, "IPC: out of memory, dropping outgoing message for %s\n", name);
+        return;
+    }
+    if (w->batch_count == 0) {
+        memcpy(w->batch_buf, IPC_BATCH_HEAD, sizeof(IPC_BATCH_HEAD) - 1);
+        w->batch_len = sizeof(IPC_BATCH_HEAD) - 1;
+        w->batch_started_ms = sync_now_ms();
+    } else {
+        w->batch_buf[w->batch_len++] = ',';
+    }
+    w->batch_buf[w->batch_len++] = '[';
+    w->batch_buf[w->batch_len++] = event ? '1' : '0';
+    w->batch_buf[w->batch_len++] = ',';
+    if (!event && ipc_is_numeric_id(name, name_len)) {
+        // A framing v2 id goes back as the number the page sent.
+        memcpy(w->batch_buf + w->batch_len, name + 1, name_len - 1);
+        w->batch_len += name_len - 1;
+    } else {
+        w->batch_len += ipc_js_string(w->batch_buf + w->batch_len, name, name_len);
+    }
+    w->batch_buf[w->batch_len++] = ',';
+    size_t written = 0;
+    if (codec_json_to_js_string(json, json_len, w->batch_buf + w->batch_len, &written)) {
+        w->batch_len += written;
+    } else if (ipc_batch_reserve(w, json_len * 6 + 4 + sizeof(IPC_BATCH_TAIL))) {
+        w->batch_len += ipc_js_string(w->batch_buf + w->batch_len, json, json_len);
+    } else {
+        memcpy(w->batch_buf + w->batch_len, "null", 4);
+        w->batch_len += 4;
+    }
+    w->batch_buf[w->batch_len++] = ']';
+    w->batch_count++;
+}
+
+static void ipc_batch_flush(IpcWindow *w) {
+    if (w->batch_count == 0) {
+        return;
+    }
+    memcpy(w->batch_buf + w->batch_len, IPC_BATCH_TAIL, sizeof(IPC_BATCH_TAIL));
+    ipc_eval_js(w, w->batch_buf, w->batch_len + sizeof(IPC_BATCH_TAIL) - 1);
+    w->batch_len = 0;
+    w->batch_count = 0;
+}
+
+static void ipc_batch_free(IpcWindow *w) {
+    free(w->batch_buf);
+    w->batch_buf = NULL;
+    w->batch_len = 0;
+    w->batch_cap = 0;
+    w->batch_count = 0;
+}
+
+// Windows nobody reads from (no evaluator yet) are skipped.
+static void ipc_window_put(IpcWindow *w, bool event, const char *name, const char *json, size_t json_len) {
+    if (!ipc_window_live(w)) {
+        return;
+    }
+    ipc_batch_append(w, event, name, json, json_len);
+    if (flush_policy.max_batch_bytes != 0 && w->batch_len >= flush_policy.max_batch_bytes) {
+        ipc_batch_flush(w);
+    }
+}
+
+void ipc_set_flush_policy(const IpcFlushPolicy *policy) {
+    if (policy != NULL) {
+        flush_policy = *policy;
+    }
+}
+
+static int ipc_batch_timeout_ms(const IpcWindow *w) {
+    if (w->batch_count == 0) {
+        return -1;
+    }
+    unsigned long long elapsed = sync_now_ms() - w->batch_started_ms;
+    if (elapsed >= flush_policy.max_delay_ms) {
+        return 0;
+    }
+    return (int)(flush_policy.max_delay_ms - elapsed);
+}
+
+int ipc_flush_timeout_ms(void) {
+    int due = -1;
+    for (int i = 0; i < IPC_MAX_WINDOWS; ++i) {
+        int in = windows[i].open ? ipc_batch_timeout_ms(&windows[i]) : -1;
+        if (in >= 0 && (due < 0 || in < due)) {
+            due = in;
+        }
+    }
+    return due;
+}
+
+void ipc_drain_outbox(void) {
+    // Clear the flag first so a push racing with this drain re-arms the wakeup.
+    atomic_store_explicit(&outbox_wake_pending, false, memory_order_release);
+    IpcOutItem *item;
+    while ((item = ipc_outbox_pop()) != NULL) {
+        if (item->kind == IPC_OUT_BYTES) {
+            // The finisher owns the item from here on; it still backs the bytes.
+            if (scheme_finish != NULL) {
+                scheme_finish(item->reply_ctx, item->name, item->json, item->len, item);
+            } else {
+                free(item);
+            }
+            continue;
+        }
+        if (item->kind == IPC_OUT_RELEASE) {
+            ipc_release((IpcMessage *)item->reply_ctx);
+            free(item);
+            continue;
+        }
+        if (deliver_fn != NULL) {
+            deliver_fn(item->kind == IPC_OUT_EVENT, item->name, item->json, item->len, deliver_arg);
+            free(item);
+            continue;
+        }
+        bool event = item->kind == IPC_OUT_EVENT;
+        if (event && item->window == IPC_ALL_WINDOWS) {
+            for (int i = 0; i < IPC_MAX_WINDOWS; ++i) {
+                if (windows[i].open) {
+                    ipc_window_put(&windows[i], true, item->name, item->json, item->len);
+                }
+            }
+        } else {
+            // A response goes back where its id says it came from, without
+            // the prefix the page never saw.
+            const char *name = item->name;
+            int window = item->window;
+            if (!event) {
+                window = ipc_window_of(name);
+                name += ipc_origin_len(name);
+            }
+            IpcWindow *w = ipc_window_get(window);
+            if (w != NULL) {
+                ipc_window_put(w, event, name, item->json, item->len);
+            }
+        }
+        free(item);
+    }
+    for (int i = 0; i < IPC_MAX_WINDOWS; ++i) {
+        if (windows[i].open && ipc_batch_timeout_ms(&windows[i]) == 0) {
+            ipc_batch_flush(&windows[i]);
+        }
+    }
 }
 
 void ipc_response(const char *id, const char *response_json) {
@@ -256,72 +1519,410 @@ void ipc_response(const char *id, const char *response_json) {
         return;
     }
 #ifdef __ANDROID__
+    // The Kotlin side already marshals onto the UI thread.
     android_response(id, response_json);
-#elif defined(_WIN32)
-    size_t resp_len = strlen(response_json);
-    size_t encoded_cap = ((resp_len + 2) / 3) * 4 + 4;
-    char *encoded = (char *)malloc(encoded_cap);
-    if (encoded == NULL) {
+#else
+    ipc_outbox_push(IPC_OUT_RESPONSE, 0, id, response_json);
+#endif
+}
+
+void ipc_complete(IpcMessage *msg, const char *content_type, const void *data, size_t len) {
+    if (msg == NULL) {
         return;
     }
-    if (!base64_encode((const unsigned char *)response_json, resp_len, encoded, encoded_cap)) {
-        free(encoded);
+    if (data != NULL && content_type == NULL) {
+        if (msg->reply_ctx != NULL) {
+            ipc_respond_bytes(NULL, msg->reply_ctx, "application/json", data, strlen((const char *)data));
+        } else {
+            ipc_response(msg->id, (const char *)data);
+        }
+    } else if (data != NULL) {
+        ipc_respond_bytes(msg->id, msg->reply_ctx, content_type, data, len);
+    } else if (msg->reply_ctx != NULL) {
+        // A scheme request must always be finished, answer or not.
+        ipc_scheme_fail(msg->reply_ctx, "{\"ok\":false,\"error\":\"no response\"}");
+    }
+    if (ipc_on_ui_thread) {
+        ipc_release(msg);
         return;
     }
-    static const char *tmpl =
-        "if(window.external&&window.external.onMessage){window.external.onMessage(\"%s\",JSON.parse(atob(\"%s\")));}";
-    char *script = build_dispatch_script(tmpl, id, encoded);
-    free(encoded);
-    if (script != NULL) {
-        ipc_eval_js(script);
-        free(script);
+    IpcOutItem *item = (IpcOutItem *)malloc(sizeof(IpcOutItem));
+    if (item == NULL) {
+        fprintf(stderr, "IPC: out of memory, leaking request slot for %s\n", msg->id);
+        return;
     }
-#else
-    (void)id;
-    (void)response_json;
-#endif
+    item->kind = IPC_OUT_RELEASE;
+    item->name = "";
+    item->json = "";
+    item->len = 0;
+    item->reply_ctx = msg;
+    item->window = 0;
+    ipc_outbox_post(item);
 }
 
 void ipc_emit_event(const char *event, const char *data_json) {
     if (event == NULL || event[0] == '\0' || data_json == NULL) {
         return;
     }
-#ifdef _WIN32
-    size_t data_len = strlen(data_json);
-    size_t encoded_cap = ((data_len + 2) / 3) * 4 + 4;
-    char *encoded = (char *)malloc(encoded_cap);
-    if (encoded == NULL) {
+    ipc_outbox_push(IPC_OUT_EVENT, IPC_ALL_WINDOWS, event, data_json);
+}
+
+void ipc_emit_event_to(int window, const char *event, const char *data_json) {
+    if (window < 0 || event == NULL || event[0] == '\0' || data_json == NULL) {
         return;
     }
-    if (!base64_encode((const unsigned char *)data_json, data_len, encoded, encoded_cap)) {
-        free(encoded);
+    ipc_outbox_push(IPC_OUT_EVENT, window, event, data_json);
+}
+
+// ============================================================================
+// Windows
+// ============================================================================
+
+int ipc_window_open(IpcEvalFn eval, void *arg) {
+    for (int i = 1; i < IPC_MAX_WINDOWS; ++i) {
+        IpcWindow *w = &windows[i];
+        if (w->open) {
+            continue;
+        }
+        if (window_reuse >= INT_MAX / IPC_MAX_WINDOWS - 1) {
+            window_reuse = 0;
+        }
+        memset(w, 0, sizeof(*w));
+        w->open = true;
+        w->handle = ++window_reuse * IPC_MAX_WINDOWS + i;
+        w->eval = eval;
+        w->eval_arg = arg;
+        return w->handle;
+    }
+    fprintf(stderr, "IPC: too many windows, at most %d\n", IPC_MAX_WINDOWS);
+    return -1;
+}
+
+void ipc_window_close(int window) {
+    IpcWindow *w = ipc_window_get(window);
+    if (window == 0 || w == NULL) {
         return;
     }
-    int needed = snprintf(NULL, 0,
-        "if(window.external&&window.external.onEvent){window.external.onEvent(\"%s\",JSON.parse(atob(\"%s\")));}",
-        event, encoded);
-    if (needed <= 0) {
-        free(encoded);
+    // Its queued requests are dropped; the answers would go nowhere, but
+    // scheme requests still have to be finished.
+    for (int l = 0; l < lane_count; ++l) {
+        for (int c = 0; c < IPC_PRIORITY_COUNT; ++c) {
+            IpcFifo *fifo = &lanes[l].fifo[c];
+            IpcMessage *prev = NULL;
+            for (IpcMessage *msg = fifo->head; msg != NULL;) {
+                IpcMessage *next = msg->next;
+                if (msg->window == window) {
+                    ipc_fifo_unlink(fifo, prev, msg);
+                    ipc_dequeued(msg);
+                    ipc_fail_message(msg, "{\"ok\":false,\"error\":\"window closed\"}");
+                    ipc_slot_free(msg);
+                } else {
+                    prev = msg;
+                }
+                msg = next;
+            }
+        }
+        if (l > 0 && lanes[l].window == window) {
+            lanes[l].name_len = 0;
+        }
+    }
+    ipc_batch_free(w);
+    ipc_commands_free(w);
+    w->open = false;
+    w->eval = NULL;
+    w->eval_arg = NULL;
+
+    // Requests already running and open streams are plug.c's; it finds them
+    // by the prefix of this request's id. Queued as window 0's so the
+    // accounting does not touch whichever window reuses the slot.
+    static const char cmd[] = "__window.closed";
+    char id[IPC_MAX_ID_LEN];
+    size_t id_len = ipc_window_tag(window, id, sizeof(id));
+    memcpy(id + id_len, "closed", sizeof("closed"));
+    id_len += sizeof("closed") - 1;
+    IpcMessage *msg = ipc_slot_alloc(sizeof(IpcMessage) + id_len + 1 + sizeof(cmd) + 1);
+    if (msg == NULL) {
+        fprintf(stderr, "IPC: out of memory, window %d's work keeps running\n", window);
         return;
     }
-    char *script = (char *)malloc((size_t)needed + 1);
-    if (script == NULL) {
-        free(encoded);
+    char *cursor = (char *)(msg + 1);
+    memcpy(cursor, id, id_len + 1);
+    msg->id = cursor;
+    msg->id_len = id_len;
+    cursor += id_len + 1;
+    memcpy(cursor, cmd, sizeof(cmd));
+    msg->cmd = cursor;
+    msg->cmd_len = sizeof(cmd) - 1;
+    cursor += sizeof(cmd);
+    cursor[0] = '\0';
+    msg->payload = cursor;
+    msg->payload_len = 0;
+    msg->data = NULL;
+    msg->data_len = 0;
+    msg->reply_ctx = NULL;
+    msg->deadline_ms = 0;
+    IpcAdmission admission = { .window = 0, .lane = 0, .policy = -1, .priority = IPC_PRIORITY_INTERACTIVE };
+    ipc_queue_push(msg, &admission);
+}
+
+int ipc_window_of(const char *id) {
+    if (id == NULL) {
+        return -1;
+    }
+    size_t origin_len = ipc_origin_len(id);
+    if (origin_len == 0) {
+        return 0;
+    }
+    char *end = NULL;
+    long handle = strtol(id, &end, 10);
+    if (end != id + origin_len - 1 || handle <= 0 || handle > INT_MAX) {
+        return -1;
+    }
+    return (int)handle;
+}
+
+// ============================================================================
+// Binary side channel
+// ============================================================================
+
+void ipc_set_scheme_handler(IpcSchemeFinish finish) {
+    scheme_finish = finish;
+}
+
+void ipc_bytes_free(void *owner) {
+    free(owner);
+}
+
+void ipc_respond_bytes(const char *id, void *reply_ctx, const char *content_type,
+                       const void *data, size_t len) {
+    if (content_type == NULL || content_type[0] == '\0') {
+        content_type = "application/octet-stream";
+    }
+    if (data == NULL) {
+        len = 0;
+    }
+    if (reply_ctx == NULL) {
+        if (id == NULL) {
+            return;
+        }
+        // JSON replies (errors included) go back as the response itself,
+        // so the page sees an object rather than the bytes of one.
+        if (strncmp(content_type, "application/json", 16) == 0) {
+            char *json = (char *)malloc(len + 1);
+            if (json == NULL) {
+                ipc_response(id, "{\"ok\":false,\"error\":\"out of memory\"}");
+                return;
+            }
+            if (len > 0) {
+                memcpy(json, data, len);
+            }
+            json[len] = '\0';
+            ipc_response(id, json);
+            free(json);
+            return;
+        }
+        // Other bytes travel back base64-encoded inside the response JSON
+        // and the bridge turns them into an ArrayBuffer.
+        if (strpbrk(content_type, "\"\\") != NULL) {
+            return;
+        }
+        static const char prefix[] = "{\"$bytes\":\"";
+        static const char middle[] = "\",\"type\":\"";
+        size_t type_len = strlen(content_type);
+        size_t encoded_len = codec_base64_encoded_len(len, CODEC_BASE64);
+        char *json = (char *)malloc(sizeof(prefix) - 1 + encoded_len + sizeof(middle) - 1 + type_len + 3);
+        if (json == NULL) {
+            ipc_response(id, "{\"ok\":false,\"error\":\"out of memory\"}");
+            return;
+        }
+        char *cursor = json;
+        memcpy(cursor, prefix, sizeof(prefix) - 1);
+        cursor += sizeof(prefix) - 1;
+        cursor += codec_base64_encode(data, len, cursor, CODEC_BASE64);
+        memcpy(cursor, middle, sizeof(middle) - 1);
+        cursor += sizeof(middle) - 1;
+        memcpy(cursor, content_type, type_len);
+        cursor += type_len;
+        memcpy(cursor, "\"}", 3);
+        ipc_response(id, json);
+        free(json);
         return;
     }
-    snprintf(script, (size_t)needed + 1,
-        "if(window.external&&window.external.onEvent){window.external.onEvent(\"%s\",JSON.parse(atob(\"%s\")));}",
-        event, encoded);
-    free(encoded);
-    ipc_eval_js(script);
-    free(script);
-#else
-    (void)event;
-    (void)data_json;
-#endif
+    size_t type_len = strlen(content_type);
+    IpcOutItem *item = (IpcOutItem *)malloc(sizeof(IpcOutItem) + type_len + 1 + len);
+    if (item == NULL) {
+        fprintf(stderr, "IPC: out of memory, dropping binary reply\n");
+        return;
+    }
+    item->kind = IPC_OUT_BYTES;
+    memcpy(item->data, content_type, type_len + 1);
+    if (len > 0) {
+        memcpy(item->data + type_len + 1, data, len);
+    }
+    item->name = item->data;
+    item->json = item->data + type_len + 1;
+    item->len = len;
+    item->reply_ctx = reply_ctx;
+    item->window = 0;
+    ipc_outbox_post(item);
+}
+
+static void ipc_scheme_fail(void *reply_ctx, const char *error_json) {
+    ipc_respond_bytes(NULL, reply_ctx, "application/json", error_json, strlen(error_json));
+}
+
+// Percent-decodes `in` into `out`, which must hold `len` bytes.
+static bool ipc_percent_decode(const char *in, size_t len, char *out, size_t *written) {
+    size_t o = 0;
+    for (size_t i = 0; i < len; ++i) {
+        if (in[i] != '%') {
+            out[o++] = in[i];
+            continue;
+        }
+        if (len - i < 3 || !codec_hex_decode(in + i + 1, 2, out + o, NULL)) {
+            return false;
+        }
+        o++;
+        i += 2;
+    }
+    *written = o;
+    return true;
+}
+
+// Finds `name`=value among the &-separated parameters of a query. The value
+// is left percent-encoded; a missing parameter reads as empty.
+static void ipc_query_param(const char *query, size_t len, const char *name, const char **value, size_t *value_len) {
+    size_t name_len = strlen(name);
+    for (size_t i = 0; i < len;) {
+        size_t n = 0;
+        while (i + n < len && query[i + n] != '&') n++;
+        if (n > name_len && query[i + name_len] == '=' && memcmp(query + i, name, name_len) == 0) {
+            *value = query + i + name_len + 1;
+            *value_len = n - name_len - 1;
+            return;
+        }
+        i += n + 1;
+    }
+    *value = query + len;
+    *value_len = 0;
+}
+
+void ipc_handle_scheme_request(const char *uri, const void *body, size_t body_len, void *reply_ctx) {
+    ipc_handle_scheme_request_from(0, uri, body, body_len, reply_ctx);
+}
+
+void ipc_handle_scheme_request_from(int window, const char *uri, const void *body, size_t body_len, void *reply_ctx) {
+    if (reply_ctx == NULL) {
+        return;
+    }
+    if (ipc_window_get(window) == NULL) {
+        ipc_scheme_fail(reply_ctx, "{\"ok\":false,\"error\":\"window closed\"}");
+        return;
+    }
+    size_t prefix_len = sizeof(IPC_SCHEME_PREFIX) - 1;
+    if (uri == NULL || strncmp(uri, IPC_SCHEME_PREFIX, prefix_len) != 0) {
+        ipc_scheme_fail(reply_ctx, "{\"ok\":false,\"error\":\"invalid command format\"}");
+        return;
+    }
+    const char *cmd = uri + prefix_len;
+    size_t cmd_len = strcspn(cmd, "?#");
+    const char *query = cmd[cmd_len] == '?' ? cmd + cmd_len + 1 : cmd + cmd_len;
+    size_t query_len = strcspn(query, "#");
+    const char *args, *page_id, *timeout;
+    size_t args_len, page_id_len, timeout_len;
+    ipc_query_param(query, query_len, "a", &args, &args_len);
+    ipc_query_param(query, query_len, "i", &page_id, &page_id_len);
+    ipc_query_param(query, query_len, "t", &timeout, &timeout_len);
+    unsigned long long timeout_ms = 0;
+    bool timeout_ok = true;
+    for (size_t i = 0; i < timeout_len && timeout_ok; ++i) {
+        timeout_ok = timeout[i] >= '0' && timeout[i] <= '9' && timeout_ms <= 0xffffffffull;
+        timeout_ms = timeout_ms * 10 + (unsigned long long)(timeout[i] - '0');
+    }
+    if (cmd_len == 0 || cmd_len >= IPC_MAX_CMD_LEN || !timeout_ok) {
+        ipc_scheme_fail(reply_ctx, "{\"ok\":false,\"error\":\"invalid command format\"}");
+        return;
+    }
+    if (body_len > IPC_MAX_PAYLOAD_LEN || args_len > IPC_MAX_PAYLOAD_LEN - body_len) {
+        ipc_scheme_fail(reply_ctx, "{\"ok\":false,\"error\":\"payload too large\"}");
+        return;
+    }
+
+    // The page's id lets it "__cancel" the call; without one it gets a
+    // private id. Either carries the window's prefix, so ipc_window_close()
+    // reaches the request once it is running.
+    char id[IPC_MAX_ID_LEN];
+    size_t tag_len = ipc_window_tag(window, id, sizeof(id));
+    size_t decoded_len = 0;
+    int id_len;
+    if (page_id_len == 0) {
+        id_len = (int)tag_len + snprintf(id + tag_len, sizeof(id) - tag_len, "bin-%u", ++scheme_request_seq);
+    } else if (tag_len + page_id_len < IPC_MAX_ID_LEN &&
+               ipc_percent_decode(page_id, page_id_len, id + tag_len, &decoded_len) &&
+               ipc_page_id_ok(id + tag_len, decoded_len, tag_len)) {
+        id_len = (int)(tag_len + decoded_len);
+        id[id_len] = '\0';
+    } else {
+        ipc_scheme_fail(reply_ctx, "{\"ok\":false,\"error\":\"invalid command format\"}");
+        return;
+    }
+
+    // Only the header, strings and (percent-decoded) args are copied; the body
+    // stays in the transport's buffer until the reply has been sent.
+    size_t extra = ipc_is_cancel(cmd, cmd_len) ? tag_len : 0;
+    IpcMessage *msg = ipc_slot_alloc(sizeof(IpcMessage) + (size_t)id_len + 1 + cmd_len + 1 + args_len + 1 + extra);
+    if (msg == NULL) {
+        ipc_scheme_fail(reply_ctx, "{\"ok\":false,\"error\":\"out of memory\"}");
+        return;
+    }
+    char *cursor = (char *)(msg + 1);
+    memcpy(cursor, id, (size_t)id_len + 1);
+    msg->id = cursor;
+    msg->id_len = (size_t)id_len;
+    cursor += id_len + 1;
+    memcpy(cursor, cmd, cmd_len);
+    cursor[cmd_len] = '\0';
+    msg->cmd = cursor;
+    msg->cmd_len = cmd_len;
+    cursor += cmd_len + 1;
+
+    size_t written = 0;
+    if (!ipc_percent_decode(args, args_len, cursor, &written) || !codec_utf8_validate(cursor, written)) {
+        ipc_slot_free(msg);
+        ipc_scheme_fail(reply_ctx, "{\"ok\":false,\"error\":\"invalid payload\"}");
+        return;
+    }
+    cursor[written] = '\0';
+    msg->payload = cursor;
+    msg->payload_len = written;
+    msg->data = body != NULL ? body : (const void *)"";
+    msg->data_len = body != NULL ? body_len : 0;
+    msg->reply_ctx = reply_ctx;
+    msg->deadline_ms = timeout_ms > 0 ? sync_now_ms() + timeout_ms : 0;
+    ipc_submit(msg, window, tag_len);
 }
 
 void ipc_deinit(void) {
+    ipc_drain_outbox();
+    for (int i = 0; i < IPC_MAX_WINDOWS; ++i) {
+        if (windows[i].open) {
+            ipc_batch_flush(&windows[i]);
+        }
+        ipc_batch_free(&windows[i]);
+        ipc_commands_free(&windows[i]);
+        if (i > 0) {
+            windows[i].open = false;
+            windows[i].eval = NULL;
+            windows[i].eval_arg = NULL;
+        }
+    }
     ipc_queue_clear();
+    ipc_slab_destroy();
+    for (int i = 0; i < policy_count; ++i) {
+        free((char *)policies[i].policy.cmd);
+    }
+    policy_count = 0;
+    lane_count = 1;
+    memset(rr_cursor, 0, sizeof(rr_cursor));
     active_webview = NULL;
 }
\ No newline at end of file
@@ -2,24 +2,188 @@
 #define IPC_H_
 
 #include <stdbool.h>
+#include <stddef.h>
 #include "plug.h"
 
 #define IPC_MAX_ID_LEN 64
 #define IPC_MAX_CMD_LEN 256
-#define IPC_MAX_PAYLOAD_LEN 4096
+#define IPC_MAX_PAYLOAD_LEN (64u * 1024u * 1024u)
 
-typedef struct {
-    char id[IPC_MAX_ID_LEN];
-    char cmd[IPC_MAX_CMD_LEN];
-    char payload[IPC_MAX_PAYLOAD_LEN];
+// Binary side channel: the page POSTs raw bytes to (or GETs them from)
+// crossweb://ipc/<cmd>?i=<id>&t=<timeout_ms>&a=<percent-encoded JSON args>,
+// all parameters optional. The id is what the page sends "__cancel" with,
+// as for any other call; the timeout becomes the request's deadline. Hosts
+// that can register the scheme with their webview (the WebKitGTK host, on
+// WebKitGTK 2.40 and later) feed requests to ipc_handle_scheme_request();
+// the others fall back to base64 frames.
+#define IPC_SCHEME "crossweb"
+#define IPC_SCHEME_PREFIX "crossweb://ipc/"
+
+// A queued request. The header, id, cmd and decoded payload all live in one
+// variable-length slot, so the strings below point into the slot itself and
+// stay valid until ipc_release() (or ipc_complete()) hands the slot back to
+// the allocator.
+typedef struct IpcMessage {
+    struct IpcMessage *next;
+    const char *id;
+    const char *cmd;
+    const char *payload;   // NUL-terminated, may also contain embedded NULs
+    size_t id_len;
+    size_t cmd_len;
+    size_t payload_len;
+    const void *data;      // Raw bytes for binary calls, NULL otherwise
+    size_t data_len;
+    void *reply_ctx;       // Scheme request to finish, NULL for framed calls
+    unsigned long long deadline_ms;  // sync_now_ms() time the caller gives up at, 0 = none
+    // internal
+    size_t slot_size;      // size class of the backing slot
+    unsigned long long enqueued_ms;
+    int lane;              // per-plugin sub-queue
+    int policy;            // index into the command policy table, -1 for none
+    int priority;          // IpcPriority
+    int window;            // window the request came from, see ipc_window_open()
+    bool dispatched;       // handed out by ipc_receive(), counts as in flight
 } IpcMessage;
 
+// Requests are queued per plugin and drained round-robin within each
+// priority class; a higher class always goes first, except that a request
+// left waiting for over a second is served regardless of class.
+typedef enum {
+    IPC_PRIORITY_INTERACTIVE,
+    IPC_PRIORITY_NORMAL,
+    IPC_PRIORITY_BULK,
+    IPC_PRIORITY_COUNT,
+} IpcPriority;
+
+// Scheduling and admission rules for a command. Requests refused at the door
+// are answered with {"ok":false,"error":"busy","busy":true,"retryAfterMs":N}.
+// Policies can also come from CROSSWEB_IPC_POLICY, e.g.
+//   "fs.read*=bulk,rate=20,concurrent=2;ui.*=interactive"
+typedef struct IpcCommandPolicy {
+    const char *cmd;               // Exact command, or prefix ending in '*'
+    IpcPriority priority;
+    unsigned int max_rate_hz;      // Admissions per second, 0 = unlimited
+    unsigned int max_concurrent;   // Dispatched but not yet released, 0 = unlimited
+    unsigned int max_queued;       // Waiting in the queue, 0 = only the global limits
+} IpcCommandPolicy;
+
+// Finishes a scheme request on the UI thread. A NULL content_type means the
+// request failed. Ownership of `owner` (which keeps `data` alive) passes to
+// the callee, which releases it with ipc_bytes_free() once the webview is
+// done with the bytes.
+typedef void (*IpcSchemeFinish)(void *reply_ctx, const char *content_type,
+                                const void *data, size_t len, void *owner);
+
+// Evaluates a script in a window's page, UI thread only. Responses, events
+// and the bridge all go through it; without one, Windows falls back to
+// webview-c for window 0 and other hosts drop them.
+typedef bool (*IpcEvalFn)(const char *script, size_t len, void *arg);
+
 void ipc_init(webview_t wv);
-bool ipc_receive(IpcMessage *msg);
+// Adds or replaces the policy for policy->cmd. UI thread only.
+bool ipc_set_command_policy(const IpcCommandPolicy *policy);
+IpcMessage *ipc_receive(void);
+void ipc_release(IpcMessage *msg);
+// Answers a request taken from ipc_receive() and releases it. Thread-safe and
+// meant to be called exactly once per request, possibly long after dispatch:
+// the slot stays valid until then. A NULL content_type sends `data` as the
+// JSON response, otherwise `data`/`len` are raw bytes (see ipc_respond_bytes).
+// NULL data finishes the request without a reply.
+void ipc_complete(IpcMessage *msg, const char *content_type, const void *data, size_t len);
+// One framed request as a string: the v1 layout, or the fixed-header v2
+// layout the bridge switches to when ipc_inject_bridge() advertises it
+// (see "Framed messages" in ipc.c). CROSSWEB_IPC_FRAMING=1 turns the
+// advertisement off; both layouts are always accepted.
 bool ipc_handle_js_message(const char *message);
+// Same as ipc_handle_js_message() for transports that deliver the fields
+// separately (WebKit script messages): nothing is base64-decoded and the
+// strings need not be NUL-terminated. `data` is NULL for non-binary calls;
+// timeout_ms = 0 means no deadline.
+bool ipc_handle_message(const char *id, size_t id_len, const char *cmd, size_t cmd_len,
+                        const char *payload, size_t payload_len,
+                        const void *data, size_t data_len, unsigned long timeout_ms);
+
+// Several webviews can share one plugin runtime. Each window has its own
+// evaluator, batch, queue lanes and request id namespace: ids from window N
+// are prefixed with "N" PLUG_ORIGIN_SEP on the way in, so the same id may be
+// in use in two windows, responses reach only the window that asked, and
+// the prefix is stripped again before the page sees them. Pages may not use
+// PLUG_ORIGIN_SEP in their ids, nor start them with '#', which marks the
+// numeric ids of framing v2. Window 0 always exists and is the one
+// ipc_init()/ipc_set_eval() configure, so single-window hosts never see a
+// prefix. Unless noted, UI thread only.
+#define IPC_MAX_WINDOWS 16
+// Returns the new window, or -1 if IPC_MAX_WINDOWS are open.
+int ipc_window_open(IpcEvalFn eval, void *arg);
+// Drops the window's queued requests and pending batch, and has plug.c
+// cancel its running requests and streams. Replies still in flight are
+// discarded. Window 0 cannot be closed.
+void ipc_window_close(int window);
+// The window a request id (as plugins see it) came from: 0 for an id
+// without a prefix, -1 for a malformed one. Thread-safe; it only reads the
+// prefix, so the window may have been closed since.
+int ipc_window_of(const char *id);
+bool ipc_handle_js_message_from(int window, const char *message);
+bool ipc_handle_message_from(int window, const char *id, size_t id_len, const char *cmd, size_t cmd_len,
+                             const char *payload, size_t payload_len,
+                             const void *data, size_t data_len, unsigned long timeout_ms);
+
+// The page-side bridge. Hosts that can inject scripts at document start
+// (WebKitGTK user scripts) add it themselves; ipc_inject_bridge() evaluates
+// it in the current page of every window.
+const char *ipc_bridge_script(void);
+// Tells the bridge that binary calls can go through crossweb://, NULL until a
+// scheme finisher is registered. Inject it before the bridge itself.
+const char *ipc_scheme_script(void);
 void ipc_inject_bridge(void);
+// Sets window 0's evaluator (see ipc_window_open() for the others).
+void ipc_set_eval(IpcEvalFn eval, void *arg);
+// For hosts that splice a reply into a script of their own (Android): a
+// malloc'd JavaScript expression that evaluates to what JSON.parse() makes
+// of `json`, or to null when that would throw. NULL when out of memory.
+char *ipc_json_to_js(const char *json, size_t *out_len);
+// Thread-safe: may be called from any thread. Messages are queued on the
+// outbox and delivered to the page by ipc_drain_outbox() on the UI thread.
+// Responses go to the window named by the id's prefix. ipc_emit_event()
+// sends to every window, ipc_emit_event_to() to one.
 void ipc_response(const char *id, const char *response_json);
 void ipc_emit_event(const char *event, const char *data_json);
+void ipc_emit_event_to(int window, const char *event, const char *data_json);
+// Called (from the producing thread) when the outbox goes from idle to
+// non-empty, so the host can wake its UI loop instead of polling.
+void ipc_set_wakeup(void (*wake)(void *arg), void *arg);
+void ipc_drain_outbox(void);
+// Hosts without a page (see headless.c) take each drained response and event
+// here instead of as batched scripts. `json` is only valid during the call.
+typedef void (*IpcDeliverFn)(bool event, const char *name, const char *json, size_t len, void *arg);
+void ipc_set_deliver(IpcDeliverFn deliver, void *arg);
+
+// Controls how drained messages are batched into script evaluations. The
+// default flushes once per drain (i.e. per loop tick) and starts a new script
+// whenever a batch grows past 1 MiB. Each window batches on its own.
+typedef struct IpcFlushPolicy {
+    size_t max_batch_bytes;      // Flush early once a batch reaches this size (0 = no limit)
+    unsigned int max_delay_ms;   // Hold a batch across ticks for up to this long (0 = every tick)
+} IpcFlushPolicy;
+
+void ipc_set_flush_policy(const IpcFlushPolicy *policy);
+// Milliseconds until a held batch must be flushed by ipc_drain_outbox(),
+// 0 if it is due now, -1 if nothing is pending. Hosts arm a timer with it.
+int ipc_flush_timeout_ms(void);
+
+// `body` is borrowed: the transport keeps it alive until `reply_ctx` has been
+// finished. Malformed requests are finished with a JSON error right away.
+void ipc_handle_scheme_request(const char *uri, const void *body, size_t body_len, void *reply_ctx);
+// The same for a request from `window`, which it is queued and cancelled as.
+void ipc_handle_scheme_request_from(int window, const char *uri, const void *body, size_t body_len,
+                                    void *reply_ctx);
+// Registering a finisher also advertises the scheme to the injected bridge.
+void ipc_set_scheme_handler(IpcSchemeFinish finish);
+// Thread-safe. Replies to a binary call: through the scheme when the call came
+// in that way (reply_ctx != NULL), otherwise as a base64 response to `id`.
+void ipc_respond_bytes(const char *id, void *reply_ctx, const char *content_type,
+                       const void *data, size_t len);
+void ipc_bytes_free(void *owner);
 void ipc_deinit(void);
 
-#endif // IPC_H_
\ No newline at end of file
+#endif // IPC_H_
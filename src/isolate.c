@@ -0,0 +1,1203 @@
+// ============================================================================
+// isolate.c - Plugin child processes over shared-memory rings
+// ============================================================================
+// See isolate.h. Process tree: the host forks one zygote from plug_init(),
+// the zygote forks the children. Both ask the kernel to kill them when their
+// parent dies, so nothing outlives the host. The rings live in one shared
+// anonymous mapping made before the zygote is forked, so every child
+// inherits its pair and no descriptor has to be passed around.
+// ============================================================================
+
+#include "isolate.h"
+#include "evloop.h"
+#include "sync.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__linux__) && !defined(__ANDROID__)
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define RING_MASK (ISOLATE_RING_BYTES - 1)
+#define FRAME_HEADER 8
+#define FRAME_MORE 0x80000000u
+#define FRAGMENT_MAX (ISOLATE_RING_BYTES / 4)
+#define MAX_IN_FLIGHT 4096
+#define FLIGHT_BUCKETS 64
+#define WAIT_SLICE_MS 1000
+#define RESTART_MIN_MS 100
+#define RESTART_MAX_MS 5000
+#define HEALTHY_MS 5000        // a child that lived this long resets the backoff
+#define STOP_GRACE_MS 2000     // then the zygote kills children that did not exit
+#define STR_NULL 0xFFFFFFFFu
+
+enum { MSG_REQUEST = 1, MSG_NOTICE, MSG_REPLY, MSG_EVENT, MSG_STREAM };
+
+// ============================================================================
+// Rings
+// ============================================================================
+// head and tail count bytes ever written and consumed. A message is one or
+// more frames (8-byte header, then up to FRAGMENT_MAX bytes); the producer
+// publishes each frame by moving head, so the consumer may see the first
+// frames of a large message before the rest is written. The two sequence
+// words are the futexes: data_seq moves on every frame written, space_seq
+// on every frame consumed.
+// ============================================================================
+
+typedef struct Ring {
+    _Alignas(64) atomic_ullong head;
+    _Alignas(64) atomic_ullong tail;
+    _Alignas(64) atomic_uint data_seq;
+    atomic_uint data_waiters;
+    atomic_uint space_seq;
+    atomic_uint space_waiters;
+    _Alignas(64) unsigned char bytes[ISOLATE_RING_BYTES];
+} Ring;
+
+typedef struct Shared {
+    Ring to_child;
+    Ring to_host;
+    atomic_uint stop;
+} Shared;
+
+typedef struct Part {
+    const void *ptr;
+    size_t len;
+} Part;
+
+// Reassembles one message from its frames.
+typedef struct Reader {
+    unsigned char *buf;
+    size_t len;
+    size_t cap;
+    unsigned int kind;
+    bool dropping;   // out of memory: skip the rest of this message
+} Reader;
+
+static void futex_wait(atomic_uint *word, unsigned int seen, int timeout_ms) {
+    struct timespec ts = { timeout_ms / 1000, (long)(timeout_ms % 1000) * 1000000L };
+    syscall(SYS_futex, (uint32_t *)word, FUTEX_WAIT, seen, timeout_ms >= 0 ? &ts : NULL, NULL, 0);
+}
+
+static void futex_wake(atomic_uint *word) {
+    syscall(SYS_futex, (uint32_t *)word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+// Moves `seq` on and makes the wake syscall only if somebody sleeps on it.
+static void ring_signal(atomic_uint *seq, atomic_uint *waiters) {
+    atomic_fetch_add(seq, 1);
+    if (atomic_load(waiters) != 0) {
+        futex_wake(seq);
+    }
+}
+
+// Sleeps until `seq` is no longer `seen`, or the timeout (-1 = none).
+static void ring_sleep(atomic_uint *seq, atomic_uint *waiters, unsigned int seen, int timeout_ms) {
+    atomic_fetch_add(waiters, 1);
+    if (atomic_load(seq) == seen) {
+        futex_wait(seq, seen, timeout_ms);
+    }
+    atomic_fetch_sub(waiters, 1);
+}
+
+static size_t ring_free(Ring *r, unsigned long long head) {
+    return ISOLATE_RING_BYTES - (size_t)(head - atomic_load_explicit(&r->tail, memory_order_acquire));
+}
+
+static void ring_copy_in(Ring *r, unsigned long long at, const void *src, size_t len) {
+    size_t off = (size_t)(at & RING_MASK);
+    size_t first = len < ISOLATE_RING_BYTES - off ? len : ISOLATE_RING_BYTES - off;
+    memcpy(r->bytes + off, src, first);
+    memcpy(r->bytes, (const unsigned char *)src + first, len - first);
+}
+
+static void ring_copy_out(const Ring *r, unsigned long long at, void *dst, size_t len) {
+    size_t off = (size_t)(at & RING_MASK);
+    size_t first = len < ISOLATE_RING_BYTES - off ? len : ISOLATE_RING_BYTES - off;
+    memcpy(dst, r->bytes + off, first);
+    memcpy((unsigned char *)dst + first, r->bytes, len - first);
+}
+
+static size_t parts_total(const Part *parts, int count, size_t *frames) {
+    size_t total = 0;
+    for (int i = 0; i < count; ++i) {
+        total += parts[i].len;
+    }
+    *frames = total == 0 ? 1 : (total + FRAGMENT_MAX - 1) / FRAGMENT_MAX;
+    return total;
+}
+
+// Writes one message straight from `parts` into the ring. Without `wait` it
+// must fit as a whole right now, or nothing is written; with `wait` the
+// writer sleeps whenever the next frame does not fit. One producer at a
+// time: callers hold their side's send lock.
+static bool ring_put(Ring *r, unsigned int kind, const Part *parts, int count, bool wait) {
+    size_t frames = 0;
+    size_t left = parts_total(parts, count, &frames);
+    unsigned long long head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    if (!wait && left + frames * FRAME_HEADER > ring_free(r, head)) {
+        return false;
+    }
+    int part = 0;
+    size_t part_off = 0;
+    do {
+        size_t len = left < FRAGMENT_MAX ? left : FRAGMENT_MAX;
+        while (ring_free(r, head) < len + FRAME_HEADER) {
+            unsigned int seen = atomic_load(&r->space_seq);
+            if (ring_free(r, head) >= len + FRAME_HEADER) {
+                break;
+            }
+            ring_sleep(&r->space_seq, &r->space_waiters, seen, WAIT_SLICE_MS);
+        }
+        uint32_t header[2] = { kind | (left > len ? FRAME_MORE : 0), (uint32_t)len };
+        ring_copy_in(r, head, header, FRAME_HEADER);
+        for (size_t done = 0; done < len;) {
+            while (part_off == parts[part].len) {
+                part++;
+                part_off = 0;
+            }
+            size_t n = parts[part].len - part_off;
+            if (n > len - done) {
+                n = len - done;
+            }
+            ring_copy_in(r, head + FRAME_HEADER + done, (const unsigned char *)parts[part].ptr + part_off, n);
+            done += n;
+            part_off += n;
+        }
+        head += FRAME_HEADER + len;
+        atomic_store_explicit(&r->head, head, memory_order_release);
+        ring_signal(&r->data_seq, &r->data_waiters);
+        left -= len;
+    } while (left > 0);
+    return true;
+}
+
+// Consumes the frames that are ready. Returns true once a whole message is
+// in rd->buf (NUL-terminated); the caller resets rd->len after using it.
+static bool ring_get(Ring *r, Reader *rd) {
+    unsigned long long tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    for (;;) {
+        unsigned long long head = atomic_load_explicit(&r->head, memory_order_acquire);
+        if (head - tail < FRAME_HEADER) {
+            return false;
+        }
+        uint32_t header[2];
+        ring_copy_out(r, tail, header, FRAME_HEADER);
+        size_t len = header[1];
+        if (!rd->dropping && rd->len + len + 1 > rd->cap) {
+            size_t cap = rd->cap ? rd->cap : 4096;
+            while (cap < rd->len + len + 1) {
+                cap *= 2;
+            }
+            unsigned char *buf = (unsigned char *)realloc(rd->buf, cap);
+            if (buf == NULL) {
+                fprintf(stderr, "isolate: out of memory, dropping a message\n");
+                rd->dropping = true;
+            } else {
+                rd->buf = buf;
+                rd->cap = cap;
+            }
+        }
+        if (!rd->dropping) {
+            ring_copy_out(r, tail + FRAME_HEADER, rd->buf + rd->len, len);
+            rd->len += len;
+            rd->buf[rd->len] = '\0';
+        }
+        rd->kind = header[0] & ~FRAME_MORE;
+        tail += FRAME_HEADER + len;
+        atomic_store_explicit(&r->tail, tail, memory_order_release);
+        ring_signal(&r->space_seq, &r->space_waiters);
+        if (!(header[0] & FRAME_MORE)) {
+            if (rd->dropping) {
+                rd->dropping = false;
+                rd->len = 0;
+                continue;
+            }
+            return true;
+        }
+    }
+}
+
+// ============================================================================
+// Message encoding
+// ============================================================================
+// Integers cross in native layout (both ends are the same build on the same
+// machine). Strings cross as a 32-bit length and the bytes plus a NUL, so the
+// reader uses them in place; NULL is the length STR_NULL.
+// ============================================================================
+
+typedef struct Encoder {
+    Part parts[20];
+    int count;
+    unsigned long long nums[3];
+    int num_count;
+    uint32_t lens[6];
+    int len_count;
+} Encoder;
+
+static void enc_u64(Encoder *e, unsigned long long v) {
+    e->nums[e->num_count] = v;
+    e->parts[e->count++] = (Part){ &e->nums[e->num_count++], sizeof(unsigned long long) };
+}
+
+static void enc_str(Encoder *e, const void *s, size_t len) {
+    static const char nul = '\0';
+    e->lens[e->len_count] = s ? (uint32_t)len : STR_NULL;
+    e->parts[e->count++] = (Part){ &e->lens[e->len_count++], sizeof(uint32_t) };
+    if (s != NULL) {
+        e->parts[e->count++] = (Part){ s, len };
+        e->parts[e->count++] = (Part){ &nul, 1 };
+    }
+}
+
+static void enc_cstr(Encoder *e, const char *s) {
+    enc_str(e, s, s ? strlen(s) : 0);
+}
+
+typedef struct Decoder {
+    const unsigned char *p;
+    const unsigned char *end;
+    bool ok;
+} Decoder;
+
+static unsigned long long dec_u64(Decoder *d) {
+    unsigned long long v = 0;
+    if ((size_t)(d->end - d->p) < sizeof(v)) {
+        d->ok = false;
+        return 0;
+    }
+    memcpy(&v, d->p, sizeof(v));
+    d->p += sizeof(v);
+    return v;
+}
+
+static const char *dec_str(Decoder *d, size_t *len) {
+    uint32_t n = 0;
+    *len = 0;
+    if ((size_t)(d->end - d->p) < sizeof(n)) {
+        d->ok = false;
+        return NULL;
+    }
+    memcpy(&n, d->p, sizeof(n));
+    d->p += sizeof(n);
+    if (n == STR_NULL) {
+        return NULL;
+    }
+    if ((size_t)(d->end - d->p) < (size_t)n + 1) {
+        d->ok = false;
+        return NULL;
+    }
+    const char *s = (const char *)d->p;
+    d->p += (size_t)n + 1;
+    *len = n;
+    return s;
+}
+
+// ============================================================================
+// Host side
+// ============================================================================
+
+typedef struct Flight {
+    struct Flight *next;
+    unsigned long long seq;
+    unsigned long long deadline_ms;
+    void *ctx;
+} Flight;
+
+typedef struct StreamRoute {
+    struct StreamRoute *next;
+    int child;
+    char *request_id;
+    char *escaped_id;
+} StreamRoute;
+
+typedef struct Child {
+    int group;
+    Shared *shared;
+    SyncMutex send_lock;           // host threads writing to_child
+    SyncMutex flight_lock;
+    Flight *flights[FLIGHT_BUCKETS];
+    atomic_uint in_flight;
+    unsigned long long next_seq;
+    atomic_ullong completed;
+    atomic_ullong restarts;
+    atomic_ullong started_ms;
+    unsigned int quick_deaths;
+    SyncThread reader;
+    atomic_int pid;                // 0 while (re)starting
+    atomic_bool died;
+} Child;
+
+// Zygote protocol, both ways over one SOCK_SEQPACKET pair: the host sends a
+// child index to fork, the zygote answers with its pid and later reports
+// its exit status.
+typedef struct ZygoteMsg {
+    int child;
+    int pid;
+    int status;
+    int started;
+} ZygoteMsg;
+
+static IsolateHooks hooks;
+static Child children[ISOLATE_MAX_CHILDREN];
+static int child_count = 0;
+static Shared *shared_map = NULL;
+static size_t shared_map_len = 0;
+static pid_t zygote_pid = -1;
+static int zygote_fd = -1;
+static SyncThread zygote_monitor;
+static SyncMutex zygote_lock = SYNC_MUTEX_INIT;
+static StreamRoute *routes = NULL;
+static SyncMutex route_lock = SYNC_MUTEX_INIT;
+static atomic_bool running = false;
+static atomic_bool stopping = false;
+static atomic_bool broken = false;   // the zygote is gone, nothing restarts
+
+// Child process side.
+static Shared *self = NULL;
+static Reader self_reader;
+static bool self_taken = false;
+static SyncMutex self_send_lock = SYNC_MUTEX_INIT;
+static SyncThread self_watcher;
+
+static bool flight_add(Child *c, Flight *f) {
+    sync_mutex_lock(&c->flight_lock);
+    bool ok = atomic_load(&c->in_flight) < MAX_IN_FLIGHT;
+    if (ok) {
+        Flight **bucket = &c->flights[f->seq % FLIGHT_BUCKETS];
+        f->next = *bucket;
+        *bucket = f;
+        atomic_fetch_add(&c->in_flight, 1);
+    }
+    sync_mutex_unlock(&c->flight_lock);
+    return ok;
+}
+
+static Flight *flight_take(Child *c, unsigned long long seq) {
+    Flight *found = NULL;
+    sync_mutex_lock(&c->flight_lock);
+    for (Flight **link = &c->flights[seq % FLIGHT_BUCKETS]; *link != NULL; link = &(*link)->next) {
+        if ((*link)->seq == seq) {
+            found = *link;
+            *link = found->next;
+            atomic_fetch_sub(&c->in_flight, 1);
+            break;
+        }
+    }
+    sync_mutex_unlock(&c->flight_lock);
+    return found;
+}
+
+// Unlinks the flights that are due (all of them with now == 0) and returns
+// them as a list. *next_ms gets the time to the next deadline, -1 if none.
+static Flight *flights_collect(Child *c, unsigned long long now, long long *next_ms) {
+    Flight *due = NULL;
+    *next_ms = -1;
+    sync_mutex_lock(&c->flight_lock);
+    for (int b = 0; b < FLIGHT_BUCKETS; ++b) {
+        for (Flight **link = &c->flights[b]; *link != NULL;) {
+            Flight *f = *link;
+            if (now == 0 || (f->deadline_ms != 0 && f->deadline_ms <= now)) {
+                *link = f->next;
+                f->next = due;
+                due = f;
+                atomic_fetch_sub(&c->in_flight, 1);
+                continue;
+            }
+            if (f->deadline_ms != 0) {
+                long long left = (long long)(f->deadline_ms - now);
+                if (*next_ms < 0 || left < *next_ms) {
+                    *next_ms = left;
+                }
+            }
+            link = &f->next;
+        }
+    }
+    sync_mutex_unlock(&c->flight_lock);
+    return due;
+}
+
+static void flights_fail(Flight *list, IsolateFailure why) {
+    while (list != NULL) {
+        Flight *f = list;
+        list = f->next;
+        hooks.fail(f->ctx, why);
+        free(f);
+    }
+}
+
+static void route_add(int child, const char *request_id, const char *escaped_id) {
+    StreamRoute *route = (StreamRoute *)calloc(1, sizeof(StreamRoute));
+    if (route == NULL) {
+        return;
+    }
+    route->child = child;
+    route->request_id = strdup(request_id);
+    route->escaped_id = strdup(escaped_id);
+    if (route->request_id == NULL || route->escaped_id == NULL) {
+        free(route->request_id);
+        free(route->escaped_id);
+        free(route);
+        return;
+    }
+    sync_mutex_lock(&route_lock);
+    route->next = routes;
+    routes = route;
+    sync_mutex_unlock(&route_lock);
+}
+
+static void route_free(StreamRoute *route) {
+    free(route->request_id);
+    free(route->escaped_id);
+    free(route);
+}
+
+// Drops the route of one stream (escaped_id != NULL) or every route of
+// `child`, calling stream_lost for the latter when `lost` is set.
+static void routes_drop(int child, const char *escaped_id, bool lost) {
+    StreamRoute *dropped = NULL;
+    sync_mutex_lock(&route_lock);
+    for (StreamRoute **link = &routes; *link != NULL;) {
+        StreamRoute *route = *link;
+        bool match = child < 0 || (route->child == child &&
+                                   (escaped_id == NULL || strcmp(route->escaped_id, escaped_id) == 0));
+        if (match) {
+            *link = route->next;
+            route->next = dropped;
+            dropped = route;
+        } else {
+            link = &route->next;
+        }
+    }
+    sync_mutex_unlock(&route_lock);
+    while (dropped != NULL) {
+        StreamRoute *route = dropped;
+        dropped = route->next;
+        if (lost && hooks.stream_lost != NULL) {
+            hooks.stream_lost(route->request_id, route->escaped_id);
+        }
+        route_free(route);
+    }
+}
+
+static void zygote_send(int child) {
+    ZygoteMsg msg = { .child = child };
+    sync_mutex_lock(&zygote_lock);
+    if (zygote_fd >= 0 && send(zygote_fd, &msg, sizeof(msg), MSG_NOSIGNAL) != (ssize_t)sizeof(msg)) {
+        fprintf(stderr, "isolate: cannot reach the zygote: %s\n", strerror(errno));
+    }
+    sync_mutex_unlock(&zygote_lock);
+}
+
+static void host_dispatch(int index, Reader *rd) {
+    Child *c = &children[index];
+    Decoder d = { rd->buf, rd->buf + rd->len, true };
+    size_t a_len = 0, b_len = 0, c_len = 0;
+    switch (rd->kind) {
+    case MSG_REPLY: {
+        unsigned long long seq = dec_u64(&d);
+        const char *content_type = dec_str(&d, &a_len);
+        const char *data = dec_str(&d, &b_len);
+        if (!d.ok) {
+            break;
+        }
+        Flight *f = flight_take(c, seq);
+        if (f != NULL) {
+            hooks.complete(f->ctx, content_type, data, b_len);
+            atomic_fetch_add(&c->completed, 1);
+            free(f);
+        }
+        return;
+    }
+    case MSG_EVENT: {
+        const char *request_id = dec_str(&d, &a_len);
+        const char *event = dec_str(&d, &b_len);
+        const char *data = dec_str(&d, &c_len);
+        if (!d.ok || event == NULL) {
+            break;
+        }
+        hooks.event(request_id, event, data ? data : "null");
+        return;
+    }
+    case MSG_STREAM: {
+        unsigned long long open = dec_u64(&d);
+        const char *request_id = dec_str(&d, &a_len);
+        const char *escaped_id = dec_str(&d, &b_len);
+        if (!d.ok || request_id == NULL || escaped_id == NULL) {
+            break;
+        }
+        if (open) {
+            route_add(index, request_id, escaped_id);
+        } else {
+            routes_drop(index, escaped_id, false);
+        }
+        return;
+    }
+    default:
+        break;
+    }
+    fprintf(stderr, "isolate: malformed message from child %d\n", index);
+}
+
+// The process behind `c` is gone: reset its rings, fail what it held and
+// fork a new one, after a pause if it keeps dying young.
+static void child_restart(int index, Reader *rd) {
+    Child *c = &children[index];
+    atomic_store(&c->died, false);
+    rd->len = 0;
+    rd->dropping = false;
+    Ring *in = &c->shared->to_host;
+    Ring *out = &c->shared->to_child;
+    atomic_store(&in->head, 0);
+    atomic_store(&in->tail, 0);
+    // Under the send lock, so a request is either failed here or written to
+    // the fresh ring for the next process, never lost in between.
+    sync_mutex_lock(&c->send_lock);
+    atomic_store(&out->head, 0);
+    atomic_store(&out->tail, 0);
+    long long next_ms;
+    Flight *lost = flights_collect(c, 0, &next_ms);
+    sync_mutex_unlock(&c->send_lock);
+    bool stop = atomic_load(&stopping) || atomic_load(&broken);
+    flights_fail(lost, stop ? ISOLATE_FAIL_STOPPED : ISOLATE_FAIL_CRASHED);
+    routes_drop(index, NULL, true);
+    if (stop) {
+        return;
+    }
+    unsigned long long lived = sync_now_ms() - atomic_load(&c->started_ms);
+    c->quick_deaths = lived < HEALTHY_MS ? c->quick_deaths + 1 : 0;
+    if (c->quick_deaths > 0) {
+        unsigned int shift = c->quick_deaths - 1 < 6 ? c->quick_deaths - 1 : 6;
+        unsigned long long until = sync_now_ms() + (RESTART_MIN_MS << shift < RESTART_MAX_MS ? RESTART_MIN_MS << shift : RESTART_MAX_MS);
+        // isolate_stop() signals data_seq, which cuts the pause short.
+        while (!atomic_load(&stopping) && sync_now_ms() < until) {
+            unsigned int seen = atomic_load(&in->data_seq);
+            ring_sleep(&in->data_seq, &in->data_waiters, seen, (int)(until - sync_now_ms()));
+        }
+        if (atomic_load(&stopping)) {
+            return;
+        }
+    }
+    atomic_fetch_add(&c->restarts, 1);
+    zygote_send(index);
+}
+
+static void child_read(void *arg) {
+    int index = (int)(intptr_t)arg;
+    Child *c = &children[index];
+    Ring *r = &c->shared->to_host;
+    Reader rd = { 0 };
+    for (;;) {
+        unsigned int seen = atomic_load(&r->data_seq);
+        while (ring_get(r, &rd)) {
+            host_dispatch(index, &rd);
+            rd.len = 0;
+        }
+        if (atomic_load(&c->died)) {
+            child_restart(index, &rd);
+            continue;
+        }
+        if (!atomic_load(&running)) {
+            break;
+        }
+        long long timeout = -1;
+        if (atomic_load(&c->in_flight) > 0) {
+            flights_fail(flights_collect(c, sync_now_ms(), &timeout), ISOLATE_FAIL_DEADLINE);
+        }
+        if (timeout < 0 || timeout > WAIT_SLICE_MS) {
+            timeout = WAIT_SLICE_MS;
+        }
+        ring_sleep(&r->data_seq, &r->data_waiters, seen, (int)timeout);
+    }
+    free(rd.buf);
+}
+
+static void child_mark_dead(Child *c) {
+    atomic_store(&c->pid, 0);
+    atomic_store(&c->died, true);
+    ring_signal(&c->shared->to_host.data_seq, &c->shared->to_host.data_waiters);
+}
+
+// Host thread reading the zygote's reports.
+static void zygote_watch(void *arg) {
+    (void)arg;
+    ZygoteMsg msg;
+    for (;;) {
+        ssize_t got = recv(zygote_fd, &msg, sizeof(msg), 0);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got != (ssize_t)sizeof(msg)) {
+            break;
+        }
+        if (msg.child < 0 || msg.child >= child_count) {
+            continue;
+        }
+        Child *c = &children[msg.child];
+        if (msg.started) {
+            atomic_store(&c->started_ms, sync_now_ms());
+            atomic_store(&c->pid, msg.pid);
+            continue;
+        }
+        if (!atomic_load(&stopping)) {
+            if (msg.pid <= 0) {
+                fprintf(stderr, "isolate: cannot fork child %d\n", msg.child);
+            } else if (WIFSIGNALED(msg.status)) {
+                fprintf(stderr, "isolate: child %d (pid %d) killed by signal %d, restarting\n",
+                        msg.child, msg.pid, WTERMSIG(msg.status));
+            } else {
+                fprintf(stderr, "isolate: child %d (pid %d) exited with status %d, restarting\n",
+                        msg.child, msg.pid, WEXITSTATUS(msg.status));
+            }
+        }
+        child_mark_dead(c);
+    }
+    if (!atomic_load(&stopping)) {
+        fprintf(stderr, "isolate: zygote exited, isolated plugins are unavailable\n");
+    }
+    atomic_store(&broken, true);
+    for (int i = 0; i < child_count; ++i) {
+        child_mark_dead(&children[i]);
+    }
+}
+
+// ============================================================================
+// Zygote and child processes
+// ============================================================================
+
+// Closes everything inherited from the host but stdio and `keep`, so the
+// zygote and its children do not hold the host's sockets open.
+static void close_inherited_fds(int keep) {
+    DIR *dir = opendir("/proc/self/fd");
+    if (dir == NULL) {
+        return;
+    }
+    int dir_fd = dirfd(dir);
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+        int fd = atoi(ent->d_name);
+        if (fd > 2 && fd != keep && fd != dir_fd) {
+            close(fd);
+        }
+    }
+    closedir(dir);
+    int null_fd = open("/dev/null", O_RDONLY);
+    if (null_fd >= 0) {
+        dup2(null_fd, STDIN_FILENO);
+        if (null_fd != STDIN_FILENO) {
+            close(null_fd);
+        }
+    }
+}
+
+// Wakes the child's event loop whenever the host writes to its ring.
+static void child_watch(void *arg) {
+    (void)arg;
+    Ring *r = &self->to_child;
+    unsigned int seen = atomic_load(&r->data_seq);
+    for (;;) {
+        ring_sleep(&r->data_seq, &r->data_waiters, seen, -1);
+        unsigned int now = atomic_load(&r->data_seq);
+        if (now != seen) {
+            seen = now;
+            evloop_wake();
+        }
+    }
+}
+
+static void child_entry(int index, pid_t zygote) {
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    if (getppid() != zygote) {
+        _exit(0);
+    }
+    self = &shared_map[index];
+    evloop_init();
+    if (!sync_thread_start(&self_watcher, child_watch, NULL)) {
+        fprintf(stderr, "isolate: child %d cannot start its watcher\n", index);
+        _exit(1);
+    }
+    hooks.child_main(children[index].group);
+    fflush(NULL);
+    _exit(0);
+}
+
+static void zygote_report(int fd, int child, int pid, int status, bool started) {
+    ZygoteMsg msg = { .child = child, .pid = pid, .status = status, .started = started };
+    (void)!send(fd, &msg, sizeof(msg), MSG_NOSIGNAL);
+}
+
+static void zygote_main(int fd, pid_t host) {
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    if (getppid() != host) {
+        _exit(0);
+    }
+    // Our copies of the host's loop descriptors; closing them leaves the
+    // host's epoll set alone.
+    evloop_deinit();
+    close_inherited_fds(fd);
+    sigset_t chld, old;
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chld, &old);
+    int sig_fd = signalfd(-1, &chld, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (sig_fd < 0) {
+        fprintf(stderr, "isolate: zygote has no signalfd: %s\n", strerror(errno));
+        _exit(1);
+    }
+    pid_t pids[ISOLATE_MAX_CHILDREN] = { 0 };
+    bool closing = false;
+    unsigned long long closing_at = 0;
+    for (;;) {
+        int live = 0;
+        for (int i = 0; i < child_count; ++i) {
+            live += pids[i] > 0;
+        }
+        if (closing && live == 0) {
+            _exit(0);
+        }
+        int timeout = -1;
+        if (closing) {
+            unsigned long long now = sync_now_ms();
+            if (now >= closing_at + STOP_GRACE_MS) {
+                for (int i = 0; i < child_count; ++i) {
+                    if (pids[i] > 0) kill(pids[i], SIGKILL);
+                }
+                timeout = 100;
+            } else {
+                timeout = (int)(closing_at + STOP_GRACE_MS - now);
+            }
+        }
+        // Once closing, the host's end is shut and would poll readable forever.
+        struct pollfd pfd[2] = { { .fd = sig_fd, .events = POLLIN }, { .fd = fd, .events = POLLIN } };
+        if (poll(pfd, closing ? 1 : 2, timeout) < 0 && errno != EINTR) {
+            _exit(1);
+        }
+        if (!closing && pfd[1].revents != 0) {
+            ZygoteMsg msg;
+            ssize_t got = recv(fd, &msg, sizeof(msg), 0);
+            if (got == 0 || (got < 0 && errno != EINTR && errno != EAGAIN)) {
+                closing = true;
+                closing_at = sync_now_ms();
+            } else if (got == (ssize_t)sizeof(msg) && msg.child >= 0 && msg.child < child_count &&
+                       pids[msg.child] == 0) {
+                fflush(NULL);
+                pid_t pid = fork();
+                if (pid == 0) {
+                    close(sig_fd);
+                    close(fd);
+                    sigprocmask(SIG_SETMASK, &old, NULL);
+                    child_entry(msg.child, getppid());
+                }
+                if (pid > 0) {
+                    pids[msg.child] = pid;
+                }
+                zygote_report(fd, msg.child, pid, 0, pid > 0);
+            }
+        }
+        struct signalfd_siginfo info;
+        while (read(sig_fd, &info, sizeof(info)) > 0) {
+        }
+        int status;
+        pid_t pid;
+        while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+            for (int i = 0; i < child_count; ++i) {
+                if (pids[i] == pid) {
+                    pids[i] = 0;
+                    zygote_report(fd, i, pid, status, false);
+                }
+            }
+        }
+    }
+}
+
+// ============================================================================
+// API
+// ============================================================================
+
+bool isolate_start(const IsolateHooks *h, const unsigned int *processes, int groups) {
+    if (atomic_load(&running)) {
+        return true;
+    }
+    int total = 0;
+    for (int g = 0; g < groups; ++g) {
+        total += (int)processes[g];
+    }
+    if (total <= 0 || h == NULL || h->complete == NULL || h->fail == NULL || h->event == NULL ||
+        h->child_main == NULL) {
+        return false;
+    }
+    if (total > ISOLATE_MAX_CHILDREN) {
+        fprintf(stderr, "isolate: %d processes requested, starting %d\n", total, ISOLATE_MAX_CHILDREN);
+        total = ISOLATE_MAX_CHILDREN;
+    }
+    hooks = *h;
+    shared_map_len = sizeof(Shared) * (size_t)total;
+    void *map = mmap(NULL, shared_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "isolate: cannot map the rings: %s\n", strerror(errno));
+        return false;
+    }
+    shared_map = (Shared *)map;
+    child_count = 0;
+    for (int g = 0; g < groups; ++g) {
+        for (unsigned int k = 0; k < processes[g] && child_count < total; ++k) {
+            Child *c = &children[child_count];
+            memset(c, 0, sizeof(*c));
+            c->group = g;
+            c->shared = &shared_map[child_count];
+            sync_mutex_init(&c->send_lock);
+            sync_mutex_init(&c->flight_lock);
+            child_count++;
+        }
+    }
+    int pair[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, pair) != 0) {
+        fprintf(stderr, "isolate: socketpair failed: %s\n", strerror(errno));
+        munmap(map, shared_map_len);
+        shared_map = NULL;
+        return false;
+    }
+    pid_t host = getpid();
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(pair[0]);
+        zygote_main(pair[1], host);
+    }
+    close(pair[1]);
+    if (pid < 0) {
+        fprintf(stderr, "isolate: cannot fork the zygote: %s\n", strerror(errno));
+        close(pair[0]);
+        munmap(map, shared_map_len);
+        shared_map = NULL;
+        return false;
+    }
+    zygote_pid = pid;
+    zygote_fd = pair[0];
+    atomic_store(&stopping, false);
+    atomic_store(&broken, false);
+    atomic_store(&running, true);
+    if (!sync_thread_start(&zygote_monitor, zygote_watch, NULL)) {
+        fprintf(stderr, "isolate: cannot start the monitor thread\n");
+    }
+    for (int i = 0; i < child_count; ++i) {
+        if (!sync_thread_start(&children[i].reader, child_read, (void *)(intptr_t)i)) {
+            fprintf(stderr, "isolate: cannot start the reader for child %d\n", i);
+        }
+        zygote_send(i);
+    }
+    return true;
+}
+
+void isolate_stop(void) {
+    if (!atomic_load(&running)) {
+        return;
+    }
+    atomic_store(&stopping, true);
+    for (int i = 0; i < child_count; ++i) {
+        Shared *s = children[i].shared;
+        atomic_store(&s->stop, 1);
+        ring_signal(&s->to_child.data_seq, &s->to_child.data_waiters);
+        ring_signal(&s->to_host.data_seq, &s->to_host.data_waiters);
+    }
+    // The zygote waits for the children to leave, then exits; the readers
+    // keep draining meanwhile so nobody blocks on a full ring.
+    shutdown(zygote_fd, SHUT_WR);
+    sync_thread_join(zygote_monitor);
+    waitpid(zygote_pid, NULL, 0);
+    sync_mutex_lock(&zygote_lock);
+    close(zygote_fd);
+    zygote_fd = -1;
+    sync_mutex_unlock(&zygote_lock);
+    zygote_pid = -1;
+    atomic_store(&running, false);
+    for (int i = 0; i < child_count; ++i) {
+        Ring *r = &children[i].shared->to_host;
+        ring_signal(&r->data_seq, &r->data_waiters);
+        sync_thread_join(children[i].reader);
+    }
+    for (int i = 0; i < child_count; ++i) {
+        long long next_ms;
+        flights_fail(flights_collect(&children[i], 0, &next_ms), ISOLATE_FAIL_STOPPED);
+        sync_mutex_destroy(&children[i].send_lock);
+        sync_mutex_destroy(&children[i].flight_lock);
+    }
+    routes_drop(-1, NULL, false);
+    munmap(shared_map, shared_map_len);
+    shared_map = NULL;
+    child_count = 0;
+}
+
+bool isolate_running(void) {
+    return atomic_load(&running);
+}
+
+static IsolateStatus child_submit(int index, const IsolateCall *call, void *ctx) {
+    Child *c = &children[index];
+    Flight *f = (Flight *)malloc(sizeof(Flight));
+    if (f == NULL) {
+        return ISOLATE_BUSY;
+    }
+    IsolateStatus status = ISOLATE_OK;
+    sync_mutex_lock(&c->send_lock);
+    f->seq = ++c->next_seq;
+    f->deadline_ms = call->deadline_ms;
+    f->ctx = ctx;
+    Encoder e = { 0 };
+    enc_u64(&e, f->seq);
+    enc_u64(&e, call->deadline_ms);
+    enc_u64(&e, call->bytes);
+    enc_cstr(&e, call->id);
+    enc_cstr(&e, call->cmd);
+    enc_str(&e, call->payload ? call->payload : "", call->payload ? call->payload_len : 0);
+    enc_str(&e, call->data, call->data_len);
+    size_t frames = 0;
+    size_t total = parts_total(e.parts, e.count, &frames);
+    if (total + frames * FRAME_HEADER > ISOLATE_RING_BYTES) {
+        status = ISOLATE_TOO_LARGE;
+    } else if (!flight_add(c, f)) {
+        status = ISOLATE_BUSY;
+    } else if (!ring_put(&c->shared->to_child, MSG_REQUEST, e.parts, e.count, false)) {
+        flight_take(c, f->seq);
+        status = ISOLATE_BUSY;
+    }
+    sync_mutex_unlock(&c->send_lock);
+    if (status != ISOLATE_OK) {
+        free(f);
+    }
+    return status;
+}
+
+IsolateStatus isolate_submit(int group, const IsolateCall *call, void *ctx) {
+    if (!atomic_load(&running) || atomic_load(&broken)) {
+        return ISOLATE_DOWN;
+    }
+    // Prefer children that are up; a restarting one still queues the
+    // request in its ring for the next process.
+    int best = -1;
+    bool best_live = false;
+    unsigned int best_load = 0;
+    for (int i = 0; i < child_count; ++i) {
+        Child *c = &children[i];
+        if (c->group != group) {
+            continue;
+        }
+        bool live = atomic_load(&c->pid) > 0 && !atomic_load(&c->died);
+        unsigned int load = atomic_load(&c->in_flight);
+        if (best < 0 || (live && !best_live) || (live == best_live && load < best_load)) {
+            best = i;
+            best_live = live;
+            best_load = load;
+        }
+    }
+    return best < 0 ? ISOLATE_DOWN : child_submit(best, call, ctx);
+}
+
+IsolateStatus isolate_submit_stream(const char *escaped_id, size_t escaped_len, const IsolateCall *call, void *ctx) {
+    if (!atomic_load(&running)) {
+        return ISOLATE_DOWN;
+    }
+    int child = -1;
+    sync_mutex_lock(&route_lock);
+    for (StreamRoute *route = routes; route != NULL; route = route->next) {
+        if (strlen(route->escaped_id) == escaped_len && memcmp(route->escaped_id, escaped_id, escaped_len) == 0) {
+            child = route->child;
+            break;
+        }
+    }
+    sync_mutex_unlock(&route_lock);
+    return child < 0 ? ISOLATE_DOWN : child_submit(child, call, ctx);
+}
+
+void isolate_notify(const char *cmd, const char *id) {
+    if (!atomic_load(&running)) {
+        return;
+    }
+    Encoder e = { 0 };
+    enc_cstr(&e, cmd);
+    enc_cstr(&e, id);
+    for (int i = 0; i < child_count; ++i) {
+        Child *c = &children[i];
+        sync_mutex_lock(&c->send_lock);
+        bool sent = ring_put(&c->shared->to_child, MSG_NOTICE, e.parts, e.count, false);
+        sync_mutex_unlock(&c->send_lock);
+        if (!sent) {
+            fprintf(stderr, "isolate: ring of child %d full, dropping %s\n", i, cmd);
+        }
+    }
+}
+
+bool isolate_get_stats(int group, IsolateStats *stats) {
+    if (stats == NULL || !atomic_load(&running)) {
+        return false;
+    }
+    memset(stats, 0, sizeof(*stats));
+    for (int i = 0; i < child_count; ++i) {
+        Child *c = &children[i];
+        if (c->group == group) {
+            stats->processes++;
+            stats->in_flight += atomic_load(&c->in_flight);
+            stats->completed += atomic_load(&c->completed);
+            stats->restarts += atomic_load(&c->restarts);
+        }
+    }
+    return stats->processes > 0;
+}
+
+bool isolate_child_take(IsolateCall *call) {
+    if (self == NULL) {
+        return false;
+    }
+    for (;;) {
+        if (self_taken) {
+            self_reader.len = 0;
+            self_taken = false;
+        }
+        if (!ring_get(&self->to_child, &self_reader)) {
+            return false;
+        }
+        self_taken = true;
+        memset(call, 0, sizeof(*call));
+        Decoder d = { self_reader.buf, self_reader.buf + self_reader.len, true };
+        size_t len = 0;
+        if (self_reader.kind == MSG_NOTICE) {
+            call->notice = true;
+            call->cmd = dec_str(&d, &len);
+            call->id = dec_str(&d, &len);
+        } else if (self_reader.kind == MSG_REQUEST) {
+            call->seq = dec_u64(&d);
+            call->deadline_ms = dec_u64(&d);
+            call->bytes = dec_u64(&d) != 0;
+            call->id = dec_str(&d, &len);
+            call->cmd = dec_str(&d, &len);
+            call->payload = dec_str(&d, &call->payload_len);
+            call->data = dec_str(&d, &call->data_len);
+        } else {
+            d.ok = false;
+        }
+        if (d.ok && call->cmd != NULL && call->id != NULL) {
+            return true;
+        }
+        fprintf(stderr, "isolate: malformed message from the host\n");
+    }
+}
+
+bool isolate_child_stopping(void) {
+    return self == NULL || atomic_load(&self->stop) != 0;
+}
+
+static void child_send(unsigned int kind, Encoder *e) {
+    if (self == NULL) {
+        return;
+    }
+    sync_mutex_lock(&self_send_lock);
+    ring_put(&self->to_host, kind, e->parts, e->count, true);
+    sync_mutex_unlock(&self_send_lock);
+}
+
+void isolate_child_reply(unsigned long long seq, const char *content_type, const void *data, size_t len) {
+    Encoder e = { 0 };
+    enc_u64(&e, seq);
+    enc_cstr(&e, content_type);
+    enc_str(&e, data, len);
+    child_send(MSG_REPLY, &e);
+}
+
+void isolate_child_event(const char *request_id, const char *event, const char *data) {
+    Encoder e = { 0 };
+    enc_cstr(&e, request_id);
+    enc_cstr(&e, event);
+    enc_cstr(&e, data);
+    child_send(MSG_EVENT, &e);
+}
+
+void isolate_child_stream(const char *request_id, const char *escaped_id, bool open) {
+    Encoder e = { 0 };
+    enc_u64(&e, open);
+    enc_cstr(&e, request_id);
+    enc_cstr(&e, escaped_id);
+    child_send(MSG_STREAM, &e);
+}
+
+#else // no futexes: plugins stay in process
+
+bool isolate_start(const IsolateHooks *hooks, const unsigned int *processes, int groups) {
+    (void)hooks;
+    (void)processes;
+    (void)groups;
+    fprintf(stderr, "isolate: plugin processes are only supported on Linux\n");
+    return false;
+}
+
+void isolate_stop(void) {}
+bool isolate_running(void) { return false; }
+
+IsolateStatus isolate_submit(int group, const IsolateCall *call, void *ctx) {
+    (void)group;
+    (void)call;
+    (void)ctx;
+    return ISOLATE_DOWN;
+}
+
+IsolateStatus isolate_submit_stream(const char *escaped_id, size_t escaped_len, const IsolateCall *call, void *ctx) {
+    (void)escaped_id;
+    (void)escaped_len;
+    (void)call;
+    (void)ctx;
+    return ISOLATE_DOWN;
+}
+
+void isolate_notify(const char *cmd, const char *id) {
+    (void)cmd;
+    (void)id;
+}
+
+bool isolate_get_stats(int group, IsolateStats *stats) {
+    (void)group;
+    (void)stats;
+    return false;
+}
+
+bool isolate_child_take(IsolateCall *call) {
+    (void)call;
+    return false;
+}
+
+bool isolate_child_stopping(void) { return true; }
+
+void isolate_child_reply(unsigned long long seq, const char *content_type, const void *data, size_t len) {
+    (void)seq;
+    (void)content_type;
+    (void)data;
+    (void)len;
+}
+
+void isolate_child_event(const char *request_id, const char *event, const char *data) {
+    (void)request_id;
+    (void)event;
+    (void)data;
+}
+
+void isolate_child_stream(const char *request_id, const char *escaped_id, bool open) {
+    (void)request_id;
+    (void)escaped_id;
+    (void)open;
+}
+
+#endif
@@ -0,0 +1,107 @@
+#ifndef ISOLATE_H_
+#define ISOLATE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// ============================================================================
+// isolate.h - Plugin child processes over shared-memory rings
+// ============================================================================
+// Runs the commands of selected plugins in child processes, so a crash or a
+// stall there cannot take the UI down. isolate_start() forks a small zygote
+// while the caller is still quiet (no workers running); the zygote forks
+// every child and reports exits, so restarts never fork from a process full
+// of busy threads. Each child shares a pair of single-producer,
+// single-consumer byte rings with the host, mapped before the fork: requests
+// go one way and replies, events and stream notices the other. A side only
+// sleeps on a futex when its ring is empty (or full), and the other only
+// issues the wake syscall if someone is actually sleeping.
+//
+// Host side: one reader thread per child drains its replies and calls the
+// hooks from there. A dead child's requests are failed and the child is
+// forked again, with a growing delay if it keeps dying young.
+//
+// Linux only; elsewhere isolate_start() refuses and the plugins stay in
+// process.
+// ============================================================================
+
+#define ISOLATE_MAX_CHILDREN 16
+#define ISOLATE_RING_BYTES (1u << 22)   // per direction and child
+
+typedef enum {
+    ISOLATE_OK = 0,
+    ISOLATE_BUSY,        // ring or in-flight table full, try again later
+    ISOLATE_TOO_LARGE,   // the request can never fit in the ring
+    ISOLATE_DOWN,        // no child is left to take it
+} IsolateStatus;
+
+typedef enum {
+    ISOLATE_FAIL_CRASHED,    // the child died before replying
+    ISOLATE_FAIL_DEADLINE,   // the deadline passed without a reply
+    ISOLATE_FAIL_STOPPED,    // isolate_stop()
+} IsolateFailure;
+
+// A request or notice as it crosses the ring. On the child side the strings
+// point into a buffer that stays valid until the next isolate_child_take().
+typedef struct IsolateCall {
+    bool notice;                    // no reply expected (see isolate_notify())
+    bool bytes;                     // a binary call (Plugin.invoke_bytes)
+    unsigned long long seq;
+    unsigned long long deadline_ms;
+    const char *id;
+    const char *cmd;
+    const char *payload;
+    size_t payload_len;
+    const void *data;
+    size_t data_len;
+} IsolateCall;
+
+typedef struct IsolateHooks {
+    // Host side, on a child's reader thread. `ctx` is what was given to
+    // isolate_submit(); each gets exactly one of complete or fail.
+    void (*complete)(void *ctx, const char *content_type, const void *data, size_t len);
+    void (*fail)(void *ctx, IsolateFailure why);
+    void (*event)(const char *request_id, const char *event, const char *data);
+    // A stream the child had open is gone with it.
+    void (*stream_lost)(const char *request_id, const char *escaped_id);
+    // Child side: runs in the new process and serves requests until
+    // isolate_child_stopping(). The process exits when it returns.
+    void (*child_main)(int group);
+} IsolateHooks;
+
+// processes[g] children serve group g. Returns false (and starts nothing)
+// where isolation is unsupported or setup fails.
+bool isolate_start(const IsolateHooks *hooks, const unsigned int *processes, int groups);
+// Asks the children to finish, reaps them and fails what is still in flight.
+void isolate_stop(void);
+bool isolate_running(void);
+
+// Thread-safe. Picks the live child of `group` with the least in flight.
+IsolateStatus isolate_submit(int group, const IsolateCall *call, void *ctx);
+// Thread-safe. Like isolate_submit() but for the child that opened the
+// stream with this (JSON-escaped) id, ISOLATE_DOWN if no child did.
+IsolateStatus isolate_submit_stream(const char *escaped_id, size_t escaped_len, const IsolateCall *call, void *ctx);
+// Thread-safe, best effort: passes a builtin such as "__cancel" to every
+// child without waiting for replies.
+void isolate_notify(const char *cmd, const char *id);
+
+typedef struct IsolateStats {
+    unsigned int processes;
+    unsigned int in_flight;
+    unsigned long long completed;
+    unsigned long long restarts;
+} IsolateStats;
+
+bool isolate_get_stats(int group, IsolateStats *stats);
+
+// Child side. isolate_child_take() never blocks: the child sleeps in its
+// event loop, which a helper thread wakes when the host writes.
+bool isolate_child_take(IsolateCall *call);
+bool isolate_child_stopping(void);
+// Thread-safe; block while the host is behind. NULL data finishes the
+// request without a reply.
+void isolate_child_reply(unsigned long long seq, const char *content_type, const void *data, size_t len);
+void isolate_child_event(const char *request_id, const char *event, const char *data);
+void isolate_child_stream(const char *request_id, const char *escaped_id, bool open);
+
+#endif // ISOLATE_H_
@@ -7,10 +7,15 @@
 // ============================================================================
 
 #include "plug.h"
+#include "sync.h"
+#include "pool.h"
+#include "evloop.h"
+#include "isolate.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdatomic.h>
 
 #ifdef ANDROID
 #include <jni.h>
@@ -20,124 +25,3288 @@ extern void android_emit(const char *event, const char *data);
 #endif
 
 // Plugin registry - populated by constructor functions before main()
-#define MAX_PLUGINS 100
-static Plugin *registered_plugins[MAX_PLUGINS];
+typedef struct RegisteredPlugin {
+    Plugin *plugin;
+    PoolStrand *strand;    // PLUG_THREAD_STRAND only, while workers run
+    int isolation;         // group + 1, 0 = runs in this process
+} RegisteredPlugin;
+
+static RegisteredPlugin *registered_plugins = NULL;
 static int plugin_count = 0;
+static int plugin_capacity = 0;
+
+// Command table: open addressing with linear probing over interned keys.
+// A plugin's commands are entered as "plugin.command", and the plugin
+// itself as "plugin" so commands outside its table can still reach invoke.
+typedef struct CommandEntry {
+    char *key;             // NULL = empty slot
+    size_t key_len;
+    unsigned int hash;
+    int plugin;            // index into registered_plugins
+    const PlugCommand *command;   // NULL on the plugin's own entry
+} CommandEntry;
+
+static CommandEntry *command_table = NULL;
+static size_t command_capacity = 0;   // power of two
+static size_t command_count = 0;
 
 static void (*host_emit_event)(const char *event, const char *data_json) = NULL;
+static void (*host_emit_event_to)(const char *request_id, const char *event, const char *data_json) = NULL;
+// True in the child process of an isolated plugin (see isolate.h).
+static bool isolated_child = false;
+
+// Event policies. Each rule tracks a handful of (event, key) slots holding
+// the last delivery time and, when coalescing, the newest undelivered value.
+#define MAX_EVENT_POLICIES 32
+#define MAX_EVENT_SLOTS 64
+
+typedef struct EventSlot {
+    char *event;           // Concrete event name (rules may match a prefix)
+    char *key;             // Value of the key field, "" without one
+    char *pending;         // Held data when coalescing, NULL otherwise
+    unsigned long long last_ms;
+    bool sent;
+} EventSlot;
+
+typedef struct EventRule {
+    PlugEventPolicy policy;  // Strings owned by the rule
+    PlugEventStats stats;
+    EventSlot slots[MAX_EVENT_SLOTS];
+    int slot_count;
+} EventRule;
+
+static EventRule event_rules[MAX_EVENT_POLICIES];
+static int event_rule_count = 0;
+static SyncMutex event_lock = SYNC_MUTEX_INIT;
+
+// FNV-1a
+static unsigned int command_hash(const char *key, size_t len) {
+    unsigned int h = 2166136261u;
+    for (size_t i = 0; i < len; ++i) {
+        h = (h ^ (unsigned char)key[i]) * 16777619u;
+    }
+    return h;
+}
+
+static CommandEntry *command_find(const char *key, size_t len, unsigned int hash) {
+    if (command_capacity == 0) {
+        return NULL;
+    }
+    size_t mask = command_capacity - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        CommandEntry *e = &command_table[i];
+        if (e->key == NULL) {
+            return NULL;
+        }
+        if (e->hash == hash && e->key_len == len && memcmp(e->key, key, len) == 0) {
+            return e;
+        }
+    }
+}
+
+static bool command_grow(void) {
+    size_t capacity = command_capacity ? command_capacity * 2 : 64;
+    CommandEntry *table = (CommandEntry *)calloc(capacity, sizeof(CommandEntry));
+    if (table == NULL) {
+        return false;
+    }
+    for (size_t k = 0; k < command_capacity; ++k) {
+        if (command_table[k].key == NULL) {
+            continue;
+        }
+        size_t i = command_table[k].hash & (capacity - 1);
+        while (table[i].key != NULL) {
+            i = (i + 1) & (capacity - 1);
+        }
+        table[i] = command_table[k];
+    }
+    free(command_table);
+    command_table = table;
+    command_capacity = capacity;
+    return true;
+}
+
+// Enters "<plugin name>[.<command>]". The first registration of a name wins.
+static bool command_add(int plugin, const PlugCommand *command) {
+    const char *name = registered_plugins[plugin].plugin->name;
+    size_t name_len = strlen(name);
+    size_t len = command ? name_len + 1 + strlen(command->name) : name_len;
+    char *key = (char *)malloc(len + 1);
+    if (key == NULL) {
+        return false;
+    }
+    memcpy(key, name, name_len);
+    if (command) {
+        key[name_len] = '.';
+        strcpy(key + name_len + 1, command->name);
+    }
+    key[len] = '\0';
+    unsigned int hash = command_hash(key, len);
+    if (command_find(key, len, hash) != NULL) {
+        fprintf(stderr, "plug_register: duplicate command %s\n", key);
+        free(key);
+        return false;
+    }
+    // Kept at most half full so misses end quickly.
+    if ((command_count + 1) * 2 > command_capacity && !command_grow()) {
+        free(key);
+        return false;
+    }
+    size_t i = hash & (command_capacity - 1);
+    while (command_table[i].key != NULL) {
+        i = (i + 1) & (command_capacity - 1);
+    }
+    command_table[i] = (CommandEntry){ .key = key, .key_len = len, .hash = hash, .plugin = plugin, .command = command };
+    command_count++;
+    return true;
+}
+
+// Index of the plugin with this name, -1 if none.
+static int plug_find(const char *name) {
+    const CommandEntry *e = command_find(name, strlen(name), command_hash(name, strlen(name)));
+    return e != NULL && e->command == NULL ? e->plugin : -1;
+}
+
+void plug_register(Plugin *plugin) {
+    if (plugin == NULL || plugin->name == NULL || plugin->name[0] == '\0' || strchr(plugin->name, '.') != NULL) {
+        fprintf(stderr, "plug_register: invalid plugin\n");
+        return;
+    }
+    // Check for duplicate registration (can happen with hotreload)
+    if (plug_find(plugin->name) >= 0) {
+        return; // Already registered
+    }
+    if (plugin_count == plugin_capacity) {
+        int capacity = plugin_capacity ? plugin_capacity * 2 : 16;
+        RegisteredPlugin *grown = (RegisteredPlugin *)realloc(registered_plugins, capacity * sizeof(RegisteredPlugin));
+        if (grown == NULL) {
+            fprintf(stderr, "plug_register: out of memory\n");
+            return;
+        }
+        registered_plugins = grown;
+        plugin_capacity = capacity;
+    }
+    int index = plugin_count;
+    registered_plugins[index] = (RegisteredPlugin){ .plugin = plugin };
+    if (!command_add(index, NULL)) {
+        return;
+    }
+    plugin_count++;
+    for (const PlugCommand *c = plugin->commands; c != NULL && c->name != NULL; ++c) {
+        command_add(index, c);
+    }
+    printf("Plugin registered: %s (v%d)\n", plugin->name, plugin->version);
+}
+
+
+bool plug_load(const char *path) {
+    (void)path;
+    // TODO: Implement dynamic loading with dlopen/LoadLibrary
+    fprintf(stderr, "Dynamic plugin loading not implemented yet\n");
+    return false;
+}
+
+static char *plug_strndup(const char *s, size_t n) {
+    char *copy = (char *)malloc(n + 1);
+    if (copy != NULL) {
+        memcpy(copy, s, n);
+        copy[n] = '\0';
+    }
+    return copy;
+}
+
+static void plug_deliver_event(const char *event, const char *data) {
+#ifdef ANDROID
+    // Delegate Android emission to android_bridge.c helper
+    android_emit(event, data);
+#else
+    // host_emit_event queues onto the IPC outbox, so this is safe from any thread.
+    if (host_emit_event) {
+        host_emit_event(event, data);
+    }
+#endif
+}
+
+// Sends to the page that made `request_id`; hosts with a single page (or no
+// targeting hook) get a plain broadcast.
+static void plug_deliver_event_to(const char *request_id, const char *event, const char *data) {
+#ifdef ANDROID
+    (void)request_id;
+    android_emit(event, data);
+#else
+    if (host_emit_event_to) {
+        host_emit_event_to(request_id, event, data);
+    } else if (host_emit_event) {
+        host_emit_event(event, data);
+    }
+#endif
+}
+
+// Length of the page prefix of a request id (see PLUG_ORIGIN_SEP), 0 if it
+// has none.
+static size_t plug_origin_len(const char *id) {
+    const char *sep = strchr(id, PLUG_ORIGIN_SEP);
+    return sep ? (size_t)(sep - id) + 1 : 0;
+}
+
+static bool event_rule_matches(const EventRule *rule, const char *event) {
+    const char *name = rule->policy.event;
+    size_t len = strlen(name);
+    if (len > 0 && name[len - 1] == '*') {
+        return strncmp(name, event, len - 1) == 0;
+    }
+    return strcmp(name, event) == 0;
+}
+
+// Finds the raw value of a top-level field in a JSON object: a string
+// (quotes included), an object or array up to its closing bracket, or any
+// scalar up to the next ',' or '}'. Returns NULL when the field is missing.
+static const char *json_top_level_field(const char *json, const char *field, size_t *len) {
+    size_t field_len = strlen(field);
+    int depth = 0;
+    for (const char *p = json; *p; ++p) {
+        if (*p == '{' || *p == '[') {
+            depth++;
+        } else if (*p == '}' || *p == ']') {
+            depth--;
+        } else if (*p == '"') {
+            const char *start = p++;
+            while (*p && *p != '"') {
+                if (*p == '\\' && p[1]) p++;
+                p++;
+            }
+            if (!*p) {
+                return NULL;
+            }
+            if (depth != 1 || (size_t)(p - start - 1) != field_len || strncmp(start + 1, field, field_len) != 0) {
+                continue;
+            }
+            const char *q = p + 1;
+            while (*q == ' ' || *q == '\t' || *q == '\n' || *q == '\r') q++;
+            if (*q != ':') {
+                continue;
+            }
+            q++;
+            while (*q == ' ' || *q == '\t' || *q == '\n' || *q == '\r') q++;
+            const char *end = q;
+            if (*end == '"') {
+                end++;
+                while (*end && *end != '"') {
+                    if (*end == '\\' && end[1]) end++;
+                    end++;
+                }
+                if (*end) end++;
+            } else if (*end == '{' || *end == '[') {
+                int nested = 0;
+                for (; *end; ++end) {
+                    if (*end == '"') {
+                        for (++end; *end && *end != '"'; ++end) {
+                            if (*end == '\\' && end[1]) end++;
+                        }
+                        if (!*end) break;
+                    } else if (*end == '{' || *end == '[') {
+                        nested++;
+                    } else if ((*end == '}' || *end == ']') && --nested == 0) {
+                        end++;
+                        break;
+                    }
+                }
+            } else {
+                while (*end && *end != ',' && *end != '}' && *end != ']') end++;
+            }
+            *len = (size_t)(end - q);
+            return q;
+        }
+    }
+    return NULL;
+}
+
+// Returns the slot for (event, key), creating it or recycling the least
+// recently used idle slot. Caller holds event_lock.
+static EventSlot *event_rule_slot(EventRule *rule, const char *event, const char *key, size_t key_len) {
+    EventSlot *victim = NULL;
+    for (int i = 0; i < rule->slot_count; ++i) {
+        EventSlot *slot = &rule->slots[i];
+        if (strcmp(slot->event, event) == 0 && strlen(slot->key) == key_len &&
+            strncmp(slot->key, key, key_len) == 0) {
+            return slot;
+        }
+        if (slot->pending == NULL && (victim == NULL || slot->last_ms < victim->last_ms)) {
+            victim = slot;
+        }
+    }
+    if (rule->slot_count < MAX_EVENT_SLOTS) {
+        victim = &rule->slots[rule->slot_count++];
+    } else if (victim != NULL) {
+        free(victim->event);
+        free(victim->key);
+    } else {
+        return NULL;
+    }
+    memset(victim, 0, sizeof(*victim));
+    victim->event = plug_strndup(event, strlen(event));
+    victim->key = plug_strndup(key, key_len);
+    if (victim->event == NULL || victim->key == NULL) {
+        free(victim->event);
+        free(victim->key);
+        // Keep the slot array dense: move the last slot into the hole.
+        *victim = rule->slots[--rule->slot_count];
+        return NULL;
+    }
+    return victim;
+}
+
+static void event_rule_free(EventRule *rule) {
+    for (int i = 0; i < rule->slot_count; ++i) {
+        free(rule->slots[i].event);
+        free(rule->slots[i].key);
+        free(rule->slots[i].pending);
+    }
+    free((char *)rule->policy.event);
+    free((char *)rule->policy.key_field);
+    memset(rule, 0, sizeof(*rule));
+}
+
+bool plug_set_event_policy(const PlugEventPolicy *policy) {
+    if (policy == NULL || policy->event == NULL || policy->event[0] == '\0') {
+        return false;
+    }
+    bool has_key = policy->key_field != NULL && policy->key_field[0] != '\0';
+    char *event = plug_strndup(policy->event, strlen(policy->event));
+    char *key_field = has_key ? plug_strndup(policy->key_field, strlen(policy->key_field)) : NULL;
+    if (event == NULL || (has_key && key_field == NULL)) {
+        free(event);
+        free(key_field);
+        return false;
+    }
+    sync_mutex_lock(&event_lock);
+    EventRule *rule = NULL;
+    for (int i = 0; i < event_rule_count; ++i) {
+        if (strcmp(event_rules[i].policy.event, policy->event) == 0) {
+            rule = &event_rules[i];
+            event_rule_free(rule);
+            break;
+        }
+    }
+    if (rule == NULL) {
+        if (event_rule_count >= MAX_EVENT_POLICIES) {
+            sync_mutex_unlock(&event_lock);
+            free(event);
+            free(key_field);
+            fprintf(stderr, "plug_set_event_policy: too many policies\n");
+            return false;
+        }
+        rule = &event_rules[event_rule_count++];
+    }
+    rule->policy = *policy;
+    rule->policy.event = event;
+    rule->policy.key_field = key_field;
+    sync_mutex_unlock(&event_lock);
+    return true;
+}
+
+bool plug_get_event_stats(const char *event, PlugEventStats *stats) {
+    if (event == NULL || stats == NULL) {
+        return false;
+    }
+    bool found = false;
+    sync_mutex_lock(&event_lock);
+    for (int i = 0; i < event_rule_count; ++i) {
+        if (strcmp(event_rules[i].policy.event, event) == 0) {
+            *stats = event_rules[i].stats;
+            found = true;
+            break;
+        }
+    }
+    sync_mutex_unlock(&event_lock);
+    return found;
+}
+
+// Parses CROSSWEB_EVENT_POLICY: "name=rate[/last][:field]" entries separated by ';'.
+static void plug_load_event_policies_from_env(void) {
+    const char *spec = getenv("CROSSWEB_EVENT_POLICY");
+    if (spec == NULL) {
+        return;
+    }
+    while (*spec) {
+        size_t entry_len = strcspn(spec, ";");
+        char entry[256];
+        if (entry_len > 0 && entry_len < sizeof(entry)) {
+            memcpy(entry, spec, entry_len);
+            entry[entry_len] = '\0';
+            char *eq = strchr(entry, '=');
+            if (eq != NULL) {
+                *eq = '\0';
+                char *rest = eq + 1;
+                char *colon = strchr(rest, ':');
+                if (colon != NULL) {
+                    *colon = '\0';
+                }
+                PlugEventPolicy policy = {
+                    .event = entry,
+                    .max_rate_hz = (unsigned int)strtoul(rest, NULL, 10),
+                    .coalesce = strstr(rest, "/last") != NULL,
+                    .key_field = colon ? colon + 1 : NULL,
+                };
+                plug_set_event_policy(&policy);
+            } else {
+                fprintf(stderr, "CROSSWEB_EVENT_POLICY: ignoring '%s'\n", entry);
+            }
+        }
+        spec += entry_len;
+        if (*spec == ';') {
+            spec++;
+        }
+    }
+}
+
+// Applies the matching policy. Returns true when the event should be
+// delivered right away.
+static bool plug_filter_event(const char *event, const char *data) {
+    sync_mutex_lock(&event_lock);
+    EventRule *rule = NULL;
+    for (int i = 0; i < event_rule_count; ++i) {
+        if (event_rule_matches(&event_rules[i], event)) {
+            rule = &event_rules[i];
+            break;
+        }
+    }
+    if (rule == NULL) {
+        sync_mutex_unlock(&event_lock);
+        return true;
+    }
+    rule->stats.emitted++;
+    const char *key = "";
+    size_t key_len = 0;
+    if (rule->policy.key_field != NULL) {
+        const char *value = json_top_level_field(data, rule->policy.key_field, &key_len);
+        if (value != NULL) {
+            key = value;
+        }
+    }
+    bool deliver = false;
+    EventSlot *slot = event_rule_slot(rule, event, key, key_len);
+    if (slot == NULL) {
+        rule->stats.dropped++;
+    } else {
+        unsigned long long now = sync_now_ms();
+        unsigned int rate = rule->policy.max_rate_hz;
+        bool due = !slot->sent || (rate != 0 && now - slot->last_ms >= 1000ull / rate);
+        if (rate == 0 && !rule->policy.coalesce) {
+            due = true;
+        }
+        if (due && slot->pending == NULL && (rate != 0 || !rule->policy.coalesce)) {
+            slot->sent = true;
+            slot->last_ms = now;
+            rule->stats.delivered++;
+            deliver = true;
+        } else if (rule->policy.coalesce) {
+            char *copy = plug_strndup(data, strlen(data));
+            if (copy == NULL) {
+                rule->stats.dropped++;
+            } else {
+                if (slot->pending != NULL) {
+                    free(slot->pending);
+                    rule->stats.coalesced++;
+                }
+                slot->pending = copy;
+            }
+        } else {
+            rule->stats.dropped++;
+        }
+    }
+    sync_mutex_unlock(&event_lock);
+    if (!deliver) {
+        evloop_wake();   // the flush deadline may be sooner than the loop's
+    }
+    return deliver;
+}
+
+// Milliseconds until plug_flush_events() has something to release.
+static long long plug_events_timeout_ms(unsigned long long now) {
+    long long timeout = -1;
+    sync_mutex_lock(&event_lock);
+    for (int r = 0; r < event_rule_count && timeout != 0; ++r) {
+        EventRule *rule = &event_rules[r];
+        unsigned int rate = rule->policy.max_rate_hz;
+        for (int i = 0; i < rule->slot_count; ++i) {
+            EventSlot *slot = &rule->slots[i];
+            if (slot->pending == NULL) {
+                continue;
+            }
+            long long due = 0;
+            if (rate != 0 && slot->sent) {
+                unsigned long long at = slot->last_ms + 1000ull / rate;
+                due = at > now ? (long long)(at - now) : 0;
+            }
+            if (timeout < 0 || due < timeout) {
+                timeout = due;
+            }
+        }
+    }
+    sync_mutex_unlock(&event_lock);
+    return timeout;
+}
+
+typedef struct HeldEvent {
+    char *event;
+    char *data;
+} HeldEvent;
+
+// Delivers coalesced events whose rate window has passed. Runs every tick.
+static void plug_flush_events(void) {
+    HeldEvent held[64];
+    int held_count;
+    do {
+        held_count = 0;
+        unsigned long long now = sync_now_ms();
+        sync_mutex_lock(&event_lock);
+        for (int r = 0; r < event_rule_count && held_count < 64; ++r) {
+            EventRule *rule = &event_rules[r];
+            unsigned int rate = rule->policy.max_rate_hz;
+            for (int i = 0; i < rule->slot_count && held_count < 64; ++i) {
+                EventSlot *slot = &rule->slots[i];
+                if (slot->pending == NULL) {
+                    continue;
+                }
+                if (rate != 0 && slot->sent && now - slot->last_ms < 1000ull / rate) {
+                    continue;
+                }
+                char *event = plug_strndup(slot->event, strlen(slot->event));
+                if (event == NULL) {
+                    continue;
+                }
+                held[held_count].event = event;
+                held[held_count].data = slot->pending;
+                held_count++;
+                slot->pending = NULL;
+                slot->sent = true;
+                slot->last_ms = now;
+                rule->stats.delivered++;
+            }
+        }
+        sync_mutex_unlock(&event_lock);
+        for (int i = 0; i < held_count; ++i) {
+            plug_deliver_event(held[i].event, held[i].data);
+            free(held[i].event);
+            free(held[i].data);
+        }
+    } while (held_count == 64);
+}
+
+// ============================================================================
+// Streams
+// ============================================================================
+
+#define STREAM_ID_CAP 64
+#define STREAM_INITIAL_CREDIT 8
+#define STREAM_MAX_CREDIT (1u << 20)
+
+struct PlugStream {
+    struct PlugStream *next;
+    char id[STREAM_ID_CAP];   // JSON-escaped request id
+    char request_id[STREAM_ID_CAP];  // as given, for routing events back
+    PlugStreamOps ops;
+    void *user;
+    unsigned int credit;
+    unsigned long long seq;
+    bool finished;            // end/error sent or cancelled; awaiting close
+    bool cancelled;
+};
+
+static PlugStream *streams = NULL;
+static SyncMutex stream_lock = SYNC_MUTEX_INIT;
+
+// The request being dispatched on this thread, so plug_stream_open() can
+// answer it without changing the Plugin.invoke signature.
+static SYNC_THREAD_LOCAL const PlugRequest *current_request = NULL;
+static SYNC_THREAD_LOCAL PlugHandle *current_handle = NULL;
+
+static bool handle_finish(PlugHandle *handle, const char *content_type, const void *data, size_t len);
+static bool plug_handle_completed(PlugHandle *handle);
+static bool plug_handle_in_process(PlugHandle *handle);
+
+// Copies `s` with '"', '\\' and control characters escaped. Returns false
+// if it does not fit.
+static bool json_escape_into(char *out, size_t cap, const char *s) {
+    static const char hex[] = "0123456789abcdef";
+    size_t o = 0;
+    for (; *s; ++s) {
+        unsigned char c = (unsigned char)*s;
+        size_t need = (c == '"' || c == '\\') ? 2 : (c < 0x20 ? 6 : 1);
+        if (o + need >= cap) {
+            return false;
+        }
+        if (need == 2) {
+            out[o++] = '\\';
+            out[o++] = (char)c;
+        } else if (need == 6) {
+            memcpy(out + o, "\\u00", 4);
+            out[o + 4] = hex[c >> 4];
+            out[o + 5] = hex[c & 0xF];
+            o += 6;
+        } else {
+            out[o++] = (char)c;
+        }
+    }
+    out[o] = '\0';
+    return true;
+}
+
+// Sends one "__stream" event. Caller holds stream_lock so chunks of a stream
+// reach the outbox in order.
+static void stream_send(const PlugStream *stream, const char *fmt, const char *value) {
+    int needed = snprintf(NULL, 0, fmt, stream->id, stream->seq, value ? value : "");
+    if (needed <= 0) {
+        return;
+    }
+    char *data = (char *)malloc((size_t)needed + 1);
+    if (data == NULL) {
+        fprintf(stderr, "plug_stream: out of memory\n");
+        return;
+    }
+    snprintf(data, (size_t)needed + 1, fmt, stream->id, stream->seq, value ? value : "");
+    plug_deliver_event_to(stream->request_id, "__stream", data);
+    free(data);
+}
+
+PlugStream *plug_stream_open(const PlugStreamOps *ops, void *user) {
+    if (current_request == NULL || current_request->id == NULL || current_handle == NULL ||
+        plug_handle_completed(current_handle)) {
+        fprintf(stderr, "plug_stream_open: not called from Plugin.invoke\n");
+        return NULL;
+    }
+    if (plug_handle_in_process(current_handle)) {
+        // Batch entries, pipeline steps and coroutine sub-requests take
+        // exactly one reply.
+        fprintf(stderr, "plug_stream_open: %s was not called from the page\n", current_request->cmd);
+        return NULL;
+    }
+    PlugStream *stream = (PlugStream *)calloc(1, sizeof(PlugStream));
+    if (stream == NULL) {
+        return NULL;
+    }
+    size_t request_id_len = strlen(current_request->id);
+    if (request_id_len >= sizeof(stream->request_id) ||
+        !json_escape_into(stream->id, sizeof(stream->id), current_request->id)) {
+        free(stream);
+        return NULL;
+    }
+    memcpy(stream->request_id, current_request->id, request_id_len + 1);
+    if (ops != NULL) {
+        stream->ops = *ops;
+    }
+    stream->user = user;
+    stream->credit = STREAM_INITIAL_CREDIT;
+
+    // The host must know where the stream lives before the page can send
+    // credit for it.
+    if (isolated_child) {
+        isolate_child_stream(stream->request_id, stream->id, true);
+    }
+    // Answer the request before the first chunk can be queued behind it.
+    char marker[STREAM_ID_CAP + 64];
+    snprintf(marker, sizeof(marker), "{\"$stream\":\"%s\",\"credit\":%u}", stream->id, STREAM_INITIAL_CREDIT);
+    sync_mutex_lock(&stream_lock);
+    handle_finish(current_handle, NULL, marker, strlen(marker));
+    stream->next = streams;
+    streams = stream;
+    sync_mutex_unlock(&stream_lock);
+    evloop_wake();
+    return stream;
+}
+
+unsigned int plug_stream_credit(PlugStream *stream) {
+    if (stream == NULL) {
+        return 0;
+    }
+    sync_mutex_lock(&stream_lock);
+    unsigned int credit = stream->finished ? 0 : stream->credit;
+    sync_mutex_unlock(&stream_lock);
+    return credit;
+}
+
+bool plug_stream_write(PlugStream *stream, const char *chunk_json) {
+    if (stream == NULL || chunk_json == NULL) {
+        return false;
+    }
+    sync_mutex_lock(&stream_lock);
+    bool ok = !stream->finished && stream->credit > 0;
+    if (ok) {
+        stream->credit--;
+        stream_send(stream, "{\"id\":\"%s\",\"seq\":%llu,\"chunk\":%s}", chunk_json);
+        stream->seq++;
+    }
+    sync_mutex_unlock(&stream_lock);
+    return ok;
+}
+
+static void stream_finish(PlugStream *stream, const char *error_json) {
+    if (stream == NULL) {
+        return;
+    }
+    sync_mutex_lock(&stream_lock);
+    if (!stream->finished) {
+        stream->finished = true;
+        if (error_json != NULL) {
+            stream_send(stream, "{\"id\":\"%s\",\"seq\":%llu,\"error\":%s}", error_json);
+        } else {
+            stream_send(stream, "{\"id\":\"%s\",\"seq\":%llu,\"end\":true%s}", NULL);
+        }
+    }
+    sync_mutex_unlock(&stream_lock);
+    evloop_wake();   // the close callback runs on the loop
+}
+
+void plug_stream_end(PlugStream *stream) {
+    stream_finish(stream, NULL);
+}
+
+void plug_stream_error(PlugStream *stream, const char *error_json) {
+    stream_finish(stream, error_json ? error_json : "null");
+}
+
+// Pulls from streams that have credit and closes finished ones. UI thread.
+static void plug_pump_streams(void) {
+    sync_mutex_lock(&stream_lock);
+    PlugStream *head = streams;
+    sync_mutex_unlock(&stream_lock);
+    // Only this function unlinks streams, so the chain from `head` stays
+    // valid; streams opened meanwhile are picked up next tick.
+    for (PlugStream *s = head; s != NULL; s = s->next) {
+        if (s->ops.pull != NULL && plug_stream_credit(s) > 0) {
+            s->ops.pull(s, s->user);
+        }
+    }
+
+    PlugStream *closed = NULL;
+    sync_mutex_lock(&stream_lock);
+    for (PlugStream **link = &streams; *link != NULL;) {
+        PlugStream *s = *link;
+        if (s->finished) {
+            *link = s->next;
+            s->next = closed;
+            closed = s;
+        } else {
+            link = &s->next;
+        }
+    }
+    sync_mutex_unlock(&stream_lock);
+    while (closed != NULL) {
+        PlugStream *s = closed;
+        closed = s->next;
+        if (s->ops.close != NULL) {
+            s->ops.close(s, s->user, s->cancelled);
+        }
+        if (isolated_child) {
+            isolate_child_stream(s->request_id, s->id, false);
+        }
+        free(s);
+    }
+}
+
+static void plug_close_all_streams(void) {
+    sync_mutex_lock(&stream_lock);
+    for (PlugStream *s = streams; s != NULL; s = s->next) {
+        if (!s->finished) {
+            s->finished = true;
+            s->cancelled = true;
+        }
+    }
+    sync_mutex_unlock(&stream_lock);
+    plug_pump_streams();
+}
+
+// Builtins the page uses to drive streams: "__stream.credit" with
+// {"id":...,"n":...} and "__stream.cancel" with {"id":...}.
+static void plug_stream_builtin(const char *subcmd, const char *payload, RespondCallback respond) {
+    size_t id_len = 0, n_len = 0;
+    const char *id = json_top_level_field(payload, "id", &id_len);
+    const char *n = json_top_level_field(payload, "n", &n_len);
+    if (id == NULL || id_len < 2 || id[0] != '"') {
+        if (respond) respond("{\"error\":\"invalid payload\"}");
+        return;
+    }
+    id++;
+    id_len -= 2;
+    bool credit = strcmp(subcmd, "credit") == 0;
+    if (!credit && strcmp(subcmd, "cancel") != 0) {
+        if (respond) respond("{\"error\":\"unknown command\"}");
+        return;
+    }
+    bool found = false;
+    sync_mutex_lock(&stream_lock);
+    for (PlugStream *s = streams; s != NULL; s = s->next) {
+        if (strlen(s->id) != id_len || strncmp(s->id, id, id_len) != 0) {
+            continue;
+        }
+        found = true;
+        if (credit) {
+            unsigned long grant = n ? strtoul(n, NULL, 10) : 0;
+            unsigned long total = (unsigned long)s->credit + grant;
+            s->credit = total > STREAM_MAX_CREDIT ? STREAM_MAX_CREDIT : (unsigned int)total;
+        } else if (!s->finished) {
+            s->finished = true;
+            s->cancelled = true;
+        }
+        break;
+    }
+    sync_mutex_unlock(&stream_lock);
+    if (found) {
+        evloop_wake();
+    }
+    if (respond) respond(found ? "{\"ok\":true}" : "{\"ok\":false,\"error\":\"unknown stream\"}");
+}
+
+// Streams with credit are pulled on every tick, finished ones closed.
+static bool plug_streams_busy(void) {
+    bool busy = false;
+    sync_mutex_lock(&stream_lock);
+    for (PlugStream *s = streams; s != NULL && !busy; s = s->next) {
+        busy = s->finished || (s->ops.pull != NULL && s->credit > 0);
+    }
+    sync_mutex_unlock(&stream_lock);
+    return busy;
+}
+
+// ============================================================================
+// Cancellation tokens
+// ============================================================================
+// Every dispatched request gets a token, registered by id while it runs so a
+// "__cancel" from the page (possibly on another thread) can find it. Cancels
+// for ids not running yet are remembered briefly, because on hosts without a
+// queue the cancel may overtake the request it targets.
+// ============================================================================
+
+#define CANCEL_TOMBSTONES 16
+
+struct PlugCancelToken {
+    PlugCancelToken *next;
+    atomic_int refs;
+    atomic_bool cancelled;
+    unsigned long long deadline_ms;
+    char id[];
+};
+
+static PlugCancelToken *tokens = NULL;
+static SyncMutex token_lock = SYNC_MUTEX_INIT;
+static char cancel_tombstones[CANCEL_TOMBSTONES][STREAM_ID_CAP];
+static int cancel_tombstone_next = 0;
+static SYNC_THREAD_LOCAL PlugCancelToken *current_token = NULL;
+
+static const char cancelled_json[] = "{\"ok\":false,\"error\":\"cancelled\",\"cancelled\":true}";
+static const char deadline_json[] = "{\"ok\":false,\"error\":\"deadline exceeded\",\"timeout\":true}";
+
+static PlugCancelToken *cancel_token_register(const PlugRequest *req) {
+    const char *id = req->id ? req->id : "";
+    size_t id_len = strlen(id);
+    PlugCancelToken *token = (PlugCancelToken *)malloc(sizeof(*token) + id_len + 1);
+    if (token == NULL) {
+        return NULL;
+    }
+    atomic_init(&token->refs, 1);
+    atomic_init(&token->cancelled, false);
+    token->deadline_ms = req->deadline_ms;
+    memcpy(token->id, id, id_len + 1);
+    sync_mutex_lock(&token_lock);
+    for (int i = 0; i < CANCEL_TOMBSTONES; ++i) {
+        if (id_len > 0 && strcmp(cancel_tombstones[i], id) == 0) {
+            cancel_tombstones[i][0] = '\0';
+            atomic_store_explicit(&token->cancelled, true, memory_order_relaxed);
+        }
+    }
+    token->next = tokens;
+    tokens = token;
+    sync_mutex_unlock(&token_lock);
+    return token;
+}
+
+static void cancel_token_unregister(PlugCancelToken *token) {
+    if (token == NULL) {
+        return;
+    }
+    sync_mutex_lock(&token_lock);
+    for (PlugCancelToken **it = &tokens; *it != NULL; it = &(*it)->next) {
+        if (*it == token) {
+            *it = token->next;
+            break;
+        }
+    }
+    sync_mutex_unlock(&token_lock);
+}
+
+PlugCancelToken *plug_cancel_token(void) {
+    return current_token;
+}
+
+void plug_cancel_token_retain(PlugCancelToken *token) {
+    if (token != NULL) {
+        atomic_fetch_add_explicit(&token->refs, 1, memory_order_relaxed);
+    }
+}
+
+void plug_cancel_token_release(PlugCancelToken *token) {
+    if (token != NULL && atomic_fetch_sub_explicit(&token->refs, 1, memory_order_acq_rel) == 1) {
+        free(token);
+    }
+}
+
+bool plug_cancel_token_cancelled(const PlugCancelToken *token) {
+    if (token == NULL) {
+        return false;
+    }
+    if (atomic_load_explicit(&token->cancelled, memory_order_relaxed)) {
+        return true;
+    }
+    return token->deadline_ms != 0 && sync_now_ms() >= token->deadline_ms;
+}
+
+unsigned long long plug_cancel_token_deadline_ms(const PlugCancelToken *token) {
+    return token ? token->deadline_ms : 0;
+}
+
+bool plug_cancelled(void) {
+    return plug_cancel_token_cancelled(current_token);
+}
+
+// "__cancel" with the target request id as its (plain string) payload. Flags
+// the running request and cancels a stream answering it, if any.
+static void plug_cancel_builtin(const char *id, RespondCallback respond) {
+    bool found = false;
+    sync_mutex_lock(&token_lock);
+    for (PlugCancelToken *t = tokens; t != NULL; t = t->next) {
+        if (strcmp(t->id, id) == 0) {
+            atomic_store_explicit(&t->cancelled, true, memory_order_relaxed);
+            found = true;
+        }
+    }
+    sync_mutex_unlock(&token_lock);
+
+    char escaped[STREAM_ID_CAP];
+    if (json_escape_into(escaped, sizeof(escaped), id)) {
+        sync_mutex_lock(&stream_lock);
+        for (PlugStream *st = streams; st != NULL; st = st->next) {
+            if (strcmp(st->id, escaped) == 0 && !st->finished) {
+                st->finished = true;
+                st->cancelled = true;
+                found = true;
+            }
+        }
+        sync_mutex_unlock(&stream_lock);
+    }
+    if (found) {
+        evloop_wake();   // waiting coroutines and streams react on the loop
+    }
+
+    if (!found && id[0] != '\0' && strlen(id) < STREAM_ID_CAP) {
+        sync_mutex_lock(&token_lock);
+        strcpy(cancel_tombstones[cancel_tombstone_next], id);
+        cancel_tombstone_next = (cancel_tombstone_next + 1) % CANCEL_TOMBSTONES;
+        sync_mutex_unlock(&token_lock);
+    }
+    if (respond) respond("{\"ok\":true}");
+}
+
+// "__window.closed", sent by the host with an id carrying the closed page's
+// prefix: flags every request still running for that page and cancels its
+// streams. Ids without a prefix name no page, so nothing is touched.
+static void plug_window_closed_builtin(const char *id, RespondCallback respond) {
+    size_t origin_len = plug_origin_len(id);
+    if (origin_len > 0) {
+        sync_mutex_lock(&token_lock);
+        for (PlugCancelToken *t = tokens; t != NULL; t = t->next) {
+            if (strncmp(t->id, id, origin_len) == 0) {
+                atomic_store_explicit(&t->cancelled, true, memory_order_relaxed);
+            }
+        }
+        sync_mutex_unlock(&token_lock);
+        sync_mutex_lock(&stream_lock);
+        for (PlugStream *st = streams; st != NULL; st = st->next) {
+            if (strncmp(st->request_id, id, origin_len) == 0 && !st->finished) {
+                st->finished = true;
+                st->cancelled = true;
+            }
+        }
+        sync_mutex_unlock(&stream_lock);
+        evloop_wake();
+    }
+    if (respond) respond("{\"ok\":true}");
+}
+
+// ============================================================================
+// Request handles
+// ============================================================================
+// Every dispatched request is wrapped in a handle that routes its one reply
+// to the host. The dispatcher holds one reference for the duration of the
+// invoke and plug_defer() hands a second one to the plugin, dropped by
+// plug_complete(), so either side may finish last.
+// ============================================================================
+
+struct PlugHandle {
+    PlugHandle *next;              // outstanding list, deferred handles only
+    void *host_ctx;
+    PlugHostComplete complete;     // host_complete, or an in-process caller's hook
+    RespondCallback respond;       // used when there is no completion hook
+    RespondBytesCallback respond_bytes;
+    PlugCancelToken *token;
+    atomic_int refs;
+    atomic_bool completed;
+    bool deferred;
+};
+
+static PlugHostComplete host_complete = NULL;
+static PlugHandle *outstanding = NULL;
+static size_t outstanding_count = 0;
+static SyncMutex handle_lock = SYNC_MUTEX_INIT;
+
+static void handle_unref(PlugHandle *handle) {
+    if (atomic_fetch_sub_explicit(&handle->refs, 1, memory_order_acq_rel) == 1) {
+        plug_cancel_token_release(handle->token);
+        free(handle);
+    }
+}
+
+// Sends a reply for a request that never got a handle.
+static void reply_without_handle(const PlugRequest *req, RespondCallback respond,
+                                 RespondBytesCallback respond_bytes, const char *json) {
+    if (req != NULL && req->host_ctx != NULL && host_complete != NULL) {
+        host_complete(req->host_ctx, NULL, json, strlen(json));
+    } else if (respond != NULL) {
+        respond(json);
+    } else if (respond_bytes != NULL) {
+        respond_bytes("application/json", json, strlen(json));
+    }
+}
+
+static PlugHandle *handle_begin(const PlugRequest *req, RespondCallback respond, RespondBytesCallback respond_bytes,
+                                PlugHostComplete complete) {
+    PlugHandle *handle = (PlugHandle *)calloc(1, sizeof(PlugHandle));
+    if (handle == NULL) {
+        return NULL;
+    }
+    handle->host_ctx = req->host_ctx;
+    if (req->host_ctx != NULL) {
+        handle->complete = complete ? complete : host_complete;
+    }
+    handle->respond = respond;
+    handle->respond_bytes = respond_bytes;
+    atomic_init(&handle->refs, 1);
+    atomic_init(&handle->completed, false);
+    handle->token = cancel_token_register(req);
+    return handle;
+}
+
+static bool plug_handle_completed(PlugHandle *handle) {
+    return atomic_load_explicit(&handle->completed, memory_order_acquire);
+}
+
+// True for requests made from inside plug.c, which install their own hook.
+static bool plug_handle_in_process(PlugHandle *handle) {
+    return handle->complete != NULL && handle->complete != host_complete;
+}
+
+static bool handle_finish(PlugHandle *handle, const char *content_type, const void *data, size_t len) {
+    if (handle == NULL || atomic_exchange_explicit(&handle->completed, true, memory_order_acq_rel)) {
+        return false;
+    }
+    if (handle->complete != NULL) {
+        handle->complete(handle->host_ctx, content_type, data, len);
+    } else if (data != NULL && content_type == NULL) {
+        if (handle->respond) handle->respond((const char *)data);
+        else if (handle->respond_bytes) handle->respond_bytes("application/json", data, len);
+    } else if (data != NULL) {
+        if (handle->respond_bytes) handle->respond_bytes(content_type, data, len);
+        else if (handle->respond) handle->respond("{\"error\":\"binary reply not supported by host\"}");
+    }
+    // The token stays with the handle but stops receiving cancels.
+    cancel_token_unregister(handle->token);
+    return true;
+}
+
+// After the invoke returned: a request that was neither answered nor
+// deferred is finished without a reply, as hosts always expect.
+static void handle_end(PlugHandle *handle) {
+    if (!handle->deferred) {
+        handle_finish(handle, NULL, NULL, 0);
+    }
+    handle_unref(handle);
+}
+
+static void plug_respond_current(const char *response) {
+    handle_finish(current_handle, NULL, response, response ? strlen(response) : 0);
+}
+
+static void plug_respond_bytes_current(const char *content_type, const void *data, size_t len) {
+    handle_finish(current_handle, content_type ? content_type : "application/octet-stream", data ? data : "", len);
+}
+
+PlugHandle *plug_defer(void) {
+    PlugHandle *handle = current_handle;
+    if (handle == NULL || handle->deferred || plug_handle_completed(handle) ||
+        handle->complete == NULL) {
+        return NULL;
+    }
+    handle->deferred = true;
+    atomic_fetch_add_explicit(&handle->refs, 1, memory_order_relaxed);
+    sync_mutex_lock(&handle_lock);
+    handle->next = outstanding;
+    outstanding = handle;
+    outstanding_count++;
+    sync_mutex_unlock(&handle_lock);
+    return handle;
+}
+
+static bool plug_complete_handle(PlugHandle *handle, const char *content_type, const void *data, size_t len) {
+    if (handle == NULL) {
+        return false;
+    }
+    bool sent = handle_finish(handle, content_type, data, len);
+    sync_mutex_lock(&handle_lock);
+    for (PlugHandle **link = &outstanding; *link != NULL; link = &(*link)->next) {
+        if (*link == handle) {
+            *link = handle->next;
+            outstanding_count--;
+            break;
+        }
+    }
+    sync_mutex_unlock(&handle_lock);
+    handle_unref(handle);
+    return sent;
+}
+
+bool plug_complete(PlugHandle *handle, const char *response_json) {
+    if (response_json == NULL) {
+        response_json = "{\"ok\":true}";
+    }
+    return plug_complete_handle(handle, NULL, response_json, strlen(response_json));
+}
+
+bool plug_complete_bytes(PlugHandle *handle, const char *content_type, const void *data, size_t len) {
+    return plug_complete_handle(handle, content_type ? content_type : "application/octet-stream",
+                                data ? data : "", data ? len : 0);
+}
+
+PlugCancelToken *plug_handle_token(PlugHandle *handle) {
+    return handle ? handle->token : NULL;
+}
+
+size_t plug_outstanding_requests(void) {
+    sync_mutex_lock(&handle_lock);
+    size_t count = outstanding_count;
+    sync_mutex_unlock(&handle_lock);
+    return count;
+}
+
+// Fails every deferred request still open. The plugin keeps its reference,
+// so a late plug_complete() is harmless and returns false.
+static void plug_fail_outstanding(const char *error_json) {
+    for (;;) {
+        sync_mutex_lock(&handle_lock);
+        PlugHandle *handle = outstanding;
+        if (handle != NULL) {
+            outstanding = handle->next;
+            outstanding_count--;
+            handle->next = NULL;
+            atomic_fetch_add_explicit(&handle->refs, 1, memory_order_relaxed);
+        }
+        sync_mutex_unlock(&handle_lock);
+        if (handle == NULL) {
+            return;
+        }
+        handle_finish(handle, NULL, error_json, strlen(error_json));
+        handle_unref(handle);
+    }
+}
+
+CROSSWEB_API void plug_set_host_complete(PlugHostComplete complete) {
+    host_complete = complete;
+}
+
+CROSSWEB_API void plug_set_host_emit_event(void (*emit)(const char *event, const char *data_json)) {
+    host_emit_event = emit;
+}
+
+CROSSWEB_API void plug_set_host_emit_event_to(void (*emit)(const char *request_id, const char *event, const char *data_json)) {
+    host_emit_event_to = emit;
+}
+
+static void plug_start_workers(void);
+static void plug_load_isolation_from_env(void);
+static void plug_start_isolation(void);
+static int plug_isolated_group(int plugin);
+
+CROSSWEB_API void plug_init(webview_t wv) {
+    // Plugins are already registered via constructors (PLUG_REGISTER macro).
+    // We just need to initialize them here.
+
+    // Detect platform for context
+    const char *platform = "unknown";
+#ifdef _WIN32
+    platform = "windows";
+#elif defined(__APPLE__)
+    platform = "macos";
+#elif defined(__ANDROID__)
+    platform = "android";
+#elif defined(__linux__)
+    platform = "linux";
+#endif
+
+    plug_load_event_policies_from_env();
+    plug_load_isolation_from_env();
+    plug_start_isolation();
+
+    // Initialize all registered plugins; isolated ones do that in their own
+    // processes.
+    PluginContext ctx = { .webview = wv, .platform = platform, .config = "{}" };
+    for (int i = 0; i < plugin_count; ++i) {
+        if (registered_plugins[i].plugin->init && plug_isolated_group(i) < 0) {
+            registered_plugins[i].plugin->init(&ctx);
+        }
+    }
+    plug_start_workers();
+}
+
+// Where a command goes: one of the plugin's table commands, or its invoke /
+// invoke_bytes with the part after the first '.'.
+typedef struct PlugRoute {
+    int plugin;            // index into registered_plugins
+    const PlugCommand *command;
+    const char *subcmd;
+} PlugRoute;
+
+// Looks "plugin.command" up in the command table, falling back to the
+// plugin's own entry. Returns false with *error set to a JSON error body
+// when the command cannot be routed; no plugin has seen the payload then.
+static bool plug_route(const char *cmd, bool bytes, PlugRoute *route, const char **error) {
+    size_t len = strlen(cmd);
+    const char *dot = (const char *)memchr(cmd, '.', len);
+    if (dot == NULL || dot == cmd) {
+        *error = "{\"error\":\"invalid command format\"}";
+        return false;
+    }
+    const CommandEntry *e = command_find(cmd, len, command_hash(cmd, len));
+    if (e == NULL) {
+        size_t plugin_len = (size_t)(dot - cmd);
+        e = command_find(cmd, plugin_len, command_hash(cmd, plugin_len));
+        if (e == NULL) {
+            *error = "{\"error\":\"unknown plugin\"}";
+            return false;
+        }
+    }
+    const Plugin *p = registered_plugins[e->plugin].plugin;
+    bool runnable = e->command ? (bytes ? e->command->run_bytes != NULL : e->command->run != NULL)
+                               : (bytes ? p->invoke_bytes != NULL : p->invoke != NULL);
+    if (!runnable) {
+        *error = bytes ? "{\"error\":\"command does not accept binary data\"}" :
+                 e->command ? "{\"error\":\"command requires binary data\"}" :
+                 "{\"error\":\"unknown command\"}";
+        return false;
+    }
+    route->plugin = e->plugin;
+    route->command = e->command;
+    route->subcmd = dot + 1;
+    return true;
+}
+
+// Runs a routed command with the current request's respond callbacks.
+static void plug_run_route(const PlugRoute *route, const PlugRequest *req, bool bytes) {
+    const Plugin *p = registered_plugins[route->plugin].plugin;
+    const char *payload = req->payload ? req->payload : "";
+    const void *data = req->data ? req->data : "";
+    if (route->command != NULL && bytes) {
+        route->command->run_bytes(payload, data, req->data_len, plug_respond_bytes_current);
+    } else if (route->command != NULL) {
+        route->command->run(payload, plug_respond_current);
+    } else if (bytes) {
+        p->invoke_bytes(route->subcmd, payload, data, req->data_len, plug_respond_bytes_current);
+    } else {
+        p->invoke(route->subcmd, payload, plug_respond_current);
+    }
+}
+
+// Answers requests whose token is already cancelled or past its deadline
+// without running the plugin. Returns true if it did.
+static bool plug_refuse_cancelled(PlugHandle *handle) {
+    if (!plug_cancel_token_cancelled(handle->token)) {
+        return false;
+    }
+    bool expired = !atomic_load_explicit(&handle->token->cancelled, memory_order_relaxed);
+    const char *error = expired ? deadline_json : cancelled_json;
+    handle_finish(handle, NULL, error, strlen(error));
+    return true;
+}
+
+// ============================================================================
+// Worker dispatch
+// ============================================================================
+
+typedef struct PlugJob {
+    PlugRequest req;       // copy; the strings stay valid until completion
+    PlugRoute route;
+    PlugHandle *handle;    // the dispatcher's reference, handed to the job
+    bool bytes;
+} PlugJob;
+
+static PoolConfig worker_config = { 0 };
+
+void plug_configure_workers(unsigned int threads, unsigned int max_queued) {
+    worker_config.threads = threads;
+    worker_config.max_queued = max_queued;
+}
+
+void plug_get_worker_stats(PlugWorkerStats *out) {
+    if (out == NULL) {
+        return;
+    }
+    PoolStats stats;
+    pool_get_stats(&stats);
+    out->threads = stats.threads;
+    out->queued = stats.queued;
+    out->running = stats.running;
+    out->peak_queued = stats.peak_queued;
+    out->completed = stats.completed;
+    out->rejected = stats.rejected;
+}
+
+// Task groups are the pool's; the plug.h names only keep pool.h private.
+PlugTaskGroup *plug_task_group(void) {
+    return (PlugTaskGroup *)pool_group_create();
+}
+
+void plug_task_spawn(PlugTaskGroup *group, PlugTaskFn fn, void *arg) {
+    pool_group_spawn((PoolGroup *)group, fn, arg);
+}
+
+void plug_task_wait(PlugTaskGroup *group) {
+    pool_group_wait((PoolGroup *)group);
+}
+
+void plug_task_then(PlugTaskGroup *group, PlugTaskFn done, void *arg) {
+    pool_group_then((PoolGroup *)group, done, arg);
+}
+
+void plug_parallel_for(size_t begin, size_t end, size_t grain, PlugRangeFn fn, void *arg) {
+    pool_parallel_for(begin, end, grain, fn, arg);
+}
+
+static void plug_run_job(void *arg) {
+    PlugJob *job = (PlugJob *)arg;
+    PlugHandle *handle = job->handle;
+    current_request = &job->req;
+    current_handle = handle;
+    current_token = handle->token;
+    // Checked again here: the request may have waited in the pool's queue.
+    if (!plug_refuse_cancelled(handle)) {
+        plug_run_route(&job->route, &job->req, job->bytes);
+    }
+    current_request = NULL;
+    current_handle = NULL;
+    current_token = NULL;
+    handle_end(handle);
+    free(job);
+}
+
+// Hands the request to the worker pool according to the plugin's threading
+// model. Returns true if a job took over the dispatcher's reference to the
+// handle; false means the caller still owns it (the request may have been
+// answered with "busy").
+static bool plug_dispatch_worker(const PlugRoute *route, const PlugRequest *req, PlugHandle *handle, bool bytes) {
+    const Plugin *p = registered_plugins[route->plugin].plugin;
+    if (p->threading == PLUG_THREAD_MAIN || handle->complete == NULL) {
+        return false;
+    }
+    PoolStrand *strand = NULL;
+    if (p->threading == PLUG_THREAD_STRAND) {
+        strand = registered_plugins[route->plugin].strand;
+        if (strand == NULL) {
+            return false;
+        }
+    }
+    PlugJob *job = (PlugJob *)malloc(sizeof(PlugJob));
+    if (job == NULL) {
+        return false;
+    }
+    job->req = *req;
+    job->route = *route;
+    job->handle = handle;
+    job->bytes = bytes;
+    bool queued = strand ? pool_strand_submit(strand, plug_run_job, job) : pool_submit(plug_run_job, job);
+    if (!queued) {
+        free(job);
+        if (pool_running()) {
+            static const char busy[] = "{\"ok\":false,\"error\":\"busy\",\"busy\":true,\"retryAfterMs\":50}";
+            handle_finish(handle, NULL, busy, sizeof(busy) - 1);
+        }
+        return false;   // not started: run inline
+    }
+    return true;
+}
+
+static void plug_start_workers(void) {
+    bool needed = false;
+    for (int i = 0; i < plugin_count; ++i) {
+        Plugin *p = registered_plugins[i].plugin;
+        if (p->threading == PLUG_THREAD_STRAND && registered_plugins[i].strand == NULL) {
+            registered_plugins[i].strand = pool_strand_create();
+        }
+        needed = needed || p->threading != PLUG_THREAD_MAIN;
+    }
+    if (needed && !pool_start(&worker_config)) {
+        fprintf(stderr, "plug: no worker threads, running all commands inline\n");
+    }
+}
+
+// Runs what is already queued to completion and joins the workers.
+static void plug_stop_workers(void) {
+    pool_stop();
+    for (int i = 0; i < plugin_count; ++i) {
+        pool_strand_destroy(registered_plugins[i].strand);
+        registered_plugins[i].strand = NULL;
+    }
+}
+
+// ============================================================================
+// Isolated plugins
+// ============================================================================
+// Host side: commands of a plugin named by plug_isolate() are written to one
+// of its child processes (see isolate.h) instead of being invoked. The
+// dispatcher's handle reference travels with the request and is completed
+// by the reader thread that sees the reply. "__cancel" and
+// "__window.closed" are passed on to every child, "__stream.*" to the child
+// that opened the stream. Child side: plug_isolated_main() runs in the new
+// process with the host hooks pointing back into the ring.
+// ============================================================================
+
+#define MAX_ISOLATED 16
+
+typedef struct IsolatedPlugin {
+    char name[64];
+    unsigned int processes;
+} IsolatedPlugin;
+
+// A request as the child keeps it: the strings must outlive the ring slot
+// they came in, since deferred and worker commands finish later.
+typedef struct IsolatedRequest {
+    unsigned long long seq;
+    PlugRequest req;
+    char strings[];
+} IsolatedRequest;
+
+static IsolatedPlugin isolated[MAX_ISOLATED];
+static int isolated_count = 0;
+static int isolated_groups[MAX_ISOLATED];    // group -> plugin index
+
+static const char crashed_json[] = "{\"ok\":false,\"error\":\"plugin crashed\",\"crashed\":true}";
+
+bool plug_isolate(const char *plugin, unsigned int processes) {
+    if (plugin == NULL || plugin[0] == '\0' || strlen(plugin) >= sizeof(isolated[0].name)) {
+        return false;
+    }
+    if (processes == 0) {
+        processes = 1;
+    }
+    for (int k = 0; k < isolated_count; ++k) {
+        if (strcmp(isolated[k].name, plugin) == 0) {
+            isolated[k].processes = processes;
+            return true;
+        }
+    }
+    if (isolated_count >= MAX_ISOLATED) {
+        fprintf(stderr, "plug_isolate: too many isolated plugins\n");
+        return false;
+    }
+    strcpy(isolated[isolated_count].name, plugin);
+    isolated[isolated_count].processes = processes;
+    isolated_count++;
+    return true;
+}
+
+// Parses CROSSWEB_ISOLATE: "name[=processes]" entries separated by ';'.
+static void plug_load_isolation_from_env(void) {
+    const char *spec = getenv("CROSSWEB_ISOLATE");
+    if (spec == NULL) {
+        return;
+    }
+    while (*spec) {
+        size_t entry_len = strcspn(spec, ";");
+        char entry[128];
+        if (entry_len > 0 && entry_len < sizeof(entry)) {
+            memcpy(entry, spec, entry_len);
+            entry[entry_len] = '\0';
+            char *eq = strchr(entry, '=');
+            if (eq != NULL) {
+                *eq = '\0';
+            }
+            if (!plug_isolate(entry, eq ? (unsigned int)strtoul(eq + 1, NULL, 10) : 1)) {
+                fprintf(stderr, "CROSSWEB_ISOLATE: ignoring '%s'\n", entry);
+            }
+        }
+        spec += entry_len;
+        if (*spec == ';') {
+            spec++;
+        }
+    }
+}
+
+static int plug_isolated_group(int plugin) {
+    return registered_plugins[plugin].isolation - 1;
+}
+
+static void plug_clear_isolation(void) {
+    for (int i = 0; i < plugin_count; ++i) {
+        registered_plugins[i].isolation = 0;
+    }
+}
+
+bool plug_get_isolate_stats(const char *plugin, PlugIsolateStats *out) {
+    if (plugin == NULL || out == NULL) {
+        return false;
+    }
+    int index = plug_find(plugin);
+    IsolateStats stats;
+    if (index < 0 || plug_isolated_group(index) < 0 || !isolate_get_stats(plug_isolated_group(index), &stats)) {
+        return false;
+    }
+    out->processes = stats.processes;
+    out->in_flight = stats.in_flight;
+    out->completed = stats.completed;
+    out->restarts = stats.restarts;
+    return true;
+}
+
+// Host side hooks, called from the children's reader threads.
+static void plug_isolated_complete(void *ctx, const char *content_type, const void *data, size_t len) {
+    PlugHandle *handle = (PlugHandle *)ctx;
+    handle_finish(handle, content_type, data, len);
+    handle_unref(handle);
+}
+
+static void plug_isolated_fail(void *ctx, IsolateFailure why) {
+    const char *error = why == ISOLATE_FAIL_CRASHED ? crashed_json :
+                        why == ISOLATE_FAIL_DEADLINE ? deadline_json :
+                        "{\"ok\":false,\"error\":\"plugin unloaded\"}";
+    plug_isolated_complete(ctx, NULL, error, strlen(error));
+}
+
+static void plug_isolated_event(const char *request_id, const char *event, const char *data) {
+    if (request_id != NULL) {
+        plug_deliver_event_to(request_id, event, data);
+    } else {
+        plug_deliver_event(event, data);
+    }
+}
+
+// The page's iterator ends with an error instead of waiting forever.
+static void plug_isolated_stream_lost(const char *request_id, const char *escaped_id) {
+    char data[STREAM_ID_CAP + sizeof(crashed_json) + 32];
+    snprintf(data, sizeof(data), "{\"id\":\"%s\",\"seq\":0,\"error\":%s}", escaped_id, crashed_json);
+    plug_deliver_event_to(request_id, "__stream", data);
+}
+
+static IsolateCall plug_isolated_call(const PlugRequest *req, bool bytes) {
+    IsolateCall call = {
+        .bytes = bytes,
+        .deadline_ms = req->deadline_ms,
+        .id = req->id ? req->id : "",
+        .cmd = req->cmd,
+        .payload = req->payload ? req->payload : "",
+        .payload_len = req->payload ? req->payload_len : 0,
+        .data = req->data,
+        .data_len = req->data_len,
+    };
+    return call;
+}
+
+// Answers a request the ring would not take.
+static void plug_isolated_refuse(PlugHandle *handle, IsolateStatus status, bool bytes) {
+    static const char busy[] = "{\"ok\":false,\"error\":\"busy\",\"busy\":true,\"retryAfterMs\":50}";
+    static const char too_large[] = "{\"ok\":false,\"error\":\"request too large for an isolated plugin\"}";
+    static const char down[] = "{\"ok\":false,\"error\":\"isolated plugin unavailable\"}";
+    const char *error = status == ISOLATE_BUSY ? busy : status == ISOLATE_TOO_LARGE ? too_large : down;
+    handle_finish(handle, bytes ? "application/json" : NULL, error, strlen(error));
+}
+
+// Sends a command of an isolated plugin to its child. Returns true if the
+// request went out with the handle; false means it was answered here.
+static bool plug_dispatch_isolated(int group, const PlugRequest *req, PlugHandle *handle, bool bytes) {
+    if (handle->complete == NULL) {
+        static const char no_hook[] = "{\"ok\":false,\"error\":\"isolated plugins need a completion hook\"}";
+        handle_finish(handle, bytes ? "application/json" : NULL, no_hook, sizeof(no_hook) - 1);
+        return false;
+    }
+    IsolateCall call = plug_isolated_call(req, bytes);
+    IsolateStatus status = isolate_submit(group, &call, handle);
+    if (status == ISOLATE_OK) {
+        return true;
+    }
+    plug_isolated_refuse(handle, status, bytes);
+    return false;
+}
+
+// "__stream.*" for a stream a child opened goes to that child. Returns false
+// when the stream is not a child's (or the request was answered here).
+static bool plug_dispatch_isolated_stream(const PlugRequest *req, const char *payload, PlugHandle *handle) {
+    if (!isolate_running() || handle->complete == NULL) {
+        return false;
+    }
+    size_t id_len = 0;
+    const char *id = json_top_level_field(payload, "id", &id_len);
+    if (id == NULL || id_len < 2 || id[0] != '"') {
+        return false;
+    }
+    IsolateCall call = plug_isolated_call(req, false);
+    IsolateStatus status = isolate_submit_stream(id + 1, id_len - 2, &call, handle);
+    if (status == ISOLATE_OK) {
+        return true;
+    }
+    if (status != ISOLATE_DOWN) {
+        plug_isolated_refuse(handle, status, false);
+    }
+    return false;
+}
+
+// Child side: replies and events go back through the ring.
+static void plug_isolated_reply(void *host_ctx, const char *content_type, const void *data, size_t len) {
+    IsolatedRequest *request = (IsolatedRequest *)host_ctx;
+    isolate_child_reply(request->seq, content_type, data, len);
+    free(request);
+}
+
+static void plug_isolated_emit(const char *event, const char *data) {
+    isolate_child_event(NULL, event, data);
+}
+
+static void plug_serve_isolated(const IsolateCall *call) {
+    if (call->notice) {
+        if (strcmp(call->cmd, "__cancel") == 0) {
+            plug_cancel_builtin(call->id, NULL);
+        } else if (strcmp(call->cmd, "__window.closed") == 0) {
+            plug_window_closed_builtin(call->id, NULL);
+        }
+        return;
+    }
+    size_t id_len = strlen(call->id), cmd_len = strlen(call->cmd);
+    IsolatedRequest *request = (IsolatedRequest *)malloc(sizeof(IsolatedRequest) + id_len + cmd_len +
+                                                         call->payload_len + call->data_len + 4);
+    if (request == NULL) {
+        static const char oom[] = "{\"error\":\"out of memory\"}";
+        isolate_child_reply(call->seq, call->bytes ? "application/json" : NULL, oom, sizeof(oom) - 1);
+        return;
+    }
+    char *at = request->strings;
+    PlugRequest *req = &request->req;
+    memset(req, 0, sizeof(*req));
+    req->id = memcpy(at, call->id, id_len + 1);
+    at += id_len + 1;
+    req->cmd = memcpy(at, call->cmd, cmd_len + 1);
+    at += cmd_len + 1;
+    req->payload = memcpy(at, call->payload ? call->payload : "", call->payload_len + 1);
+    req->payload_len = call->payload_len;
+    at += call->payload_len + 1;
+    if (call->data != NULL) {
+        req->data = memcpy(at, call->data, call->data_len + 1);
+        req->data_len = call->data_len;
+    }
+    req->deadline_ms = call->deadline_ms;
+    req->host_ctx = request;
+    request->seq = call->seq;
+    // Every request with a host_ctx reaches plug_isolated_reply() exactly
+    // once, which frees it.
+    if (call->bytes) {
+        plug_invoke_bytes(req, NULL);
+    } else {
+        plug_invoke(req, NULL);
+    }
+}
+
+// Runs in an isolated plugin's own process: initialises just that plugin and
+// serves what the host sends until told to stop.
+static void plug_isolated_main(int group) {
+    Plugin *p = registered_plugins[isolated_groups[group]].plugin;
+    plug_clear_isolation();
+    isolated_child = true;
+    host_complete = plug_isolated_reply;
+    host_emit_event = plug_isolated_emit;
+    host_emit_event_to = isolate_child_event;
+    PluginContext ctx = { .webview = NULL, .platform = "linux", .config = "{}" };
+    if (p->init) {
+        p->init(&ctx);
+    }
+    plug_start_workers();
+    while (!isolate_child_stopping()) {
+        IsolateCall call;
+        while (isolate_child_take(&call)) {
+            plug_serve_isolated(&call);
+        }
+        plug_poll(NULL, -1);
+    }
+    plug_close_all_streams();
+    plug_stop_workers();
+    if (p->cleanup) {
+        p->cleanup();
+    }
+    plug_fail_outstanding("{\"ok\":false,\"error\":\"plugin unloaded\"}");
+}
+
+// Forks the children before any plugin is initialised here, so they start
+// from a clean copy of the registry. Plugins stay in process if that fails.
+static void plug_start_isolation(void) {
+    plug_clear_isolation();
+    unsigned int processes[MAX_ISOLATED];
+    int groups = 0;
+    for (int k = 0; k < isolated_count; ++k) {
+        int index = plug_find(isolated[k].name);
+        if (index < 0) {
+            fprintf(stderr, "plug_isolate: no plugin named '%s'\n", isolated[k].name);
+            continue;
+        }
+        isolated_groups[groups] = index;
+        processes[groups] = isolated[k].processes;
+        groups++;
+    }
+    if (groups == 0) {
+        return;
+    }
+    IsolateHooks hooks = {
+        .complete = plug_isolated_complete,
+        .fail = plug_isolated_fail,
+        .event = plug_isolated_event,
+        .stream_lost = plug_isolated_stream_lost,
+        .child_main = plug_isolated_main,
+    };
+    if (!isolate_start(&hooks, processes, groups)) {
+        fprintf(stderr, "plug: running isolated plugins in process\n");
+        return;
+    }
+    for (int g = 0; g < groups; ++g) {
+        registered_plugins[isolated_groups[g]].isolation = g + 1;
+    }
+}
+
+static void plug_stop_isolation(void) {
+    isolate_stop();
+    plug_clear_isolation();
+}
+
+static void plug_batch_builtin(const PlugRequest *req);
+static void plug_pipeline_builtin(const PlugRequest *req);
+
+// Returns true if the request went to a worker (or a child process), which
+// now owns the handle.
+static bool plug_invoke_handle(const PlugRequest *req) {
+    const char *payload = req->payload ? req->payload : "";
+    // Builtins only touch plug.c's own state and always run inline.
+    if (strncmp(req->cmd, "__stream.", 9) == 0) {
+        if (plug_dispatch_isolated_stream(req, payload, current_handle)) {
+            return true;
+        }
+        if (!plug_handle_completed(current_handle)) {
+            plug_stream_builtin(req->cmd + 9, payload, plug_respond_current);
+        }
+        return false;
+    }
+    if (strcmp(req->cmd, "__cancel") == 0) {
+        plug_cancel_builtin(payload, plug_respond_current);
+        isolate_notify(req->cmd, payload);
+        return false;
+    }
+    if (strcmp(req->cmd, "__batch") == 0) {
+        plug_batch_builtin(req);
+        return false;
+    }
+    if (strcmp(req->cmd, "__pipeline") == 0) {
+        plug_pipeline_builtin(req);
+        return false;
+    }
+    if (strcmp(req->cmd, "__window.closed") == 0) {
+        plug_window_closed_builtin(req->id ? req->id : "", plug_respond_current);
+        isolate_notify(req->cmd, req->id ? req->id : "");
+        return false;
+    }
+    // e.g. "fs.read" -> the "read" command of plugin "fs"
+    PlugRoute route;
+    const char *error = NULL;
+    if (!plug_route(req->cmd, false, &route, &error)) {
+        plug_respond_current(error);
+        return false;
+    }
+    if (plug_refuse_cancelled(current_handle)) {
+        return false;
+    }
+    if (plug_isolated_group(route.plugin) >= 0) {
+        return plug_dispatch_isolated(plug_isolated_group(route.plugin), req, current_handle, false);
+    }
+    if (plug_dispatch_worker(&route, req, current_handle, false)) {
+        return true;
+    }
+    if (!atomic_load(&current_handle->completed)) {
+        plug_run_route(&route, req, false);
+    }
+    return false;
+}
+
+// `complete` overrides the host's completion hook, for requests made from
+// inside plug.c (see plug_coro_invoke()).
+static void plug_invoke_with(const PlugRequest *req, RespondCallback respond, PlugHostComplete complete) {
+    PlugHandle *handle = handle_begin(req, respond, NULL, complete);
+    if (handle == NULL) {
+        static const char oom[] = "{\"error\":\"out of memory\"}";
+        if (complete != NULL) {
+            complete(req->host_ctx, NULL, oom, sizeof(oom) - 1);
+        } else {
+            reply_without_handle(req, respond, NULL, oom);
+        }
+        return;
+    }
+    const PlugRequest *previous_request = current_request;
+    PlugHandle *previous_handle = current_handle;
+    PlugCancelToken *previous_token = current_token;
+    current_request = req;
+    current_handle = handle;
+    current_token = handle->token;
+    bool handed_off = plug_invoke_handle(req);
+    current_request = previous_request;
+    current_handle = previous_handle;
+    current_token = previous_token;
+    if (!handed_off) {
+        handle_end(handle);
+    }
+}
+
+CROSSWEB_API void plug_invoke(const PlugRequest *req, RespondCallback respond) {
+    if (req == NULL || req->cmd == NULL) {
+        reply_without_handle(req, respond, NULL, "{\"error\":\"invalid command format\"}");
+        return;
+    }
+    plug_invoke_with(req, respond, NULL);
+}
+
+// The binary counterpart of plug_invoke_with(), for pipeline steps.
+static void plug_invoke_bytes_with(const PlugRequest *req, RespondBytesCallback respond, PlugHostComplete complete) {
+    PlugHandle *handle = handle_begin(req, NULL, respond, complete);
+    if (handle == NULL) {
+        static const char oom[] = "{\"error\":\"out of memory\"}";
+        if (complete != NULL) {
+            complete(req->host_ctx, "application/json", oom, sizeof(oom) - 1);
+        } else {
+            reply_without_handle(req, NULL, respond, oom);
+        }
+        return;
+    }
+    const PlugRequest *previous_request = current_request;
+    PlugHandle *previous_handle = current_handle;
+    PlugCancelToken *previous_token = current_token;
+    current_request = req;
+    current_handle = handle;
+    current_token = handle->token;
+    PlugRoute route;
+    const char *error = NULL;
+    bool handed_off = false;
+    if (!plug_route(req->cmd, true, &route, &error)) {
+        handle_finish(handle, "application/json", error, strlen(error));
+    } else if (plug_isolated_group(route.plugin) >= 0) {
+        handed_off = !plug_refuse_cancelled(handle) &&
+                     plug_dispatch_isolated(plug_isolated_group(route.plugin), req, handle, true);
+    } else if (!plug_refuse_cancelled(handle)) {
+        handed_off = plug_dispatch_worker(&route, req, handle, true);
+        if (!handed_off && !atomic_load(&handle->completed)) {
+            plug_run_route(&route, req, true);
+        }
+    }
+    current_request = previous_request;
+    current_handle = previous_handle;
+    current_token = previous_token;
+    if (!handed_off) {
+        handle_end(handle);
+    }
+}
+
+CROSSWEB_API void plug_invoke_bytes(const PlugRequest *req, RespondBytesCallback respond) {
+    if (req == NULL || req->cmd == NULL) {
+        reply_without_handle(req, NULL, respond, "{\"error\":\"invalid command format\"}");
+        return;
+    }
+    plug_invoke_bytes_with(req, respond, NULL);
+}
+
+// ============================================================================
+// Batches
+// ============================================================================
+// "__batch" answers many commands for one bridge crossing. Its payload is a
+// JSON array of [command, payload] pairs of strings, and its reply the array
+// of their replies in the same order. Each entry is dispatched as a request
+// of its own under the batch's id, so a "__cancel" for the batch reaches all
+// of them: entries of worker plugins run in parallel, those of one strand
+// plugin in order, and main-thread ones inline, one after the other.
+// ============================================================================
+
+#define PLUG_BATCH_MAX 256
+
+typedef struct PlugBatch PlugBatch;
+
+typedef struct PlugBatchEntry {
+    PlugBatch *batch;
+    const char *cmd;
+    const char *payload;
+    size_t payload_len;
+    char *reply;           // NULL = no reply, sent as null
+    size_t reply_len;
+} PlugBatchEntry;
+
+struct PlugBatch {
+    PlugHandle *handle;        // the "__batch" request, deferred
+    atomic_size_t remaining;   // entries not answered yet, plus one while dispatching
+    char *id;
+    char *text;                // decoded commands and payloads
+    PlugBatchEntry *entries;
+    size_t count;
+};
+
+static const char batch_invalid_json[] = "{\"ok\":false,\"error\":\"invalid batch\"}";
+
+static void json_skip_space(const char *in, size_t len, size_t *pos) {
+    while (*pos < len && (in[*pos] == ' ' || in[*pos] == '\t' || in[*pos] == '\n' || in[*pos] == '\r')) {
+        (*pos)++;
+    }
+}
+
+static bool json_hex4(const char *in, size_t len, size_t pos, unsigned long *value) {
+    if (pos > len || len - pos < 4) {
+        return false;
+    }
+    unsigned long v = 0;
+    for (int k = 0; k < 4; ++k) {
+        char c = in[pos + k];
+        int d = (c >= '0' && c <= '9') ? c - '0' : (c >= 'a' && c <= 'f') ? c - 'a' + 10 :
+                (c >= 'A' && c <= 'F') ? c - 'A' + 10 : -1;
+        if (d < 0) {
+            return false;
+        }
+        v = (v << 4) | (unsigned long)d;
+    }
+    *value = v;
+    return true;
+}
+
+static size_t utf8_put(char *out, unsigned long cp) {
+    if (cp < 0x80) {
+        out[0] = (char)cp;
+        return 1;
+    }
+    if (cp < 0x800) {
+        out[0] = (char)(0xC0 | (cp >> 6));
+        out[1] = (char)(0x80 | (cp & 0x3F));
+        return 2;
+    }
+    if (cp < 0x10000) {
+        out[0] = (char)(0xE0 | (cp >> 12));
+        out[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        out[2] = (char)(0x80 | (cp & 0x3F));
+        return 3;
+    }
+    out[0] = (char)(0xF0 | (cp >> 18));
+    out[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+    out[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+    out[3] = (char)(0x80 | (cp & 0x3F));
+    return 4;
+}
+
+// Decodes the JSON string whose opening quote is at in[*pos] into `out`,
+// which never needs more room than the escaped text took. Lone surrogates
+// become U+FFFD, as they do in the page's TextEncoder.
+static bool json_string_decode(const char *in, size_t len, size_t *pos, char *out, size_t *out_len) {
+    size_t i = *pos + 1;
+    size_t o = 0;
+    while (i < len && in[i] != '"') {
+        unsigned char c = (unsigned char)in[i];
+        if (c < 0x20) {
+            return false;
+        }
+        if (c != '\\') {
+            out[o++] = (char)c;
+            i++;
+            continue;
+        }
+        if (i + 1 >= len) {
+            return false;
+        }
+        char e = in[i + 1];
+        i += 2;
+        switch (e) {
+        case '"': case '\\': case '/': out[o++] = e; continue;
+        case 'b': out[o++] = '\b'; continue;
+        case 'f': out[o++] = '\f'; continue;
+        case 'n': out[o++] = '\n'; continue;
+        case 'r': out[o++] = '\r'; continue;
+        case 't': out[o++] = '\t'; continue;
+        case 'u': break;
+        default: return false;
+        }
+        unsigned long cp = 0;
+        unsigned long low = 0;
+        if (!json_hex4(in, len, i, &cp)) {
+            return false;
+        }
+        i += 4;
+        if (cp >= 0xD800 && cp <= 0xDBFF && i + 1 < len && in[i] == '\\' && in[i + 1] == 'u' &&
+            json_hex4(in, len, i + 2, &low) && low >= 0xDC00 && low <= 0xDFFF) {
+            cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+            i += 6;
+        } else if (cp >= 0xD800 && cp <= 0xDFFF) {
+            cp = 0xFFFD;
+        }
+        o += utf8_put(out + o, cp);
+    }
+    if (i >= len) {
+        return false;
+    }
+    *pos = i + 1;
+    *out_len = o;
+    return true;
+}
+
+// Cheap shape check for an entry's reply: brackets balance and strings
+// close. A reply the page cannot parse would otherwise turn the whole batch
+// into null.
+static bool json_reply_balanced(const char *s, size_t len) {
+    int depth = 0;
+    for (size_t i = 0; i < len; ++i) {
+        unsigned char c = (unsigned char)s[i];
+        if (c == '"') {
+            for (++i; i < len && s[i] != '"'; ++i) {
+                if ((unsigned char)s[i] < 0x20) {
+                    return false;
+                }
+                if (s[i] == '\\') ++i;
+            }
+            if (i >= len) {
+                return false;
+            }
+        } else if (c == '{' || c == '[') {
+            depth++;
+        } else if (c == '}' || c == ']') {
+            if (--depth < 0) {
+                return false;
+            }
+        } else if (c == '\0') {
+            return false;
+        }
+    }
+    return depth == 0;
+}
+
+static void plug_batch_free(PlugBatch *batch) {
+    if (batch == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < batch->count; ++i) {
+        free(batch->entries[i].reply);
+    }
+    free(batch->entries);
+    free(batch->text);
+    free(batch->id);
+    free(batch);
+}
+
+// Returns NULL on success, else the error to answer with.
+static const char *plug_batch_parse(PlugBatch *batch, const char *in, size_t len) {
+    // Decoded strings are never longer than their JSON form, quotes
+    // included, so each fits with its NUL in what the input spent on it.
+    batch->text = (char *)malloc(len + 1);
+    if (batch->text == NULL) {
+        return "{\"ok\":false,\"error\":\"out of memory\"}";
+    }
+    size_t pos = 0;
+    size_t text_len = 0;
+    size_t capacity = 0;
+    json_skip_space(in, len, &pos);
+    if (pos >= len || in[pos++] != '[') {
+        return batch_invalid_json;
+    }
+    json_skip_space(in, len, &pos);
+    bool more = pos < len && in[pos] != ']';
+    while (more) {
+        json_skip_space(in, len, &pos);
+        if (pos >= len || in[pos++] != '[') {
+            return batch_invalid_json;
+        }
+        char *field[2];
+        size_t field_len[2];
+        for (int f = 0; f < 2; ++f) {
+            json_skip_space(in, len, &pos);
+            if (f == 1) {
+                if (pos >= len || in[pos++] != ',') {
+                    return batch_invalid_json;
+                }
+                json_skip_space(in, len, &pos);
+            }
+            field[f] = batch->text + text_len;
+            if (pos >= len || in[pos] != '"' || !json_string_decode(in, len, &pos, field[f], &field_len[f])) {
+                return batch_invalid_json;
+            }
+            field[f][field_len[f]] = '\0';
+            text_len += field_len[f] + 1;
+        }
+        json_skip_space(in, len, &pos);
+        if (pos >= len || in[pos++] != ']') {
+            return batch_invalid_json;
+        }
+        if (batch->count == PLUG_BATCH_MAX) {
+            return "{\"ok\":false,\"error\":\"too many commands in batch\"}";
+        }
+        if (batch->count == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            PlugBatchEntry *grown = (PlugBatchEntry *)realloc(batch->entries, capacity * sizeof(PlugBatchEntry));
+            if (grown == NULL) {
+                return "{\"ok\":false,\"error\":\"out of memory\"}";
+            }
+            batch->entries = grown;
+        }
+        batch->entries[batch->count++] = (PlugBatchEntry){
+            .batch = batch,
+            .cmd = field[0],
+            .payload = field[1],
+            .payload_len = field_len[1],
+        };
+        json_skip_space(in, len, &pos);
+        more = pos < len && in[pos] == ',';
+        pos += more;
+    }
+    if (pos >= len || in[pos++] != ']') {
+        return batch_invalid_json;
+    }
+    json_skip_space(in, len, &pos);
+    return pos == len ? NULL : batch_invalid_json;
+}
+
+// Called once per entry and once by the dispatcher; the last call answers
+// the batch, from whichever thread that is.
+static void plug_batch_release(PlugBatch *batch) {
+    if (atomic_fetch_sub_explicit(&batch->remaining, 1, memory_order_acq_rel) != 1) {
+        return;
+    }
+    size_t total = 2;
+    for (size_t i = 0; i < batch->count; ++i) {
+        total += (batch->entries[i].reply ? batch->entries[i].reply_len : 4) + 1;
+    }
+    char *out = (char *)malloc(total + 1);
+    if (out == NULL) {
+        plug_complete(batch->handle, "{\"ok\":false,\"error\":\"out of memory\"}");
+    } else {
+        size_t o = 0;
+        out[o++] = '[';
+        for (size_t i = 0; i < batch->count; ++i) {
+            const PlugBatchEntry *entry = &batch->entries[i];
+            if (i > 0) out[o++] = ',';
+            if (entry->reply) {
+                memcpy(out + o, entry->reply, entry->reply_len);
+                o += entry->reply_len;
+            } else {
+                memcpy(out + o, "null", 4);
+                o += 4;
+            }
+        }
+        out[o++] = ']';
+        out[o] = '\0';
+        plug_complete(batch->handle, out);
+        free(out);
+    }
+    plug_batch_free(batch);
+}
+
+// May run on any thread, once per entry.
+static void batch_entry_complete(void *host_ctx, const char *content_type, const void *data, size_t len) {
+    PlugBatchEntry *entry = (PlugBatchEntry *)host_ctx;
+    static const char binary[] = "{\"error\":\"binary reply not supported by host\"}";
+    static const char malformed[] = "{\"ok\":false,\"error\":\"malformed reply\"}";
+    if (content_type != NULL && data != NULL) {
+        data = binary;
+        len = sizeof(binary) - 1;
+    } else if (data != NULL && !json_reply_balanced((const char *)data, len)) {
+        data = malformed;
+        len = sizeof(malformed) - 1;
+    }
+    if (data != NULL && len > 0 && (entry->reply = (char *)malloc(len)) != NULL) {
+        memcpy(entry->reply, data, len);
+        entry->reply_len = len;
+    }
+    plug_batch_release(entry->batch);
+}
 
-void plug_register(Plugin *plugin) {
-    if (plugin == NULL) {
-        fprintf(stderr, "plug_register: NULL plugin\n");
+static void plug_batch_builtin(const PlugRequest *req) {
+    PlugBatch *batch = (PlugBatch *)calloc(1, sizeof(PlugBatch));
+    const char *error = batch ? plug_batch_parse(batch, req->payload ? req->payload : "", req->payload_len)
+                              : "{\"ok\":false,\"error\":\"out of memory\"}";
+    if (error == NULL && batch->count == 0) {
+        error = "[]";
+    }
+    if (error == NULL && (batch->id = strdup(req->id ? req->id : "")) == NULL) {
+        error = "{\"ok\":false,\"error\":\"out of memory\"}";
+    }
+    if (error == NULL && (batch->handle = plug_defer()) == NULL) {
+        error = "{\"ok\":false,\"error\":\"batch not supported by host\"}";
+    }
+    if (error != NULL) {
+        plug_respond_current(error);
+        plug_batch_free(batch);
         return;
     }
-    if (plugin_count < MAX_PLUGINS) {
-        // Check for duplicate registration (can happen with hotreload)
-        for (int i = 0; i < plugin_count; ++i) {
-            if (registered_plugins[i] == plugin ||
-                (registered_plugins[i]->name && plugin->name &&
-                 strcmp(registered_plugins[i]->name, plugin->name) == 0)) {
-                return; // Already registered
-            }
+    // One more than there are entries until the loop is done, so the last
+    // entry to answer cannot free the batch under it.
+    atomic_init(&batch->remaining, batch->count + 1);
+    PlugCancelToken *token = plug_handle_token(batch->handle);
+    static const char builtin_json[] = "{\"ok\":false,\"error\":\"builtin commands cannot be batched\"}";
+    for (size_t i = 0; i < batch->count; ++i) {
+        PlugBatchEntry *entry = &batch->entries[i];
+        if (strncmp(entry->cmd, "__", 2) == 0) {
+            batch_entry_complete(entry, NULL, builtin_json, sizeof(builtin_json) - 1);
+            continue;
         }
-        registered_plugins[plugin_count++] = plugin;
-        printf("Plugin registered: %s (v%d)\n", plugin->name, plugin->version);
-    } else {
-        fprintf(stderr, "Maximum number of plugins reached\n");
+        // Entries started from here on would miss a cancel that already
+        // reached the batch.
+        if (plug_cancel_token_cancelled(token)) {
+            const char *reply = atomic_load(&token->cancelled) ? cancelled_json : deadline_json;
+            batch_entry_complete(entry, NULL, reply, strlen(reply));
+            continue;
+        }
+        PlugRequest sub = {
+            .id = batch->id,
+            .cmd = entry->cmd,
+            .payload = entry->payload,
+            .payload_len = entry->payload_len,
+            .deadline_ms = plug_cancel_token_deadline_ms(token),
+            .host_ctx = entry,
+        };
+        plug_invoke_with(&sub, NULL, batch_entry_complete);
     }
+    plug_batch_release(batch);
 }
 
+// ============================================================================
+// Pipelines
+// ============================================================================
+// "__pipeline" runs a small DAG of commands where later steps take earlier
+// steps' replies as input, so intermediates stay in this process. Payload:
+//   {"steps":[[cmd, parts], [cmd, parts, input], ...], "outputs":[i, ...]}
+// `parts` are concatenated into the step's payload: strings are literal
+// JSON text, and [k] or [k, "field"] insert step k's reply or one of its
+// top-level fields. `input`, a reference of the same form, makes the step a
+// binary call whose body is that reply (a string field is decoded first).
+// Steps only refer to earlier ones and run as soon as what they read is
+// there, in parallel where the plugins allow. A reply is freed once the
+// steps reading it are done. The first step that fails stops the rest.
+// ============================================================================
 
-bool plug_load(const char *path) {
-    (void)path;
-    // TODO: Implement dynamic loading with dlopen/LoadLibrary
-    fprintf(stderr, "Dynamic plugin loading not implemented yet\n");
+#define PLUG_PIPELINE_MAX_STEPS 64
+
+typedef struct PlugPipeline PlugPipeline;
+
+typedef enum {
+    PIPELINE_STEP_WAITING,
+    PIPELINE_STEP_RUNNING,
+    PIPELINE_STEP_DONE,
+    PIPELINE_STEP_SKIPPED,
+} PlugPipelineStepState;
+
+typedef struct PlugPipelinePart {
+    int ref;               // step whose reply goes here, -1 = literal text
+    const char *text;      // the literal, or the field to take (NULL = all)
+    size_t len;
+} PlugPipelinePart;
+
+typedef struct PlugPipelineStep {
+    PlugPipeline *pipeline;
+    const char *cmd;
+    size_t first_part;
+    size_t part_count;
+    PlugPipelinePart input;     // ref -1 = a JSON call
+    PlugPipelineStepState state;
+    int uses;                   // readers of the reply not done yet
+    char *payload;              // while running
+    char *data;                 // decoded input field, while running
+    char *reply;                // NUL-terminated; NULL once freed
+    size_t reply_len;
+    char *content_type;         // binary reply, else NULL
+} PlugPipelineStep;
+
+struct PlugPipeline {
+    PlugHandle *handle;         // the "__pipeline" request, deferred
+    SyncMutex lock;
+    int active;                 // running steps plus callers of pipeline_advance()
+    int failed;                 // first failed step, -1 = none
+    char *id;
+    char *text;                 // decoded strings of the payload
+    PlugPipelinePart *parts;
+    size_t part_count;
+    size_t part_capacity;
+    PlugPipelineStep steps[PLUG_PIPELINE_MAX_STEPS];
+    size_t count;
+    int outputs[PLUG_PIPELINE_MAX_STEPS];
+    size_t output_count;
+};
+
+static const char pipeline_invalid_json[] = "{\"ok\":false,\"error\":\"invalid pipeline\"}";
+
+// Skips whitespace and takes `c` if it is next.
+static bool json_expect(const char *in, size_t len, size_t *pos, char c) {
+    json_skip_space(in, len, pos);
+    if (*pos < len && in[*pos] == c) {
+        (*pos)++;
+        return true;
+    }
     return false;
 }
 
-CROSSWEB_API void plug_set_host_emit_event(void (*emit)(const char *event, const char *data_json)) {
-    host_emit_event = emit;
+// Decodes the string next in the input into `out`, NUL-terminated.
+static bool json_string_at(const char *in, size_t len, size_t *pos, char *out, size_t *out_len) {
+    json_skip_space(in, len, pos);
+    if (*pos >= len || in[*pos] != '"' || !json_string_decode(in, len, pos, out, out_len)) {
+        return false;
+    }
+    out[*out_len] = '\0';
+    return true;
 }
 
-CROSSWEB_API void plug_init(webview_t wv) {
-    // Plugins are already registered via constructors (PLUG_REGISTER macro).
-    // We just need to initialize them here.
+static bool json_index_at(const char *in, size_t len, size_t *pos, int limit, int *value) {
+    json_skip_space(in, len, pos);
+    int v = 0;
+    size_t start = *pos;
+    while (*pos < len && in[*pos] >= '0' && in[*pos] <= '9' && v < limit) {
+        v = v * 10 + (in[(*pos)++] - '0');
+    }
+    *value = v;
+    return *pos > start && v < limit;
+}
 
-    // Detect platform for context
-    const char *platform = "unknown";
-#ifdef _WIN32
-    platform = "windows";
-#elif defined(__APPLE__)
-    platform = "macos";
-#elif defined(__ANDROID__)
-    platform = "android";
-#elif defined(__linux__)
-    platform = "linux";
-#endif
+// Parses [k] or [k, "field"] for step `step`, which may only read earlier
+// ones.
+static bool pipeline_parse_ref(PlugPipeline *p, const char *in, size_t len, size_t *pos, size_t *text_len,
+                               int step, PlugPipelinePart *part) {
+    part->text = NULL;
+    part->len = 0;
+    if (!json_expect(in, len, pos, '[') || !json_index_at(in, len, pos, step, &part->ref)) {
+        return false;
+    }
+    if (json_expect(in, len, pos, ',')) {
+        char *field = p->text + *text_len;
+        if (!json_string_at(in, len, pos, field, &part->len)) {
+            return false;
+        }
+        part->text = field;
+        *text_len += part->len + 1;
+    }
+    p->steps[part->ref].uses++;
+    return json_expect(in, len, pos, ']');
+}
 
-    // Initialize all registered plugins
-    PluginContext ctx = { .webview = wv, .platform = platform, .config = "{}" };
-    for (int i = 0; i < plugin_count; ++i) {
-        if (registered_plugins[i]->init) {
-            registered_plugins[i]->init(&ctx);
+static bool pipeline_parse_step(PlugPipeline *p, const char *in, size_t len, size_t *pos, size_t *text_len) {
+    int index = (int)p->count;
+    PlugPipelineStep *step = &p->steps[p->count++];
+    step->pipeline = p;
+    step->input.ref = -1;
+    step->first_part = p->part_count;
+    char *cmd = p->text + *text_len;
+    size_t cmd_len = 0;
+    if (!json_expect(in, len, pos, '[') || !json_string_at(in, len, pos, cmd, &cmd_len) ||
+        !json_expect(in, len, pos, ',') || !json_expect(in, len, pos, '[')) {
+        return false;
+    }
+    step->cmd = cmd;
+    *text_len += cmd_len + 1;
+    bool more = !json_expect(in, len, pos, ']');
+    while (more) {
+        if (p->part_count == p->part_capacity) {
+            size_t capacity = p->part_capacity ? p->part_capacity * 2 : 16;
+            PlugPipelinePart *grown = (PlugPipelinePart *)realloc(p->parts, capacity * sizeof(PlugPipelinePart));
+            if (grown == NULL) {
+                return false;
+            }
+            p->parts = grown;
+            p->part_capacity = capacity;
+        }
+        PlugPipelinePart *part = &p->parts[p->part_count];
+        json_skip_space(in, len, pos);
+        if (*pos < len && in[*pos] == '"') {
+            char *literal = p->text + *text_len;
+            if (!json_string_at(in, len, pos, literal, &part->len)) {
+                return false;
+            }
+            part->ref = -1;
+            part->text = literal;
+            *text_len += part->len + 1;
+        } else if (!pipeline_parse_ref(p, in, len, pos, text_len, index, part)) {
+            return false;
+        }
+        p->part_count++;
+        step->part_count++;
+        if (!json_expect(in, len, pos, ',')) {
+            more = false;
+            if (!json_expect(in, len, pos, ']')) {
+                return false;
+            }
+        }
+    }
+    if (json_expect(in, len, pos, ',') && !pipeline_parse_ref(p, in, len, pos, text_len, index, &step->input)) {
+        return false;
+    }
+    return json_expect(in, len, pos, ']');
+}
+
+// Returns NULL on success, else the error to answer with.
+static const char *plug_pipeline_parse(PlugPipeline *p, const char *in, size_t len) {
+    // As for batches, decoded strings fit in the space their JSON took.
+    p->text = (char *)malloc(len + 1);
+    if (p->text == NULL) {
+        return "{\"ok\":false,\"error\":\"out of memory\"}";
+    }
+    size_t pos = 0;
+    size_t text_len = 0;
+    bool has_outputs = false;
+    if (!json_expect(in, len, &pos, '{')) {
+        return pipeline_invalid_json;
+    }
+    do {
+        // Keys are decoded into the free space and not kept.
+        char *key = p->text + text_len;
+        size_t key_len = 0;
+        if (!json_string_at(in, len, &pos, key, &key_len) || !json_expect(in, len, &pos, ':')) {
+            return pipeline_invalid_json;
+        }
+        if (strcmp(key, "steps") == 0 && p->count == 0) {
+            if (!json_expect(in, len, &pos, '[')) {
+                return pipeline_invalid_json;
+            }
+            do {
+                if (p->count == PLUG_PIPELINE_MAX_STEPS) {
+                    return "{\"ok\":false,\"error\":\"too many steps in pipeline\"}";
+                }
+                if (!pipeline_parse_step(p, in, len, &pos, &text_len)) {
+                    return pipeline_invalid_json;
+                }
+            } while (json_expect(in, len, &pos, ','));
+            if (!json_expect(in, len, &pos, ']')) {
+                return pipeline_invalid_json;
+            }
+        } else if (strcmp(key, "outputs") == 0 && !has_outputs) {
+            has_outputs = true;
+            if (!json_expect(in, len, &pos, '[')) {
+                return pipeline_invalid_json;
+            }
+            bool more = !json_expect(in, len, &pos, ']');
+            while (more) {
+                if (p->output_count == PLUG_PIPELINE_MAX_STEPS ||
+                    !json_index_at(in, len, &pos, PLUG_PIPELINE_MAX_STEPS, &p->outputs[p->output_count++])) {
+                    return pipeline_invalid_json;
+                }
+                more = json_expect(in, len, &pos, ',');
+                if (!more && !json_expect(in, len, &pos, ']')) {
+                    return pipeline_invalid_json;
+                }
+            }
+        } else {
+            return pipeline_invalid_json;
+        }
+    } while (json_expect(in, len, &pos, ','));
+    if (!json_expect(in, len, &pos, '}')) {
+        return pipeline_invalid_json;
+    }
+    json_skip_space(in, len, &pos);
+    if (pos != len || p->count == 0) {
+        return pipeline_invalid_json;
+    }
+    if (!has_outputs) {
+        p->outputs[p->output_count++] = (int)p->count - 1;
+    }
+    for (size_t i = 0; i < p->output_count; ++i) {
+        if ((size_t)p->outputs[i] >= p->count) {
+            return pipeline_invalid_json;
         }
+        // Outputs are read once more, by pipeline_finish().
+        p->steps[p->outputs[i]].uses++;
     }
+    return NULL;
 }
 
-CROSSWEB_API void plug_invoke(const char *cmd, const char *payload, RespondCallback respond) {
-    fprintf(stderr, "plug_invoke: cmd=%s payload=%s\n", cmd ? cmd : "NULL", payload ? payload : "NULL");
-    // Parse cmd, e.g., "fs.read" -> plugin "fs", subcmd "read"
-    char *dot = strchr(cmd, '.');
-    if (!dot) {
-        if (respond) respond("{\"error\":\"invalid command format\"}");
+static void plug_pipeline_free(PlugPipeline *p) {
+    if (p == NULL) {
         return;
     }
-    size_t plugin_len = dot - cmd;
-    char plugin_name[256];
-    strncpy(plugin_name, cmd, plugin_len);
-    plugin_name[plugin_len] = '\0';
-    const char *subcmd = dot + 1;
+    for (size_t i = 0; i < p->count; ++i) {
+        free(p->steps[i].payload);
+        free(p->steps[i].data);
+        free(p->steps[i].reply);
+        free(p->steps[i].content_type);
+    }
+    sync_mutex_destroy(&p->lock);
+    free(p->parts);
+    free(p->text);
+    free(p->id);
+    free(p);
+}
 
-    for (int i = 0; i < plugin_count; ++i) {
-        Plugin *p = registered_plugins[i];
-        if (strcmp(p->name, plugin_name) == 0) {
-            if (p->invoke) {
-                p->invoke(subcmd, payload, respond);
+// A reply failed when it has a non-null "error" or "ok" is false.
+static bool pipeline_reply_failed(const char *reply) {
+    size_t len = 0;
+    const char *value = json_top_level_field(reply, "error", &len);
+    if (value != NULL && strncmp(value, "null", 4) != 0) {
+        return true;
+    }
+    value = json_top_level_field(reply, "ok", &len);
+    return value != NULL && strncmp(value, "false", 5) == 0;
+}
+
+// What a reference stands for in a payload. Sets *error when it cannot be
+// used there.
+static const char *pipeline_ref_value(const PlugPipeline *p, const PlugPipelinePart *part, size_t *len,
+                                      const char **error) {
+    const PlugPipelineStep *from = &p->steps[part->ref];
+    if (from->content_type != NULL) {
+        *error = "{\"ok\":false,\"error\":\"binary reply used as JSON\"}";
+        return NULL;
+    }
+    if (part->text == NULL) {
+        *len = from->reply_len;
+        return from->reply;
+    }
+    const char *value = json_top_level_field(from->reply, part->text, len);
+    if (value == NULL) {
+        *len = 4;
+        return "null";
+    }
+    return value;
+}
+
+static void pipeline_step_complete(void *host_ctx, const char *content_type, const void *data, size_t len);
+
+// Builds the step's payload and input from the replies it reads and
+// dispatches it. Those replies stay put until the step is done.
+static void pipeline_start(PlugPipeline *p, PlugPipelineStep *step) {
+    const char *error = NULL;
+    size_t total = 0;
+    for (size_t i = 0; i < step->part_count && error == NULL; ++i) {
+        const PlugPipelinePart *part = &p->parts[step->first_part + i];
+        size_t len = part->len;
+        if (part->ref >= 0) {
+            pipeline_ref_value(p, part, &len, &error);
+        }
+        total += len;
+    }
+    if (error == NULL && (step->payload = (char *)malloc(total + 1)) == NULL) {
+        error = "{\"ok\":false,\"error\":\"out of memory\"}";
+    }
+    if (error != NULL) {
+        pipeline_step_complete(step, NULL, error, strlen(error));
+        return;
+    }
+    size_t o = 0;
+    for (size_t i = 0; i < step->part_count; ++i) {
+        const PlugPipelinePart *part = &p->parts[step->first_part + i];
+        size_t len = part->len;
+        const char *value = part->ref >= 0 ? pipeline_ref_value(p, part, &len, &error) : part->text;
+        memcpy(step->payload + o, value, len);
+        o += len;
+    }
+    step->payload[o] = '\0';
+
+    PlugRequest sub = {
+        .id = p->id,
+        .cmd = step->cmd,
+        .payload = step->payload,
+        .payload_len = o,
+        .deadline_ms = plug_cancel_token_deadline_ms(plug_handle_token(p->handle)),
+        .host_ctx = step,
+    };
+    if (step->input.ref < 0) {
+        plug_invoke_with(&sub, NULL, pipeline_step_complete);
+        return;
+    }
+    const PlugPipelineStep *from = &p->steps[step->input.ref];
+    sub.data = from->reply;
+    sub.data_len = from->reply_len;
+    if (step->input.text != NULL) {
+        if (from->content_type != NULL) {
+            static const char binary[] = "{\"ok\":false,\"error\":\"binary reply has no fields\"}";
+            pipeline_step_complete(step, NULL, binary, sizeof(binary) - 1);
+            return;
+        }
+        size_t len = 0;
+        const char *value = json_top_level_field(from->reply, step->input.text, &len);
+        size_t pos = 0;
+        if (value == NULL) {
+            sub.data = "";
+            sub.data_len = 0;
+        } else if (value[0] != '"') {
+            sub.data = value;
+            sub.data_len = len;
+        } else if ((step->data = (char *)malloc(len)) != NULL &&
+                   json_string_decode(value, len, &pos, step->data, &sub.data_len)) {
+            sub.data = step->data;
+        } else {
+            static const char bad[] = "{\"ok\":false,\"error\":\"invalid input field\"}";
+            pipeline_step_complete(step, NULL, bad, sizeof(bad) - 1);
+            return;
+        }
+    }
+    plug_invoke_bytes_with(&sub, NULL, pipeline_step_complete);
+}
+
+static bool pipeline_step_ready(const PlugPipeline *p, const PlugPipelineStep *step) {
+    for (size_t i = 0; i < step->part_count; ++i) {
+        int ref = p->parts[step->first_part + i].ref;
+        if (ref >= 0 && p->steps[ref].state != PIPELINE_STEP_DONE) {
+            return false;
+        }
+    }
+    return step->input.ref < 0 || p->steps[step->input.ref].state == PIPELINE_STEP_DONE;
+}
+
+// Drops one reader of a step's reply. Caller holds p->lock.
+static void pipeline_release_reply(PlugPipeline *p, int ref) {
+    PlugPipelineStep *step = &p->steps[ref];
+    if (--step->uses == 0) {
+        free(step->reply);
+        free(step->content_type);
+        step->reply = NULL;
+        step->content_type = NULL;
+    }
+}
+
+static void pipeline_finish(PlugPipeline *p) {
+    PlugCancelToken *token = plug_handle_token(p->handle);
+    bool complete = true;
+    for (size_t i = 0; i < p->output_count; ++i) {
+        complete = complete && p->steps[p->outputs[i]].state == PIPELINE_STEP_DONE;
+    }
+    if (p->failed >= 0) {
+        const PlugPipelineStep *step = &p->steps[p->failed];
+        size_t len = 0;
+        const char *error = step->reply ? json_top_level_field(step->reply, "error", &len) : NULL;
+        if (error == NULL || strncmp(error, "null", 4) == 0) {
+            error = step->reply ? "\"step failed\"" : "\"out of memory\"";
+            len = strlen(error);
+        }
+        char *out = (char *)malloc(len + 64);
+        if (out != NULL) {
+            snprintf(out, len + 64, "{\"ok\":false,\"step\":%d,\"error\":%.*s}", p->failed, (int)len, error);
+        }
+        plug_complete(p->handle, out ? out : "{\"ok\":false,\"error\":\"out of memory\"}");
+        free(out);
+    } else if (!complete) {
+        plug_complete(p->handle, atomic_load(&token->cancelled) ? cancelled_json : deadline_json);
+    } else if (p->output_count == 1) {
+        const PlugPipelineStep *step = &p->steps[p->outputs[0]];
+        if (step->content_type != NULL) {
+            plug_complete_bytes(p->handle, step->content_type, step->reply, step->reply_len);
+        } else {
+            plug_complete(p->handle, step->reply);
+        }
+    } else {
+        static const char binary[] = "{\"error\":\"binary reply can only be the sole output\"}";
+        static const char malformed[] = "{\"ok\":false,\"error\":\"malformed reply\"}";
+        size_t total = 2;
+        for (size_t i = 0; i < p->output_count; ++i) {
+            total += p->steps[p->outputs[i]].reply_len + sizeof(binary) + sizeof(malformed);
+        }
+        char *out = (char *)malloc(total + 1);
+        if (out == NULL) {
+            plug_complete(p->handle, "{\"ok\":false,\"error\":\"out of memory\"}");
+        } else {
+            size_t o = 0;
+            out[o++] = '[';
+            for (size_t i = 0; i < p->output_count; ++i) {
+                const PlugPipelineStep *step = &p->steps[p->outputs[i]];
+                const char *reply = step->reply;
+                size_t len = step->reply_len;
+                if (step->content_type != NULL) {
+                    reply = binary;
+                    len = sizeof(binary) - 1;
+                } else if (!json_reply_balanced(reply, len)) {
+                    reply = malformed;
+                    len = sizeof(malformed) - 1;
+                }
+                if (i > 0) out[o++] = ',';
+                memcpy(out + o, reply, len);
+                o += len;
+            }
+            out[o++] = ']';
+            out[o] = '\0';
+            plug_complete(p->handle, out);
+            free(out);
+        }
+    }
+    plug_pipeline_free(p);
+}
+
+// Starts every step that can run. The caller holds one count of
+// p->active, which this gives up; whoever drops it to zero answers.
+static void pipeline_advance(PlugPipeline *p) {
+    PlugCancelToken *token = plug_handle_token(p->handle);
+    for (;;) {
+        bool stop = plug_cancel_token_cancelled(token);
+        PlugPipelineStep *next = NULL;
+        bool finished = false;
+        sync_mutex_lock(&p->lock);
+        stop = stop || p->failed >= 0;
+        for (size_t i = 0; i < p->count && next == NULL; ++i) {
+            PlugPipelineStep *step = &p->steps[i];
+            if (step->state != PIPELINE_STEP_WAITING) {
+                continue;
+            }
+            if (stop) {
+                step->state = PIPELINE_STEP_SKIPPED;
+            } else if (pipeline_step_ready(p, step)) {
+                step->state = PIPELINE_STEP_RUNNING;
+                p->active++;
+                next = step;
+            }
+        }
+        if (next == NULL) {
+            finished = --p->active == 0;
+        }
+        sync_mutex_unlock(&p->lock);
+        if (next == NULL) {
+            if (finished) {
+                pipeline_finish(p);
             }
             return;
         }
+        pipeline_start(p, next);
     }
-    if (respond) respond("{\"error\":\"unknown plugin\"}");
 }
 
-CROSSWEB_API void plug_emit(const char *event, const char *data) {
-#ifdef ANDROID
-    // Delegate Android emission to android_bridge.c helper
-    android_emit(event, data ? data : "null");
-#elif defined(_WIN32)
-    if (event && host_emit_event) {
-        host_emit_event(event, data ? data : "null");
+// May run on any thread, once per step.
+static void pipeline_step_complete(void *host_ctx, const char *content_type, const void *data, size_t len) {
+    PlugPipelineStep *step = (PlugPipelineStep *)host_ctx;
+    PlugPipeline *p = step->pipeline;
+    if (content_type != NULL && strcmp(content_type, "application/json") == 0) {
+        content_type = NULL;
+    }
+    if (data == NULL) {
+        content_type = NULL;
+        data = "null";
+        len = 4;
+    }
+    char *reply = (char *)malloc(len + 1);
+    char *type = content_type ? strdup(content_type) : NULL;
+    if (reply != NULL) {
+        memcpy(reply, data, len);
+        reply[len] = '\0';
+    }
+    if (reply == NULL || (content_type != NULL && type == NULL)) {
+        free(reply);
+        free(type);
+        reply = type = NULL;
+        len = 0;
+    }
+    bool failed = reply == NULL || (type == NULL && pipeline_reply_failed(reply));
+    free(step->payload);
+    free(step->data);
+    step->payload = step->data = NULL;
+
+    sync_mutex_lock(&p->lock);
+    step->reply = reply;
+    step->reply_len = len;
+    step->content_type = type;
+    step->state = PIPELINE_STEP_DONE;
+    int index = (int)(step - p->steps);
+    if (failed && (p->failed < 0 || index < p->failed)) {
+        p->failed = index;
+    }
+    for (size_t i = 0; i < step->part_count; ++i) {
+        if (p->parts[step->first_part + i].ref >= 0) {
+            pipeline_release_reply(p, p->parts[step->first_part + i].ref);
+        }
+    }
+    if (step->input.ref >= 0) {
+        pipeline_release_reply(p, step->input.ref);
+    }
+    if (step->uses == 0 && !failed) {
+        // Nothing reads this reply; a failed one is kept for the answer.
+        free(step->reply);
+        free(step->content_type);
+        step->reply = step->content_type = NULL;
+    }
+    sync_mutex_unlock(&p->lock);
+    pipeline_advance(p);
+}
+
+static void plug_pipeline_builtin(const PlugRequest *req) {
+    PlugPipeline *p = (PlugPipeline *)calloc(1, sizeof(PlugPipeline));
+    if (p != NULL) {
+        sync_mutex_init(&p->lock);
+    }
+    const char *error = p ? plug_pipeline_parse(p, req->payload ? req->payload : "", req->payload_len)
+                          : "{\"ok\":false,\"error\":\"out of memory\"}";
+    for (size_t i = 0; error == NULL && i < p->count; ++i) {
+        if (strncmp(p->steps[i].cmd, "__", 2) == 0) {
+            error = "{\"ok\":false,\"error\":\"builtin commands cannot be piped\"}";
+        }
+    }
+    if (error == NULL && (p->id = strdup(req->id ? req->id : "")) == NULL) {
+        error = "{\"ok\":false,\"error\":\"out of memory\"}";
+    }
+    if (error == NULL && (p->handle = plug_defer()) == NULL) {
+        error = "{\"ok\":false,\"error\":\"pipeline not supported by host\"}";
+    }
+    if (error != NULL) {
+        plug_respond_current(error);
+        plug_pipeline_free(p);
+        return;
+    }
+    p->failed = -1;
+    p->active = 1;
+    pipeline_advance(p);
+}
+
+// ============================================================================
+// Event loop
+// ============================================================================
+
+bool plug_watch_fd(int fd, unsigned int events, PlugFdFn fn, void *arg) {
+    return evloop_watch_fd(fd, events, fn, arg);
+}
+
+void plug_unwatch_fd(int fd) {
+    evloop_unwatch_fd(fd);
+}
+
+unsigned long plug_timer_start(unsigned int delay_ms, unsigned int period_ms, PlugTimerFn fn, void *arg) {
+    return evloop_timer_start(delay_ms, period_ms, fn, arg);
+}
+
+bool plug_timer_cancel(unsigned long id) {
+    return evloop_timer_cancel(id);
+}
+
+// ============================================================================
+// Coroutines
+// ============================================================================
+// The scheduler resumes coroutines from plug_update() on the UI thread. A
+// PlugCoro is the head of a private slot that holds what the wait macros
+// record. fd waits are one-shot watches on the core event loop. Replies to
+// sub-requests and plug_coro_wake() may come from any thread; they set a
+// flag and wake the loop. Windows hosts do not sleep in that loop, so there
+// plug_update_timeout_ms() polls for them every CORO_POLL_MS.
+// ============================================================================
+
+#define CORO_POLL_MS 10
+
+typedef enum {
+    CORO_WAIT_NONE,        // resume on the next tick
+    CORO_WAIT_SLEEP,
+    CORO_WAIT_FD,
+    CORO_WAIT_INVOKE,
+    CORO_WAIT_WAKE,
+} CoroWait;
+
+typedef struct CoroSlot {
+    PlugCoro co;                   // first, so a PlugCoro * is its slot
+    struct CoroSlot *next;
+    PlugCoroFn fn;
+    void (*cleanup)(void *user);
+    CoroWait wait;
+    unsigned long long wake_ms;    // timeout, 0 = none
+    int fd;                        // watched while wait == CORO_WAIT_FD
+    char *reply_buf;               // owns co.reply
+    char *sub_cmd;                 // sub-request strings, live until its reply
+    char *sub_payload;
+    atomic_bool sub_done;
+    atomic_bool woken;
+} CoroSlot;
+
+static CoroSlot *coros = NULL;
+static SyncMutex coro_lock = SYNC_MUTEX_INIT;
+
+static CoroSlot *coro_slot(PlugCoro *co) {
+    return (CoroSlot *)co;
+}
+
+bool plug_coro_cancelled(PlugCoro *co) {
+    return co != NULL && co->handle != NULL && plug_cancel_token_cancelled(plug_handle_token(co->handle));
+}
+
+static PlugCoroStatus coro_resume(CoroSlot *slot) {
+    const PlugRequest *previous_request = current_request;
+    PlugHandle *previous_handle = current_handle;
+    PlugCancelToken *previous_token = current_token;
+    // plug_cancelled() works inside a coroutine; plug_defer() does not.
+    current_request = NULL;
+    current_handle = NULL;
+    current_token = slot->co.handle ? plug_handle_token(slot->co.handle) : NULL;
+    slot->wait = CORO_WAIT_NONE;
+    PlugCoroStatus status = slot->fn(&slot->co);
+    current_request = previous_request;
+    current_handle = previous_handle;
+    current_token = previous_token;
+    return status;
+}
+
+static void coro_fd_ready(int fd, unsigned int revents, void *arg) {
+    CoroSlot *slot = (CoroSlot *)arg;
+    slot->co.revents = revents;
+    evloop_unwatch_fd(fd);
+    slot->fd = -1;
+}
+
+// Stops watching when the wait ended some other way.
+static void coro_unwatch(CoroSlot *slot) {
+    if (slot->fd >= 0) {
+        evloop_unwatch_fd(slot->fd);
+        slot->fd = -1;
+    }
+}
+
+// A coroutine that ends without answering reports why it stopped early, or
+// plain success.
+static void coro_finish(CoroSlot *slot) {
+    coro_unwatch(slot);
+    if (slot->co.handle != NULL) {
+        PlugCancelToken *token = plug_handle_token(slot->co.handle);
+        const char *reply = NULL;
+        if (plug_cancel_token_cancelled(token)) {
+            reply = atomic_load(&token->cancelled) ? cancelled_json : deadline_json;
+        }
+        plug_complete(slot->co.handle, reply);
+        slot->co.handle = NULL;
+    }
+    if (slot->cleanup != NULL) {
+        slot->cleanup(slot->co.user);
+    }
+    free(slot->reply_buf);
+    free(slot->sub_cmd);
+    free(slot->sub_payload);
+    free(slot);
+}
+
+bool plug_coro_start(PlugCoroFn fn, void *user, void (*cleanup)(void *user)) {
+    if (fn == NULL) {
+        return false;
+    }
+    CoroSlot *slot = (CoroSlot *)calloc(1, sizeof(CoroSlot));
+    if (slot == NULL) {
+        return false;
+    }
+    slot->fn = fn;
+    slot->cleanup = cleanup;
+    slot->fd = -1;
+    slot->co.user = user;
+    slot->co.handle = plug_defer();
+    atomic_init(&slot->sub_done, false);
+    atomic_init(&slot->woken, false);
+    if (coro_resume(slot) == PLUG_CORO_DONE) {
+        coro_finish(slot);
+        return true;
+    }
+    sync_mutex_lock(&coro_lock);
+    slot->next = coros;
+    coros = slot;
+    sync_mutex_unlock(&coro_lock);
+    evloop_wake();   // may have started on a worker
+    return true;
+}
+
+void plug_coro_respond(PlugCoro *co, const char *response_json) {
+    if (co != NULL && co->handle != NULL) {
+        plug_complete(co->handle, response_json);
+        co->handle = NULL;
+    }
+}
+
+void plug_coro_wake(PlugCoro *co) {
+    if (co != NULL) {
+        atomic_store(&coro_slot(co)->woken, true);
+        evloop_wake();
+    }
+}
+
+static void coro_set_timeout(CoroSlot *slot, int timeout_ms) {
+    slot->wake_ms = timeout_ms >= 0 ? sync_now_ms() + (unsigned long long)timeout_ms : 0;
+    slot->co.timed_out = false;
+}
+
+bool plug_coro_sleep(PlugCoro *co, unsigned int ms) {
+    CoroSlot *slot = coro_slot(co);
+    slot->wait = CORO_WAIT_SLEEP;
+    coro_set_timeout(slot, (int)ms);
+    return true;
+}
+
+bool plug_coro_wait_fd(PlugCoro *co, int fd, unsigned int events, int timeout_ms) {
+    CoroSlot *slot = coro_slot(co);
+    co->revents = 0;
+    if (!evloop_watch_fd(fd, events, coro_fd_ready, slot)) {
+        co->timed_out = true;   // e.g. on Windows
+        return false;
+    }
+    slot->wait = CORO_WAIT_FD;
+    slot->fd = fd;
+    coro_set_timeout(slot, timeout_ms);
+    return true;
+}
+
+bool plug_coro_wait_wake(PlugCoro *co, int timeout_ms) {
+    CoroSlot *slot = coro_slot(co);
+    slot->wait = CORO_WAIT_WAKE;
+    coro_set_timeout(slot, timeout_ms);
+    return true;
+}
+
+// May run on any thread, once per sub-request.
+static void coro_sub_complete(void *host_ctx, const char *content_type, const void *data, size_t len) {
+    CoroSlot *slot = (CoroSlot *)host_ctx;
+    static const char binary[] = "{\"error\":\"binary reply not supported by host\"}";
+    if (content_type != NULL && data != NULL) {
+        data = binary;
+        len = sizeof(binary) - 1;
+    }
+    char *buf = NULL;
+    if (data != NULL && (buf = (char *)malloc(len + 1)) != NULL) {
+        memcpy(buf, data, len);
+        buf[len] = '\0';
+    }
+    slot->reply_buf = buf;
+    slot->co.reply = buf ? buf : "null";
+    slot->co.reply_len = buf ? len : 4;
+    atomic_store(&slot->sub_done, true);
+    evloop_wake();
+}
+
+bool plug_coro_invoke(PlugCoro *co, const char *cmd, const char *payload_json) {
+    CoroSlot *slot = coro_slot(co);
+    free(slot->reply_buf);
+    slot->reply_buf = NULL;
+    co->reply = NULL;
+    co->reply_len = 0;
+    co->timed_out = false;
+    if (payload_json == NULL) {
+        payload_json = "{}";
+    }
+    slot->sub_cmd = cmd ? strdup(cmd) : NULL;
+    slot->sub_payload = strdup(payload_json);
+    if (slot->sub_cmd == NULL || slot->sub_payload == NULL) {
+        free(slot->sub_cmd);
+        free(slot->sub_payload);
+        slot->sub_cmd = slot->sub_payload = NULL;
+        co->reply = "{\"error\":\"invalid command format\"}";
+        co->reply_len = strlen(co->reply);
+        return false;
+    }
+    atomic_store(&slot->sub_done, false);
+    slot->wait = CORO_WAIT_INVOKE;
+    // The sub-request gives up when the coroutine's own caller does.
+    PlugRequest req = {
+        .id = "",
+        .cmd = slot->sub_cmd,
+        .payload = slot->sub_payload,
+        .payload_len = strlen(slot->sub_payload),
+        .deadline_ms = co->handle ? plug_cancel_token_deadline_ms(plug_handle_token(co->handle)) : 0,
+        .host_ctx = slot,
+    };
+    plug_invoke_with(&req, NULL, coro_sub_complete);
+    return true;
+}
+
+static bool coro_ready(CoroSlot *slot, unsigned long long now) {
+    switch (slot->wait) {
+    case CORO_WAIT_NONE:
+        return true;
+    case CORO_WAIT_INVOKE:
+        // Not cut short by cancellation: the reply still has to land here.
+        return atomic_load(&slot->sub_done);
+    case CORO_WAIT_WAKE:
+        if (atomic_exchange(&slot->woken, false)) {
+            return true;
+        }
+        break;
+    case CORO_WAIT_FD:
+        if (slot->co.revents != 0) {
+            return true;
+        }
+        break;
+    case CORO_WAIT_SLEEP:
+        break;
+    }
+    if (slot->wake_ms != 0 && now >= slot->wake_ms) {
+        slot->co.timed_out = slot->wait != CORO_WAIT_SLEEP;
+        return true;
+    }
+    return plug_coro_cancelled(&slot->co);
+}
+
+static void plug_run_coros(void) {
+    sync_mutex_lock(&coro_lock);
+    CoroSlot *list = coros;
+    coros = NULL;
+    sync_mutex_unlock(&coro_lock);
+    if (list == NULL) {
+        return;
+    }
+    unsigned long long now = sync_now_ms();
+    CoroSlot *keep = NULL;
+    CoroSlot **tail = &keep;
+    while (list != NULL) {
+        CoroSlot *slot = list;
+        list = slot->next;
+        slot->next = NULL;
+        if (coro_ready(slot, now)) {
+            coro_unwatch(slot);
+            if (slot->wait == CORO_WAIT_INVOKE) {
+                free(slot->sub_cmd);
+                free(slot->sub_payload);
+                slot->sub_cmd = slot->sub_payload = NULL;
+            }
+            if (coro_resume(slot) == PLUG_CORO_DONE) {
+                coro_finish(slot);
+                continue;
+            }
+        }
+        *tail = slot;
+        tail = &slot->next;
+    }
+    // Coroutines started meanwhile stay in front.
+    sync_mutex_lock(&coro_lock);
+    *tail = coros;
+    coros = keep;
+    sync_mutex_unlock(&coro_lock);
+}
+
+// Ends every coroutine without resuming it. Their requests have already
+// been failed by plug_fail_outstanding().
+static void plug_drop_coros(void) {
+    sync_mutex_lock(&coro_lock);
+    CoroSlot *list = coros;
+    coros = NULL;
+    sync_mutex_unlock(&coro_lock);
+    while (list != NULL) {
+        CoroSlot *slot = list;
+        list = slot->next;
+        coro_finish(slot);
+    }
+}
+
+static long long coro_due_ms(CoroSlot *slot, unsigned long long now) {
+    if (slot->wait == CORO_WAIT_NONE || plug_coro_cancelled(&slot->co) || slot->co.revents != 0) {
+        return 0;
+    }
+    unsigned long long at = slot->wake_ms;
+    if (slot->co.handle != NULL) {
+        unsigned long long deadline = plug_cancel_token_deadline_ms(plug_handle_token(slot->co.handle));
+        if (deadline != 0 && (at == 0 || deadline < at)) {
+            at = deadline;
+        }
+    }
+    long long due = at == 0 ? -1 : at > now ? (long long)(at - now) : 0;
+#ifdef _WIN32
+    if ((slot->wait == CORO_WAIT_INVOKE || slot->wait == CORO_WAIT_WAKE) && (due < 0 || due > CORO_POLL_MS)) {
+        due = CORO_POLL_MS;
     }
 #endif
+    return due;
+}
+
+CROSSWEB_API int plug_update_timeout_ms(void) {
+    unsigned long long now = sync_now_ms();
+    long long timeout = plug_streams_busy() ? 0 : evloop_timeout_ms();
+    long long events_due = plug_events_timeout_ms(now);
+    if (events_due >= 0 && (timeout < 0 || events_due < timeout)) {
+        timeout = events_due;
+    }
+    sync_mutex_lock(&coro_lock);
+    for (CoroSlot *slot = coros; slot != NULL && timeout != 0; slot = slot->next) {
+        long long due = coro_due_ms(slot, now);
+        if (due >= 0 && (timeout < 0 || due < timeout)) {
+            timeout = due;
+        }
+    }
+    sync_mutex_unlock(&coro_lock);
+    return timeout > 0x7fffffff ? 0x7fffffff : (int)timeout;
+}
+
+CROSSWEB_API void plug_poll(webview_t wv, int timeout_ms) {
+    int due = plug_update_timeout_ms();
+    if (due >= 0 && (timeout_ms < 0 || due < timeout_ms)) {
+        timeout_ms = due;
+    }
+    evloop_run_once(timeout_ms);
+    plug_update(wv);
+}
+
+CROSSWEB_API int plug_poll_fd(void) {
+    return evloop_fd();
+}
+
+void plug_emit_to(const char *request_id, const char *event, const char *data) {
+    if (event == NULL) {
+        return;
+    }
+    if (data == NULL) {
+        data = "null";
+    }
+    if (request_id != NULL) {
+        plug_deliver_event_to(request_id, event, data);
+    } else {
+        plug_deliver_event(event, data);
+    }
+}
+
+CROSSWEB_API void plug_emit(const char *event, const char *data) {
+    if (event == NULL) {
+        return;
+    }
+    if (data == NULL) {
+        data = "null";
+    }
+    if (plug_filter_event(event, data)) {
+        plug_deliver_event(event, data);
+    }
 }
 
 CROSSWEB_API void plug_update(webview_t wv) {
     (void)wv;
-    // Intentionally minimal: the host owns IPC and calls plug_invoke directly.
+    // The host owns IPC and calls plug_invoke directly; here we run ready
+    // fd watches and timers, release events held back by their policies and
+    // feed streams with credit.
+    evloop_run_once(0);
+    plug_flush_events();
+    plug_pump_streams();
+    plug_run_coros();
 }
 
-CROSSWEB_API void *plug_pre_reload(void) { return NULL; }  // Hotreload hooks
+CROSSWEB_API void *plug_pre_reload(void) {  // Hotreload hooks
+    // Queued jobs still run against the old code; deferred work belongs to
+    // code that is about to be unloaded. Children are forked again from the
+    // new code.
+    plug_stop_isolation();
+    plug_stop_workers();
+    plug_fail_outstanding("{\"ok\":false,\"error\":\"plugin reloaded\"}");
+    plug_drop_coros();
+    evloop_deinit();
+    return NULL;
+}
 CROSSWEB_API void plug_post_reload(void *state) {
     (void)state;
 }
 CROSSWEB_API void plug_cleanup(webview_t wv) {
     (void)wv;
-    // Cleanup all plugins
+    plug_close_all_streams();
+    plug_stop_workers();
+    // Cleanup all plugins; isolated ones clean up in their own processes.
     for (int i = 0; i < plugin_count; ++i) {
-        if (registered_plugins[i]->cleanup) {
-            registered_plugins[i]->cleanup();
+        if (registered_plugins[i].plugin->cleanup && plug_isolated_group(i) < 0) {
+            registered_plugins[i].plugin->cleanup();
         }
     }
+    plug_stop_isolation();
+    plug_fail_outstanding("{\"ok\":false,\"error\":\"plugin unloaded\"}");
+    plug_drop_coros();
+    plug_flush_events();
+    sync_mutex_lock(&event_lock);
+    for (int i = 0; i < event_rule_count; ++i) {
+        event_rule_free(&event_rules[i]);
+    }
+    event_rule_count = 0;
+    sync_mutex_unlock(&event_lock);
+    evloop_deinit();
 }
 
 // Resource loading (keep minimal)
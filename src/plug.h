@@ -6,6 +6,38 @@
 typedef void* webview_t;
 
 typedef void (*RespondCallback)(const char *response);
+// Replies to a binary call with raw bytes. `data` is copied before returning.
+// Errors are reported as "application/json" bodies like {"ok":false,...}.
+typedef void (*RespondBytesCallback)(const char *content_type, const void *data, size_t len);
+
+// A single call routed to a plugin. The payload is decoded once by the host and
+// handed over by pointer and length; it is NUL-terminated for convenience and
+// stays valid until the response has been sent.
+typedef struct PlugRequest {
+    const char *id;        // Request id chosen by the caller (JS side)
+    const char *cmd;       // Full command, e.g. "fs.read"
+    const char *payload;   // Decoded payload bytes
+    size_t payload_len;    // Length of payload in bytes
+    const void *data;      // Raw bytes of a binary call (crossweb:// body), else NULL
+    size_t data_len;
+    unsigned long long deadline_ms;  // sync_now_ms() time the caller gives up at, 0 = none
+    void *host_ctx;        // Handed back to the host's completion hook, see below
+} PlugRequest;
+
+// Hosts serving several pages from one runtime (see ipc_window_open()) prefix
+// each id with its page, up to and including this separator. Ids stay opaque
+// to plugins; plug.c uses the prefix to send "__stream" events back to the
+// page that opened the stream and to drop a closed page's work when the host
+// sends "__window.closed" with an id carrying that prefix.
+#define PLUG_ORIGIN_SEP '\x1f'
+
+// Installed by hosts that can answer a request after plug_invoke() returned.
+// Called exactly once per request that carries a host_ctx, from whichever
+// thread completes it. A NULL content_type means `data` is the JSON response;
+// otherwise `data`/`len` are raw bytes. NULL data finishes the request
+// without a reply. When set, the `respond` argument of plug_invoke() and
+// plug_invoke_bytes() is not used for such requests.
+typedef void (*PlugHostComplete)(void *host_ctx, const char *content_type, const void *data, size_t len);
 
 typedef struct PluginContext {
     webview_t webview;
@@ -13,6 +45,23 @@ typedef struct PluginContext {
     const char *config;    // JSON config string
 } PluginContext;
 
+// Where a plugin's commands run. Plugin code that touches the webview or
+// other thread-affine state keeps the default.
+typedef enum {
+    PLUG_THREAD_MAIN = 0,      // On the thread that calls plug_invoke() (the UI loop)
+    PLUG_THREAD_STRAND,        // On the worker pool, one command at a time, in order
+    PLUG_THREAD_CONCURRENT,    // On the worker pool, any number at once
+} PlugThreading;
+
+// One command of a plugin, found by its full "plugin.command" name. `run`
+// takes the JSON payload; `run_bytes` is the optional binary entrypoint with
+// the same arguments as Plugin.invoke_bytes. Either may be NULL.
+typedef struct PlugCommand {
+    const char *name;      // e.g. "read" for "fs.read"
+    bool (*run)(const char *payload, RespondCallback respond);
+    bool (*run_bytes)(const char *args, const void *data, size_t len, RespondBytesCallback respond);
+} PlugCommand;
+
 typedef struct Plugin {
     const char *name;      // Plugin identifier (e.g., "fs", "dialog")
     int version;           // Semantic version (e.g., 100 for 1.0.0)
@@ -20,6 +69,16 @@ typedef struct Plugin {
     bool (*invoke)(const char *command, const char *payload, RespondCallback respond);  // Handle commands
     void (*event)(const char *event, const char *data);  // Handle events
     void (*cleanup)(void);  // Cleanup resources
+    // Optional binary entrypoint: `args` is the JSON argument string and
+    // `data`/`len` the raw request body, which may contain NULs.
+    bool (*invoke_bytes)(const char *command, const char *args, const void *data, size_t len,
+                         RespondBytesCallback respond);
+    PlugThreading threading;
+    // Optional table ending with a { NULL } entry. Its commands are looked up
+    // before anything else; with a table, invoke and invoke_bytes only see
+    // commands that are not in it, and a plugin with neither has unknown
+    // commands refused before their payload is touched.
+    const PlugCommand *commands;
 } Plugin;
 
 // Export control for the hotreload DLL.
@@ -41,7 +100,9 @@ typedef struct Plugin {
 // Usage in plugin lib.c:
 //   PLUG_REGISTER(my_plugin)
 //
-// Where my_plugin is a Plugin struct defined in the same file.
+// Where my_plugin is a Plugin struct defined in the same file. Registration
+// also enters each of its commands in plug.c's command table, so dispatch
+// is one hash lookup on the full "plugin.command" name.
 // ============================================================================
 
 // Cross-platform constructor attribute
@@ -74,14 +135,339 @@ bool plug_load(const char *path);
 void *plug_load_resource(const char *file_path, size_t *size);
 void plug_free_resource(void *data);
 
+// ============================================================================
+// EVENT POLICIES
+// ============================================================================
+// High-rate emitters (progress, telemetry, sensors) can register a policy so
+// plug_emit() does not turn every call into a page update. Policies are
+// matched by exact event name, or by prefix when the name ends in '*'. They
+// can also come from the CROSSWEB_EVENT_POLICY environment variable, e.g.
+//   CROSSWEB_EVENT_POLICY="progress=30;sensor.*=60/last:id"
+// (rate in Hz, "/last" for last-value-wins, ":field" for the key field).
+// ============================================================================
+
+typedef struct PlugEventPolicy {
+    const char *event;         // Event name, or prefix ending in '*'
+    unsigned int max_rate_hz;  // Per event (and key) delivery cap, 0 = no cap
+    bool coalesce;             // Last value wins: hold the newest event instead
+                               // of dropping; flushed from plug_update(). With
+                               // no rate cap this means at most once per tick.
+    const char *key_field;     // Optional top-level JSON field; each distinct
+                               // value is rate-limited/coalesced separately
+} PlugEventPolicy;
+
+typedef struct PlugEventStats {
+    unsigned long long emitted;    // plug_emit() calls matching the policy
+    unsigned long long delivered;  // Events forwarded to the page
+    unsigned long long coalesced;  // Held events replaced by a newer value
+    unsigned long long dropped;    // Events discarded by the rate cap
+} PlugEventStats;
+
+// Registers or replaces the policy for policy->event. Thread-safe.
+bool plug_set_event_policy(const PlugEventPolicy *policy);
+// Counters for the policy registered under `event` (the policy's own name).
+bool plug_get_event_stats(const char *event, PlugEventStats *stats);
+// Sends an event only to the page that made `request_id`, on hosts that can
+// tell pages apart (elsewhere it goes to every page). Thread-safe. Targeted
+// events are for one reader and skip the policies above.
+void plug_emit_to(const char *request_id, const char *event, const char *data);
+
+// ============================================================================
+// STREAMING RESPONSES
+// ============================================================================
+// A command can answer with a stream of JSON chunks instead of one response.
+// Inside Plugin.invoke, call plug_stream_open() instead of `respond`; the page
+// gets an async iterator and grants credit (one unit per chunk) as it
+// consumes, so a producer that outpaces the page is paused instead of
+// buffering without bound.
+//
+// Chunks are pulled: while a stream has credit, plug_update() calls
+// ops->pull on the UI thread, which writes up to plug_stream_credit() chunks.
+// Producers living on their own thread may call plug_stream_write() directly;
+// it returns false when the page has not granted credit yet.
+// ============================================================================
+
+typedef struct PlugStream PlugStream;
+
+typedef struct PlugStreamOps {
+    // Produce chunks. Optional for producers that write from their own thread.
+    void (*pull)(PlugStream *stream, void *user);
+    // Called exactly once, on the UI thread, after the stream ended, failed or
+    // was cancelled by the page. The handle is invalid after this returns, so
+    // any producer thread must be stopped here.
+    void (*close)(PlugStream *stream, void *user, bool cancelled);
+} PlugStreamOps;
+
+// Only valid inside Plugin.invoke, for a call straight from the page (not a
+// batch entry, pipeline step or coroutine sub-request); the request is
+// answered by the stream.
+PlugStream *plug_stream_open(const PlugStreamOps *ops, void *user);
+unsigned int plug_stream_credit(PlugStream *stream);
+// Thread-safe. Sends one chunk (a JSON value) if credit is available.
+bool plug_stream_write(PlugStream *stream, const char *chunk_json);
+// Thread-safe. Finish the stream normally or with an error (a JSON value).
+void plug_stream_end(PlugStream *stream);
+void plug_stream_error(PlugStream *stream, const char *error_json);
+
+// ============================================================================
+// CANCELLATION AND DEADLINES
+// ============================================================================
+// The page can abandon a call (AbortSignal, timeout), which sends a
+// "__cancel" for its id. Requests still queued are dropped by the host;
+// running ones get their token flagged. Long-running commands should poll
+// plug_cancelled() between units of work and stop early when it turns true.
+// ============================================================================
+
+typedef struct PlugCancelToken PlugCancelToken;
+
+// Token of the request being handled on this thread, NULL outside
+// Plugin.invoke. Owned by the dispatcher until the invoke returns; retain it
+// to check from work that outlives the call.
+PlugCancelToken *plug_cancel_token(void);
+void plug_cancel_token_retain(PlugCancelToken *token);
+void plug_cancel_token_release(PlugCancelToken *token);
+// True once the page cancelled the request or its deadline has passed.
+// Thread-safe and cheap enough to call per chunk of work.
+bool plug_cancel_token_cancelled(const PlugCancelToken *token);
+// sync_now_ms() time the caller gives up at, 0 when there is no deadline.
+unsigned long long plug_cancel_token_deadline_ms(const PlugCancelToken *token);
+// Shorthand for the current request's token.
+bool plug_cancelled(void);
+
+// ============================================================================
+// DEFERRED COMPLETION
+// ============================================================================
+// Plugin.invoke normally answers through `respond` before returning. A
+// command that waits on I/O or a worker can instead take the request with
+// plug_defer() and return at once, keeping the UI loop free; the handle is
+// completed later, from any thread, exactly once. The request's payload stays
+// valid until then, and outstanding handles are failed on plugin cleanup and
+// hot reload.
+// ============================================================================
+
+typedef struct PlugHandle PlugHandle;
+
+// Only valid inside Plugin.invoke / invoke_bytes. Returns NULL when the host
+// cannot complete requests later; answer through `respond` then.
+PlugHandle *plug_defer(void);
+// Thread-safe. Exactly one of these per handle; the handle is invalid
+// afterwards. Returns false if it had already been completed (or failed on
+// cleanup), in which case nothing is sent.
+bool plug_complete(PlugHandle *handle, const char *response_json);
+bool plug_complete_bytes(PlugHandle *handle, const char *content_type, const void *data, size_t len);
+// The request's cancellation token, valid until the handle is completed.
+PlugCancelToken *plug_handle_token(PlugHandle *handle);
+// Deferred requests not completed yet.
+size_t plug_outstanding_requests(void);
+
+// ============================================================================
+// WORKER POOL
+// ============================================================================
+// Commands of PLUG_THREAD_STRAND and PLUG_THREAD_CONCURRENT plugins are run
+// on a bounded pool of worker threads, so a slow command does not stall the
+// UI loop; their replies travel back through the host's completion hook.
+// Hosts without that hook run everything inline. When the pool's queue is
+// full, requests are refused with the same "busy" error as the IPC queue.
+// Sizing: plug_configure_workers() before plug_init(), or CROSSWEB_WORKERS /
+// CROSSWEB_WORKER_QUEUE in the environment.
+// ============================================================================
+
+typedef struct PlugWorkerStats {
+    unsigned int threads;
+    unsigned int queued;               // Commands waiting for a worker
+    unsigned int running;
+    unsigned int peak_queued;
+    unsigned long long completed;
+    unsigned long long rejected;       // Refused with "busy"
+} PlugWorkerStats;
+
+// threads = 0 picks one per CPU; max_queued = 0 keeps the default (1024).
+void plug_configure_workers(unsigned int threads, unsigned int max_queued);
+void plug_get_worker_stats(PlugWorkerStats *stats);
+
+// ============================================================================
+// ISOLATED PLUGINS
+// ============================================================================
+// A plugin can run in child processes instead of the UI process, so a crash
+// there only fails the requests it was serving and a stall only delays its
+// own commands. Each child initialises just that plugin and runs its
+// commands with the usual threading model. Requests and replies cross
+// shared memory, not a socket. A child that dies is forked again. With
+// several processes, each request goes to the one with the least in flight.
+// The plugin gets no webview (PluginContext.webview is NULL), and its
+// plug_emit() policies are the ones set from the environment.
+//
+// Call plug_isolate() before plug_init(), or list plugins in
+// CROSSWEB_ISOLATE, e.g. CROSSWEB_ISOLATE="keystore;fs=2" (two processes for
+// fs). Requests over 4 MiB are refused; replies may be any size. Linux
+// only: elsewhere the plugins keep running in process.
+// ============================================================================
+
+typedef struct PlugIsolateStats {
+    unsigned int processes;
+    unsigned int in_flight;            // Sent to a child, not answered yet
+    unsigned long long completed;
+    unsigned long long restarts;       // Children forked again after dying
+} PlugIsolateStats;
+
+// processes = 0 means one.
+bool plug_isolate(const char *plugin, unsigned int processes);
+// False unless the plugin is currently running isolated.
+bool plug_get_isolate_stats(const char *plugin, PlugIsolateStats *stats);
+
+// ============================================================================
+// PARALLEL TASKS
+// ============================================================================
+// Fork/join on the worker pool, for splitting one command's work across
+// cores: spawn tasks into a group, then join. Idle workers steal tasks, so
+// recursive splits balance themselves.
+//
+// A command that answers only after the join either waits for it (fine on a
+// worker, i.e. from STRAND and CONCURRENT plugins) or, to keep the UI thread
+// free, takes a handle with plug_defer() and completes it from the
+// continuation given to plug_task_then():
+//
+//     PlugHandle *h = plug_defer();
+//     PlugTaskGroup *g = plug_task_group();
+//     for (size_t i = 0; i < n; ++i) plug_task_spawn(g, hash_chunk, &chunks[i]);
+//     plug_task_then(g, reply_with_digest, h);
+//
+// Without a running pool every task runs inline.
+// ============================================================================
+
+typedef struct PlugTaskGroup PlugTaskGroup;
+typedef void (*PlugTaskFn)(void *arg);
+typedef void (*PlugRangeFn)(size_t begin, size_t end, void *arg);
+
+PlugTaskGroup *plug_task_group(void);
+// Thread-safe; tasks may spawn into their own group.
+void plug_task_spawn(PlugTaskGroup *group, PlugTaskFn fn, void *arg);
+// Helps run tasks until the group is done, then frees it.
+void plug_task_wait(PlugTaskGroup *group);
+// Frees the group once its tasks are done, calling `done` from the thread
+// that finished the last one.
+void plug_task_then(PlugTaskGroup *group, PlugTaskFn done, void *arg);
+// Runs fn over disjoint chunks of [begin, end) of at most `grain` items
+// (0 = pick from the worker count) and returns when all are done.
+void plug_parallel_for(size_t begin, size_t end, size_t grain, PlugRangeFn fn, void *arg);
+
+// ============================================================================
+// EVENT LOOP
+// ============================================================================
+// Plugins that need to react to a file descriptor (socket, pipe, inotify)
+// or to time register with the core loop instead of polling from their own
+// threads. Callbacks run on the thread that drives plug_update(). On
+// Windows only timers are available and plug_watch_fd() returns false.
+// ============================================================================
+
+#define PLUG_FD_READ  0x1u
+#define PLUG_FD_WRITE 0x2u
+#define PLUG_FD_ERROR 0x4u   // Error or hangup, always reported
+
+typedef void (*PlugFdFn)(int fd, unsigned int revents, void *arg);
+typedef void (*PlugTimerFn)(void *arg);
+
+// Thread-safe. One watch per fd; watching it again replaces the callback.
+bool plug_watch_fd(int fd, unsigned int events, PlugFdFn fn, void *arg);
+void plug_unwatch_fd(int fd);
+// Fires after delay_ms, then every period_ms (0 = once). Returns an id for
+// plug_timer_cancel(), 0 on failure.
+unsigned long plug_timer_start(unsigned int delay_ms, unsigned int period_ms, PlugTimerFn fn, void *arg);
+bool plug_timer_cancel(unsigned long id);
+
+// ============================================================================
+// COROUTINES
+// ============================================================================
+// Stackless coroutines (protothreads) for commands that spend most of their
+// time waiting: on a timer, a file descriptor or another command. A waiting
+// coroutine costs a few dozen bytes and no thread; the scheduler resumes it
+// from plug_update() on the host's UI loop once what it waits for is ready.
+//
+//     static PlugCoroStatus slow_echo(PlugCoro *co) {
+//         PLUG_CORO_BEGIN(co);
+//         PLUG_CORO_SLEEP(co, 500);
+//         PLUG_CORO_AWAIT_INVOKE(co, "fs.exists", co->user);
+//         plug_coro_respond(co, co->reply);
+//         PLUG_CORO_END(co);
+//     }
+//
+// Local variables do not survive a wait; keep state in `user`. Only one
+// wait per source line. Started from a command, a coroutine takes over the
+// request: it answers with plug_coro_respond(), or with {"ok":true} if it
+// finishes without doing so.
+// ============================================================================
+
+typedef enum {
+    PLUG_CORO_WAITING,
+    PLUG_CORO_DONE,
+} PlugCoroStatus;
+
+typedef struct PlugCoro PlugCoro;
+typedef PlugCoroStatus (*PlugCoroFn)(PlugCoro *co);
+
+struct PlugCoro {
+    int resume_line;           // Continuation, 0 = not started, -1 = done
+    void *user;
+    PlugHandle *handle;        // Request being served, NULL if none
+    const char *reply;         // JSON reply to the last PLUG_CORO_AWAIT_INVOKE
+    size_t reply_len;
+    unsigned int revents;      // PLUG_FD_* from the last PLUG_CORO_AWAIT_FD, 0 on timeout
+    bool timed_out;            // The last wait ended by its timeout
+};
+
+// Runs `fn` up to its first wait. From inside a command the coroutine
+// defers the request (see plug_defer()). `cleanup`, if given, frees `user`
+// once the coroutine is done. Returns false if it could not be started.
+bool plug_coro_start(PlugCoroFn fn, void *user, void (*cleanup)(void *user));
+// Answers the coroutine's request; later calls are ignored.
+void plug_coro_respond(PlugCoro *co, const char *response_json);
+// Thread-safe: ends a PLUG_CORO_AWAIT_WAKE early.
+void plug_coro_wake(PlugCoro *co);
+// The request was cancelled or its deadline passed. Waits end early when
+// that happens, so check after each one.
+bool plug_coro_cancelled(PlugCoro *co);
+
+// Used by the wait macros; each returns false when there is nothing to wait
+// for (e.g. fd waits on Windows), in which case the macro does not yield.
+bool plug_coro_sleep(PlugCoro *co, unsigned int ms);
+bool plug_coro_wait_fd(PlugCoro *co, int fd, unsigned int events, int timeout_ms);
+bool plug_coro_invoke(PlugCoro *co, const char *cmd, const char *payload_json);
+bool plug_coro_wait_wake(PlugCoro *co, int timeout_ms);
+
+#define PLUG_CORO_BEGIN(co) switch ((co)->resume_line) { case 0:
+#define PLUG_CORO_YIELD(co) \
+    do { (co)->resume_line = __LINE__; return PLUG_CORO_WAITING; case __LINE__:; } while (0)
+#define PLUG_CORO_SLEEP(co, ms) \
+    do { if (plug_coro_sleep((co), (ms))) PLUG_CORO_YIELD(co); } while (0)
+#define PLUG_CORO_AWAIT_FD(co, fd, events, timeout_ms) \
+    do { if (plug_coro_wait_fd((co), (fd), (events), (timeout_ms))) PLUG_CORO_YIELD(co); } while (0)
+#define PLUG_CORO_AWAIT_INVOKE(co, cmd, payload_json) \
+    do { if (plug_coro_invoke((co), (cmd), (payload_json))) PLUG_CORO_YIELD(co); } while (0)
+#define PLUG_CORO_AWAIT_WAKE(co, timeout_ms) \
+    do { if (plug_coro_wait_wake((co), (timeout_ms))) PLUG_CORO_YIELD(co); } while (0)
+#define PLUG_CORO_END(co) } (co)->resume_line = -1; return PLUG_CORO_DONE
+
+// Host loop: call plug_update() every iteration. A host that blocks in its
+// own message loop wakes up after plug_update_timeout_ms() (-1 = no need);
+// a host without one calls plug_poll(), which sleeps in the core event loop
+// until there is work (or timeout_ms passes, -1 = no limit) and then runs
+// plug_update(). A host whose message loop can watch descriptors (GLib)
+// watches plug_poll_fd() instead and calls plug_update() when it turns
+// readable; the fd changes across a hot reload and is -1 where unsupported.
 #define LIST_OF_PLUGS \
     PLUG(plug_init, void, webview_t) \
     PLUG(plug_pre_reload, void*, void) \
     PLUG(plug_post_reload, void, void*) \
     PLUG(plug_update, void, webview_t) \
-    PLUG(plug_invoke, void, const char*, const char*, RespondCallback) \
+    PLUG(plug_update_timeout_ms, int, void) \
+    PLUG(plug_poll, void, webview_t, int) \
+    PLUG(plug_poll_fd, int, void) \
+    PLUG(plug_invoke, void, const PlugRequest*, RespondCallback) \
+    PLUG(plug_invoke_bytes, void, const PlugRequest*, RespondBytesCallback) \
     PLUG(plug_emit, void, const char*, const char*) \
     PLUG(plug_set_host_emit_event, void, void (*)(const char *event, const char *data_json)) \
+    PLUG(plug_set_host_emit_event_to, void, void (*)(const char *request_id, const char *event, const char *data_json)) \
+    PLUG(plug_set_host_complete, void, PlugHostComplete) \
     PLUG(plug_cleanup, void, webview_t)
 
 #define PLUG(name, ret, ...) typedef ret (name##_t)(__VA_ARGS__);
@@ -98,7 +484,7 @@ LIST_OF_PLUGS
 
 #ifdef ANDROID
 #include <jni.h>
-extern JNIEnv *global_env;
+extern JavaVM *global_jvm;
 extern jobject global_obj;
 extern jmethodID emitMethodId;
 #endif
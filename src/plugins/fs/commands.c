@@ -1,26 +1,36 @@
 #include "commands.h"
 #include "models.h"
 #include "error.h"
+#include "../../codec.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-// JSON parsing stub (replace with proper JSON lib)
+// JSON parsing stub (replace with proper JSON lib): finds "key":"value" and
+// returns a copy of value with \" and \\ unescaped.
 static char *parse_json_string(const char *json, const char *key) {
-    // Very basic parser for "key":"value"
     char pattern[256];
-    snprintf(pattern, sizeof(pattern), "\"%s\":\"([^\"]+)\"", key);
-    // For simplicity, assume json is {"path":"value"}
-    const char *start = strstr(json, "\"");
+    snprintf(pattern, sizeof(pattern), "\"%s\"", key);
+    const char *start = strstr(json, pattern);
     if (!start) return NULL;
-    start = strstr(start + 1, "\"");
-    if (!start) return NULL;
-    start++;
-    const char *end = strstr(start, "\"");
-    if (!end) return NULL;
-    size_t len = end - start;
-    char *value = malloc(len + 1);
-    strncpy(value, start, len);
+    start += strlen(pattern);
+    while (*start == ' ' || *start == '\t' || *start == '\n' || *start == '\r') start++;
+    if (*start++ != ':') return NULL;
+    while (*start == ' ' || *start == '\t' || *start == '\n' || *start == '\r') start++;
+    if (*start++ != '"') return NULL;
+    const char *end = start;
+    while (*end && *end != '"') {
+        if (*end == '\\' && end[1]) end++;
+        end++;
+    }
+    if (*end != '"') return NULL;
+    char *value = malloc((size_t)(end - start) + 1);
+    if (!value) return NULL;
+    size_t len = 0;
+    for (const char *p = start; p < end; ++p) {
+        if (*p == '\\') p++;
+        value[len++] = *p;
+    }
     value[len] = '\0';
     return value;
 }
@@ -71,4 +81,117 @@ bool fs_write_command(const char *payload, char **response) {
     }
     *response = strdup("{\"success\":true}");
     return true;
-}
\ No newline at end of file
+}
+
+static void fs_respond_error(RespondBytesCallback respond, FsError err) {
+    char buf[256];
+    int n = snprintf(buf, sizeof(buf), "{\"error\":\"%s\"}", fs_error_to_string(err));
+    respond("application/json", buf, (size_t)n);
+}
+
+bool fs_read_bytes_command(const char *args, RespondBytesCallback respond) {
+    char *path = parse_json_string(args, "path");
+    if (!path) {
+        static const char invalid[] = "{\"error\":\"invalid payload\"}";
+        respond("application/json", invalid, sizeof(invalid) - 1);
+        return false;
+    }
+    ReadFileRequest req = { .path = path, .binary = true };
+    char *content;
+    size_t size;
+    FsError err = fs_read_file(&req, &content, &size);
+    free(path);
+    if (err != FS_ERROR_NONE) {
+        fs_respond_error(respond, err);
+        return false;
+    }
+    respond("application/octet-stream", content, size);
+    free(content);
+    return true;
+}
+
+bool fs_write_bytes_command(const char *args, const void *data, size_t len, RespondBytesCallback respond) {
+    char *path = parse_json_string(args, "path");
+    if (!path) {
+        static const char invalid[] = "{\"error\":\"invalid payload\"}";
+        respond("application/json", invalid, sizeof(invalid) - 1);
+        return false;
+    }
+    WriteFileRequest req = { .path = path, .content = (const char *)data, .length = len, .binary = true };
+    FsError err = fs_write_file(&req);
+    free(path);
+    if (err != FS_ERROR_NONE) {
+        fs_respond_error(respond, err);
+        return false;
+    }
+    static const char ok[] = "{\"success\":true}";
+    respond("application/json", ok, sizeof(ok) - 1);
+    return true;
+}
+
+#define FS_STREAM_CHUNK (64 * 1024)
+
+typedef struct FsReadStream {
+    FILE *file;
+    unsigned char buf[FS_STREAM_CHUNK];
+    char json[sizeof("{\"data\":\"\"}") + ((FS_STREAM_CHUNK + 2) / 3) * 4];
+} FsReadStream;
+
+static void fs_read_stream_pull(PlugStream *stream, void *user) {
+    FsReadStream *rs = (FsReadStream *)user;
+    for (unsigned int credit = plug_stream_credit(stream); credit > 0; --credit) {
+        size_t n = fread(rs->buf, 1, sizeof(rs->buf), rs->file);
+        if (n > 0) {
+            size_t len = 0;
+            memcpy(rs->json, "{\"data\":\"", 9);
+            len = 9;
+            len += codec_base64_encode(rs->buf, n, rs->json + len, CODEC_BASE64);
+            memcpy(rs->json + len, "\"}", 3);
+            plug_stream_write(stream, rs->json);
+        }
+        if (n < sizeof(rs->buf)) {
+            if (ferror(rs->file)) {
+                plug_stream_error(stream, "{\"error\":\"io error\"}");
+            } else {
+                plug_stream_end(stream);
+            }
+            return;
+        }
+    }
+}
+
+static void fs_read_stream_close(PlugStream *stream, void *user, bool cancelled) {
+    (void)stream;
+    (void)cancelled;
+    FsReadStream *rs = (FsReadStream *)user;
+    fclose(rs->file);
+    free(rs);
+}
+
+bool fs_read_stream_command(const char *payload, RespondCallback respond) {
+    char *path = parse_json_string(payload, "path");
+    if (!path) {
+        respond("{\"error\":\"invalid payload\"}");
+        return false;
+    }
+    FsReadStream *rs = (FsReadStream *)malloc(sizeof(FsReadStream));
+    FILE *file = rs ? fopen(path, "rb") : NULL;
+    free(path);
+    if (file == NULL) {
+        FsError err = rs ? FS_ERROR_FILE_NOT_FOUND : FS_ERROR_OUT_OF_MEMORY;
+        free(rs);
+        char buf[256];
+        snprintf(buf, sizeof(buf), "{\"error\":\"%s\"}", fs_error_to_string(err));
+        respond(buf);
+        return false;
+    }
+    rs->file = file;
+    static const PlugStreamOps ops = { .pull = fs_read_stream_pull, .close = fs_read_stream_close };
+    if (plug_stream_open(&ops, rs) == NULL) {
+        fclose(file);
+        free(rs);
+        respond("{\"error\":\"stream unavailable\"}");
+        return false;
+    }
+    return true;
+}
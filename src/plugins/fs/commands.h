@@ -1,12 +1,22 @@
 #ifndef FS_COMMANDS_H
 #define FS_COMMANDS_H
 
+#include "../../plug.h"
 #include "models.h"
 #include "error.h"
 
 bool fs_read_command(const char *payload, char **response);
 bool fs_write_command(const char *payload, char **response);
 
+// Binary variants over the crossweb:// side channel: file contents travel as
+// raw bytes, `args` carries {"path":...}.
+bool fs_read_bytes_command(const char *args, RespondBytesCallback respond);
+bool fs_write_bytes_command(const char *args, const void *data, size_t len, RespondBytesCallback respond);
+
+// Streams the file as {"data":"<base64>"} chunks of 64 KiB, paced by the
+// page's credit, so multi-GB files never sit in memory at once.
+bool fs_read_stream_command(const char *payload, RespondCallback respond);
+
 // Platform-specific file operations
 FsError fs_read_file(const ReadFileRequest *req, char **content, size_t *size);
 FsError fs_write_file(const WriteFileRequest *req);
@@ -1,9 +1,12 @@
 #include "models.h"
 #include "error.h"
+#include "../../plug.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#define FS_READ_CHUNK (1024 * 1024)
+
 // Desktop-specific file operations (Win32, POSIX)
 FsError fs_read_file(const ReadFileRequest *req, char **content, size_t *size) {
     FILE *file = fopen(req->path, req->binary ? "rb" : "r");
@@ -18,7 +21,23 @@ FsError fs_read_file(const ReadFileRequest *req, char **content, size_t *size) {
         fclose(file);
         return FS_ERROR_IO_ERROR;
     }
-    fread(*content, 1, *size, file);
+    // Read in chunks so a request the page has abandoned stops early.
+    size_t done = 0;
+    while (done < *size) {
+        if (plug_cancelled()) {
+            free(*content);
+            *content = NULL;
+            fclose(file);
+            return FS_ERROR_CANCELLED;
+        }
+        size_t chunk = *size - done < FS_READ_CHUNK ? *size - done : FS_READ_CHUNK;
+        size_t n = fread(*content + done, 1, chunk, file);
+        done += n;
+        if (n < chunk) {
+            break;
+        }
+    }
+    *size = done;
     if (!req->binary) {
         (*content)[*size] = '\0';
     }
@@ -31,9 +50,10 @@ FsError fs_write_file(const WriteFileRequest *req) {
     if (!file) {
         return FS_ERROR_PERMISSION_DENIED;
     }
-    size_t written = fwrite(req->content, 1, strlen(req->content), file);
+    size_t length = req->binary ? req->length : strlen(req->content);
+    size_t written = fwrite(req->content, 1, length, file);
     fclose(file);
-    return written == strlen(req->content) ? FS_ERROR_NONE : FS_ERROR_IO_ERROR;
+    return written == length ? FS_ERROR_NONE : FS_ERROR_IO_ERROR;
 }
 
 FsError fs_get_file_info(const char *path, FileInfo *info) {
@@ -7,6 +7,8 @@ const char *fs_error_to_string(FsError error) {
         case FS_ERROR_PERMISSION_DENIED: return "Permission denied";
         case FS_ERROR_INVALID_PATH: return "Invalid path";
         case FS_ERROR_IO_ERROR: return "I/O error";
+        case FS_ERROR_OUT_OF_MEMORY: return "Out of memory";
+        case FS_ERROR_CANCELLED: return "Cancelled";
         default: return "Unknown error";
     }
 }
\ No newline at end of file
@@ -8,6 +8,7 @@ typedef enum {
     FS_ERROR_INVALID_PATH,
     FS_ERROR_IO_ERROR,
     FS_ERROR_OUT_OF_MEMORY,
+    FS_ERROR_CANCELLED,
     FS_ERROR_UNKNOWN
 } FsError;
 
@@ -31,23 +31,43 @@ bool fs_init(PluginContext *ctx) {
     return true;
 }
 
-bool fs_invoke(const char *command, const char *payload, RespondCallback respond) {
-    char *response = NULL;
-    bool success = false;
-    if (strcmp(command, "read") == 0) {
-        success = fs_read_command(payload, &response);
-    } else if (strcmp(command, "write") == 0) {
-        success = fs_write_command(payload, &response);
-    } else {
-        response = strdup("{\"error\":\"unknown command\"}");
-    }
+// Sends what a command left in `response` and frees it.
+static bool fs_answer(bool success, char *response, RespondCallback respond) {
     if (respond && response) {
         respond(response);
-        free(response);
     }
+    free(response);
     return success;
 }
 
+static bool fs_read(const char *payload, RespondCallback respond) {
+    char *response = NULL;
+    bool success = fs_read_command(payload, &response);
+    return fs_answer(success, response, respond);
+}
+
+static bool fs_write(const char *payload, RespondCallback respond) {
+    char *response = NULL;
+    bool success = fs_write_command(payload, &response);
+    return fs_answer(success, response, respond);
+}
+
+// A read has no request body.
+static bool fs_read_bytes(const char *args, const void *data, size_t len, RespondBytesCallback respond) {
+    (void)data;
+    (void)len;
+    return fs_read_bytes_command(args, respond);
+}
+
+// Dispatched by name from plug.c; anything else is refused there.
+static const PlugCommand fs_commands[] = {
+    { "read", fs_read, fs_read_bytes },
+    { "write", fs_write, fs_write_bytes_command },
+    // Answers through the stream (or with an error) itself.
+    { "readStream", fs_read_stream_command, NULL },
+    { NULL, NULL, NULL }
+};
+
 void fs_event(const char *event, const char *data) {
     // Handle file system events
     printf("FS event: %s %s\n", event, data);
@@ -62,9 +82,11 @@ Plugin fs_plugin = {
     .name = "fs",
     .version = 100,
     .init = fs_init,
-    .invoke = fs_invoke,
     .event = fs_event,
-    .cleanup = fs_cleanup
+    .cleanup = fs_cleanup,
+    // Commands keep no shared state, so any number may run at once
+    .threading = PLUG_THREAD_CONCURRENT,
+    .commands = fs_commands
 };
 
 // Auto-register this plugin at load time
@@ -33,9 +33,10 @@ FsError fs_write_file(const WriteFileRequest *req) {
     if (!file) {
         return FS_ERROR_PERMISSION_DENIED;
     }
-    size_t written = fwrite(req->content, 1, strlen(req->content), file);
+    size_t length = req->binary ? req->length : strlen(req->content);
+    size_t written = fwrite(req->content, 1, length, file);
     fclose(file);
-    return written == strlen(req->content) ? FS_ERROR_NONE : FS_ERROR_IO_ERROR;
+    return written == length ? FS_ERROR_NONE : FS_ERROR_IO_ERROR;
 }
 
 FsError fs_get_file_info(const char *path, FileInfo *info) {
@@ -19,6 +19,7 @@ typedef struct ReadFileRequest {
 typedef struct WriteFileRequest {
     const char *path;
     const char *content;
+    size_t length;         // Byte count for binary writes; text uses strlen
     bool binary;
 } WriteFileRequest;
 
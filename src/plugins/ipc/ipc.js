@@ -1,94 +1,685 @@
 // IPC helper for plugins.
-// Provides `isNative()` and `invokeNative(cmd, payload)` to call the host IPC.
+// Provides `isNative()` and `invokeNative(cmd, payload, {signal, timeoutMs})`
+// to call the host IPC, plus `invokeBinary(cmd, args, bytes, options)` for raw
+// ArrayBuffer transfers, `invokeBatch(calls, options)` to send many
+// commands in one message, and `invokePipeline(steps, options)` to chain
+// commands natively.
+// Commands that answer with a stream resolve to an async iterator (see
+// openStream below).
+// In a plain browser tab (no native bridge) calls go over a WebSocket to
+// `crossweb-headless --ws 5180` instead; see connectNative().
+//
+// Pages may make thousands of calls a second, so the per-call path avoids
+// allocating what it can: pending calls are one small object each in a Map,
+// deadlines share a single timer wheel instead of a setTimeout per call, and
+// the text encoder and decoder are created once.
 
-const pending = {};
-let nativeListenerInstalled = false;
+// Debug logging is dropped at build time: bundlers replace the identifier
+// (Vite: `define: { __CROSSWEB_IPC_DEBUG__: 'true' }`), and without it every
+// `if (DEBUG)` below is dead code.
+/* global __CROSSWEB_IPC_DEBUG__ */
+const DEBUG = typeof __CROSSWEB_IPC_DEBUG__ !== 'undefined' && !!__CROSSWEB_IPC_DEBUG__;
+
+const DEFAULT_TIMEOUT_MS = 30000;
+const pending = new Map();     // request id -> Pending
+const streams = new Map();     // stream id -> stream
+const installedOn = new WeakSet();
+
+const SEP = String.fromCharCode(30);
+const ASCII = /^[\x00-\x7f]*$/;
+const encoder = typeof TextEncoder !== 'undefined' ? new TextEncoder() : null;
+const decoder = typeof TextDecoder !== 'undefined' ? new TextDecoder() : null;
+const clock = typeof performance !== 'undefined' && typeof performance.now === 'function'
+  ? () => performance.now() : Date.now;
+
+// window.CROSSWEB_IPC_URL overrides the endpoint; false disables the socket.
+const SOCKET_URL = 'ws://127.0.0.1:5180/';
+let socket = null;          // open connection, if any
+let socketReady = null;     // connection attempt in progress
+let socketUsed = false;     // a connection was open once, so retry on demand
+
+function nativeBridge() {
+  return typeof window !== 'undefined' && window.external && typeof window.external.invoke === 'function'
+    ? window.external : null;
+}
+
+// Ids this module picks itself (socket and raw-string calls): a counter
+// behind a per-load prefix, so a reloaded page does not pick up replies
+// meant for the last one.
+const ID_PREFIX = Math.random().toString(36).slice(2, 8) + '.';
+let idCounter = 0;
+
+function nextId() {
+  idCounter = (idCounter + 1) % Number.MAX_SAFE_INTEGER;
+  return ID_PREFIX + idCounter.toString(36);
+}
+
+function normalize(value) {
+  if (value === undefined || value === null) return '';
+  return (typeof value === 'string') ? value : JSON.stringify(value);
+}
+
+// btoa() takes a binary string; building it 32K bytes per call keeps
+// String.fromCharCode.apply under engine argument limits.
+function base64Bytes(bytes) {
+  let bin = '';
+  for (let i = 0; i < bytes.length; i += 0x8000) {
+    bin += String.fromCharCode.apply(null, bytes.subarray(i, i + 0x8000));
+  }
+  return btoa(bin);
+}
+
+// ASCII text is already a binary string, so only the rest goes through
+// the encoder.
+function base64Text(text) {
+  if (text === '') return '';
+  if (ASCII.test(text)) return btoa(text);
+  if (encoder) return base64Bytes(encoder.encode(text));
+  return btoa(unescape(encodeURIComponent(text)));
+}
+
+// Same shape as the bridge the native host injects. Requests are binary
+// messages with the payload as-is (no base64):
+//   0<RS>id[@timeoutMs]<RS>cmd<RS>payload
+//   2<RS>id<RS>cmd<RS>payload byte length<RS>payload bytes
+// and every reply is a binary 0|1<RS>id|event<RS>json.
+const socketBridge = {
+  __bridgeInstalled: true,
+  invoke(cmd, payload, timeoutMs) {
+    const id = nextId();
+    const budget = timeoutMs > 0 ? '@' + Math.ceil(timeoutMs) : '';
+    socket.send(encoder.encode('0' + SEP + id + budget + SEP + String(cmd || '') + SEP + normalize(payload)));
+    return id;
+  },
+  invokeBytes(cmd, args, bytes) {
+    const id = nextId();
+    const argBytes = encoder.encode(normalize(args));
+    const head = '2' + SEP + id + SEP + String(cmd || '') + SEP + argBytes.length + SEP;
+    // The head goes straight into the message, sized for the worst case.
+    const msg = new Uint8Array(head.length * 3 + argBytes.length + bytes.length);
+    const n = encoder.encodeInto(head, msg).written;
+    msg.set(argBytes, n);
+    msg.set(bytes, n + argBytes.length);
+    socket.send(msg.subarray(0, n + argBytes.length + bytes.length));
+    return id;
+  },
+};
+
+function dispatchSocketMessage(data) {
+  const text = typeof data === 'string' ? data : decoder.decode(data);
+  const first = text.indexOf(SEP);
+  const second = text.indexOf(SEP, first + 1);
+  if (first < 0 || second < 0) return;
+  let value = null;
+  try { value = JSON.parse(text.slice(second + 1)); } catch (e) { /* leave null */ }
+  const cb = text.charCodeAt(0) === 49 /* '1' */ ? socketBridge.onEvent : socketBridge.onMessage;
+  if (typeof cb === 'function') {
+    try { cb(text.slice(first + 1, second), value); } catch (e) { /* ignore */ }
+  }
+}
+
+// A dropped connection settles everything still waiting on it.
+function failAll(err) {
+  for (const entry of pending.values()) {
+    settle(entry);
+    entry.reject(err);
+  }
+  for (const stream of streams.values()) {
+    stream._push({ error: { error: err.message } });
+  }
+}
+
+function bridge() {
+  return nativeBridge() || (socket ? socketBridge : null);
+}
 
 export function isNative() {
-  console.log('isNative check:', typeof window !== 'undefined', window && window.external, window && window.external && typeof window.external.invoke === 'function');
-  return typeof window !== 'undefined' && window.external && typeof window.external.invoke === 'function';
+  return !!bridge();
+}
+
+// Resolves true once calls can be made: right away under the native host,
+// otherwise when the WebSocket to the headless host is open. Started on
+// import, so pages only need it to pick between native and web code paths.
+export function connectNative() {
+  if (bridge()) return Promise.resolve(true);
+  if (socketReady) return socketReady;
+  const url = typeof window !== 'undefined' && window.CROSSWEB_IPC_URL !== undefined ? window.CROSSWEB_IPC_URL : SOCKET_URL;
+  if (!url || typeof WebSocket !== 'function') return Promise.resolve(false);
+  socketReady = new Promise((resolve) => {
+    let ws;
+    try {
+      ws = new WebSocket(url);
+    } catch (e) {
+      socketReady = null;
+      resolve(false);
+      return;
+    }
+    ws.binaryType = 'arraybuffer';
+    ws.onopen = () => {
+      socket = ws;
+      socketUsed = true;
+      socketReady = null;
+      resolve(true);
+    };
+    ws.onmessage = (ev) => dispatchSocketMessage(ev.data);
+    ws.onclose = () => {
+      if (socket === ws) {
+        socket = null;
+        failAll(new Error('native bridge disconnected'));
+      } else {
+        socketReady = null;
+        resolve(false);
+      }
+    };
+  });
+  return socketReady;
+}
+
+// Waits for a connection attempt in flight, or reopens one that dropped,
+// before a call is refused. Null when there is nothing to wait for.
+function whenBridge() {
+  if (bridge()) return null;
+  const ready = socketReady || (socketUsed ? connectNative() : null);
+  return ready && ready.then((ok) => {
+    if (!ok) throw new Error('native bridge not available');
+  });
+}
+
+if (typeof window !== 'undefined' && !nativeBridge()) connectNative();
+
+// Binary replies on the framed fallback path arrive as {"$bytes": base64}.
+// Native sends JSON replies unwrapped, but one tagged application/json is
+// still parsed rather than handed out as bytes.
+function decodeBytes(result) {
+  if (!result || typeof result.$bytes !== 'string') return result;
+  const bin = atob(result.$bytes);
+  if (typeof result.type === 'string' && result.type.indexOf('application/json') === 0) {
+    const text = decoder ? decoder.decode(Uint8Array.from(bin, (c) => c.charCodeAt(0))) : bin;
+    try { return JSON.parse(text); } catch (e) { return null; }
+  }
+  const bytes = new Uint8Array(bin.length);
+  for (let i = 0; i < bin.length; i++) bytes[i] = bin.charCodeAt(i);
+  return bytes.buffer;
+}
+
+// One per call in flight, always with the same shape.
+class Pending {
+  constructor(resolve, reject, binary) {
+    this.resolve = resolve;
+    this.reject = reject;
+    this.binary = binary;     // settle through checkBinaryResult()
+    this.id = null;
+    this.deadline = 0;        // clock() time, 0 = none
+    this.signal = null;
+    this.onAbort = null;
+    this.fetch = null;        // AbortController of a crossweb:// call
+    this.done = false;
+  }
+}
+
+// Deadlines live in a timer wheel: a call sits in the slot of the tick its
+// deadline falls in, and a sweep fails what is due in the slots it has
+// passed, leaving anything a full turn or more away for a later turn. The
+// one timer is set for the next occupied slot, so it only fires when
+// something may be due. Settled calls are skipped rather than removed, and
+// compacted away once they outnumber the live ones.
+const WHEEL_TICK_MS = 10;
+const WHEEL_SLOTS = 512;
+const wheel = [];
+for (let i = 0; i < WHEEL_SLOTS; i++) wheel.push([]);
+let wheelSize = 0;          // calls in the slots, settled or not
+let wheelLive = 0;          // ... of which still waiting
+let wheelTick = 0;          // next tick to sweep
+let wheelTimer = null;
+let wheelTimerTick = 0;     // tick the timer is set for
+
+function wheelArm(tick, now) {
+  if (wheelTimer !== null) clearTimeout(wheelTimer);
+  wheelTimerTick = tick;
+  wheelTimer = setTimeout(wheelSweep, Math.max(0, tick * WHEEL_TICK_MS - now) + 1);
+}
+
+function wheelCompact() {
+  wheelSize = 0;
+  for (let i = 0; i < WHEEL_SLOTS; i++) {
+    const slot = wheel[i];
+    let keep = 0;
+    for (let j = 0; j < slot.length; j++) {
+      if (!slot[j].done) slot[keep++] = slot[j];
+    }
+    slot.length = keep;
+    wheelSize += keep;
+  }
+}
+
+function wheelAdd(entry) {
+  if (wheelSize > 1024 && wheelSize > 4 * wheelLive) wheelCompact();
+  const now = clock();
+  if (wheelTimer === null) wheelTick = Math.floor(now / WHEEL_TICK_MS);
+  const tick = Math.max(wheelTick, Math.ceil(entry.deadline / WHEEL_TICK_MS));
+  wheel[tick % WHEEL_SLOTS].push(entry);
+  wheelSize++;
+  wheelLive++;
+  if (wheelTimer === null || tick < wheelTimerTick) wheelArm(tick, now);
 }
 
-function installListener() {
-  if (nativeListenerInstalled || !isNative()) return;
-  const prev = window.external.onMessage;
-  window.external.onMessage = (id, result) => {
-    if (pending[id]) {
-      try { pending[id].resolve(result); } catch (e) { /* ignore */ }
-      delete pending[id];
+function wheelSweep() {
+  wheelTimer = null;
+  const now = clock();
+  const until = Math.floor(now / WHEEL_TICK_MS);
+  // After a long stall (a background tab), one pass over every slot.
+  if (until - wheelTick >= WHEEL_SLOTS) wheelTick = until - WHEEL_SLOTS + 1;
+  for (; wheelTick <= until && wheelLive > 0; wheelTick++) {
+    const slot = wheel[wheelTick % WHEEL_SLOTS];
+    let keep = 0;
+    for (let i = 0; i < slot.length; i++) {
+      const entry = slot[i];
+      if (entry.done) continue;
+      if (entry.deadline <= now) giveUp(entry, new Error('native call timeout'));
+      else slot[keep++] = entry;
+    }
+    wheelSize -= slot.length - keep;
+    slot.length = keep;
+  }
+  if (wheelLive === 0) {
+    for (let i = 0; i < WHEEL_SLOTS; i++) wheel[i].length = 0;
+    wheelSize = 0;
+    return;
+  }
+  let tick = wheelTick;
+  while (wheel[tick % WHEEL_SLOTS].length === 0) tick++;
+  wheelArm(tick, now);
+}
+
+function onAbortEntry(entry) {
+  giveUp(entry, abortError(entry.signal));
+}
+
+// Registers a call under the id its request went out with. `timeoutMs`
+// (0 = none) rejects it and was also sent as the native deadline, after
+// which the request is skipped if it has not started.
+function track(entry, id, signal, timeoutMs) {
+  entry.id = id;
+  pending.set(id, entry);
+  if (timeoutMs > 0) {
+    entry.deadline = clock() + timeoutMs;
+    wheelAdd(entry);
+  }
+  if (signal) {
+    entry.signal = signal;
+    entry.onAbort = () => onAbortEntry(entry);
+    signal.addEventListener('abort', entry.onAbort, { once: true });
+  }
+}
+
+function settle(entry) {
+  entry.done = true;
+  pending.delete(entry.id);
+  if (entry.deadline) wheelLive--;
+  if (entry.signal) entry.signal.removeEventListener('abort', entry.onAbort);
+}
+
+// Settles the call locally on timeout or abort and lets native know, so it
+// stops working on the request.
+function giveUp(entry, err) {
+  if (entry.done) return;
+  settle(entry);
+  entry.reject(err);
+  if (entry.fetch) entry.fetch.abort();
+  sendCancel(entry.id);
+}
+
+// A streamed reply: chunks arrive as "__stream" events and are consumed with
+// `for await`, or via toReadableStream(). Credit for half the window is
+// granted back each time that many chunks have been consumed, so the native
+// producer never runs more than `credit` chunks ahead of the page.
+function openStream(id, credit) {
+  const queue = [];
+  const waiters = [];
+  const grantAt = Math.max(1, Math.floor((credit || 1) / 2));
+  let consumed = 0;
+  let done = false;
+  let error = null;
+
+  function consume(value) {
+    consumed++;
+    if (consumed >= grantAt && !done) {
+      invokeNative('__stream.credit', { id, n: consumed }).catch(() => { /* stream gone */ });
+      consumed = 0;
+    }
+    return { value, done: false };
+  }
+
+  function settleWaiters() {
+    while (waiters.length && (queue.length || done)) {
+      const w = waiters.shift();
+      if (queue.length) w.resolve(consume(queue.shift()));
+      else if (error) w.reject(error);
+      else w.resolve({ value: undefined, done: true });
     }
+  }
+
+  const stream = {
+    id,
+    _push(msg) {
+      if ('chunk' in msg) {
+        queue.push(msg.chunk);
+      } else {
+        done = true;
+        if ('error' in msg) {
+          const e = msg.error;
+          error = new Error((e && (e.error || e.msg)) || 'stream failed');
+          error.detail = e;
+        }
+        streams.delete(id);
+      }
+      settleWaiters();
+    },
+    next() {
+      if (queue.length) return Promise.resolve(consume(queue.shift()));
+      if (error) return Promise.reject(error);
+      if (done) return Promise.resolve({ value: undefined, done: true });
+      return new Promise((resolve, reject) => waiters.push({ resolve, reject }));
+    },
+    return() {
+      if (!done) {
+        done = true;
+        streams.delete(id);
+        invokeNative('__stream.cancel', { id }).catch(() => { /* already finished */ });
+      }
+      queue.length = 0;
+      settleWaiters();
+      return Promise.resolve({ value: undefined, done: true });
+    },
+    [Symbol.asyncIterator]() { return this; },
+    toReadableStream() {
+      return new ReadableStream({
+        pull: (controller) => stream.next().then((r) => (r.done ? controller.close() : controller.enqueue(r.value))),
+        cancel: () => stream.return(),
+      }, { highWaterMark: 0 });
+    },
+  };
+  streams.set(id, stream);
+  return stream;
+}
+
+// Routes "__stream" events to their stream and everything else to the
+// handler registered with listen(), which keeps working as before.
+function installEventHook(b) {
+  let userHandler = b.onEvent;
+  b.onEvent = (name, data) => {
+    if (name === '__stream') {
+      const stream = data && streams.get(data.id);
+      if (stream) stream._push(data);
+      return;
+    }
+    if (typeof userHandler === 'function') userHandler(name, data);
+  };
+  b.listen = (cb) => { userHandler = cb; };
+}
+
+// The native queue refuses requests it cannot take right now with
+// {busy:true, retryAfterMs}; surface that as a rejection callers can back
+// off on (err.busy, err.retryAfterMs).
+function busyError(result) {
+  const err = new Error('native queue busy');
+  err.busy = true;
+  err.retryAfterMs = result.retryAfterMs || 0;
+  return err;
+}
+
+function checkBinaryResult(result) {
+  if (result && result.busy === true) throw busyError(result);
+  if (result && !(result instanceof ArrayBuffer) && (result.error || result.ok === false)) {
+    throw new Error(result.error || result.msg || 'native call failed');
+  }
+  return result;
+}
+
+function deliver(entry, result) {
+  settle(entry);
+  if (result && result.busy === true) {
+    entry.reject(busyError(result));
+  } else if (entry.binary) {
+    let value;
+    try { value = checkBinaryResult(decodeBytes(result)); } catch (e) { entry.reject(e); return; }
+    entry.resolve(value);
+  } else {
+    entry.resolve(decodeBytes(result));
+  }
+}
+
+function installListener(b) {
+  if (installedOn.has(b)) return;
+  installEventHook(b);
+  const prev = b.onMessage;
+  b.onMessage = (id, result) => {
+    if (DEBUG) console.debug('[ipc] reply', id, result);
+    // Register streams synchronously: their first chunks may be dispatched
+    // in the same batch, before the promise below settles.
+    if (result && typeof result.$stream === 'string') {
+      result = openStream(result.$stream, result.credit);
+    }
+    const entry = pending.get(id);
+    if (entry !== undefined) deliver(entry, result);
     if (typeof prev === 'function') {
       try { prev(id, result); } catch (e) { /* ignore */ }
     }
   };
-  nativeListenerInstalled = true;
+  installedOn.add(b);
+}
+
+function abortError(signal) {
+  if (signal && signal.reason !== undefined) return signal.reason;
+  const err = new Error('native call aborted');
+  err.name = 'AbortError';
+  return err;
+}
+
+// Tells native the page no longer wants the answer: a queued request is
+// dropped, a running one has its cancellation token flagged. Numeric ids
+// come from the v2 framing, where native knows them as "#<id>".
+function sendCancel(id) {
+  invokeNative('__cancel', typeof id === 'number' ? '#' + id : id, { timeoutMs: 0 }).catch(() => { /* already gone */ });
 }
 
-export function invokeNative(cmd, payload) {
+// Options: `signal` (AbortSignal) cancels the call, `timeoutMs` (default
+// 30000, 0 = none) rejects it and also becomes the native deadline.
+export function invokeNative(cmd, payload, options) {
+  const wait = whenBridge();
+  if (wait) return wait.then(() => invokeNative(cmd, payload, options));
+  const signal = options ? options.signal : undefined;
+  const timeoutMs = options && options.timeoutMs !== undefined ? options.timeoutMs : DEFAULT_TIMEOUT_MS;
   return new Promise((resolve, reject) => {
-    if (!isNative()) return reject(new Error('native bridge not available'));
+    const b = bridge();
+    if (!b) return reject(new Error('native bridge not available'));
+    if (signal && signal.aborted) return reject(abortError(signal));
+    if (DEBUG) console.debug('[ipc] invoke', cmd, payload);
+    let id;
     try {
-      installListener();
-      console.log(`Invoking native command: ${cmd} with payload:`, payload);
-      // If the host injected the bridge it will set __bridgeInstalled.
-      // Otherwise, some webviews expose a raw `external.invoke` that
-      // expects a single string payload. Compose the message to match
-      // the native format: id<SEP>cmd<SEP>base64(payload)
-      const SEP = String.fromCharCode(30);
-      function encodePayload(value) {
-        if (value === undefined || value === null) return '';
-        const text = (typeof value === 'string') ? value : JSON.stringify(value);
-        if (typeof TextEncoder !== 'undefined') {
-          const bytes = new TextEncoder().encode(text);
-          let bin = '';
-          for (let i = 0; i < bytes.length; i++) bin += String.fromCharCode(bytes[i]);
-          return btoa(bin);
-        }
-        return btoa(unescape(encodeURIComponent(text)));
+      installListener(b);
+      if (b.__bridgeInstalled) {
+        // The bridge frames the call itself and returns its id, a number
+        // under the v2 framing.
+        id = b.invoke(cmd, payload, timeoutMs);
+        if (id === undefined || id === null || id === '') id = nextId();
+      } else {
+        // A raw `external.invoke` (no bridge injected yet) takes the v1
+        // frame: id[@timeoutMs]<SEP>cmd<SEP>base64(payload)
+        id = nextId();
+        const budget = timeoutMs > 0 ? '@' + Math.ceil(timeoutMs) : '';
+        b.invoke(id + budget + SEP + String(cmd || '') + SEP + base64Text(normalize(payload)));
       }
+    } catch (err) {
+      return reject(err);
+    }
+    track(new Pending(resolve, reject, false), id, signal, timeoutMs);
+  });
+}
 
-      const id = Math.random().toString(36).slice(2) + Date.now().toString(36);
-      pending[id] = { resolve, reject };
-
-      // If bridge installed, call native invoke as (cmd, payload) and expect it to return id.
-      if (window.external.__bridgeInstalled) {
-        try {
-          const ret = window.external.invoke(cmd, payload);
-          // Some bridges return the id directly
-          if (ret) {
-            // Use returned id if non-empty and pending not yet set for it
-            if (typeof ret === 'string' && ret.length && !pending[ret]) {
-              pending[ret] = pending[id];
-              delete pending[id];
-            }
-          }
-        } catch (e) {
-          // ignore and fall back to composed call below
-        }
-      } else {
-        // Compose single-string payload expected by native host
-        const normalized = (payload === undefined || payload === null) ? '' : (typeof payload === 'string' ? payload : JSON.stringify(payload));
-        const encoded = encodePayload(normalized);
-        try {
-          window.external.invoke(id + SEP + String(cmd || '') + SEP + encoded);
-        } catch (e) {
-          // if invoke throws, clean up pending and rethrow
-          delete pending[id];
-          throw e;
-        }
+// Native answers at most this many commands per "__batch"; longer lists
+// go out as several.
+const BATCH_MAX = 256;
+
+// Runs `calls` ([{cmd, payload}, ...]) for one bridge crossing and resolves
+// to their results in the same order, each what invokeNative() would have
+// resolved to. A failing command leaves an error object in its place rather
+// than rejecting the rest. Natively the commands run in parallel where their
+// plugins allow, so calls that depend on each other belong in separate
+// batches. Options are as for invokeNative() and apply to the batch as a
+// whole; commands answering with a stream get an error instead.
+export function invokeBatch(calls, options) {
+  const list = Array.from(calls || [], (call) => [String(call.cmd || ''), normalize(call.payload)]);
+  const parts = [];
+  for (let i = 0; i < list.length; i += BATCH_MAX) {
+    parts.push(invokeNative('__batch', JSON.stringify(list.slice(i, i + BATCH_MAX)), options).then((results) => {
+      if (!Array.isArray(results)) {
+        throw new Error((results && results.error) || 'native batch failed');
       }
+      return results;
+    }));
+  }
+  return Promise.all(parts).then((results) => [].concat(...results));
+}
 
-      // timeout to avoid forever-hanging promises
-      setTimeout(() => {
-        if (pending[id]) {
-          try { pending[id].reject(new Error('native call timeout')); } catch (e) { /* ignore */ }
-          delete pending[id];
-        }
-      }, 30000);
+// A step's reply (or one top-level field of it) inside a later step of
+// invokePipeline(), in place of the value.
+class PipelineRef {
+  constructor(step, field) {
+    this.step = step;
+    this.field = field;
+  }
+}
+
+export function pipelineRef(step, field) {
+  return new PipelineRef(step, field);
+}
+
+function refWire(ref) {
+  return ref.field === undefined ? [ref.step] : [ref.step, String(ref.field)];
+}
+
+// Splits a payload into literal JSON text and references for native to
+// join. References are stringified as markers first, then cut back out.
+const REF_MARK = /"\\u0000pipelineRef:(\d+)"/g;
+
+function pipelineParts(payload) {
+  if (payload instanceof PipelineRef) return [refWire(payload)];
+  if (typeof payload !== 'object' || payload === null) return [normalize(payload)];
+  const refs = [];
+  const text = JSON.stringify(payload, (key, value) => {
+    if (!(value instanceof PipelineRef)) return value;
+    refs.push(value);
+    return '\u0000pipelineRef:' + (refs.length - 1);
+  });
+  if (refs.length === 0) return [text];
+  const parts = [];
+  let last = 0;
+  for (const m of text.matchAll(REF_MARK)) {
+    if (m.index > last) parts.push(text.slice(last, m.index));
+    parts.push(refWire(refs[+m[1]]));
+    last = m.index + m[0].length;
+  }
+  if (last < text.length) parts.push(text.slice(last));
+  return parts;
+}
+
+// Runs `steps` ([{cmd, payload, input}, ...]) natively as one call. A
+// payload may hold pipelineRef(i) or pipelineRef(i, 'field') for the reply
+// of an earlier step, and `input: pipelineRef(...)` sends that reply as the
+// raw body of a binary call (a string field is sent as its text). Replies
+// pass from step to step without reaching the page. Resolves to the last
+// step's result, or with `options.outputs` (step indexes) to an array of
+// those. Rejects with err.step set when a step fails. Other options are as
+// for invokeNative() and cover the whole pipeline.
+export function invokePipeline(steps, options) {
+  const wire = {
+    steps: Array.from(steps || [], (step) => {
+      const entry = [String(step.cmd || ''), pipelineParts(step.payload)];
+      if (step.input instanceof PipelineRef) entry.push(refWire(step.input));
+      return entry;
+    }),
+  };
+  const outputs = options && Array.isArray(options.outputs) ? options.outputs : null;
+  if (outputs) wire.outputs = outputs;
+  return invokeNative('__pipeline', JSON.stringify(wire), options).then((result) => {
+    if (result && !(result instanceof ArrayBuffer) && result.ok === false && 'step' in result) {
+      const err = new Error(typeof result.error === 'string' ? result.error : 'pipeline step failed');
+      err.step = result.step;
+      err.detail = result.error;
+      throw err;
+    }
+    if (result && result.ok === false && typeof result.error === 'string') throw new Error(result.error);
+    return outputs && outputs.length === 1 ? [result] : result;
+  });
+}
+
+function toBytes(data) {
+  if (data === undefined || data === null) return new Uint8Array(0);
+  if (data instanceof Uint8Array) return data;
+  if (data instanceof ArrayBuffer) return new Uint8Array(data);
+  if (ArrayBuffer.isView(data)) return new Uint8Array(data.buffer, data.byteOffset, data.byteLength);
+  return encoder.encode(String(data));
+}
+
+// Sends `data` (ArrayBuffer, typed array or string) to `cmd` as raw bytes.
+// Resolves with an ArrayBuffer, or the parsed object for JSON replies.
+// Hosts that register the crossweb:// scheme skip base64 entirely; others
+// fall back to a base64 frame over the regular bridge. Options are as for
+// invokeNative() on either path.
+export function invokeBinary(cmd, args, data, options) {
+  const wait = whenBridge();
+  if (wait) return wait.then(() => invokeBinary(cmd, args, data, options));
+  const signal = options ? options.signal : undefined;
+  const timeoutMs = options && options.timeoutMs !== undefined ? options.timeoutMs : DEFAULT_TIMEOUT_MS;
+  const b = bridge();
+  if (!b) return Promise.reject(new Error('native bridge not available'));
+  if (signal && signal.aborted) return Promise.reject(abortError(signal));
+  const argText = normalize(args);
+  const bytes = toBytes(data);
+  if (b.__binaryScheme) {
+    // The call is tracked like any other, under an id native knows it by,
+    // so a timeout or abort also cancels it there.
+    return new Promise((resolve, reject) => {
+      const entry = new Pending(resolve, reject, true);
+      const id = nextId();
+      let url = 'crossweb://ipc/' + String(cmd || '') + '?i=' + encodeURIComponent(id);
+      if (timeoutMs > 0) url += '&t=' + Math.ceil(timeoutMs);
+      if (argText) url += '&a=' + encodeURIComponent(argText);
+      const init = bytes.byteLength ? { method: 'POST', body: bytes } : { method: 'GET' };
+      if (typeof AbortController === 'function') {
+        entry.fetch = new AbortController();
+        init.signal = entry.fetch.signal;
+      }
+      track(entry, id, signal, timeoutMs);
+      fetch(url, init).then((res) => {
+        const type = res.headers.get('Content-Type') || '';
+        return type.indexOf('application/json') === 0 ? res.json() : res.arrayBuffer();
+      }).then((result) => {
+        if (!entry.done) deliver(entry, result);
+      }, (err) => {
+        if (entry.done) return;
+        settle(entry);
+        reject(err);
+      });
+    });
+  }
+  return new Promise((resolve, reject) => {
+    let id;
+    try {
+      installListener(b);
+      if (typeof b.invokeBytes === 'function') {
+        id = b.invokeBytes(cmd, argText, bytes, timeoutMs);
+      } else {
+        id = nextId();
+        const budget = timeoutMs > 0 ? '@' + Math.ceil(timeoutMs) : '';
+        b.invoke(id + budget + SEP + String(cmd || '') + SEP + base64Text(argText) + SEP + base64Bytes(bytes));
+      }
     } catch (err) {
-      reject(err);
+      return reject(err);
     }
+    track(new Pending(resolve, reject, true), id, signal, timeoutMs);
   });
 }
 
-export default { isNative, invokeNative };
+export default { isNative, connectNative, invokeNative, invokeBatch, invokePipeline, pipelineRef, invokeBinary };
@@ -1,4 +1,5 @@
 #include "../../../plug.h"
+#include "../../../codec.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdbool.h>
@@ -70,41 +71,14 @@ static void get_credential_id_path(char *path, size_t cap) {
 }
 
 static char *base64url_encode(const unsigned char *data, size_t len, size_t *out_len) {
-    if (out_len) {
-        *out_len = 0;
-    }
-
-    DWORD base64_len = 0;
-    if (!CryptBinaryToStringA((const BYTE *)data, (DWORD)len,
-                              CRYPT_STRING_BASE64 | CRYPT_STRING_NOCRLF,
-                              NULL, &base64_len)) {
-        return NULL;
-    }
-
-    char *base64 = (char *)malloc((size_t)base64_len + 1);
+    char *base64 = (char *)malloc(codec_base64_encoded_len(len, CODEC_BASE64URL) + 1);
     if (base64 == NULL) {
+        if (out_len) {
+            *out_len = 0;
+        }
         return NULL;
     }
-
-    if (!CryptBinaryToStringA((const BYTE *)data, (DWORD)len,
-                              CRYPT_STRING_BASE64 | CRYPT_STRING_NOCRLF,
-                              base64, &base64_len)) {
-        free(base64);
-        return NULL;
-    }
-    base64[base64_len] = '\0';
-
-    // Convert to base64url and strip padding.
-    // base64_len includes the trailing NUL in some cases; handle safely.
-    size_t n = strlen(base64);
-    while (n > 0 && base64[n - 1] == '=') {
-        n--;
-    }
-    for (size_t i = 0; i < n; ++i) {
-        if (base64[i] == '+') base64[i] = '-';
-        else if (base64[i] == '/') base64[i] = '_';
-    }
-    base64[n] = '\0';
+    size_t n = codec_base64_encode(data, len, base64, CODEC_BASE64URL);
     if (out_len) {
         *out_len = n;
     }
@@ -396,14 +370,10 @@ static bool keystore_invoke(const char *cmd, const char *payload, RespondCallbac
             respond("{\"ok\":false,\"msg\":\"out of memory\"}");
             return false;
         }
-        for (size_t i = 0; i < byte_len; ++i) {
-            unsigned int v = 0;
-            if (sscanf(in + (i * 2), "%2x", &v) != 1) {
-                free(bytes);
-                respond("{\"ok\":false,\"msg\":\"invalid hex\"}");
-                return false;
-            }
-            bytes[i] = (BYTE)v;
+        if (!codec_hex_decode(in, in_len, bytes, NULL)) {
+            free(bytes);
+            respond("{\"ok\":false,\"msg\":\"invalid hex\"}");
+            return false;
         }
 
         DATA_BLOB in_blob = {0};
@@ -420,32 +390,17 @@ static bool keystore_invoke(const char *cmd, const char *payload, RespondCallbac
         }
         free(bytes);
 
-        DWORD b64_len = 0;
-        if (!CryptBinaryToStringA(out_blob.pbData, out_blob.cbData,
-                                 CRYPT_STRING_BASE64 | CRYPT_STRING_NOCRLF, NULL, &b64_len)) {
-            LocalFree(out_blob.pbData);
-            respond("{\"ok\":false,\"msg\":\"base64 encode failed\"}");
-            return false;
-        }
-
-        char *b64 = (char *)malloc((size_t)b64_len + 1);
+        char *b64 = (char *)malloc(codec_base64_encoded_len(out_blob.cbData, CODEC_BASE64) + 1);
         if (b64 == NULL) {
             LocalFree(out_blob.pbData);
             respond("{\"ok\":false,\"msg\":\"out of memory\"}");
             return false;
         }
-        if (!CryptBinaryToStringA(out_blob.pbData, out_blob.cbData,
-                                 CRYPT_STRING_BASE64 | CRYPT_STRING_NOCRLF, b64, &b64_len)) {
-            free(b64);
-            LocalFree(out_blob.pbData);
-            respond("{\"ok\":false,\"msg\":\"base64 encode failed\"}");
-            return false;
-        }
-        b64[b64_len] = '\0';
+        size_t b64_len = codec_base64_encode(out_blob.pbData, out_blob.cbData, b64, CODEC_BASE64);
         LocalFree(out_blob.pbData);
 
         // JSON response
-        size_t resp_cap = strlen(b64) + 64;
+        size_t resp_cap = b64_len + 64;
         char *resp = (char *)malloc(resp_cap);
         if (resp == NULL) {
             free(b64);
@@ -478,17 +433,15 @@ static bool keystore_invoke(const char *cmd, const char *payload, RespondCallbac
             }
         }
         // Input: base64 string (DPAPI blob)
-        DWORD bin_len = 0;
-        if (!CryptStringToBinaryA(in, 0, CRYPT_STRING_BASE64, NULL, &bin_len, NULL, NULL)) {
-            respond("{\"ok\":false,\"msg\":\"invalid base64\"}");
-            return false;
-        }
-        BYTE *bin = (BYTE *)malloc((size_t)bin_len ? (size_t)bin_len : 1);
+        size_t in_len = strlen(in);
+        size_t bin_cap = codec_base64_decoded_cap(in_len);
+        BYTE *bin = (BYTE *)malloc(bin_cap);
         if (bin == NULL) {
             respond("{\"ok\":false,\"msg\":\"out of memory\"}");
             return false;
         }
-        if (!CryptStringToBinaryA(in, 0, CRYPT_STRING_BASE64, bin, &bin_len, NULL, NULL)) {
+        size_t bin_len = 0;
+        if (!codec_base64_decode(in, in_len, bin, bin_cap, &bin_len, CODEC_BASE64)) {
             free(bin);
             respond("{\"ok\":false,\"msg\":\"invalid base64\"}");
             return false;
@@ -496,7 +449,7 @@ static bool keystore_invoke(const char *cmd, const char *payload, RespondCallbac
 
         DATA_BLOB in_blob = {0};
         in_blob.pbData = bin;
-        in_blob.cbData = bin_len;
+        in_blob.cbData = (DWORD)bin_len;
         DATA_BLOB out_blob = {0};
 
         if (!CryptUnprotectData(&in_blob, NULL, NULL, NULL, NULL, 0, &out_blob)) {
@@ -514,13 +467,7 @@ static bool keystore_invoke(const char *cmd, const char *payload, RespondCallbac
             respond("{\"ok\":false,\"msg\":\"out of memory\"}");
             return false;
         }
-        static const char *digits = "0123456789abcdef";
-        for (DWORD i = 0; i < out_blob.cbData; ++i) {
-            BYTE b = out_blob.pbData[i];
-            hex[i * 2] = digits[(b >> 4) & 0xF];
-            hex[i * 2 + 1] = digits[b & 0xF];
-        }
-        hex[hex_len] = '\0';
+        codec_hex_encode(out_blob.pbData, out_blob.cbData, hex);
         LocalFree(out_blob.pbData);
 
         size_t resp_cap = hex_len + 64;
@@ -732,14 +679,16 @@ bool android_keystore_invoke(const char *cmd, const char *payload, RespondCallba
     jmethodID loadMethod = (*current_env)->GetStaticMethodID(current_env, keystoreClass, "load", "(Landroid/content/Context;)Ljava/lang/String;");
 
     if (strcmp(cmd, "encrypt") == 0) {
-        size_t len = strlen(payload) / 2;
-        jbyteArray bytes = (*current_env)->NewByteArray(current_env, (jsize)len);
-        jbyte *tmp = malloc(len);
-        for (size_t i = 0; i < len; i++) {
-            unsigned int byte;
-            sscanf(payload + 2 * i, "%2x", &byte);
-            tmp[i] = (jbyte)byte;
+        size_t hex_len = strlen(payload);
+        size_t len = hex_len / 2;
+        jbyte *tmp = malloc(len ? len : 1);
+        if (tmp == NULL || (hex_len % 2) != 0 || !codec_hex_decode(payload, hex_len, tmp, NULL)) {
+            free(tmp);
+            respond("{\"ok\":false,\"msg\":\"invalid hex\"}");
+            (*current_env)->DeleteLocalRef(current_env, keystoreClass);
+            return false;
         }
+        jbyteArray bytes = (*current_env)->NewByteArray(current_env, (jsize)len);
         (*current_env)->SetByteArrayRegion(current_env, bytes, 0, (jsize)len, tmp);
         free(tmp);
 
@@ -769,10 +718,14 @@ bool android_keystore_invoke(const char *cmd, const char *payload, RespondCallba
         jbyte *buf = malloc(len);
         (*current_env)->GetByteArrayRegion(current_env, decryptedBytes, 0, len, buf);
         char hex[2048];
-        for (jsize i = 0; i < len; i++) {
-            sprintf(hex + 2 * i, "%02x", (unsigned char)buf[i]);
+        if ((size_t)len * 2 >= sizeof(hex)) {
+            free(buf);
+            (*current_env)->DeleteLocalRef(current_env, decryptedBytes);
+            respond("{\"ok\":false,\"msg\":\"decrypted key too large\"}");
+            (*current_env)->DeleteLocalRef(current_env, keystoreClass);
+            return false;
         }
-        hex[2 * len] = '\0';
+        codec_hex_encode(buf, (size_t)len, hex);
         free(buf);
         (*current_env)->DeleteLocalRef(current_env, decryptedBytes);
         char response[2048];
@@ -0,0 +1,549 @@
+#include "pool.h"
+#include "sync.h"
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define POOL_DEFAULT_QUEUE 1024
+#define POOL_MAX_THREADS 64
+#define POOL_INJECT POOL_MAX_THREADS   // deque for tasks spawned outside the pool
+
+typedef struct PoolJob {
+    struct PoolJob *next;
+    PoolJobFn fn;
+    void *arg;
+    PoolStrand *strand;    // set on a strand's runner entry, NULL on plain jobs
+} PoolJob;
+
+struct PoolStrand {
+    PoolJob *head;         // jobs waiting for their turn
+    PoolJob *tail;
+    bool scheduled;        // the runner is queued or one of its jobs is running
+    PoolJob runner;        // queue entry standing in for the whole strand
+};
+
+static SyncMutex pool_lock = SYNC_MUTEX_INIT;
+static SyncCond pool_wake = SYNC_COND_INIT;
+static PoolJob *queue_head = NULL;
+static PoolJob *queue_tail = NULL;
+static SyncThread workers[POOL_MAX_THREADS];
+static unsigned int worker_count = 0;
+static unsigned int max_queued = POOL_DEFAULT_QUEUE;
+static bool accepting = false;
+static bool stopping = false;
+static PoolStats stats;
+
+// Fork/join tasks live apart from the job FIFO: every worker has a deque it
+// pushes to and pops from at the bottom (newest first, cache-warm), and idle
+// threads steal from the top of the others (oldest first, the biggest
+// pieces of a recursive split).
+typedef struct PoolTask {
+    PoolJobFn fn;
+    void *arg;
+    PoolGroup *group;
+} PoolTask;
+
+typedef struct PoolDeque {
+    SyncMutex lock;
+    PoolTask *items;       // ring buffer
+    size_t head;
+    size_t count;
+    size_t cap;
+} PoolDeque;
+
+struct PoolGroup {
+    atomic_size_t pending;   // unfinished tasks, plus one until wait/then
+    PoolJobFn then;
+    void *then_arg;
+};
+
+static PoolDeque deques[POOL_MAX_THREADS + 1];
+static bool deques_ready = false;
+static atomic_uint deque_count;          // worker deques in use
+static atomic_int tasks_pending;         // pushed but not yet taken
+static unsigned int joiners = 0;         // threads blocked in pool_group_wait()
+static SYNC_THREAD_LOCAL int pool_self = -1;  // worker index, -1 off the pool
+
+// Caller holds pool_lock.
+static void pool_enqueue(PoolJob *job) {
+    job->next = NULL;
+    if (queue_tail != NULL) {
+        queue_tail->next = job;
+    } else {
+        queue_head = job;
+    }
+    queue_tail = job;
+    // A joiner could swallow a plain signal without taking the job.
+    if (joiners > 0) {
+        sync_cond_broadcast(&pool_wake);
+    } else {
+        sync_cond_signal(&pool_wake);
+    }
+}
+
+static bool deque_push(PoolDeque *d, PoolTask task) {
+    sync_mutex_lock(&d->lock);
+    if (d->count == d->cap) {
+        size_t cap = d->cap ? d->cap * 2 : 64;
+        PoolTask *items = (PoolTask *)malloc(cap * sizeof(PoolTask));
+        if (items == NULL) {
+            sync_mutex_unlock(&d->lock);
+            return false;
+        }
+        for (size_t i = 0; i < d->count; ++i) {
+            items[i] = d->items[(d->head + i) % d->cap];
+        }
+        free(d->items);
+        d->items = items;
+        d->head = 0;
+        d->cap = cap;
+    }
+    d->items[(d->head + d->count) % d->cap] = task;
+    d->count++;
+    sync_mutex_unlock(&d->lock);
+    return true;
+}
+
+static bool deque_pop(PoolDeque *d, bool bottom, PoolTask *out) {
+    sync_mutex_lock(&d->lock);
+    bool found = d->count > 0;
+    if (found) {
+        if (bottom) {
+            *out = d->items[(d->head + d->count - 1) % d->cap];
+        } else {
+            *out = d->items[d->head];
+            d->head = (d->head + 1) % d->cap;
+        }
+        d->count--;
+    }
+    sync_mutex_unlock(&d->lock);
+    return found;
+}
+
+// Own deque first, then steal, starting with the next worker over so that
+// thieves spread out.
+static bool pool_take_task(PoolTask *out) {
+    if (atomic_load(&tasks_pending) <= 0) {
+        return false;
+    }
+    unsigned int count = atomic_load(&deque_count);
+    int self = pool_self;
+    if (self >= 0 && deque_pop(&deques[self], true, out)) {
+        atomic_fetch_sub(&tasks_pending, 1);
+        return true;
+    }
+    if (deque_pop(&deques[POOL_INJECT], false, out)) {
+        atomic_fetch_sub(&tasks_pending, 1);
+        return true;
+    }
+    for (unsigned int i = 1; i <= count; ++i) {
+        unsigned int victim = (unsigned int)(self + (int)i) % count;
+        if ((int)victim != self && deque_pop(&deques[victim], false, out)) {
+            atomic_fetch_sub(&tasks_pending, 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+static void pool_task_done(PoolGroup *group) {
+    if (group == NULL) {
+        return;
+    }
+    size_t left = atomic_fetch_sub(&group->pending, 1);
+    if (left == 1) {
+        // Last one out after pool_group_then(): run the continuation.
+        group->then(group->then_arg);
+        free(group);
+    } else if (left == 2) {
+        // Only the owner's reference is left; wake it if it is waiting.
+        sync_mutex_lock(&pool_lock);
+        if (joiners > 0) {
+            sync_cond_broadcast(&pool_wake);
+        }
+        sync_mutex_unlock(&pool_lock);
+    }
+}
+
+static void pool_run_task(const PoolTask *task) {
+    task->fn(task->arg);
+    pool_task_done(task->group);
+}
+
+static void pool_worker(void *arg) {
+    pool_self = (int)(uintptr_t)arg;
+    sync_mutex_lock(&pool_lock);
+    for (;;) {
+        // Tasks belong to requests already running, so they go first.
+        if (atomic_load(&tasks_pending) > 0) {
+            sync_mutex_unlock(&pool_lock);
+            PoolTask task;
+            while (pool_take_task(&task)) {
+                pool_run_task(&task);
+            }
+            sync_mutex_lock(&pool_lock);
+            if (queue_head == NULL) {
+                continue;
+            }
+        }
+        while (queue_head == NULL && atomic_load(&tasks_pending) <= 0 && !stopping) {
+            sync_cond_wait(&pool_wake, &pool_lock);
+        }
+        PoolJob *entry = queue_head;
+        if (entry == NULL && atomic_load(&tasks_pending) > 0) {
+            continue;
+        }
+        if (entry == NULL) {
+            break;   // stopping and drained
+        }
+        queue_head = entry->next;
+        if (queue_head == NULL) {
+            queue_tail = NULL;
+        }
+
+        PoolStrand *strand = entry->strand;
+        PoolJob *job = entry;
+        if (strand != NULL) {
+            job = strand->head;
+            strand->head = job->next;
+            if (strand->head == NULL) {
+                strand->tail = NULL;
+            }
+        }
+        stats.queued--;
+        stats.running++;
+        sync_mutex_unlock(&pool_lock);
+
+        job->fn(job->arg);
+        free(job);
+
+        sync_mutex_lock(&pool_lock);
+        stats.running--;
+        stats.completed++;
+        if (strand != NULL) {
+            // Go to the back of the line so one busy strand cannot hog a worker.
+            if (strand->head != NULL) {
+                pool_enqueue(&strand->runner);
+            } else {
+                strand->scheduled = false;
+            }
+        }
+    }
+    sync_mutex_unlock(&pool_lock);
+}
+
+static unsigned int pool_env_uint(const char *name, unsigned int fallback) {
+    const char *value = getenv(name);
+    if (value == NULL || *value == '\0') {
+        return fallback;
+    }
+    char *end = NULL;
+    unsigned long n = strtoul(value, &end, 10);
+    if (end == value || *end != '\0') {
+        fprintf(stderr, "%s: expected a number, got '%s'\n", name, value);
+        return fallback;
+    }
+    return (unsigned int)n;
+}
+
+bool pool_start(const PoolConfig *config) {
+    PoolConfig cfg = { 0 };
+    if (config != NULL) {
+        cfg = *config;
+    }
+    cfg.threads = pool_env_uint("CROSSWEB_WORKERS", cfg.threads);
+    cfg.max_queued = pool_env_uint("CROSSWEB_WORKER_QUEUE", cfg.max_queued);
+    if (cfg.threads == 0) {
+        cfg.threads = sync_cpu_count();
+        if (cfg.threads < 2) {
+            cfg.threads = 2;
+        }
+    }
+    if (cfg.threads > POOL_MAX_THREADS) {
+        cfg.threads = POOL_MAX_THREADS;
+    }
+
+    sync_mutex_lock(&pool_lock);
+    if (accepting || worker_count > 0) {
+        sync_mutex_unlock(&pool_lock);
+        return true;
+    }
+    stopping = false;
+    accepting = true;
+    max_queued = cfg.max_queued ? cfg.max_queued : POOL_DEFAULT_QUEUE;
+    if (!deques_ready) {
+        for (int i = 0; i <= POOL_MAX_THREADS; ++i) {
+            sync_mutex_init(&deques[i].lock);
+        }
+        deques_ready = true;
+    }
+    atomic_store(&deque_count, cfg.threads);
+    sync_mutex_unlock(&pool_lock);
+
+    unsigned int started = 0;
+    while (started < cfg.threads && sync_thread_start(&workers[started], pool_worker, (void *)(uintptr_t)started)) {
+        started++;
+    }
+    sync_mutex_lock(&pool_lock);
+    worker_count = started;
+    stats.threads = started;
+    if (started == 0) {
+        accepting = false;
+    }
+    sync_mutex_unlock(&pool_lock);
+    if (started < cfg.threads) {
+        fprintf(stderr, "pool: started %u of %u worker threads\n", started, cfg.threads);
+    }
+    return started > 0;
+}
+
+void pool_stop(void) {
+    sync_mutex_lock(&pool_lock);
+    accepting = false;
+    stopping = true;
+    sync_cond_broadcast(&pool_wake);
+    unsigned int count = worker_count;
+    sync_mutex_unlock(&pool_lock);
+
+    for (unsigned int i = 0; i < count; ++i) {
+        sync_thread_join(workers[i]);
+    }
+
+    sync_mutex_lock(&pool_lock);
+    worker_count = 0;
+    stats.threads = 0;
+    stopping = false;
+    for (int i = 0; deques_ready && i <= POOL_MAX_THREADS; ++i) {
+        sync_mutex_lock(&deques[i].lock);
+        free(deques[i].items);
+        deques[i].items = NULL;
+        deques[i].head = deques[i].count = deques[i].cap = 0;
+        sync_mutex_unlock(&deques[i].lock);
+    }
+    sync_mutex_unlock(&pool_lock);
+}
+
+bool pool_running(void) {
+    sync_mutex_lock(&pool_lock);
+    bool running = accepting;
+    sync_mutex_unlock(&pool_lock);
+    return running;
+}
+
+// Reserves a queue slot. Caller holds pool_lock.
+static bool pool_admit(void) {
+    if (!accepting || stats.queued >= max_queued) {
+        stats.rejected++;
+        return false;
+    }
+    stats.queued++;
+    if (stats.queued > stats.peak_queued) {
+        stats.peak_queued = stats.queued;
+    }
+    return true;
+}
+
+bool pool_submit(PoolJobFn fn, void *arg) {
+    PoolJob *job = (PoolJob *)malloc(sizeof(PoolJob));
+    if (job == NULL) {
+        return false;
+    }
+    job->fn = fn;
+    job->arg = arg;
+    job->strand = NULL;
+    sync_mutex_lock(&pool_lock);
+    bool ok = pool_admit();
+    if (ok) {
+        pool_enqueue(job);
+    }
+    sync_mutex_unlock(&pool_lock);
+    if (!ok) {
+        free(job);
+    }
+    return ok;
+}
+
+PoolStrand *pool_strand_create(void) {
+    PoolStrand *strand = (PoolStrand *)calloc(1, sizeof(PoolStrand));
+    if (strand != NULL) {
+        strand->runner.strand = strand;
+    }
+    return strand;
+}
+
+void pool_strand_destroy(PoolStrand *strand) {
+    free(strand);
+}
+
+bool pool_strand_submit(PoolStrand *strand, PoolJobFn fn, void *arg) {
+    if (strand == NULL) {
+        return false;
+    }
+    PoolJob *job = (PoolJob *)malloc(sizeof(PoolJob));
+    if (job == NULL) {
+        return false;
+    }
+    job->next = NULL;
+    job->fn = fn;
+    job->arg = arg;
+    job->strand = NULL;
+    sync_mutex_lock(&pool_lock);
+    bool ok = pool_admit();
+    if (ok) {
+        if (strand->tail != NULL) {
+            strand->tail->next = job;
+        } else {
+            strand->head = job;
+        }
+        strand->tail = job;
+        if (!strand->scheduled) {
+            strand->scheduled = true;
+            pool_enqueue(&strand->runner);
+        }
+    }
+    sync_mutex_unlock(&pool_lock);
+    if (!ok) {
+        free(job);
+    }
+    return ok;
+}
+
+void pool_get_stats(PoolStats *out) {
+    if (out == NULL) {
+        return;
+    }
+    sync_mutex_lock(&pool_lock);
+    *out = stats;
+    sync_mutex_unlock(&pool_lock);
+}
+
+// ============================================================================
+// Fork/join
+// ============================================================================
+
+PoolGroup *pool_group_create(void) {
+    PoolGroup *group = (PoolGroup *)malloc(sizeof(PoolGroup));
+    if (group != NULL) {
+        atomic_init(&group->pending, 1);
+        group->then = NULL;
+        group->then_arg = NULL;
+    }
+    return group;
+}
+
+void pool_group_spawn(PoolGroup *group, PoolJobFn fn, void *arg) {
+    PoolTask task = { fn, arg, group };
+    if (group == NULL) {
+        fn(arg);   // pool_group_create() failed: nothing to join on
+        return;
+    }
+    atomic_fetch_add(&group->pending, 1);
+    int self = pool_self;
+    sync_mutex_lock(&pool_lock);
+    // Workers only exit once every task is taken, so a worker may always
+    // push to its own deque.
+    bool queued = (self >= 0 || accepting) && deque_push(&deques[self >= 0 ? self : POOL_INJECT], task);
+    if (queued) {
+        atomic_fetch_add(&tasks_pending, 1);
+        if (joiners > 0) {
+            sync_cond_broadcast(&pool_wake);
+        } else {
+            sync_cond_signal(&pool_wake);
+        }
+    }
+    sync_mutex_unlock(&pool_lock);
+    if (!queued) {
+        pool_run_task(&task);
+    }
+}
+
+void pool_group_wait(PoolGroup *group) {
+    if (group == NULL) {
+        return;
+    }
+    // Help instead of blocking, so nested joins on the workers cannot
+    // starve the pool of threads.
+    while (atomic_load(&group->pending) > 1) {
+        PoolTask task;
+        if (pool_take_task(&task)) {
+            pool_run_task(&task);
+            continue;
+        }
+        sync_mutex_lock(&pool_lock);
+        joiners++;
+        while (atomic_load(&group->pending) > 1 && atomic_load(&tasks_pending) <= 0) {
+            sync_cond_wait(&pool_wake, &pool_lock);
+        }
+        joiners--;
+        sync_mutex_unlock(&pool_lock);
+    }
+    free(group);
+}
+
+void pool_group_then(PoolGroup *group, PoolJobFn done, void *arg) {
+    if (group == NULL) {
+        done(arg);
+        return;
+    }
+    group->then = done;
+    group->then_arg = arg;
+    if (atomic_fetch_sub(&group->pending, 1) == 1) {
+        free(group);
+        done(arg);
+    }
+}
+
+typedef struct PoolRange {
+    size_t begin;
+    size_t end;
+    size_t grain;
+    PoolRangeFn fn;
+    void *arg;
+    PoolGroup *group;
+} PoolRange;
+
+static void pool_range_run(PoolRange *range);
+
+static void pool_range_task(void *arg) {
+    PoolRange *range = (PoolRange *)arg;
+    pool_range_run(range);
+    free(range);
+}
+
+// Splits off the upper half until the rest is one grain, so thieves take
+// large pieces and the owner works through the small ones.
+static void pool_range_run(PoolRange *range) {
+    while (range->end - range->begin > range->grain) {
+        size_t mid = range->begin + (range->end - range->begin) / 2;
+        PoolRange *upper = (PoolRange *)malloc(sizeof(PoolRange));
+        if (upper == NULL) {
+            break;
+        }
+        *upper = *range;
+        upper->begin = mid;
+        pool_group_spawn(range->group, pool_range_task, upper);
+        range->end = mid;
+    }
+    range->fn(range->begin, range->end, range->arg);
+}
+
+void pool_parallel_for(size_t begin, size_t end, size_t grain, PoolRangeFn fn, void *arg) {
+    if (end <= begin) {
+        return;
+    }
+    if (grain == 0) {
+        // About four pieces per worker leaves room for stealing to balance.
+        size_t pieces = (size_t)(atomic_load(&deque_count) ? atomic_load(&deque_count) : 1) * 4;
+        grain = (end - begin + pieces - 1) / pieces;
+    }
+    PoolRange range = { begin, end, grain, fn, arg, pool_group_create() };
+    if (range.group == NULL) {
+        fn(begin, end, arg);
+        return;
+    }
+    pool_range_run(&range);
+    pool_group_wait(range.group);
+}
@@ -0,0 +1,74 @@
+#ifndef POOL_H_
+#define POOL_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// ============================================================================
+// pool.h - Bounded worker pool with serial strands
+// ============================================================================
+// A fixed set of worker threads drains one FIFO of jobs. Jobs submitted to a
+// strand run one at a time and in submission order, but still on the shared
+// workers, so a plugin that is not thread-safe costs no thread of its own.
+// The queue is bounded: submissions past the limit are refused instead of
+// buffered, and the caller reports the overload. Fork/join tasks for
+// splitting up one request are scheduled by work stealing on the same
+// threads.
+// ============================================================================
+
+typedef void (*PoolJobFn)(void *arg);
+
+typedef struct PoolStrand PoolStrand;
+
+typedef struct PoolConfig {
+    unsigned int threads;      // Worker threads, 0 = one per CPU (at least 2)
+    unsigned int max_queued;   // Jobs waiting across all strands, 0 = default (1024)
+} PoolConfig;
+
+typedef struct PoolStats {
+    unsigned int threads;
+    unsigned int queued;             // Waiting, including jobs parked on strands
+    unsigned int running;
+    unsigned int peak_queued;        // High-water mark of `queued`
+    unsigned long long completed;
+    unsigned long long rejected;     // Refused because the queue was full
+} PoolStats;
+
+// Starts the workers. A NULL config uses the defaults, overridden by
+// CROSSWEB_WORKERS and CROSSWEB_WORKER_QUEUE in the environment.
+bool pool_start(const PoolConfig *config);
+// Runs every job already queued, then joins the workers. Strands stay valid.
+void pool_stop(void);
+bool pool_running(void);
+
+// Thread-safe. Returns false (and runs nothing) when the pool is stopped or
+// its queue is full.
+bool pool_submit(PoolJobFn fn, void *arg);
+
+PoolStrand *pool_strand_create(void);
+// The strand must be idle (nothing queued or running on it).
+void pool_strand_destroy(PoolStrand *strand);
+// Thread-safe. Like pool_submit(), serialised with the strand's other jobs.
+bool pool_strand_submit(PoolStrand *strand, PoolJobFn fn, void *arg);
+
+void pool_get_stats(PoolStats *stats);
+
+// Fork/join. Tasks go on per-worker deques that idle workers steal from, and
+// run ahead of queued jobs. They are not subject to max_queued. With the
+// pool stopped (or a NULL group) a spawned task runs inline.
+typedef struct PoolGroup PoolGroup;
+typedef void (*PoolRangeFn)(size_t begin, size_t end, void *arg);
+
+PoolGroup *pool_group_create(void);
+// Thread-safe; tasks may spawn more tasks into their own group.
+void pool_group_spawn(PoolGroup *group, PoolJobFn fn, void *arg);
+// Runs tasks until the group's are done, then frees the group.
+void pool_group_wait(PoolGroup *group);
+// Returns at once; `done` runs on whichever thread finishes the group's last
+// task (or right here if none are left), after which the group is freed.
+void pool_group_then(PoolGroup *group, PoolJobFn done, void *arg);
+// Calls fn on disjoint sub-ranges of [begin, end) of at most `grain` items
+// (0 = split by worker count) and returns when all have run.
+void pool_parallel_for(size_t begin, size_t end, size_t grain, PoolRangeFn fn, void *arg);
+
+#endif // POOL_H_
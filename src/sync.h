@@ -0,0 +1,149 @@
+#ifndef SYNC_H_
+#define SYNC_H_
+
+// ============================================================================
+// sync.h - Minimal portable synchronisation primitives
+// ============================================================================
+// Header-only wrappers so core code and plugins can share state across
+// threads without caring whether they run on Win32 or pthreads.
+// ============================================================================
+
+#if defined(_MSC_VER)
+#define SYNC_THREAD_LOCAL __declspec(thread)
+#else
+#define SYNC_THREAD_LOCAL _Thread_local
+#endif
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+typedef void (*SyncThreadFn)(void *arg);
+
+typedef struct SyncThreadStart {
+    SyncThreadFn fn;
+    void *arg;
+} SyncThreadStart;
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+
+typedef SRWLOCK SyncMutex;
+#define SYNC_MUTEX_INIT SRWLOCK_INIT
+
+static inline void sync_mutex_init(SyncMutex *m) { InitializeSRWLock(m); }
+static inline void sync_mutex_lock(SyncMutex *m) { AcquireSRWLockExclusive(m); }
+static inline void sync_mutex_unlock(SyncMutex *m) { ReleaseSRWLockExclusive(m); }
+static inline void sync_mutex_destroy(SyncMutex *m) { (void)m; }
+
+static inline unsigned long long sync_now_ms(void) {
+    return (unsigned long long)GetTickCount64();
+}
+
+typedef CONDITION_VARIABLE SyncCond;
+#define SYNC_COND_INIT CONDITION_VARIABLE_INIT
+
+static inline void sync_cond_init(SyncCond *c) { InitializeConditionVariable(c); }
+static inline void sync_cond_wait(SyncCond *c, SyncMutex *m) { SleepConditionVariableSRW(c, m, INFINITE, 0); }
+static inline void sync_cond_signal(SyncCond *c) { WakeConditionVariable(c); }
+static inline void sync_cond_broadcast(SyncCond *c) { WakeAllConditionVariable(c); }
+static inline void sync_cond_destroy(SyncCond *c) { (void)c; }
+
+typedef HANDLE SyncThread;
+
+static inline DWORD WINAPI sync_thread_trampoline(LPVOID param) {
+    SyncThreadStart start = *(SyncThreadStart *)param;
+    free(param);
+    start.fn(start.arg);
+    return 0;
+}
+
+static inline bool sync_thread_start(SyncThread *thread, SyncThreadFn fn, void *arg) {
+    SyncThreadStart *start = (SyncThreadStart *)malloc(sizeof(SyncThreadStart));
+    if (start == NULL) {
+        return false;
+    }
+    start->fn = fn;
+    start->arg = arg;
+    *thread = CreateThread(NULL, 0, sync_thread_trampoline, start, 0, NULL);
+    if (*thread == NULL) {
+        free(start);
+        return false;
+    }
+    return true;
+}
+
+static inline void sync_thread_join(SyncThread thread) {
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+}
+
+static inline unsigned int sync_cpu_count(void) {
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (unsigned int)info.dwNumberOfProcessors : 1;
+}
+#else
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef pthread_mutex_t SyncMutex;
+#define SYNC_MUTEX_INIT PTHREAD_MUTEX_INITIALIZER
+
+static inline void sync_mutex_init(SyncMutex *m) { pthread_mutex_init(m, NULL); }
+static inline void sync_mutex_lock(SyncMutex *m) { pthread_mutex_lock(m); }
+static inline void sync_mutex_unlock(SyncMutex *m) { pthread_mutex_unlock(m); }
+static inline void sync_mutex_destroy(SyncMutex *m) { pthread_mutex_destroy(m); }
+
+static inline unsigned long long sync_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000ull + (unsigned long long)ts.tv_nsec / 1000000ull;
+}
+
+typedef pthread_cond_t SyncCond;
+#define SYNC_COND_INIT PTHREAD_COND_INITIALIZER
+
+static inline void sync_cond_init(SyncCond *c) { pthread_cond_init(c, NULL); }
+static inline void sync_cond_wait(SyncCond *c, SyncMutex *m) { pthread_cond_wait(c, m); }
+static inline void sync_cond_signal(SyncCond *c) { pthread_cond_signal(c); }
+static inline void sync_cond_broadcast(SyncCond *c) { pthread_cond_broadcast(c); }
+static inline void sync_cond_destroy(SyncCond *c) { pthread_cond_destroy(c); }
+
+typedef pthread_t SyncThread;
+
+static inline void *sync_thread_trampoline(void *param) {
+    SyncThreadStart start = *(SyncThreadStart *)param;
+    free(param);
+    start.fn(start.arg);
+    return NULL;
+}
+
+static inline bool sync_thread_start(SyncThread *thread, SyncThreadFn fn, void *arg) {
+    SyncThreadStart *start = (SyncThreadStart *)malloc(sizeof(SyncThreadStart));
+    if (start == NULL) {
+        return false;
+    }
+    start->fn = fn;
+    start->arg = arg;
+    if (pthread_create(thread, NULL, sync_thread_trampoline, start) != 0) {
+        free(start);
+        return false;
+    }
+    return true;
+}
+
+static inline void sync_thread_join(SyncThread thread) {
+    pthread_join(thread, NULL);
+}
+
+static inline unsigned int sync_cpu_count(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (unsigned int)n : 1;
+}
+#endif
+
+#endif // SYNC_H_
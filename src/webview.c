@@ -3,6 +3,10 @@
 #include <string.h>
 #include <stdbool.h>
 
+#if !defined(_WIN32) && defined(__linux__) && !defined(__ANDROID__)
+#define CROSSWEB_WEBKITGTK 1
+#endif
+
 #ifndef _WIN32
 #include <signal.h>
 #include <unistd.h>
@@ -15,44 +19,94 @@
 #include "./thirdparty/webview-c/webview.h"
 #endif
 
+#ifdef CROSSWEB_WEBKITGTK
+#include <stdatomic.h>
+#include <glib-unix.h>
+#include <gtk/gtk.h>
+#include <webkit2/webkit2.h>
+#endif
+
 #include "hotreload.h"
 #include "plug.h"
 #include "ipc.h"
 
-#ifdef _WIN32
-
-static char g_start_url[MAX_PATH * 4];
+#if defined(_WIN32) || defined(CROSSWEB_WEBKITGTK)
 
-static char pending_invoke_id[IPC_MAX_ID_LEN] = {0};
+// Each request carries its IpcMessage as host_ctx, so a plugin can answer
+// from any thread, long after plug_invoke() returned.
+static void complete_request(void *host_ctx, const char *content_type, const void *data, size_t len) {
+    ipc_complete((IpcMessage *)host_ctx, content_type, data, len);
+}
 
-static void respond_to_js(const char *response) {
-    if (pending_invoke_id[0] == '\0') {
+static void host_emit_event(const char *event, const char *data_json) {
+    if (event == NULL || event[0] == '\0') {
         return;
     }
-    const char *payload = response ? response : "{\"ok\":true}";
-    ipc_response(pending_invoke_id, payload);
+    ipc_emit_event(event, data_json ? data_json : "null");
 }
 
-static void host_emit_event(const char *event, const char *data_json) {
+// Stream chunks and other replies-as-events go only to the window whose
+// request they answer.
+static void host_emit_event_to(const char *request_id, const char *event, const char *data_json) {
     if (event == NULL || event[0] == '\0') {
         return;
     }
-    ipc_emit_event(event, data_json ? data_json : "null");
+    ipc_emit_event_to(ipc_window_of(request_id), event, data_json ? data_json : "null");
+}
+
+static void register_host_hooks(void) {
+#ifdef CROSSWEB_HOTRELOAD
+    if (plug_set_host_emit_event == NULL || plug_set_host_emit_event_to == NULL ||
+        plug_set_host_complete == NULL) {
+        return;
+    }
+#endif
+    plug_set_host_emit_event(host_emit_event);
+    plug_set_host_emit_event_to(host_emit_event_to);
+    plug_set_host_complete(complete_request);
 }
 
 static void process_ipc_queue(webview_t wv) {
-    IpcMessage msg;
-    while (ipc_receive(&msg)) {
-        char previous_id[IPC_MAX_ID_LEN];
-        memcpy(previous_id, pending_invoke_id, sizeof(previous_id));
-        strncpy(pending_invoke_id, msg.id, sizeof(pending_invoke_id) - 1);
-        pending_invoke_id[sizeof(pending_invoke_id) - 1] = '\0';
-        plug_invoke(msg.cmd, msg.payload, respond_to_js);
-        memcpy(pending_invoke_id, previous_id, sizeof(pending_invoke_id));
+    IpcMessage *msg;
+    while ((msg = ipc_receive()) != NULL) {
+        PlugRequest req = {
+            .id = msg->id,
+            .cmd = msg->cmd,
+            .payload = msg->payload,
+            .payload_len = msg->payload_len,
+            .data = msg->data,
+            .data_len = msg->data_len,
+            .deadline_ms = msg->deadline_ms,
+            .host_ctx = msg,
+        };
+        // The slot is released by complete_request(), which plug.c calls
+        // exactly once per request, now or later.
+        if (msg->data != NULL) {
+            plug_invoke_bytes(&req, NULL);
+        } else {
+            plug_invoke(&req, NULL);
+        }
     }
     (void)wv;
 }
 
+#endif // _WIN32 || CROSSWEB_WEBKITGTK
+
+#ifdef _WIN32
+
+static char g_start_url[MAX_PATH * 4];
+
+#define IPC_FLUSH_TIMER_ID 0x1C0
+
+// May run on any thread: nudges the blocking message loop so the outbox is
+// drained promptly. The message itself carries no data.
+static void wake_ui_loop(void *arg) {
+    struct webview *wv = (struct webview *)arg;
+    if (wv != NULL && wv->priv.hwnd != NULL) {
+        PostMessageA(wv->priv.hwnd, WM_NULL, 0, 0);
+    }
+}
+
 static bool file_exists(const char *path) {
     DWORD attrs = GetFileAttributesA(path);
     return attrs != INVALID_FILE_ATTRIBUTES && (attrs & FILE_ATTRIBUTE_DIRECTORY) == 0;
@@ -150,11 +204,7 @@ int main(void) {
         return 1;
     }
 
-#ifdef CROSSWEB_HOTRELOAD
-    if (plug_set_host_emit_event != NULL) {
-        plug_set_host_emit_event(host_emit_event);
-    }
-#endif
+    register_host_hooks();
 
     struct webview wv;
     configure_webview(&wv);
@@ -164,6 +214,7 @@ int main(void) {
     }
 
     ipc_init((webview_t)&wv);
+    ipc_set_wakeup(wake_ui_loop, &wv);
     plug_init((webview_t)&wv);
 
     bool running = true;
@@ -173,9 +224,7 @@ int main(void) {
             void *state = plug_pre_reload();
             if (reload_libplug()) {
                 printf("HOTRELOAD: successfully reloaded plugin\n");
-                if (plug_set_host_emit_event != NULL) {
-                    plug_set_host_emit_event(host_emit_event);
-                }
+                register_host_hooks();
                 plug_init((webview_t)&wv);
                 plug_post_reload(state);
             } else {
@@ -185,14 +234,522 @@ int main(void) {
 #endif
         process_ipc_queue((webview_t)&wv);
         plug_update((webview_t)&wv);
+        ipc_drain_outbox();
+        // A batch held back by the flush policy still has to go out on time,
+        // and sleeping coroutines have to be resumed, even if nothing else
+        // wakes the message loop.
+        int flush_in = ipc_flush_timeout_ms();
+        int update_in = plug_update_timeout_ms();
+        if (update_in >= 0 && (flush_in < 0 || update_in < flush_in)) {
+            flush_in = update_in;
+        }
+        if (flush_in >= 0) {
+            SetTimer(wv.priv.hwnd, IPC_FLUSH_TIMER_ID, (UINT)(flush_in > 0 ? flush_in : 1), NULL);
+        } else {
+            KillTimer(wv.priv.hwnd, IPC_FLUSH_TIMER_ID);
+        }
     }
     plug_cleanup((webview_t)&wv);
+    ipc_set_wakeup(NULL, NULL);
     ipc_deinit();
     webview_exit(&wv);
     return 0;
 }
 
-#else // !_WIN32
+#elif defined(CROSSWEB_WEBKITGTK)
+
+// ============================================================================
+// WebKitGTK host
+// ============================================================================
+// The bridge is injected as a document-start user script and posts requests
+// to the "crossweb" script message handler as plain objects, so payloads
+// arrive as JS strings and binary data as a Uint8Array, with no base64 hop.
+// On WebKitGTK 2.40 and later, binary calls go through the crossweb:// scheme
+// instead, which also returns the reply bytes as they are.
+// Everything runs on the GLib main loop: requests and outbox wakeups
+// schedule an idle pump, the core event loop's epoll fd is watched as a
+// GLib source, and the remaining deadlines (held batches, coroutine sleeps)
+// arm a one-shot timeout. Nothing polls.
+//
+// Every top-level window is an IPC window of its own (ipc_window_open()), so
+// pages get their own request ids and replies, while all of them share the
+// one plugin runtime. There is one window per URL on the command line, and
+// window.open() from a page opens another; the host exits when the last one
+// is closed.
+// ============================================================================
+
+#define START_URL "http://localhost:5173"
+#define MESSAGE_HANDLER "crossweb"
+
+typedef struct HostWindow {
+    struct HostWindow *next;
+    GtkWidget *window;
+    WebKitWebView *view;
+    int ipc_window;
+} HostWindow;
+
+static HostWindow *g_windows = NULL;
+static atomic_bool g_pump_pending = false;
+static guint g_deadline_source = 0;
+static guint g_poll_source = 0;
+
+static gboolean pump(gpointer user_data);
+
+// Thread-safe: any number of calls before the pump runs cost one idle source.
+static void schedule_pump(void) {
+    if (!atomic_exchange(&g_pump_pending, true)) {
+        g_idle_add(pump, NULL);
+    }
+}
+
+static void wake_ui_loop(void *arg) {
+    (void)arg;
+    schedule_pump();
+}
+
+static void on_eval_done(GObject *object, GAsyncResult *result, gpointer user_data) {
+    (void)user_data;
+    GError *error = NULL;
+#if WEBKIT_CHECK_VERSION(2, 40, 0)
+    JSCValue *value = webkit_web_view_evaluate_javascript_finish(WEBKIT_WEB_VIEW(object), result, &error);
+    if (value != NULL) {
+        g_object_unref(value);
+    }
+#else
+    WebKitJavascriptResult *value = webkit_web_view_run_javascript_finish(WEBKIT_WEB_VIEW(object), result, &error);
+    if (value != NULL) {
+        webkit_javascript_result_unref(value);
+    }
+#endif
+    if (error != NULL) {
+        fprintf(stderr, "IPC: failed to evaluate script: %s\n", error->message);
+        g_error_free(error);
+    }
+}
+
+// Batches are evaluated in place from the drain; WebKit copies the script.
+static bool eval_in_page(const char *script, size_t len, void *arg) {
+    WebKitWebView *view = WEBKIT_WEB_VIEW(arg);
+#if WEBKIT_CHECK_VERSION(2, 40, 0)
+    webkit_web_view_evaluate_javascript(view, script, (gssize)len, NULL, NULL, NULL, on_eval_done, NULL);
+#else
+    (void)len;
+    webkit_web_view_run_javascript(view, script, NULL, on_eval_done, NULL);
+#endif
+    return true;
+}
+
+// UTF-8 bytes of a string property, NULL if it is missing or not a string.
+static GBytes *message_string(JSCValue *message, const char *name) {
+    JSCValue *value = jsc_value_object_get_property(message, name);
+    GBytes *bytes = jsc_value_is_string(value) ? jsc_value_to_string_as_bytes(value) : NULL;
+    g_object_unref(value);
+    return bytes;
+}
+
+static void handle_object_message(int window, JSCValue *message) {
+    GBytes *id = message_string(message, "id");
+    GBytes *cmd = message_string(message, "cmd");
+    GBytes *payload = message_string(message, "payload");
+    JSCValue *timeout = jsc_value_object_get_property(message, "timeoutMs");
+    JSCValue *bytes = jsc_value_object_get_property(message, "bytes");
+
+    double timeout_ms = jsc_value_is_number(timeout) ? jsc_value_to_double(timeout) : 0.0;
+    const void *data = NULL;
+    size_t data_len = 0;
+    guint8 *copy = NULL;
+    if (!jsc_value_is_undefined(bytes) && !jsc_value_is_null(bytes)) {
+#if WEBKIT_CHECK_VERSION(2, 38, 0)
+        gsize n = 0;
+        data = jsc_value_is_typed_array(bytes) ? jsc_value_typed_array_get_data(bytes, &n) : NULL;
+        data_len = (size_t)n;
+#else
+        // No typed array accessors: read the elements one by one.
+        JSCValue *length = jsc_value_object_get_property(bytes, "length");
+        data_len = jsc_value_is_number(length) ? (size_t)jsc_value_to_double(length) : 0;
+        g_object_unref(length);
+        copy = (guint8 *)g_malloc(data_len + 1);
+        for (size_t i = 0; i < data_len; ++i) {
+            JSCValue *item = jsc_value_object_get_property_at_index(bytes, (guint)i);
+            copy[i] = (guint8)jsc_value_to_int32(item);
+            g_object_unref(item);
+        }
+        data = copy;
+#endif
+        if (data == NULL) {
+            data = "";
+            data_len = 0;
+        }
+    }
+
+    if (id == NULL || cmd == NULL) {
+        fprintf(stderr, "IPC: dropped malformed message\n");
+    } else {
+        gsize id_len = 0, cmd_len = 0, payload_len = 0;
+        const char *id_text = (const char *)g_bytes_get_data(id, &id_len);
+        const char *cmd_text = (const char *)g_bytes_get_data(cmd, &cmd_len);
+        const char *payload_text = payload != NULL ? (const char *)g_bytes_get_data(payload, &payload_len) : NULL;
+        unsigned long budget = timeout_ms > 0.0 && timeout_ms < 4294967295.0 ? (unsigned long)timeout_ms : 0;
+        if (!ipc_handle_message_from(window, id_text, id_len, cmd_text, cmd_len, payload_text, payload_len,
+                                     data, data_len, budget)) {
+            fprintf(stderr, "IPC: dropped message for %.*s\n", (int)cmd_len, cmd_text);
+        }
+    }
+
+    g_free(copy);
+    g_object_unref(bytes);
+    g_object_unref(timeout);
+    if (payload != NULL) g_bytes_unref(payload);
+    if (cmd != NULL) g_bytes_unref(cmd);
+    if (id != NULL) g_bytes_unref(id);
+}
+
+static void on_script_message(WebKitUserContentManager *manager, WebKitJavascriptResult *result, gpointer user_data) {
+    (void)manager;
+    HostWindow *hw = (HostWindow *)user_data;
+    JSCValue *message = webkit_javascript_result_get_js_value(result);
+    if (jsc_value_is_string(message)) {
+        // A page that frames its own calls (see ipc.js) sends the same
+        // id<SEP>cmd<SEP>base64 string as the Windows bridge.
+        char *text = jsc_value_to_string(message);
+        if (!ipc_handle_js_message_from(hw->ipc_window, text)) {
+            fprintf(stderr, "IPC: dropped malformed message\n");
+        }
+        g_free(text);
+    } else if (jsc_value_is_object(message)) {
+        handle_object_message(hw->ipc_window, message);
+    }
+    schedule_pump();
+}
+
+#if WEBKIT_CHECK_VERSION(2, 40, 0)
+// A crossweb:// request in flight. ipc.c borrows the body until the reply is
+// finished, so it is kept here with the request.
+typedef struct SchemeCall {
+    WebKitURISchemeRequest *request;
+    GBytes *body;
+} SchemeCall;
+
+static void free_scheme_call(SchemeCall *call) {
+    g_object_unref(call->request);
+    if (call->body != NULL) g_bytes_unref(call->body);
+    g_free(call);
+}
+
+static void finish_scheme_request(void *reply_ctx, const char *content_type,
+                                  const void *data, size_t len, void *owner) {
+    SchemeCall *call = (SchemeCall *)reply_ctx;
+    if (content_type == NULL) {
+        GError *error = g_error_new_literal(G_IO_ERROR, G_IO_ERROR_FAILED, "IPC request failed");
+        webkit_uri_scheme_request_finish_error(call->request, error);
+        g_error_free(error);
+        free_scheme_call(call);
+        return;
+    }
+    // WebKit reads straight from the reply; ipc.c gets it back once WebKit
+    // drops the stream.
+    GBytes *bytes = g_bytes_new_with_free_func(data, len, ipc_bytes_free, owner);
+    GInputStream *stream = g_memory_input_stream_new_from_bytes(bytes);
+    WebKitURISchemeResponse *response = webkit_uri_scheme_response_new(stream, (gint64)len);
+    webkit_uri_scheme_response_set_content_type(response, content_type);
+    // The page fetches from its own origin, so the reply needs CORS headers.
+    SoupMessageHeaders *headers = soup_message_headers_new(SOUP_MESSAGE_HEADERS_RESPONSE);
+    soup_message_headers_append(headers, "Access-Control-Allow-Origin", "*");
+    webkit_uri_scheme_response_set_http_headers(response, headers);
+    webkit_uri_scheme_request_finish_with_response(call->request, response);
+    g_object_unref(response);
+    g_object_unref(stream);
+    g_bytes_unref(bytes);
+    free_scheme_call(call);
+}
+
+static void on_scheme_request(WebKitURISchemeRequest *request, gpointer user_data) {
+    (void)user_data;
+    // Calls are queued as their page's window, so a closed window cancels
+    // them with everything else it started.
+    WebKitWebView *view = webkit_uri_scheme_request_get_web_view(request);
+    HostWindow *hw = g_windows;
+    while (hw != NULL && hw->view != view) {
+        hw = hw->next;
+    }
+    if (hw == NULL) {
+        GError *error = g_error_new_literal(G_IO_ERROR, G_IO_ERROR_FAILED, "no such window");
+        webkit_uri_scheme_request_finish_error(request, error);
+        g_error_free(error);
+        return;
+    }
+    SchemeCall *call = g_new0(SchemeCall, 1);
+    call->request = (WebKitURISchemeRequest *)g_object_ref(request);
+    GInputStream *in = webkit_uri_scheme_request_get_http_body(request);
+    if (in != NULL) {
+        // Request bodies are already in memory, so this does not block.
+        GOutputStream *out = g_memory_output_stream_new_resizable();
+        GError *error = NULL;
+        gssize n = g_output_stream_splice(out, in,
+                                          G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE | G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET,
+                                          NULL, &error);
+        if (n >= 0) {
+            call->body = g_memory_output_stream_steal_as_bytes(G_MEMORY_OUTPUT_STREAM(out));
+        }
+        g_object_unref(out);
+        g_object_unref(in);
+        if (n < 0) {
+            fprintf(stderr, "IPC: failed to read request body: %s\n", error->message);
+            webkit_uri_scheme_request_finish_error(request, error);
+            g_error_free(error);
+            free_scheme_call(call);
+            return;
+        }
+    }
+    gsize body_len = 0;
+    const void *body = call->body != NULL ? g_bytes_get_data(call->body, &body_len) : NULL;
+    ipc_handle_scheme_request_from(hw->ipc_window, webkit_uri_scheme_request_get_uri(request), body, body_len,
+                                   call);
+    schedule_pump();
+}
+
+// Binary calls skip base64 in both directions. Older WebKitGTK cannot read
+// request bodies, so there the bridge keeps using script messages.
+static void register_scheme(void) {
+    WebKitWebContext *context = webkit_web_context_get_default();
+    webkit_web_context_register_uri_scheme(context, IPC_SCHEME, on_scheme_request, NULL, NULL);
+    WebKitSecurityManager *security = webkit_web_context_get_security_manager(context);
+    webkit_security_manager_register_uri_scheme_as_secure(security, IPC_SCHEME);
+    webkit_security_manager_register_uri_scheme_as_cors_enabled(security, IPC_SCHEME);
+    ipc_set_scheme_handler(finish_scheme_request);
+}
+#endif
+
+static gboolean on_deadline(gpointer user_data) {
+    g_deadline_source = 0;
+    return pump(user_data);
+}
+
+static gboolean on_poll_fd(gint fd, GIOCondition condition, gpointer user_data) {
+    (void)fd;
+    (void)condition;
+    pump(user_data);
+    return G_SOURCE_CONTINUE;
+}
+
+// The core loop's fd is closed by plug_pre_reload() and plug_cleanup(), so
+// the watch comes off before either and is set up anew after a reload.
+static void unwatch_poll_fd(void) {
+    if (g_poll_source != 0) {
+        g_source_remove(g_poll_source);
+        g_poll_source = 0;
+    }
+}
+
+static void watch_poll_fd(void) {
+    unwatch_poll_fd();
+    int fd = plug_poll_fd();
+    if (fd >= 0) {
+        g_poll_source = g_unix_fd_add(fd, G_IO_IN, on_poll_fd, NULL);
+    }
+}
+
+// Plugins get the first window still open as their PluginContext webview.
+static webview_t main_view(void) {
+    return g_windows != NULL ? (webview_t)g_windows->view : NULL;
+}
+
+static gboolean pump(gpointer user_data) {
+    (void)user_data;
+    // Cleared first so a wakeup racing with this pump schedules another.
+    atomic_store(&g_pump_pending, false);
+    process_ipc_queue(main_view());
+    plug_update(main_view());
+    ipc_drain_outbox();
+
+    // A held batch and sleeping coroutines still have to run on time even if
+    // nothing else wakes the loop.
+    int due = ipc_flush_timeout_ms();
+    int update_in = plug_update_timeout_ms();
+    if (update_in >= 0 && (due < 0 || update_in < due)) {
+        due = update_in;
+    }
+    if (g_deadline_source != 0) {
+        g_source_remove(g_deadline_source);
+        g_deadline_source = 0;
+    }
+    if (due >= 0) {
+        g_deadline_source = g_timeout_add((guint)due, on_deadline, NULL);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+#ifdef CROSSWEB_HOTRELOAD
+static gboolean check_reload(gpointer user_data) {
+    (void)user_data;
+    if (reload_libplug_changed()) {
+        unwatch_poll_fd();
+        void *state = plug_pre_reload();
+        if (reload_libplug()) {
+            printf("HOTRELOAD: successfully reloaded plugin\n");
+            register_host_hooks();
+            plug_init(main_view());
+            plug_post_reload(state);
+        } else {
+            printf("HOTRELOAD: reload failed, keeping old version\n");
+        }
+        watch_poll_fd();
+        schedule_pump();
+    }
+    return G_SOURCE_CONTINUE;
+}
+#endif
+
+static HostWindow *open_window(WebKitWebView *related);
+
+static void on_window_destroy(GtkWidget *widget, gpointer user_data) {
+    (void)widget;
+    HostWindow *hw = (HostWindow *)user_data;
+    ipc_window_close(hw->ipc_window);
+    for (HostWindow **it = &g_windows; *it != NULL; it = &(*it)->next) {
+        if (*it == hw) {
+            *it = hw->next;
+            break;
+        }
+    }
+    g_free(hw);
+    schedule_pump();   // hand plug.c the close before the loop exits
+    if (g_windows == NULL) {
+        gtk_main_quit();
+    }
+}
+
+static void on_view_close(WebKitWebView *view, gpointer user_data) {
+    (void)view;
+    gtk_widget_destroy(((HostWindow *)user_data)->window);
+}
+
+static void on_ready_to_show(WebKitWebView *view, gpointer user_data) {
+    (void)view;
+    gtk_widget_show_all(((HostWindow *)user_data)->window);
+}
+
+// window.open(): the new page gets a window (and IPC window) of its own;
+// WebKit loads it once we hand back the view.
+static GtkWidget *on_create(WebKitWebView *view, WebKitNavigationAction *action, gpointer user_data) {
+    (void)action;
+    (void)user_data;
+    HostWindow *hw = open_window(view);
+    if (hw == NULL) {
+        return NULL;
+    }
+    g_signal_connect(hw->view, "ready-to-show", G_CALLBACK(on_ready_to_show), hw);
+    return GTK_WIDGET(hw->view);
+}
+
+// Each view gets its own content manager, so script messages say which
+// window they came from. A related view shares its opener's web process.
+static HostWindow *open_window(WebKitWebView *related) {
+    HostWindow *hw = g_new0(HostWindow, 1);
+    WebKitUserContentManager *content = webkit_user_content_manager_new();
+    g_signal_connect(content, "script-message-received::" MESSAGE_HANDLER, G_CALLBACK(on_script_message), hw);
+    if (!webkit_user_content_manager_register_script_message_handler(content, MESSAGE_HANDLER)) {
+        fprintf(stderr, "IPC: failed to register the script message handler\n");
+    }
+    const char *scheme_js = ipc_scheme_script();
+    if (scheme_js != NULL) {
+        WebKitUserScript *scheme = webkit_user_script_new(scheme_js,
+                                                          WEBKIT_USER_CONTENT_INJECT_TOP_FRAME,
+                                                          WEBKIT_USER_SCRIPT_INJECT_AT_DOCUMENT_START,
+                                                          NULL, NULL);
+        webkit_user_content_manager_add_script(content, scheme);
+        webkit_user_script_unref(scheme);
+    }
+    WebKitUserScript *bridge = webkit_user_script_new(ipc_bridge_script(),
+                                                      WEBKIT_USER_CONTENT_INJECT_TOP_FRAME,
+                                                      WEBKIT_USER_SCRIPT_INJECT_AT_DOCUMENT_START,
+                                                      NULL, NULL);
+    webkit_user_content_manager_add_script(content, bridge);
+    webkit_user_script_unref(bridge);
+
+    hw->view = WEBKIT_WEB_VIEW(g_object_new(WEBKIT_TYPE_WEB_VIEW,
+                                            "user-content-manager", content,
+                                            "related-view", related,
+                                            NULL));
+    g_object_unref(content);
+    webkit_settings_set_enable_developer_extras(webkit_web_view_get_settings(hw->view), TRUE);
+
+    hw->ipc_window = ipc_window_open(eval_in_page, hw->view);
+    if (hw->ipc_window < 0) {
+        g_object_ref_sink(hw->view);
+        g_object_unref(hw->view);
+        g_free(hw);
+        return NULL;
+    }
+    hw->window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
+    gtk_window_set_title(GTK_WINDOW(hw->window), "Crossweb");
+    gtk_window_set_default_size(GTK_WINDOW(hw->window), 1280, 800);
+    gtk_container_add(GTK_CONTAINER(hw->window), GTK_WIDGET(hw->view));
+    g_signal_connect(hw->window, "destroy", G_CALLBACK(on_window_destroy), hw);
+    g_signal_connect(hw->view, "create", G_CALLBACK(on_create), NULL);
+    g_signal_connect(hw->view, "close", G_CALLBACK(on_view_close), hw);
+
+    // Appended, so the first window stays main_view() while it is open.
+    HostWindow **tail = &g_windows;
+    while (*tail != NULL) {
+        tail = &(*tail)->next;
+    }
+    *tail = hw;
+    return hw;
+}
+
+int main(int argc, char **argv)
+{
+    struct sigaction act = {0};
+    act.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &act, NULL);
+
+    if (!gtk_init_check(&argc, &argv)) {
+        fprintf(stderr, "Failed to initialize GTK\n");
+        return 1;
+    }
+    if (!reload_libplug()) return 1;
+    register_host_hooks();
+
+    ipc_init(NULL);
+    ipc_set_wakeup(wake_ui_loop, NULL);
+#if WEBKIT_CHECK_VERSION(2, 40, 0)
+    // Before any view exists, so the first web process already knows it.
+    register_scheme();
+#endif
+    // One window per URL given, or the dev server.
+    for (int i = argc > 1 ? 1 : 0; i < argc; ++i) {
+        HostWindow *hw = open_window(NULL);
+        if (hw != NULL) {
+            webkit_web_view_load_uri(hw->view, argc > 1 ? argv[i] : START_URL);
+            gtk_widget_show_all(hw->window);
+        }
+    }
+    if (g_windows == NULL) {
+        ipc_deinit();
+        return 1;
+    }
+    plug_init(main_view());
+    watch_poll_fd();
+#ifdef CROSSWEB_HOTRELOAD
+    g_timeout_add(250, check_reload, NULL);
+#endif
+
+    gtk_main();
+
+    // The last window is gone: let plug.c see the closes, then shut down.
+    pump(NULL);
+    unwatch_poll_fd();
+    if (g_deadline_source != 0) {
+        g_source_remove(g_deadline_source);
+    }
+    plug_cleanup(NULL);
+    ipc_set_wakeup(NULL, NULL);
+    ipc_deinit();
+    return 0;
+}
+
+#else // headless
 
 int main(void)
 {
@@ -204,15 +761,18 @@ int main(void)
     plug_init((webview_t)NULL);
 
     for (;;) {
+        // Sleep in the core event loop until a plugin fd, timer or wakeup
+        // needs us.
+        int timeout_ms = -1;
 #ifdef CROSSWEB_HOTRELOAD
         if (reload_libplug_changed()) {
             void *state = plug_pre_reload();
             if (!reload_libplug()) return 1;
             plug_post_reload(state);
         }
+        timeout_ms = 250;   // look for a rebuilt libplug now and then
 #endif
-        plug_update((webview_t)NULL);
-        usleep(1000);
+        plug_poll((webview_t)NULL, timeout_ms);
     }
     plug_cleanup((webview_t)NULL);
     return 0;
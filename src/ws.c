@@ -0,0 +1,290 @@
+// ============================================================================
+// ws.c - WebSocket (RFC 6455) server-side framing
+// ============================================================================
+
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+
+#include "codec.h"
+#include "ws.h"
+
+#define WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+// ============================================================================
+// SHA-1, only for the handshake
+// ============================================================================
+
+static uint32_t rol32(uint32_t x, int n) {
+    return (x << n) | (x >> (32 - n));
+}
+
+static void sha1_block(uint32_t h[5], const unsigned char *p) {
+    uint32_t w[80];
+    for (int i = 0; i < 16; ++i) {
+        w[i] = (uint32_t)p[i * 4] << 24 | (uint32_t)p[i * 4 + 1] << 16 |
+               (uint32_t)p[i * 4 + 2] << 8 | (uint32_t)p[i * 4 + 3];
+    }
+    for (int i = 16; i < 80; ++i) {
+        w[i] = rol32(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    for (int i = 0; i < 80; ++i) {
+        uint32_t f, k;
+        if (i < 20) {
+            f = (b & c) | (~b & d);
+            k = 0x5A827999;
+        } else if (i < 40) {
+            f = b ^ c ^ d;
+            k = 0x6ED9EBA1;
+        } else if (i < 60) {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8F1BBCDC;
+        } else {
+            f = b ^ c ^ d;
+            k = 0xCA62C1D6;
+        }
+        uint32_t t = rol32(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = rol32(b, 30);
+        b = a;
+        a = t;
+    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+}
+
+static void sha1(const void *data, size_t len, unsigned char out[20]) {
+    uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+    const unsigned char *p = (const unsigned char *)data;
+    size_t left = len;
+    while (left >= 64) {
+        sha1_block(h, p);
+        p += 64;
+        left -= 64;
+    }
+    unsigned char tail[128] = {0};
+    memcpy(tail, p, left);
+    tail[left] = 0x80;
+    size_t tail_len = left < 56 ? 64 : 128;
+    unsigned long long bits = (unsigned long long)len * 8;
+    for (int i = 0; i < 8; ++i) {
+        tail[tail_len - 1 - i] = (unsigned char)(bits >> (i * 8));
+    }
+    sha1_block(h, tail);
+    if (tail_len == 128) {
+        sha1_block(h, tail + 64);
+    }
+    for (int i = 0; i < 5; ++i) {
+        out[i * 4] = (unsigned char)(h[i] >> 24);
+        out[i * 4 + 1] = (unsigned char)(h[i] >> 16);
+        out[i * 4 + 2] = (unsigned char)(h[i] >> 8);
+        out[i * 4 + 3] = (unsigned char)h[i];
+    }
+}
+
+// ============================================================================
+// Opening handshake
+// ============================================================================
+
+size_t ws_request_head_len(const char *buf, size_t len) {
+    for (size_t i = 3; i < len; ++i) {
+        if (buf[i] == '\n' && buf[i - 1] == '\r' && buf[i - 2] == '\n' && buf[i - 3] == '\r') {
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+static void trim(const char **s, size_t *len) {
+    while (*len > 0 && (**s == ' ' || **s == '\t')) {
+        (*s)++;
+        (*len)--;
+    }
+    while (*len > 0 && ((*s)[*len - 1] == ' ' || (*s)[*len - 1] == '\t')) {
+        (*len)--;
+    }
+}
+
+// True if the comma-separated header value lists `token` (case-insensitive).
+static bool has_token(const char *value, size_t len, const char *token) {
+    size_t token_len = strlen(token);
+    const char *end = value + len;
+    while (value < end) {
+        const char *comma = memchr(value, ',', (size_t)(end - value));
+        const char *item = value;
+        size_t item_len = (size_t)((comma ? comma : end) - value);
+        trim(&item, &item_len);
+        if (item_len == token_len && strncasecmp(item, token, token_len) == 0) {
+            return true;
+        }
+        if (comma == NULL) {
+            break;
+        }
+        value = comma + 1;
+    }
+    return false;
+}
+
+bool ws_parse_upgrade(const char *head, size_t len, WsUpgrade *out) {
+    memset(out, 0, sizeof(*out));
+    const char *end = head + len;
+    const char *eol = memchr(head, '\n', len);
+    if (eol == NULL || len < 4 || memcmp(head, "GET ", 4) != 0) {
+        return false;
+    }
+    bool upgrade = false, connection = false, version = false;
+    for (const char *line = eol + 1; line < end; line = eol + 1) {
+        eol = memchr(line, '\n', (size_t)(end - line));
+        if (eol == NULL) {
+            break;
+        }
+        size_t line_len = (size_t)(eol - line);
+        if (line_len > 0 && line[line_len - 1] == '\r') {
+            line_len--;
+        }
+        const char *colon = memchr(line, ':', line_len);
+        if (colon == NULL) {
+            continue;
+        }
+        size_t name_len = (size_t)(colon - line);
+        const char *value = colon + 1;
+        size_t value_len = line_len - name_len - 1;
+        trim(&value, &value_len);
+#define HEADER_IS(name) (name_len == sizeof(name) - 1 && strncasecmp(line, name, name_len) == 0)
+        if (HEADER_IS("Upgrade")) {
+            upgrade = has_token(value, value_len, "websocket");
+        } else if (HEADER_IS("Connection")) {
+            connection = has_token(value, value_len, "upgrade");
+        } else if (HEADER_IS("Sec-WebSocket-Version")) {
+            version = value_len == 2 && memcmp(value, "13", 2) == 0;
+        } else if (HEADER_IS("Sec-WebSocket-Key")) {
+            out->key = value;
+            out->key_len = value_len;
+        } else if (HEADER_IS("Origin")) {
+            out->origin = value;
+            out->origin_len = value_len;
+        }
+#undef HEADER_IS
+    }
+    return upgrade && connection && version && out->key != NULL && out->key_len > 0 && out->key_len <= 64;
+}
+
+void ws_accept_key(const char *key, size_t key_len, char out[WS_ACCEPT_LEN + 1]) {
+    char buf[64 + sizeof(WS_GUID)];
+    if (key_len > 64) {
+        key_len = 64;
+    }
+    memcpy(buf, key, key_len);
+    memcpy(buf + key_len, WS_GUID, sizeof(WS_GUID) - 1);
+    unsigned char digest[20];
+    sha1(buf, key_len + sizeof(WS_GUID) - 1, digest);
+    codec_base64_encode(digest, sizeof(digest), out, CODEC_BASE64);
+}
+
+// ============================================================================
+// Frames
+// ============================================================================
+
+int ws_parse_frame_header(const unsigned char *buf, size_t len, WsFrame *frame) {
+    if (len < 2) {
+        return 0;
+    }
+    if (buf[0] & 0x70) {
+        return -1;   // no extensions were negotiated
+    }
+    frame->fin = (buf[0] & 0x80) != 0;
+    frame->opcode = buf[0] & 0x0F;
+    frame->masked = (buf[1] & 0x80) != 0;
+    unsigned long long payload_len = buf[1] & 0x7F;
+    size_t header_len = 2;
+    if (payload_len == 126) {
+        header_len += 2;
+    } else if (payload_len == 127) {
+        header_len += 8;
+    }
+    if (frame->masked) {
+        header_len += 4;
+    }
+    if (len < header_len) {
+        return 0;
+    }
+    const unsigned char *p = buf + 2;
+    if (payload_len == 126) {
+        payload_len = (unsigned long long)p[0] << 8 | p[1];
+        p += 2;
+    } else if (payload_len == 127) {
+        payload_len = 0;
+        for (int i = 0; i < 8; ++i) {
+            payload_len = payload_len << 8 | p[i];
+        }
+        p += 8;
+        if (payload_len >> 63) {
+            return -1;
+        }
+    }
+    if (frame->masked) {
+        memcpy(frame->mask, p, 4);
+    }
+    switch (frame->opcode) {
+    case WS_OP_CONTINUATION:
+    case WS_OP_TEXT:
+    case WS_OP_BINARY:
+        break;
+    case WS_OP_CLOSE:
+    case WS_OP_PING:
+    case WS_OP_PONG:
+        if (!frame->fin || payload_len > 125) {
+            return -1;
+        }
+        break;
+    default:
+        return -1;
+    }
+    frame->header_len = header_len;
+    frame->payload_len = payload_len;
+    return 1;
+}
+
+void ws_unmask(unsigned char *data, size_t len, const unsigned char mask[4], size_t offset) {
+    unsigned char m[8];
+    for (int i = 0; i < 8; ++i) {
+        m[i] = mask[(offset + (size_t)i) & 3];
+    }
+    uint64_t wide;
+    memcpy(&wide, m, 8);
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t chunk;
+        memcpy(&chunk, data + i, 8);
+        chunk ^= wide;
+        memcpy(data + i, &chunk, 8);
+    }
+    for (; i < len; ++i) {
+        data[i] ^= m[i & 7];
+    }
+}
+
+size_t ws_frame_header(unsigned char *out, int opcode, size_t len) {
+    out[0] = (unsigned char)(0x80 | (opcode & 0x0F));
+    if (len < 126) {
+        out[1] = (unsigned char)len;
+        return 2;
+    }
+    if (len <= 0xFFFF) {
+        out[1] = 126;
+        out[2] = (unsigned char)(len >> 8);
+        out[3] = (unsigned char)len;
+        return 4;
+    }
+    out[1] = 127;
+    unsigned long long wide = len;
+    for (int i = 0; i < 8; ++i) {
+        out[2 + i] = (unsigned char)(wide >> ((7 - i) * 8));
+    }
+    return 10;
+}
@@ -0,0 +1,61 @@
+#ifndef WS_H_
+#define WS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// ============================================================================
+// ws.h - WebSocket (RFC 6455) server-side framing
+// ============================================================================
+// Just the protocol: the opening handshake and frame headers. No I/O, so the
+// host decides how connections are read, buffered and multiplexed (see
+// headless.c).
+// ============================================================================
+
+#define WS_OP_CONTINUATION 0x0
+#define WS_OP_TEXT 0x1
+#define WS_OP_BINARY 0x2
+#define WS_OP_CLOSE 0x8
+#define WS_OP_PING 0x9
+#define WS_OP_PONG 0xA
+
+#define WS_MAX_HEADER 10          // server frames are never masked
+#define WS_ACCEPT_LEN 28          // base64 of a SHA-1 digest
+
+typedef struct {
+    const char *key;              // Sec-WebSocket-Key
+    size_t key_len;
+    const char *origin;           // NULL when the client sent none
+    size_t origin_len;
+} WsUpgrade;
+
+typedef struct {
+    int opcode;
+    bool fin;
+    bool masked;
+    unsigned char mask[4];
+    size_t header_len;
+    unsigned long long payload_len;
+} WsFrame;
+
+// Looks for the end of an HTTP request head in `buf`. Returns its length
+// including the blank line, or 0 if more bytes are needed.
+size_t ws_request_head_len(const char *buf, size_t len);
+// Checks that `head` is a GET asking for a version 13 WebSocket upgrade and
+// picks out the fields the reply needs. The pointers in `out` point into `head`.
+bool ws_parse_upgrade(const char *head, size_t len, WsUpgrade *out);
+// Computes Sec-WebSocket-Accept for a client key. `out` gets
+// WS_ACCEPT_LEN characters and a NUL.
+void ws_accept_key(const char *key, size_t key_len, char out[WS_ACCEPT_LEN + 1]);
+
+// Returns 1 and fills `frame` once its whole header is in `buf`, 0 if more
+// bytes are needed, -1 on a protocol error (reserved bits, bad opcode,
+// oversized or fragmented control frame).
+int ws_parse_frame_header(const unsigned char *buf, size_t len, WsFrame *frame);
+// XORs `len` bytes with the mask, `offset` bytes into the payload.
+void ws_unmask(unsigned char *data, size_t len, const unsigned char mask[4], size_t offset);
+// Writes an unmasked, final frame header for a payload of `len` bytes into
+// `out` (at least WS_MAX_HEADER bytes). Returns the header length.
+size_t ws_frame_header(unsigned char *out, int opcode, size_t len);
+
+#endif // WS_H_
@@ -114,7 +114,16 @@ bool build_dist(void) {
     if (!copy_file("src/plug.c", "android/app/src/main/c/plug.c")) return false;
     if (!copy_file("src/ipc.c", "android/app/src/main/c/ipc.c")) return false;
     if (!copy_file("src/plug.h", "android/app/src/main/c/plug.h")) return false;
+    if (!copy_file("src/pool.c", "android/app/src/main/c/pool.c")) return false;
+    if (!copy_file("src/pool.h", "android/app/src/main/c/pool.h")) return false;
+    if (!copy_file("src/evloop.c", "android/app/src/main/c/evloop.c")) return false;
+    if (!copy_file("src/evloop.h", "android/app/src/main/c/evloop.h")) return false;
+    if (!copy_file("src/isolate.c", "android/app/src/main/c/isolate.c")) return false;
+    if (!copy_file("src/isolate.h", "android/app/src/main/c/isolate.h")) return false;
     if (!copy_file("src/ipc.h", "android/app/src/main/c/ipc.h")) return false;
+    if (!copy_file("src/codec.c", "android/app/src/main/c/codec.c")) return false;
+    if (!copy_file("src/codec.h", "android/app/src/main/c/codec.h")) return false;
+    if (!copy_file("src/sync.h", "android/app/src/main/c/sync.h")) return false;
     if (!copy_file("build/config.h", "android/app/src/main/c/config.h")) return false;
 
     if (!mkdir_if_not_exists("android/app/src/main/c/plugins")) return false;
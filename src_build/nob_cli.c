@@ -225,6 +225,18 @@ int nob_cli_main(int argc, char **argv)
                 nob_log(NOB_ERROR, "Unknown android subcommand `%s`", subcommand);
                 return 1;
             }
+        } else if (strcmp(command_name, "bench") == 0) {
+            // Codec throughput against the loops it replaced (src/codec_bench.c)
+            Cmd cmd = {0};
+            nob_cc(&cmd);
+            nob_cc_flags(&cmd);
+            cmd_append(&cmd, "-O2");
+            nob_cc_output(&cmd, "./build/codec-bench");
+            nob_cc_inputs(&cmd, "./src/codec_bench.c");
+            if (!cmd_run(&cmd)) return 1;
+            cmd_append(&cmd, "./build/codec-bench");
+            if (!cmd_run(&cmd)) return 1;
+            return 0;
         } else if (strcmp(command_name, "help") == 0) {
             nob_log(INFO, "Usage: %s [command]", program);
             nob_log(INFO, "Commands:");
@@ -233,6 +245,7 @@ int nob_cli_main(int argc, char **argv)
             nob_log(INFO, "    dev");
             nob_log(INFO, "    build");
             nob_log(INFO, "    android <init|dev|build|run|install>");
+            nob_log(INFO, "    bench");
             nob_log(INFO, "    help");
             return 0;
         } else {
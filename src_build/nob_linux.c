@@ -22,7 +22,7 @@ bool build_dist(void)
     cmd_append(&cmd, "-DCROSSWEB_BUILDING_PLUG=1");
     cmd_append(&cmd, "-fPIC", "-shared");
     cmd_append(&cmd, "-o", "./build/libplug.so");
-    cmd_append(&cmd, "./src/plug.c", "./src/ipc.c");
+    cmd_append(&cmd, "./src/plug.c", "./src/pool.c", "./src/evloop.c", "./src/isolate.c", "./src/codec.c");
     
     // Add all discovered plugin sources
     for (size_t i = 0; i < plugin_sources.count; ++i) {
@@ -37,7 +37,7 @@ bool build_dist(void)
     cmd_append(&cmd, "-I.");
     cmd_append(&cmd, "-include", "build/config.h");
     cmd_append(&cmd, "-o", "./build/crossweb");
-    cmd_append(&cmd, "./src/webview.c", "./src/hotreload_posix.c");
+    cmd_append(&cmd, "./src/webview.c", "./src/ipc.c", "./src/codec.c", "./src/hotreload_posix.c");
     cmd_append(&cmd, "-Wl,-rpath=./build/", "-Wl,-rpath=./");
     cmd_append(&cmd, "-lm", "-ldl", "-lpthread");
     cmd_append(&cmd, "`pkg-config --cflags --libs gtk+-3.0 webkit2gtk-4.0`");
@@ -48,7 +48,7 @@ bool build_dist(void)
     cmd_append(&cmd, "-I.");
     cmd_append(&cmd, "-include", "build/config.h");
     cmd_append(&cmd, "-o", "./build/crossweb");
-    cmd_append(&cmd, "./src/plug.c", "./src/ipc.c", "./src/webview.c");
+    cmd_append(&cmd, "./src/plug.c", "./src/pool.c", "./src/evloop.c", "./src/isolate.c", "./src/ipc.c", "./src/codec.c", "./src/webview.c");
     
     // Add all discovered plugin sources
     for (size_t i = 0; i < plugin_sources.count; ++i) {
@@ -60,6 +60,23 @@ bool build_dist(void)
     if (!cmd_run(&cmd)) return_defer(false);
 #endif // CROSSWEB_HOTRELOAD
 
+    // Headless host: always monolithic, no GTK. Building as the plug keeps
+    // plug.h from turning the entry points into hot-reload pointers.
+    cmd_append(&cmd, "cc");
+    cmd_append(&cmd, "-Wall", "-Wextra", "-ggdb");
+    cmd_append(&cmd, "-I.");
+    cmd_append(&cmd, "-include", "build/config.h");
+    cmd_append(&cmd, "-DCROSSWEB_BUILDING_PLUG=1");
+    cmd_append(&cmd, "-o", "./build/crossweb-headless");
+    cmd_append(&cmd, "./src/headless.c", "./src/ws.c", "./src/plug.c", "./src/pool.c", "./src/evloop.c", "./src/isolate.c", "./src/ipc.c", "./src/codec.c");
+
+    for (size_t i = 0; i < plugin_sources.count; ++i) {
+        cmd_append(&cmd, plugin_sources.items[i]);
+    }
+
+    cmd_append(&cmd, "-lm", "-ldl", "-lpthread");
+    if (!cmd_run(&cmd)) return_defer(false);
+
 defer:
     cmd_free(cmd);
     da_free(procs);
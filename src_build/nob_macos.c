@@ -24,7 +24,7 @@ bool build_dist(void)
         nob_cmd_append(&cmd, "-DCROSSWEB_BUILDING_PLUG=1");
         nob_cmd_append(&cmd, "-fPIC", "-shared");
         nob_cmd_append(&cmd, "-o", "./build/libplug.dylib");
-        nob_cmd_append(&cmd, "./src/plug.c", "./src/ipc.c");
+        nob_cmd_append(&cmd, "./src/plug.c", "./src/pool.c", "./src/evloop.c", "./src/isolate.c", "./src/ipc.c", "./src/codec.c");
         
         // Add all discovered plugin sources
         for (size_t i = 0; i < plugin_sources.count; ++i) {
@@ -55,7 +55,7 @@ bool build_dist(void)
         nob_cmd_append(&cmd, "-I.");
         nob_cmd_append(&cmd, "-include", "build/config.h");
         nob_cmd_append(&cmd, "-o", "./build/crossweb");
-        nob_cmd_append(&cmd, "./src/plug.c", "./src/ipc.c", "./src/webview.c");
+        nob_cmd_append(&cmd, "./src/plug.c", "./src/pool.c", "./src/evloop.c", "./src/isolate.c", "./src/ipc.c", "./src/codec.c", "./src/webview.c");
         
         // Add all discovered plugin sources
         for (size_t i = 0; i < plugin_sources.count; ++i) {
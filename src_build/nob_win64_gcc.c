@@ -29,7 +29,7 @@ bool build_dist(void)
     cmd_append(&cmd, "-static-libgcc");
     cmd_append(&cmd, "-Wno-implicit-function-declaration");
     cmd_append(&cmd, "-o", "./build/libplug.dll");
-    cmd_append(&cmd, "./src/plug.c");
+    cmd_append(&cmd, "./src/plug.c", "./src/pool.c", "./src/evloop.c", "./src/isolate.c", "./src/codec.c");
     
     // Add all discovered plugin sources
     for (size_t i = 0; i < plugin_sources.count; ++i) {
@@ -56,6 +56,7 @@ bool build_dist(void)
     cmd_append(&cmd,
         "./src/webview.c",
         "./src/ipc.c",
+        "./src/codec.c",
         "./src/hotreload_windows.c");
     cmd_append(&cmd, "-lole32", "-lcomctl32", "-loleaut32", "-luuid", "-lgdi32", "-ladvapi32");
     
@@ -94,7 +95,7 @@ bool build_dist(void)
     cmd_append(&cmd, "-DWEBVIEW_WINAPI=1");
     cmd_append(&cmd, "-I", "./thirdparty/webview-c/ms.webview2/include");
     cmd_append(&cmd, "-o", "./build/crossweb");
-    cmd_append(&cmd, "./src/plug.c", "./src/ipc.c", "./src/webview.c");
+    cmd_append(&cmd, "./src/plug.c", "./src/pool.c", "./src/evloop.c", "./src/isolate.c", "./src/ipc.c", "./src/codec.c", "./src/webview.c");
     
     // Add all discovered plugin sources
     for (size_t i = 0; i < plugin_sources.count; ++i) {
@@ -31,27 +31,34 @@ class Ipc(val webView: WebView) {
 
     @JavascriptInterface
     fun invoke(cmd: String, payload: String): String {
+        return invokeWithTimeout(cmd, payload, 0)
+    }
+
+    // Same as invoke, but native gives up on the request after timeoutMs
+    // (0 = no deadline). Cancel with invoke("__cancel", id).
+    @JavascriptInterface
+    fun invokeWithTimeout(cmd: String, payload: String, timeoutMs: Int): String {
         val id = java.util.UUID.randomUUID().toString()
         Log.d("{{APP_NAME}}", "invoke called with cmd: $cmd, payload: $payload")
-        nativeInvoke(id, cmd, payload)
+        nativeInvoke(id, cmd, payload, timeoutMs)
         return id
     }
 
+    // `result` and `data` arrive from native as JavaScript expressions
+    // (validated JSON literals), so they go into the script unchanged.
     fun resolveInvoke(id: String, result: String) {
         Log.d("{{APP_NAME}}", "resolveInvoke called with result: $result")
         // Send back to JS with id
-        val safeResult = result.replace("'", "\\'").replace("\n", "").replace("\r", "")
         webView.post {
-            webView.evaluateJavascript("window.external.onMessage('$id', JSON.parse('$safeResult'))", null)
+            webView.evaluateJavascript("window.external.onMessage('$id', $result)", null)
         }
     }
 
     fun emit(event: String, data: String) {
         Log.d("{{APP_NAME}}", "emit called with event: $event, data: $data")
         // Send event to JS asynchronously
-        val safeData = data.replace("'", "\\'").replace("\n", "").replace("\r", "")
         webView.post {
-            webView.evaluateJavascript("if (window.external.onEvent) window.external.onEvent('$event', JSON.parse('$safeData'))", null)
+            webView.evaluateJavascript("if (window.external.onEvent) window.external.onEvent('$event', $data)", null)
         }
     }
 
@@ -63,5 +70,5 @@ class Ipc(val webView: WebView) {
     }
 
     private external fun ipc(url: String, message: String)
-    private external fun nativeInvoke(id: String, cmd: String, payload: String)
+    private external fun nativeInvoke(id: String, cmd: String, payload: String, timeoutMs: Int)
 }
\ No newline at end of file